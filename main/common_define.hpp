@@ -622,6 +622,34 @@ Button Index mapping
       iclp_usb,
     };
 
+    // 外部MIDIクロックを受信するポート
+    enum midi_clock_port_t : uint8_t {
+      mcp_off = 0,
+      mcp_portc,
+      mcp_ble,
+      mcp_usb,
+    };
+
+    // MIDIの経路設定で使用するポート (外部ポートの並びは midi_clock_port_t と揃える)
+    // 送信元としての mrp_internal は演奏タスク、送信先としての mrp_internal は内蔵音源を表す
+    enum midi_route_port_t : uint8_t {
+      mrp_internal = 0,
+      mrp_portc,
+      mrp_ble,
+      mrp_usb,
+      max_midi_route_port,
+    };
+
+    // 演奏操作の入力元 (入力タイミングの傾向を入力元ごとに推定するために使用する)
+    enum input_source_t : uint8_t {
+      insrc_unknown = 0,
+      insrc_internal,  // 本体のボタン
+      insrc_port_a,    // PortA 外部ボタン
+      insrc_port_b,    // PortB 外部入力
+      insrc_midi,      // 外部MIDI
+      max_input_source,
+    };
+
     enum instachord_link_dev_t : uint8_t {
       icld_kanplay = 0,
       icld_instachord,
@@ -644,6 +672,7 @@ Button Index mapping
       sc_reset,
       sc_save,
       sc_erase_nvs,
+      sc_latency_dump,
     };
 
     // コマンドとパラメータのペア
@@ -1134,7 +1163,7 @@ Button Index mapping
     static constexpr const uint8_t max_program_number = 129;  // プログラムチェンジの最大値(MIDIの規格128＋ドラム用の1)
     static constexpr const uint8_t max_cursor_x = max_arpeggio_step;    // 編集時の横方向カーソル移動範囲
     static constexpr const uint8_t max_cursor_y = max_pitch_with_drum;  // 編集時の縦方向カーソル移動範囲
-    static constexpr const uint16_t max_sequence_step = 10000;
+    static constexpr const uint16_t max_sequence_step = 0xFFFF;  // シーケンスの最大ステップ数 (ステップ番号は16bit)
 
     static constexpr const int16_t tempo_bpm_min = 20;  // テンポ最小値
     static constexpr const int16_t tempo_bpm_default = 120;  //テンポ初期値
@@ -1144,7 +1173,13 @@ Button Index mapping
     static constexpr const int16_t swing_percent_default = 0;  //スウィング初期値
     static constexpr const int16_t swing_percent_max = 100; // スウィング最大値
 
+    static constexpr const uint8_t max_groove_step = 32; // グルーブテンプレートの最大ステップ数
+    static constexpr const int8_t groove_timing_percent_max = 50; // グルーブのタイミングのずれの最大値 (1ステップの長さに対する百分率)
+    static constexpr const uint8_t groove_velocity_percent_max = 200; // グルーブのベロシティ倍率の最大値 (百分率)
+
     static constexpr const int16_t input_tolerating_msec = 50; // 自動演奏時の遅延入力に対する許容時間 ( msec )
+    static constexpr const int16_t input_tolerating_min_msec = 20; // 入力タイミングの推定に基づく許容時間の最小値 ( msec )
+    static constexpr const int16_t input_tolerating_max_msec = 100; // 入力タイミングの推定に基づく許容時間の最大値 ( msec )
 
     static constexpr const int autorelease_msec = 5000; // コード演奏モードでの 自動ノートオフまでの時間 5秒
     static constexpr const float arpeggio_reset_timeout_beats = 4.2f;
@@ -1235,6 +1270,7 @@ Button Index mapping
     };
     static constexpr const char filename_setting[] = "setting.json";
     static constexpr const char filename_resume[] = "resume.json";
+    static constexpr const char filename_latency_trace[] = "latency_trace.json"; // 遅延計測結果の出力先
     static constexpr const char filename_mapping_device[] = "device.kmap"; // デバイスのマッピング情報
     static constexpr const char filename_mapping_song[] = "song.kmap"; // ソングのマッピング情報（レジューム用に必要）
     static constexpr const char fileext_song[] = ".json";
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "groove.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+bool groove_table_t::update(const system_registry_t::reg_song_groove_t& groove, uint32_t step_cycle_usec)
+{
+  // 世代番号は内容を読む前に取得しておき、作成中に変更された場合も次回に作り直されるようにする
+  uint32_t generation = groove.getGeneration();
+  if (_generation == generation && _step_cycle_usec == step_cycle_usec) { return false; }
+  _generation = generation;
+  _step_cycle_usec = step_cycle_usec;
+
+  uint8_t steps = groove.getSteps();
+  if (steps != 16 && steps != 32) { steps = 0; }
+
+  int32_t lead_usec = 0;
+  for (size_t i = 0; i < steps; ++i) {
+    int32_t offset_usec = (int32_t)step_cycle_usec * groove.getTiming(i) / 100;
+    _offset_usec[i] = offset_usec;
+    _velocity[i] = groove.getVelocity(i);
+    // 最も前に突っ込むステップに合わせて前倒しの量を決める
+    if (lead_usec < -offset_usec) { lead_usec = -offset_usec; }
+  }
+  _lead_usec = lead_usec;
+  _steps = steps;
+  return true;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
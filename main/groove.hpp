@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_GROOVE_HPP
+#define KANPLAY_GROOVE_HPP
+
+/*
+ - グルーブテンプレートの適用
+   ソングのグルーブテンプレート(ステップ毎のタイミングのずれとベロシティの倍率)を、
+   現在のテンポでのusec単位の表に変換して保持する。表はテンプレートかテンポが変わった時のみ作り直す。
+   ずれが負のステップ(前に突っ込むステップ)は、ウラ拍の自動演奏を全体に前倒しし、
+   その分だけ各ステップの発音を遅らせることで実現する。
+*/
+
+#include "system_registry.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class groove_table_t {
+public:
+  static constexpr const size_t max_step = def::app::max_groove_step;
+
+  // テンプレートとステップ間隔に基づいて表を更新する。前回と同じ内容の場合は何もしない
+  // 表を作り直した場合は true を返す
+  bool update(const system_registry_t::reg_song_groove_t& groove, uint32_t step_cycle_usec);
+
+  bool isEnabled(void) const { return _steps != 0; }
+  // ウラ拍の自動演奏を前倒しする時間 (usec)
+  int32_t getLeadUsec(void) const { return _lead_usec; }
+  // 指定ステップのタイミングのずれ (usec, 負の値は前に突っ込む)
+  int32_t getOffsetUsec(uint32_t step) const { return _steps ? _offset_usec[step & (_steps - 1)] : 0; }
+  // 指定ステップのベロシティの倍率 (百分率)
+  uint8_t getVelocity(uint32_t step) const { return _steps ? _velocity[step & (_steps - 1)] : 100; }
+
+private:
+  uint32_t _generation = 0;
+  uint32_t _step_cycle_usec = 0;
+  int32_t _lead_usec = 0;
+  uint8_t _steps = 0;
+  int32_t _offset_usec[max_step] = { 0, };
+  uint8_t _velocity[max_step] = { 0, };
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -2660,9 +2660,7 @@ protected:
       _current_step_index = visible_stepindex;
       _x_scroll_offset = offset;
       param->addInvalidatedRect({offset_x, offset_y, _client_rect.w, _client_rect.h});
-      for (int32_t i = 0; i < max_visible_step+2; ++i) {
-        _desc[i] = system_registry->current_sequence->getStepDescriptor(visible_stepindex + i);
-      }
+      system_registry->current_sequence->getStepDescriptors(visible_stepindex, _desc, max_visible_step+2);
     }
   }
 
@@ -192,13 +192,13 @@ flg_int = true;
       default:
 // RGB LEDの変更指示は連続して実行するとSTM32側がハングアップすることがあるため、一度に処理しない。
         {
-          auto history = system_registry->rgbled_control.getHistory(rgbled_history_code);
-          if (history != nullptr) {
-            uint32_t rgb_reg_index = history->index >> 2;
+          registry_t::history_t history;
+          if (system_registry->rgbled_control.getHistory(rgbled_history_code, history)) {
+            uint32_t rgb_reg_index = history.index >> 2;
             if (rgb_reg_index < def::hw::max_rgb_led) {
               // RGB LEDは全開で点灯させない。1/4に輝度を下げる。
-              // uint32_t color = (history->value >> 2) & 0x3F3F3F;
-              uint32_t color = history->value;
+              // uint32_t color = (history.value >> 2) & 0x3F3F3F;
+              uint32_t color = history.value;
               uint8_t brightness = system_registry->user_setting.getLedBrightness();
               static constexpr const uint8_t brightness_table[] = { 21, 34, 55, 89, 144 };
               brightness = brightness_table[brightness];
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "input_timing.hpp"
+
+#include "common_define.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+void input_timing_t::addSample(int32_t offset_usec)
+{
+  if (_samples == 0) {
+    _latency_usec = offset_usec;
+    _deviation_usec = 0;
+    _samples = 1;
+    return;
+  }
+  // 入力が少ないうちは単純平均とし、以降は直近の入力を重視した指数移動平均とする
+  const int32_t weight = _samples < ewma_weight ? _samples + 1 : ewma_weight;
+  int32_t diff = offset_usec - _latency_usec;
+  _latency_usec += diff / weight;
+  if (diff < 0) { diff = -diff; }
+  _deviation_usec += (diff - _deviation_usec) / weight;
+  if (_samples < UINT32_MAX) { ++_samples; }
+}
+
+void input_timing_t::reset(void)
+{
+  _latency_usec = 0;
+  _deviation_usec = 0;
+  _samples = 0;
+}
+
+int32_t input_timing_t::getToleranceUsec(void) const
+{
+  if (_samples < min_samples) { return def::app::input_tolerating_msec * 1000; }
+
+  // 遅れの平均にばらつきの3倍を加えた時間までを、遅れて押されたものと見做す
+  int32_t tolerance = _latency_usec + _deviation_usec * 3;
+  if (tolerance < def::app::input_tolerating_min_msec * 1000) { tolerance = def::app::input_tolerating_min_msec * 1000; }
+  if (tolerance > def::app::input_tolerating_max_msec * 1000) { tolerance = def::app::input_tolerating_max_msec * 1000; }
+  return tolerance;
+}
+
+bool input_timing_t::isLateInput(int32_t elapsed_usec, int32_t step_cycle_usec) const
+{
+  // 遅れのオフセットは許容時間の終端として反映しており、判定の基準 (拍の頭) 自体は動かさない。
+  // 遅れがちな演奏者でも拍の直後の入力はその拍を意図したものであり、基準を遅れの分だけ後ろにずらすと
+  // そうした入力を次の拍に回してしまう。先走る演奏者の入力は拍より前に届き、次のオモテ拍でそのまま反映される。
+  int32_t tolerance_usec = getToleranceUsec();
+  if (step_cycle_usec > 0) {
+    // 既定値より広げる場合は、最初のウラ拍の位置を超えないようにする
+    if (step_cycle_usec < def::app::input_tolerating_msec * 1000) { step_cycle_usec = def::app::input_tolerating_msec * 1000; }
+    if (tolerance_usec > step_cycle_usec) { tolerance_usec = step_cycle_usec; }
+  }
+  return elapsed_usec < tolerance_usec;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
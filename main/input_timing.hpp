@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_INPUT_TIMING_HPP
+#define KANPLAY_INPUT_TIMING_HPP
+
+/*
+ - 自動演奏時の入力タイミングの推定
+   拍の前後に押されたDegreeボタンについて、拍に対するずれを指数移動平均で集計し、
+   演奏者(入力元)ごとの遅れの傾向とばらつきを求める。
+   拍の直後の入力を遅れた演奏と見做す許容時間を、固定値ではなく推定値に合わせて伸縮させる。
+*/
+
+#include <stdint.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class input_timing_t {
+public:
+  // 指数移動平均の重み (直近何回分の入力を重視するか)
+  static constexpr const uint32_t ewma_weight = 8;
+  // 推定値を許容時間に反映するまでに必要な入力の数
+  static constexpr const uint32_t min_samples = 4;
+
+  // 拍に対する入力のずれを記録する (offset_usec : 正の値は遅れ、負の値は先走り)
+  void addSample(int32_t offset_usec);
+  void reset(void);
+
+  // 遅れの平均 (usec)
+  int32_t getLatencyUsec(void) const { return _latency_usec; }
+  // 遅れのばらつき (平均絶対偏差, usec)
+  int32_t getDeviationUsec(void) const { return _deviation_usec; }
+  uint32_t getSamples(void) const { return _samples; }
+  // 拍の直後の入力をその拍の演奏として扱う許容時間 (usec)
+  // 遅れの平均 (入力元ごとの遅れのオフセット) にばらつきの分を加えた時間。入力が少ないうちは既定値を返す
+  int32_t getToleranceUsec(void) const;
+  // 拍の頭から elapsed_usec 経過した入力を、その拍の演奏が遅れたものと見做すか判定する
+  // step_cycle_usec : 最初のウラ拍までの時間。許容時間を既定値より広げる場合の上限 (0 は上限なし)
+  bool isLateInput(int32_t elapsed_usec, int32_t step_cycle_usec) const;
+
+private:
+  int32_t _latency_usec = 0;
+  int32_t _deviation_usec = 0;
+  uint32_t _samples = 0;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
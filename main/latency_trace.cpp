@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include <M5Unified.h>
+
+#include "latency_trace.hpp"
+#include "file_manage.hpp"
+
+#include <stdio.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+latency_trace_t latency_trace;
+
+uint32_t latency_trace_t::now(void) const
+{
+  uint32_t usec = _clock ? _clock() : M5.micros();
+  // 0 は未到達を表すため使用しない
+  return usec ? usec : 1;
+}
+
+uint8_t latency_trace_t::begin(void)
+{
+  uint8_t id;
+  do {
+    id = (_next_id.fetch_add(1, std::memory_order_relaxed) + 1) & (max_trace - 1);
+  } while (id == 0);
+
+  auto trace = &_trace[id];
+  for (size_t i = 1; i < max_stage; ++i) {
+    trace->usec[i].store(0, std::memory_order_relaxed);
+  }
+  trace->usec[stage_input].store(now(), std::memory_order_release);
+  return id;
+}
+
+uint8_t latency_trace_t::begin(const def::command::command_param_t& command_param, bool is_pressed)
+{
+  if (!is_pressed) { return 0; }
+  switch (command_param.getCommand()) {
+  default:
+    return 0;
+  case def::command::chord_degree:
+  case def::command::note_button:
+  case def::command::drum_button:
+    return begin();
+  }
+}
+
+void latency_trace_t::mark(uint8_t trace_id, stage_t stage)
+{
+  if (trace_id == 0 || trace_id >= max_trace || stage == stage_input || stage >= max_stage) { return; }
+  auto trace = &_trace[trace_id];
+  uint32_t usec = now();
+  uint32_t expected = 0;
+  // 複数のタスクから同じ段階に到達した場合は最初の1回のみ記録する
+  if (!trace->usec[stage].compare_exchange_strong(expected, usec, std::memory_order_acq_rel)) { return; }
+
+  // 直前に到達した段階を探す
+  uint32_t prev_usec = 0;
+  for (int i = stage - 1; i >= 0 && prev_usec == 0; --i) {
+    prev_usec = trace->usec[i].load(std::memory_order_acquire);
+  }
+  if (prev_usec == 0) { return; }
+
+  auto add = [this](stage_t index, uint32_t diff) {
+    size_t bin = 0;
+    while (bin < max_bin - 1 && diff >= bin_limit_usec[bin]) { ++bin; }
+    _histogram[index][bin].fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = _max[index].load(std::memory_order_relaxed);
+    while (max < diff && !_max[index].compare_exchange_weak(max, diff, std::memory_order_relaxed)) {}
+  };
+  add(stage, usec - prev_usec);
+
+  if (stage == stage_flush) {
+    uint32_t input_usec = trace->usec[stage_input].load(std::memory_order_acquire);
+    if (input_usec) { add(stage_input, usec - input_usec); }
+  }
+}
+
+void latency_trace_t::reset(void)
+{
+  for (size_t stage = 0; stage < max_stage; ++stage) {
+    for (size_t bin = 0; bin < max_bin; ++bin) {
+      _histogram[stage][bin].store(0, std::memory_order_relaxed);
+    }
+    _max[stage].store(0, std::memory_order_relaxed);
+  }
+}
+
+size_t latency_trace_t::printTo(char* buf, size_t length) const
+{
+  size_t pos = 0;
+  auto print = [&](const char* format, auto... args) {
+    if (pos < length) {
+      int len = snprintf(&buf[pos], length - pos, format, args...);
+      if (len > 0) { pos += len; }
+      if (pos > length) { pos = length; }
+    }
+  };
+  print("%-8s", "usec");
+  for (size_t bin = 0; bin < max_bin - 1; ++bin) {
+    print(" <%-6u", (unsigned)bin_limit_usec[bin]);
+  }
+  print(" >=%-5u %7s\n", (unsigned)bin_limit_usec[max_bin - 2], "max");
+  for (size_t stage = 0; stage < max_stage; ++stage) {
+    print("%-8s", stage_name[stage]);
+    for (size_t bin = 0; bin < max_bin; ++bin) {
+      print(" %7u", (unsigned)getCount((stage_t)stage, bin));
+    }
+    print(" %7u\n", (unsigned)getMax((stage_t)stage));
+  }
+  return pos;
+}
+
+void latency_trace_t::printLog(void) const
+{
+  char buf[640];
+  printTo(buf, sizeof(buf));
+  M5_LOGV("latency trace:\n%s", buf);
+}
+
+bool latency_trace_t::dump(void) const
+{
+  // 保存処理はJSON形式のみ受け付けるため、集計結果をJSONとして出力する
+  static constexpr const size_t length = 16 * 1024;
+  auto mem = file_manage.createMemoryInfo(length);
+  if (mem == nullptr) { return false; }
+  mem->filename = def::app::filename_latency_trace;
+  mem->dir_type = def::app::data_type_t::data_system;
+
+  auto buf = (char*)mem->data;
+  size_t pos = 0;
+  auto print = [&](const char* format, auto... args) {
+    if (pos < length) {
+      int len = snprintf(&buf[pos], length - pos, format, args...);
+      if (len > 0) { pos += len; }
+      if (pos > length) { pos = length; }
+    }
+  };
+
+  print("{\"format\":\"latency_trace\",\"bin_limit_usec\":[");
+  for (size_t bin = 0; bin < max_bin - 1; ++bin) {
+    print(bin ? ",%u" : "%u", (unsigned)bin_limit_usec[bin]);
+  }
+  print("],\"stage\":{");
+  for (size_t stage = 0; stage < max_stage; ++stage) {
+    print(stage ? ",\"%s\":{\"histogram\":[" : "\"%s\":{\"histogram\":[", stage_name[stage]);
+    for (size_t bin = 0; bin < max_bin; ++bin) {
+      print(bin ? ",%u" : "%u", (unsigned)getCount((stage_t)stage, bin));
+    }
+    print("],\"max\":%u}", (unsigned)getMax((stage_t)stage));
+  }
+
+  // 直近のトレースについて、入力時刻からの各段階の経過時間を出力する (未到達は -1)
+  print("},\"trace\":[");
+  bool first = true;
+  for (size_t id = 1; id < max_trace; ++id) {
+    auto trace = &_trace[id];
+    uint32_t input_usec = trace->usec[stage_input].load(std::memory_order_acquire);
+    if (input_usec == 0) { continue; }
+    print(first ? "[%u" : ",[%u", (unsigned)id);
+    first = false;
+    for (size_t stage = 1; stage < max_stage; ++stage) {
+      uint32_t usec = trace->usec[stage].load(std::memory_order_acquire);
+      print(",%d", usec ? (int)(usec - input_usec) : -1);
+    }
+    print("]");
+  }
+  print("]}\n");
+  mem->size = pos;
+
+  bool result = file_manage.saveFile(mem->dir_type, mem->index);
+  mem->release();
+  return result;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
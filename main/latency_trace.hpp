@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_LATENCY_TRACE_HPP
+#define KANPLAY_LATENCY_TRACE_HPP
+
+/*
+ - 入力からMIDI送信までの遅延の計測
+   演奏操作の入力時にトレース番号を発行し、コマンドやMIDIメッセージと一緒に各タスクへ受け渡す。
+   各タスクは受け取った時点で mark を呼び、区間ごとの所要時間をヒストグラムに集計する。
+*/
+
+#include "common_define.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class latency_trace_t {
+public:
+  enum stage_t : uint8_t {
+    stage_input = 0, // 入力 (task_commander が operator_command に追加)
+    stage_operator,  // task_operator が受信
+    stage_player,    // task_kantanplay が受信
+    stage_note,      // task_kantanplay が midi_out_control にノートオンを出力
+    stage_midi,      // task_midi が midi_out_control から受信
+    stage_flush,     // task_midi が送信を完了
+    max_stage,
+  };
+  static constexpr const char* stage_name[max_stage] = { "total", "operator", "player", "note", "midi", "flush" };
+
+  // ヒストグラムの各区間の上限値 (usec) 最後の区間は上限なし
+  static constexpr const size_t max_bin = 8;
+  static constexpr const uint32_t bin_limit_usec[max_bin - 1] = { 250, 500, 1000, 2000, 4000, 8000, 16000 };
+
+  // 同時に追跡できるトレースの数。トレース番号は 1 ~ max_trace-1 を循環して使用する (0 は無効)
+  static constexpr const size_t max_trace = 64;
+
+  // 新しいトレースを開始し、トレース番号を返す
+  uint8_t begin(void);
+  // 演奏操作のコマンドを押した場合のみトレースを開始する。対象外の場合は 0 を返す
+  uint8_t begin(const def::command::command_param_t& command_param, bool is_pressed);
+
+  // トレースが指定の段階に到達したことを記録する。同じ段階への2回目以降の到達は無視する
+  // 直前に到達した段階からの経過時間を、指定の段階のヒストグラムに加算する
+  // 最終段階(stage_flush)に到達した場合は、入力からの経過時間を stage_input のヒストグラムに加算する
+  void mark(uint8_t trace_id, stage_t stage);
+
+  uint32_t getCount(stage_t stage, size_t bin) const { return (stage < max_stage && bin < max_bin) ? _histogram[stage][bin].load(std::memory_order_relaxed) : 0; }
+  uint32_t getMax(stage_t stage) const { return stage < max_stage ? _max[stage].load(std::memory_order_relaxed) : 0; }
+  void reset(void);
+
+  // 集計結果をテキストで出力する。書き込んだ文字数を返す
+  size_t printTo(char* buf, size_t length) const;
+  // 集計結果をログに出力する
+  void printLog(void) const;
+  // 集計結果と直近のトレースをシステムフォルダのファイルに保存する
+  bool dump(void) const;
+
+  // 時刻の取得関数を差し替える (仮想時刻で駆動する場合に使用する。nullptr で M5.micros に戻す)
+  void setClock(uint32_t (*clock)(void)) { _clock = clock; }
+
+private:
+  uint32_t now(void) const;
+
+  struct trace_t {
+    // 各段階に到達した時刻 (0 は未到達)
+    std::atomic<uint32_t> usec[max_stage];
+  };
+  trace_t _trace[max_trace];
+  std::atomic<uint32_t> _histogram[max_stage][max_bin] = {};
+  std::atomic<uint32_t> _max[max_stage] = {};
+  std::atomic<uint8_t> _next_id { 0 };
+  uint32_t (*_clock)(void) = nullptr;
+};
+
+extern latency_trace_t latency_trace;
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -17,6 +17,7 @@
 #include "task_kantanplay.hpp"
 #include "system_registry.hpp"
 #include "file_manage.hpp"
+#include "latency_trace.hpp"
 
 namespace kanplay_ns {
   static void log_memory(int index = 0)
@@ -144,6 +145,9 @@ void loop() {
   M5.delay(1024);
 #if !defined ( M5UNIFIED_PC_BUILD )
   kanplay_ns::log_memory(); 
+#if CORE_DEBUG_LEVEL > 3
+  kanplay_ns::latency_trace.printLog();
+#endif
 /*
   {
     auto t = time(nullptr);
@@ -543,6 +543,35 @@ public:
   }
 };
 
+struct mi_latency_trace_t : public mi_selector_t {
+protected:
+  static constexpr const localize_text_array_t name_array = { 2, (const localize_text_t[]){
+    { "Cancel", "キャンセル" },
+    { "Save",   "保存"       },
+  }};
+
+public:
+  constexpr mi_latency_trace_t( def::menu_category_t cate, uint16_t menu_id, uint8_t level, const localize_text_t& title )
+  : mi_selector_t { cate, menu_id, level, title, &name_array } {}
+
+  const char* getValueText(void) const override { return "..."; }
+
+  int getValue(void) const override
+  {
+    return getMinValue();
+  }
+  bool setValue(int value) const override
+  {
+    if (mi_selector_t::setValue(value) == false) { return false; }
+    value -= getMinValue();
+    if (value == 1) {
+      // 遅延計測の集計結果をシステムフォルダへ保存する (保存処理は task_operator で行う)
+      system_registry->operator_command.addQueue( { def::command::system_control, def::command::system_control_t::sc_latency_dump } );
+    }
+    return true;
+  }
+};
+
   
 #if 0
 struct mi_intvalue_t : public mi_normal_t {
@@ -1619,6 +1648,56 @@ public:
   }
 };
 
+struct mi_clock_in_port_t : public mi_selector_t {
+protected:
+  static constexpr const localize_text_array_t name_array = { 4, (const localize_text_t[]){
+    { "Off",   "オフ" },
+    { "PortC", "ポートC" },
+    { "BLE", nullptr },
+    { "USB", nullptr },
+  }};
+
+public:
+  constexpr mi_clock_in_port_t( def::menu_category_t cate, uint16_t menu_id, uint8_t level, const localize_text_t& title )
+  : mi_selector_t { cate, menu_id, level, title, &name_array } {}
+  int getValue(void) const override
+  {
+    return getMinValue() + system_registry->midi_port_setting.getClockInPort();
+  }
+  bool setValue(int value) const override
+  {
+    if (mi_selector_t::setValue(value) == false) { return false; }
+    value -= getMinValue();
+    system_registry->midi_port_setting.setClockInPort( static_cast<def::command::midi_clock_port_t>(value));
+    return true;
+  }
+};
+
+struct mi_clock_out_t : public mi_selector_t {
+protected:
+  static constexpr const localize_text_array_t name_array = { 2, (const localize_text_t[]){
+    { "Off", "送信しない" },
+    { "On" , "送信する"   },
+  }};
+  def::command::midi_clock_port_t _port;
+
+public:
+  constexpr mi_clock_out_t( def::menu_category_t cate, uint16_t menu_id, uint8_t level, const localize_text_t& title, def::command::midi_clock_port_t port )
+  : mi_selector_t { cate, menu_id, level, title, &name_array }
+  , _port { port } {}
+  int getValue(void) const override
+  {
+    return getMinValue() + system_registry->midi_port_setting.getClockOutEnabled(_port);
+  }
+  bool setValue(int value) const override
+  {
+    if (mi_selector_t::setValue(value) == false) { return false; }
+    value -= getMinValue();
+    system_registry->midi_port_setting.setClockOutEnabled(_port, static_cast<bool>(value));
+    return true;
+  }
+};
+
 struct mi_iclink_dev_t : public mi_selector_t {
 protected:
   static constexpr const localize_text_array_t name_array = { 2, (const localize_text_t[]){
@@ -2393,6 +2472,11 @@ static constexpr menu_item_ptr menu_system[] = {
   MENU_BUILDER(mi_usb_mode_t      ,    4 , { "USB MODE"       , "USBモード設定" }),
   MENU_BUILDER(mi_usb_power_t     ,    4 , { "Host Power Supply", "ホスト給電設定" }),
   MENU_BUILDER(mi_usb_midi_t      ,    4 , { "USB MIDI"       , nullptr     }),
+  MENU_BUILDER(mi_tree_t          ,   3  , { "MIDI Clock"     , "MIDIクロック" }),
+  MENU_BUILDER(mi_clock_in_port_t ,    4 , { "Clock In"       , "クロック入力" }),
+  MENU_BUILDER(mi_clock_out_t     ,    4 , { "Clock Out PortC", "クロック出力 ポートC" }, def::command::midi_clock_port_t::mcp_portc),
+  MENU_BUILDER(mi_clock_out_t     ,    4 , { "Clock Out BLE"  , "クロック出力 BLE" }, def::command::midi_clock_port_t::mcp_ble),
+  MENU_BUILDER(mi_clock_out_t     ,    4 , { "Clock Out USB"  , "クロック出力 USB" }, def::command::midi_clock_port_t::mcp_usb),
   MENU_BUILDER(mi_tree_t          ,   3  , { "InstaChord Link", "インスタコードリンク"}),
   MENU_BUILDER(mi_iclink_port_t   ,    4 , { "Connect"        , "接続方法"   }),
   MENU_BUILDER(mi_iclink_dev_t    ,    4 , { "Play Device"    , "演奏デバイス"}),
@@ -2408,6 +2492,7 @@ static constexpr menu_item_ptr menu_system[] = {
   MENU_BUILDER(mi_vol_midi_t      ,   3  , { "MIDI Mastervol" , "MIDIマスター音量"}),
   MENU_BUILDER(mi_vol_adcmic_t    ,   3  , { "ADC MicAmp"     , "ADCマイクアンプ" }),
   MENU_BUILDER(mi_all_reset_t     ,  2   , { "Reset All Settings", "全設定リセット"    }),
+  MENU_BUILDER(mi_latency_trace_t ,  2   , { "Save Latency Trace", "遅延計測の保存"    }),
   MENU_BUILDER(mi_manual_qr_t     , 1    , { "Manual QR"      , "説明書QR"     }),
   nullptr, // end of menu
 };
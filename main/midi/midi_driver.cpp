@@ -95,75 +95,107 @@ void MIDI_Encoder::pushMessage(uint8_t status_byte, uint8_t data1, uint8_t data2
   }
 }
 //*/
-bool MIDI_Decoder::popMessage(MIDI_Message* message)
+void MIDI_Decoder::clear(void)
 {
-  if (_data.empty()) { return false; }
-// printf("popMessage : data.size:%d\n", _data.size());
-//  printf("len:%d  data:%02X %02X %02X\n", _data.size(), _data[0], _data[1], _data[2]);
-//  fflush(stdout);
+  _read_pos = _write_pos = 0;
+  _status = 0;
+  _data_count = 0;
+  _sysex_length = 0;
+  _sysex_truncated = false;
+}
 
-  size_t index = 0;
-  if (_data[index] & 0x80) { // Status byte
-    message->status = _data[index++];
-    _runningStatus = message->status;
-  } else {
-    if (_runningStatus < 0x80) {
-      while (index < _data.size() && (_data[index] & 0x80) == 0) { ++index; }
-// printf("popMessage : invalid data erase : index:%d\n", index);
-      _data.erase(_data.begin(), _data.begin() + index);
-      return false;
-      // index = 0;
-      // _runningStatus = message->status;
-    }
-    message->status = _runningStatus;
+void MIDI_Decoder::addData(const uint8_t* data, size_t length)
+{
+  size_t space = getAvailableSpace();
+  if (length > space) {
+    _overflow_count += length - space;
+    length = space;
   }
-  size_t dataByteLength = getDataByteLength(message->status);
-  if (dataByteLength == -1) {
-    _runningStatus = 0;
-// printf("popMessage : invalid data status:%02x\n", message->status);
-    _data.erase(_data.begin());
-    // _data.erase(_data.begin(), _data.begin() + index);
-    return false;
+  for (size_t i = 0; i < length; ++i) {
+    _rx_buffer[(_write_pos + i) & (rx_buffer_size - 1)] = data[i];
   }
+  _write_pos += length;
+}
+
+bool MIDI_Decoder::popMessage(MIDI_Message* message)
+{
+  while (_read_pos != _write_pos) {
+    const uint8_t byte = _rx_buffer[_read_pos & (rx_buffer_size - 1)];
+
+    if (byte >= 0xF8) {
+      // システム・リアルタイム・メッセージは組み立て中のメッセージに割り込んで先に出力する
+      ++_read_pos;
+      message->status = byte;
+      message->length = 0;
+      message->sysex_data = nullptr;
+      message->truncated = false;
+      return true;
+    }
 
-  if (dataByteLength == 0) {
-    _runningStatus = 0;
-    if (message->status == 0xF0)
-    { // System Exclusive
-      size_t index_end = index;
-      // while (index_end < _data.size() && _data[index_end] != 0xF7) { ++index_end; }
-      while (index_end < _data.size() && ((_data[index_end] & 0x80) == 0)) { ++index_end; }
-      if (index_end == _data.size()) {
-        // システムエクスクルーシブの終了がまだバッファに入っていない場合
-        return false;
+    if (byte & 0x80) { // Status byte
+      if (_status == 0xF0) {
+        // システムエクスクルーシブの終了。終端のステータスバイトは次のメッセージとして扱うため、ここでは消費しない
+        _status = 0;
+        message->status = 0xF0;
+        message->length = _sysex_length;
+        message->sysex_data = _sysex_buffer;
+        message->truncated = _sysex_truncated;
+        if (_sysex_truncated) { ++_sysex_truncated_count; }
+        return true;
+      }
+      ++_read_pos;
+      _status = byte;
+      _data_count = 0;
+      _data_length = getDataByteLength(byte);
+      if (byte == 0xF0) {
+        _sysex_length = 0;
+        _sysex_truncated = false;
+        continue;
       }
-      auto data = _data[index_end];
-      if (data > 0xF7) {
-        // システムエクスクルーシブ中に、システム・リアルタイム・メッセージが来た場合
-        // 当該メッセージを先に出力する
-        message->status = data;
-        message->data.clear();
-        // 当該メッセージをバッファから削除
-        _data.erase(_data.begin() + index_end);
+      if (_data_length == 0) {
+        // データバイトを持たないメッセージはすぐに出力し、ランニングステータスを解除する
+        _status = 0;
+        message->status = byte;
+        message->length = 0;
+        message->sysex_data = nullptr;
+        message->truncated = false;
         return true;
       }
-      // if (_data[index_end] == 0xF7) {
-      //   ++index_end; // システムエクスクルーシブの終了バイトを含める
-      // }
-  // printf("sys ex:len:%d  , end:%02x\n", _data.size(), _data[index_end]);
-      message->data.assign(_data.begin() + index, _data.begin() + index_end);
-      _data.erase(_data.begin(), _data.begin() + index_end);
-      return true;
+      continue;
     }
+
+    // Data byte
+    ++_read_pos;
+    if (_status == 0xF0) {
+      // バッファに入りきらない分は破棄し、出力するメッセージに truncated を付ける
+      if (_sysex_length < sysex_buffer_size) {
+        _sysex_buffer[_sysex_length++] = byte;
+      } else {
+        _sysex_truncated = true;
+      }
+      continue;
+    }
+    if (_status == 0) {
+      // ステータスが不明なデータバイトは読み捨てる
+      continue;
+    }
+    _data[_data_count++] = byte;
+    if (_data_count < _data_length) { continue; }
+
+    message->status = _status;
+    message->data[0] = _data[0];
+    message->data[1] = (_data_length > 1) ? _data[1] : 0;
+    message->length = _data_length;
+    message->sysex_data = nullptr;
+    message->truncated = false;
+    _data_count = 0;
+    if (_status >= 0xF0) {
+      // システムコモンメッセージはランニングステータスの対象外
+      _status = 0;
+    }
+    return true;
   }
-  if (index + dataByteLength > _data.size()) {
-// printf("data len error: index:%d, dataByteLen:%d, data size:%d\n", index, dataByteLength, _data.size());
-// _data.clear();
-    return false;
-  }
-  message->data.assign(_data.begin() + index, _data.begin() + index + dataByteLength);
-  _data.erase(_data.begin(), _data.begin() + index + dataByteLength);
-  return true;
+  return false;
 }
 
 //-------------------------------------------------------------------------
@@ -5,6 +5,7 @@
 #define MIDI_DRIVER_HPP
 
 #include <vector>
+#include <atomic>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -16,16 +17,69 @@
 
 namespace midi_driver {
 
+  // 受信コールバック(書込み側)と受信タスク(読出し側)の間でバイト列を受け渡すためのロックフリーリングバッファ
+  // 書込み側・読出し側ともに単一のタスクからのみ操作すること
+  template <size_t N>
+  class spsc_ring_t {
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+  public:
+    size_t available(void) const { return _write_pos.load(std::memory_order_acquire) - _read_pos.load(std::memory_order_relaxed); }
+    size_t getFree(void) const { return N - (_write_pos.load(std::memory_order_relaxed) - _read_pos.load(std::memory_order_acquire)); }
+
+    // 書込み側 : 空きが足りない場合は書き込める分だけ書き込み、書き込んだバイト数を返す
+    size_t write(const uint8_t* src, size_t length) {
+      size_t wp = _write_pos.load(std::memory_order_relaxed);
+      size_t free = N - (wp - _read_pos.load(std::memory_order_acquire));
+      if (length > free) { length = free; }
+      for (size_t i = 0; i < length; ++i) {
+        _buf[(wp + i) & (N - 1)] = src[i];
+      }
+      _write_pos.store(wp + length, std::memory_order_release);
+      return length;
+    }
+
+    // 読出し側
+    uint8_t peek(size_t offset) const { return _buf[(_read_pos.load(std::memory_order_relaxed) + offset) & (N - 1)]; }
+    void consume(size_t length) { _read_pos.store(_read_pos.load(std::memory_order_relaxed) + length, std::memory_order_release); }
+    size_t read(uint8_t* dst, size_t cap) {
+      size_t rp = _read_pos.load(std::memory_order_relaxed);
+      size_t length = _write_pos.load(std::memory_order_acquire) - rp;
+      if (length > cap) { length = cap; }
+      for (size_t i = 0; i < length; ++i) {
+        dst[i] = _buf[(rp + i) & (N - 1)];
+      }
+      _read_pos.store(rp + length, std::memory_order_release);
+      return length;
+    }
+    void clear(void) { _read_pos.store(_write_pos.load(std::memory_order_acquire), std::memory_order_release); }
+
+  private:
+    uint8_t _buf[N];
+    std::atomic<size_t> _write_pos { 0 };
+    std::atomic<size_t> _read_pos { 0 };
+  };
+
   // MIDI Message structure
   struct MIDI_Message {
-    std::vector<uint8_t> data;
+    // チャンネルメッセージ・システムコモンメッセージのデータバイト
+    uint8_t data[2] = { 0, 0 };
     union {
-      uint8_t status;
+      uint8_t status = 0;
       struct {
         uint8_t channel : 4;
         uint8_t type : 4;
       };
     };
+    // データバイト数 (SysExの場合は sysex_data のバイト数)
+    uint16_t length = 0;
+    // SysExがデコーダのバッファに入りきらず、末尾が切り詰められている場合は true
+    bool truncated = false;
+    // SysExのデータ (先頭の0xF0と終端のステータスバイトは含まない)
+    // デコーダ内部のバッファを指しているため、次に popMessage するまでの間だけ有効
+    const uint8_t* sysex_data = nullptr;
+
+    const uint8_t* getData(void) const { return sysex_data ? sysex_data : data; }
+    size_t size(void) const { return length; }
   };
 /*
   // MIDI Encoder class
@@ -44,23 +98,51 @@ namespace midi_driver {
   };
 //*/
   // MIDI Decoder class
+  // 受信データを固定長のリングバッファに溜め、1バイトずつ状態遷移しながらメッセージを組み立てる
   class MIDI_Decoder {
-    std::vector<uint8_t> _data;
-    uint8_t _runningStatus;
   public:
-    MIDI_Decoder() : _runningStatus(0) {}
+    static constexpr const size_t rx_buffer_size = 1024;  // 2の累乗であること
+    static constexpr const size_t sysex_buffer_size = 512;
+
+    MIDI_Decoder() = default;
     virtual ~MIDI_Decoder() = default;
-    void clear(void) { _data.clear(); }
+    void clear(void);
 
     void addData(const std::vector<uint8_t>& data) {
-      _data.insert(_data.end(), data.begin(), data.end());
-// printf("data.size:%d\n", _data.size());
+      addData(data.data(), data.size());
     }
-    void addData(const uint8_t* data, size_t length) {
-      _data.insert(_data.end(), data, data + length);
-// printf("data.size:%d\n", _data.size());
+    // バッファに入りきらないデータは破棄し、getOverflowCount で破棄したバイト数を返す
+    void addData(const uint8_t* data, size_t length);
+    // リングバッファの連続した空き領域を返す。書き込んだ後 commitData で確定する
+    size_t getWriteSpan(uint8_t** dst) {
+      size_t offset = _write_pos & (rx_buffer_size - 1);
+      size_t length = rx_buffer_size - offset;
+      size_t space = getAvailableSpace();
+      *dst = &_rx_buffer[offset];
+      return (length < space) ? length : space;
     }
+    void commitData(size_t length) { _write_pos += length; }
     bool popMessage(MIDI_Message* message);
+
+    size_t getAvailableSpace(void) const { return rx_buffer_size - (_write_pos - _read_pos); }
+    uint32_t getOverflowCount(void) const { return _overflow_count; }
+    // sysex_buffer_size を超えたため切り詰めて出力したSysExの数
+    uint32_t getSysExTruncatedCount(void) const { return _sysex_truncated_count; }
+
+  private:
+    uint8_t _rx_buffer[rx_buffer_size];
+    uint8_t _sysex_buffer[sysex_buffer_size];
+    size_t _read_pos = 0;
+    size_t _write_pos = 0;
+    uint32_t _overflow_count = 0;
+    uint32_t _sysex_truncated_count = 0;
+    uint16_t _sysex_length = 0;
+    bool _sysex_truncated = false;
+    // 組み立て中のメッセージのステータス (チャンネルメッセージの場合はランニングステータスを兼ねる)
+    uint8_t _status = 0;
+    uint8_t _data[2] = { 0, 0 };
+    uint8_t _data_count = 0;
+    uint8_t _data_length = 0;
   };
 
   // Abstract base class for MIDI transport
@@ -72,10 +154,18 @@ namespace midi_driver {
     virtual bool begin(void) = 0;
     virtual void end(void) = 0;
 
-    virtual std::vector<uint8_t> read(void) = 0;
+    // 受信済みのデータを最大 cap バイトまで dst に書き込み、書き込んだバイト数を返す
+    virtual size_t read(uint8_t* dst, size_t cap) = 0;
     // virtual size_t write(const uint8_t* data, size_t length) = 0;
     virtual void addMessage(const uint8_t* data, size_t length) = 0;
+    // SysExのバイト列(0xF0~0xF7)を送信バッファに追加し、受け付けたバイト数を返す
+    // 長いSysExは複数回に分けて渡してよい。受け付けられなかった残りは sendFlush の後に改めて渡すこと
+    virtual size_t addSysEx(const uint8_t* data, size_t length) { addMessage(data, length); return length; }
     virtual bool sendFlush(void) = 0;
+    // 送信を保留しているメッセージがある場合、再度 sendFlush すべきまでの時間(msec)を返す。保留がなければ 0
+    virtual uint32_t getPendingTxWaitMsec(void) const { return 0; }
+    // 受信済みで読み出し時刻を待っているデータがある場合、再度 read すべきまでの時間(msec)を返す。なければ 0
+    virtual uint32_t getPendingRxWaitMsec(void) const { return 0; }
 
     bool isConnected(void) const { return _connected; }
     bool getUseTx(void) const { return _use_tx; }
@@ -142,6 +232,10 @@ protected:
     void sendProgramChange(uint8_t channel, uint8_t program) {
       sendMessage(0xC0 | channel, program, 0);
     }
+    // SysExを送信する。受け付けたバイト数を返す (詳細は MIDI_Transport::addSysEx を参照)
+    size_t sendSysEx(const uint8_t* data, size_t length) {
+      return _transport->addSysEx(data, length);
+    }
 
     bool sendFlush(void) {
       return _transport->sendFlush();
@@ -153,14 +247,27 @@ _send_data.clear();
 return result;
 */
     }
+    uint32_t getPendingTxWaitMsec(void) const { return _transport->getPendingTxWaitMsec(); }
+    uint32_t getPendingRxWaitMsec(void) const { return _transport->getPendingRxWaitMsec(); }
+    uint32_t getSysExTruncatedCount(void) const { return _decoder.getSysExTruncatedCount(); }
+    // トランスポートの受信データをデコーダのバッファへ直接読み込む
     bool receive(void) {
-      auto data = _transport->read();
-      if (data.empty()) { return false; }
-      _decoder.addData(data);
-      return true;
+      size_t total = 0;
+      for (int i = 0; i < 2; ++i) { // リングバッファの折り返しがあるため最大2回
+        uint8_t* dst;
+        size_t cap = _decoder.getWriteSpan(&dst);
+        if (cap == 0) { break; }
+        size_t len = _transport->read(dst, cap);
+        _decoder.commitData(len);
+        total += len;
+        if (len < cap) { break; }
+      }
+      return total != 0;
     }
     bool receiveMessage(MIDI_Message* message) {
-      receive();
+      // デコーダに残っているメッセージを先に取り出し、無くなってから受信データを読み込む
+      if (_decoder.popMessage(message)) { return true; }
+      if (!receive()) { return false; }
       return _decoder.popMessage(message);
     }
 
@@ -5,6 +5,103 @@
 
 #include "midi_transport_ble.hpp"
 
+namespace midi_driver {
+
+//----------------------------------------------------------------
+
+void ble_midi_clock_t::beginPacket(uint32_t arrival_usec)
+{
+  if (_synced) {
+    int32_t elapsed = (int32_t)(arrival_usec - _arrival_usec);
+    if (elapsed < 0) { elapsed = 0; }
+    if (elapsed > (int32_t)resync_usec) {
+      _synced = false;
+    } else {
+      // 送信側のクロックが遅い場合に備え、基準を経過時間に応じて後ろへずらす
+      _offset_usec += elapsed / (1000000 / drift_ppm);
+    }
+  }
+  _arrival_usec = arrival_usec;
+}
+
+uint32_t ble_midi_clock_t::getReleaseUsec(uint16_t timestamp)
+{
+  timestamp &= 0x1FFF;
+  if (!_synced) {
+    _synced = true;
+    _remote_msec = timestamp;
+    _last_timestamp = timestamp;
+    _offset_usec = _arrival_usec - _remote_msec * 1000;
+    _jitter_usec = 0;
+    return _arrival_usec;
+  }
+
+  // 13bitのタイムスタンプの周回を補正して送信側の時刻を延長する (前後どちらにも半周までの差を許容する)
+  int32_t delta = (timestamp - _last_timestamp) & 0x1FFF;
+  if (delta >= 0x1000) { delta -= 0x2000; }
+  _last_timestamp = timestamp;
+  _remote_msec += delta;
+
+  // 基準に対する今回の受信の遅れ。基準より早く届いた場合は基準を更新する
+  int32_t delay = (int32_t)(_arrival_usec - _remote_msec * 1000 - _offset_usec);
+  if (delay < 0) {
+    _offset_usec += delay;
+    delay = 0;
+  }
+  // 保留時間は遅れの分布の上位(およそ95%点)に合わせる。再送等でまれに大きく遅れた受信には引きずられない
+  if (_jitter_usec < delay) {
+    _jitter_usec += jitter_step_usec * 19;
+  } else {
+    _jitter_usec -= jitter_step_usec;
+  }
+  if (_jitter_usec > (int32_t)max_hold_usec) { _jitter_usec = max_hold_usec; }
+
+  // 最も遅れて届くメッセージに揃えるよう、遅れの少なかった分だけ保留する
+  int32_t hold = _jitter_usec - delay;
+  if (hold < 0) { hold = 0; }
+  return _arrival_usec + hold;
+}
+
+bool ble_midi_packer_t::addMessage(const uint8_t* data, size_t length, uint32_t msec)
+{
+  if (length == 0) { return true; }
+  uint8_t status = data[0];
+  // システムメッセージはランニングステータスを使わない
+  bool need_status = (_running_status != status) || (status >= 0xF0);
+  // ステータスの前にはタイムスタンプが必須。時刻が変わった場合もランニングステータスのままタイムスタンプを付ける
+  bool need_timestamp = need_status || (_msec != msec);
+  size_t need = (_data.empty() ? 1 : 0) + (need_timestamp ? 1 : 0) + length - (need_status ? 0 : 1);
+  if (!_data.empty()) {
+    // 受信側はタイムスタンプの下位7bitの戻りで上位の繰り上がりを判断するため、128msec以上経過したら別パケットにする
+    if (_data.size() + need > _payload_size || msec - _first_msec >= 128) { return false; }
+  } else {
+    _data.push_back(0x80 | ((msec >> 7) & 0x3F));
+    _first_msec = msec;
+  }
+  if (need_timestamp) {
+    _data.push_back(0x80 | (msec & 0x7F));
+  }
+  if (need_status) {
+    _data.push_back(status);
+  }
+  _data.insert(_data.end(), data + 1, data + length);
+  _running_status = (status < 0xF0) ? status : 0;
+  _msec = msec;
+  ++_message_count;
+  return true;
+}
+
+void ble_midi_packer_t::clear(void)
+{
+  _data.clear();
+  _message_count = 0;
+  _running_status = 0;
+}
+
+//----------------------------------------------------------------
+
+} // namespace midi_driver
+
 #if __has_include(<esp_bt.h>)
 
 #include "../system_registry.hpp"
@@ -18,15 +115,13 @@
 
 #include <esp_bt.h>
 #include <esp32-hal-bt.h>
-#include <mutex>
+#include <esp_timer.h>
 
 #define MIDI_SERVICE_UUID         "03b80e5a-ede8-4b33-a751-6ce34ec4c700"
 #define MIDI_CHARACTERISTIC_UUID  "7772e5db-3868-4112-a1a9-f2669d106bf3"
 
 namespace midi_driver {
 
-static std::mutex mutex_rx;
-
 //----------------------------------------------------------------
 
 static MIDI_Transport_BLE* _instance = nullptr;
@@ -40,11 +135,18 @@ static BLEAdvertising *pAdvertising = nullptr;
 static BLECharacteristic *pCharacteristic = nullptr;
 static int _conn_id = -1;
 // static std::deque<std::vector<uint8_t> > _rx_queue;
-static std::vector<uint8_t> _rx_data;
+// 受信コールバックから受信タスクへ受け渡すバッファ
+// 1バイトの長さと4バイトの読み出し時刻(usec)のヘッダに続けてMIDIデータを格納したフレーム単位で受け渡す
+static spsc_ring_t<2048> _rx_ring;
+static constexpr const size_t rx_frame_header_size = 5;
+// 受信データのタイムスタンプから読み出し時刻を求める (受信コールバック側でのみ操作する)
+static ble_midi_clock_t _rx_clock;
 
 // InstaChordと直結時のCharacteristic
 static BLERemoteCharacteristic* remotecharacteristic = nullptr;
 static uint16_t _mtu_size = 23;
+// 接続間隔 (usec)
+static uint32_t _conn_interval_usec = MIDI_Transport_BLE::default_conn_interval_usec;
 
 // static constexpr const size_t _tx_queue_size = 4;
 // static int _tx_queue_index = 0;
@@ -54,6 +156,8 @@ static uint16_t _mtu_size = 23;
 class MyServerCallbacks: public BLEServerCallbacks {
   void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) override {
     _conn_id = pServer->getConnId();
+    // 接続間隔は 1.25msec 単位
+    MIDI_Transport_BLE::setConnParams(param->connect.conn_params.interval * 1250, 0);
     _instance->setPeripheralConnected(true);
 // printf("BLE MIDI Connected.\n");
 // pServer->updatePeerMTU(_conn_id, _mtu_size);
@@ -66,9 +170,19 @@ class MyServerCallbacks: public BLEServerCallbacks {
   }
   void onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) override {
 // printf("BLE onMtuChanged : %d\n", param->mtu.mtu);
+    MIDI_Transport_BLE::setConnParams(0, param->mtu.mtu);
   }
 };
 
+// 接続後に接続間隔が変更された場合に、送信のまとめ時間を追従させる
+static void onGapEvent(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+  if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT && param->update_conn_params.status == ESP_BT_STATUS_SUCCESS) {
+    // 接続間隔は 1.25msec 単位
+    MIDI_Transport_BLE::setConnParams(param->update_conn_params.conn_int * 1250, 0);
+  }
+}
+
 class MyCallbacks: public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override {
     _instance->decodeReceive(pCharacteristic->getData(), pCharacteristic->getLength());
@@ -99,6 +213,8 @@ class MyCallbacks: public BLECharacteristicCallbacks {
 class MyServerCallbacks: public BLEServerCallbacks {
   void onConnect(BLEServer *pServer, ble_gap_conn_desc *desc) override {
     _conn_id = pServer->getConnId();
+    // 接続間隔は 1.25msec 単位
+    MIDI_Transport_BLE::setConnParams(desc->conn_itvl * 1250, 0);
     _instance->setPeripheralConnected(true);
   };
   void onDisconnect(BLEServer *pServer, ble_gap_conn_desc *desc) override {
@@ -106,9 +222,25 @@ class MyServerCallbacks: public BLEServerCallbacks {
     _instance->setPeripheralConnected(false);
   }
   void onMtuChanged(BLEServer *pServer, ble_gap_conn_desc *desc, uint16_t mtu) override {
+    MIDI_Transport_BLE::setConnParams(0, mtu);
   }
 };
 
+// 接続後に接続間隔が変更された場合に、送信のまとめ時間を追従させる
+// (サーバーのコールバックには接続パラメータ更新の通知が無いため、GAPイベントのリスナーで受け取る)
+static ble_gap_event_listener _gap_listener;
+static int onGapEvent(ble_gap_event *event, void *arg)
+{
+  if (event->type == BLE_GAP_EVENT_CONN_UPDATE && event->conn_update.status == 0) {
+    ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+      // 接続間隔は 1.25msec 単位
+      MIDI_Transport_BLE::setConnParams(desc.conn_itvl * 1250, 0);
+    }
+  }
+  return 0;
+}
+
 class MyCallbacks: public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *pCharacteristic, ble_gap_conn_desc *desc) override {
     _instance->decodeReceive(pCharacteristic->getData(), pCharacteristic->getLength());
@@ -119,9 +251,39 @@ class MyCallbacks: public BLECharacteristicCallbacks {
 
 static MyServerCallbacks myServerCallbacks;
 
+static void writeRxFrame(const uint8_t* data, size_t length, uint32_t release_usec)
+{
+  while (length) {
+    size_t len = (length < 255) ? length : 255;
+    // フレームの途中で途切れないよう、空きが足りない場合は破棄する
+    if (_rx_ring.getFree() < rx_frame_header_size + len) { return; }
+    uint8_t header[rx_frame_header_size] = {
+      (uint8_t)len,
+      (uint8_t)(release_usec      ),
+      (uint8_t)(release_usec >>  8),
+      (uint8_t)(release_usec >> 16),
+      (uint8_t)(release_usec >> 24),
+    };
+    _rx_ring.write(header, rx_frame_header_size);
+    _rx_ring.write(data, len);
+    data += len;
+    length -= len;
+  }
+}
+
+static uint32_t peekRxReleaseUsec(void)
+{
+  return (uint32_t)_rx_ring.peek(1)
+       | (uint32_t)_rx_ring.peek(2) << 8
+       | (uint32_t)_rx_ring.peek(3) << 16
+       | (uint32_t)_rx_ring.peek(4) << 24;
+}
+
 void MIDI_Transport_BLE::decodeReceive(const uint8_t* data, size_t length)
 {
   if (length < 2) { return; }
+  uint32_t arrival_usec = (uint32_t)esp_timer_get_time();
+  _rx_clock.beginPacket(arrival_usec);
   /*
   ESP_LOGV("BLE", "receive data length : %d  data:", length);
   printf("ble receive len:%d  data:", length);
@@ -132,26 +294,35 @@ void MIDI_Transport_BLE::decodeReceive(const uint8_t* data, size_t length)
   printf("\n");
   fflush(stdout);
 //*/
-  // uint8_t timestamp_high = data[0];
+  // ヘッダにはタイムスタンプの上位6bit、各メッセージの前のタイムスタンプバイトには下位7bitが入る
+  uint16_t timestamp_high = data[0] & 0x3F;
+  uint8_t prev_timestamp_low = 0;
+  // タイムスタンプの無いデータ (前のパケットから続くSysEx等) は受信した時点で読み出せるようにする
+  uint32_t release_usec = arrival_usec;
   size_t timestamp_low_index = 0;
   if (data[1] & 0x80) {
     timestamp_low_index = 1;
   }
-  std::vector<uint8_t> rxtmp;
   for (size_t i = timestamp_low_index + 1; i <= length; ++i) {
     if (i == length || data[i] & 0x80) {
       if (timestamp_low_index + 1 < i) {
-        // rxtmpの末尾にdata[timestamp_low_index+1]からrxValue[i]までを追加
-        rxtmp.insert(rxtmp.end(), data + timestamp_low_index + 1, data + i);
+        if (timestamp_low_index) {
+          uint8_t timestamp_low = data[timestamp_low_index] & 0x7F;
+          // パケット内で下位7bitが戻った場合は上位に繰り上がっている
+          if (timestamp_low < prev_timestamp_low) {
+            timestamp_high = (timestamp_high + 1) & 0x3F;
+          }
+          prev_timestamp_low = timestamp_low;
+          release_usec = _rx_clock.getReleaseUsec(timestamp_high << 7 | timestamp_low);
+        }
+        // data[timestamp_low_index+1]からdata[i]までを、送信側の時刻に合わせた読み出し時刻を付けて受信バッファに追加
+        // (バッファが溢れた分は破棄される)
+        writeRxFrame(data + timestamp_low_index + 1, i - (timestamp_low_index + 1), release_usec);
 //   printf("split:%0d-%0d\n", timestamp_low_index + 1, i);
         timestamp_low_index = i;
       }
     }
   }
-  {
-    std::lock_guard<std::mutex> lock(mutex_rx);
-    _rx_data.insert(_rx_data.end(), rxtmp.begin(), rxtmp.end());
-  }
 }
 
 static std::vector<BLEAdvertisedDevice> ble_scan(void)
@@ -222,64 +393,118 @@ void MIDI_Transport_BLE::end(void)
   }
 }
 
+void MIDI_Transport_BLE::setConnParams(uint32_t interval_usec, uint16_t mtu)
+{
+  if (interval_usec) { _conn_interval_usec = interval_usec; }
+  if (mtu) { _mtu_size = mtu; }
+}
+
 void MIDI_Transport_BLE::addMessage(const uint8_t* data, size_t length)
 {
   uint32_t msec = M5.millis();
-  int len = length + (_tx_runningStatus != data[0] ? 2 : 0);
-  if (_tx_data.size() + len >= _mtu_size - 1) {
-    // If the tx_data size exceeds the buffer size, send it immediately
-    sendFlush();
-  }
-  if (_tx_data.empty()) {
-    uint32_t msec_high = 0x3F & (msec >> 7);
-    _tx_data.push_back(0x80 | msec_high);
-    _tx_runningStatus = 0;
+  if (_tx_packer.empty()) {
+    _tx_packer.setPayloadSize(_mtu_size - 3);
   }
-
-  if (_tx_runningStatus != data[0])
-  {
-    uint32_t msec_low = (msec & 0x7F);
-    _tx_data.push_back(0x80 | msec_low);
-    _tx_data.push_back(data[0]); // status byte
-    _tx_runningStatus = data[0];
+  if (!_tx_packer.addMessage(data, length, msec)) {
+    // パケットに入りきらない場合は、接続間隔を待たずに送信してから詰め直す
+    _sendPacket();
+    _tx_packer.addMessage(data, length, msec);
   }
-  _tx_data.insert(_tx_data.end(), data + 1, data + length);
-  if (_tx_data.size() + 4 >= _mtu_size - 3) {
-    // If the tx_data size exceeds the buffer size, send it immediately
-    sendFlush();
+  if (_tx_packer.isFull()) {
+    _sendPacket();
   }
 }
 
-bool MIDI_Transport_BLE::sendFlush(void)
+uint32_t MIDI_Transport_BLE::_getTxHoldUsec(void) const
+{
+  uint32_t interval = _conn_interval_usec;
+  if (interval > max_tx_hold_usec) { interval = max_tx_hold_usec; }
+  int32_t elapsed = (int32_t)((uint32_t)esp_timer_get_time() - _tx_last_send_usec);
+  if (elapsed < 0 || (uint32_t)elapsed >= interval) { return 0; }
+  return interval - elapsed;
+}
+
+uint32_t MIDI_Transport_BLE::getPendingTxWaitMsec(void) const
+{
+  if (_tx_packer.empty()) { return 0; }
+  uint32_t hold = _getTxHoldUsec();
+  return hold ? (hold + 999) / 1000 : 1;
+}
+
+void MIDI_Transport_BLE::_sendPacket(void)
 {
-  bool result = false;
-ESP_LOGV("BLE", "sendFlush called, tx_data size: %d", _tx_data.size());
-// printf("sendFlush called, tx_data size: %d\n", _tx_data.size());
+  if (_tx_packer.empty()) { return; }
+ESP_LOGV("BLE", "sendPacket: size: %d", _tx_packer.size());
   auto remote = remotecharacteristic;
-  if (remote)
-  {
-    result = true;
-    if (!_tx_data.empty()) {
-      remote->writeValue(_tx_data.data(), _tx_data.size(), false);
-    }
+  if (remote) {
+    remote->writeValue(const_cast<uint8_t*>(_tx_packer.data()), _tx_packer.size(), false);
   } else if (pCharacteristic && _conn_id >= 0) {
-    result = true;
-    if (!_tx_data.empty()) {
-      pCharacteristic->setValue( _tx_data.data(), _tx_data.size());
-      pCharacteristic->notify();
+    pCharacteristic->setValue(const_cast<uint8_t*>(_tx_packer.data()), _tx_packer.size());
+    pCharacteristic->notify();
+  }
+  uint32_t now_usec = (uint32_t)esp_timer_get_time();
+  _tx_last_send_usec = now_usec;
+  ++_stat_packets;
+  _stat_bytes += _tx_packer.size();
+  _updateTxStats(now_usec);
+  _tx_packer.clear();
+}
+
+void MIDI_Transport_BLE::_updateTxStats(uint32_t now_usec)
+{
+  uint32_t elapsed = now_usec - _stat_window_usec;
+  if (elapsed < 1000000) { return; }
+  _tx_stats.packets_per_sec = (uint64_t)_stat_packets * 1000000 / elapsed;
+  _tx_stats.bytes_per_packet = _stat_packets ? _stat_bytes / _stat_packets : 0;
+  _stat_window_usec = now_usec;
+  _stat_packets = 0;
+  _stat_bytes = 0;
+}
+
+bool MIDI_Transport_BLE::sendFlush(void)
+{
+  if (remotecharacteristic == nullptr && (pCharacteristic == nullptr || _conn_id < 0)) {
+    _tx_packer.clear();
+    return false;
+  }
+  // 前回の送信から接続間隔が経つまでは送らずに溜めておき、1回の接続イベントで届く分を1パケットにまとめる
+  // (溜めている間は getPendingTxWaitMsec により、送信すべき時刻に再度呼び出される)
+  if (!_tx_packer.empty() && _getTxHoldUsec() == 0) {
+    _sendPacket();
+  }
+  _updateTxStats((uint32_t)esp_timer_get_time());
+  return true;
+}
+
+size_t MIDI_Transport_BLE::read(uint8_t* dst, size_t cap)
+{
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  size_t result = 0;
+  while (result < cap) {
+    if (_rx_frame_remain == 0) {
+      if (_rx_ring.available() < rx_frame_header_size) { break; }
+      // 読み出し時刻に達していないフレームは残す (後続のフレームも順序を保つためそのまま待たせる)
+      if ((int32_t)(peekRxReleaseUsec() - now) > 0) { break; }
+      _rx_frame_remain = _rx_ring.peek(0);
+      _rx_ring.consume(rx_frame_header_size);
     }
+    size_t len = cap - result;
+    if (len > _rx_frame_remain) { len = _rx_frame_remain; }
+    len = _rx_ring.read(dst + result, len);
+    if (len == 0) { break; }
+    result += len;
+    _rx_frame_remain -= len;
   }
-  _tx_data.clear();
-  _tx_runningStatus = 0;
   return result;
 }
 
-std::vector<uint8_t> MIDI_Transport_BLE::read(void)
+uint32_t MIDI_Transport_BLE::getPendingRxWaitMsec(void) const
 {
-  std::lock_guard<std::mutex> lock(mutex_rx);
-  auto rxValueVec = _rx_data;
-  _rx_data.clear();
-  return rxValueVec;
+  if (_rx_frame_remain) { return 1; }
+  if (_rx_ring.available() < rx_frame_header_size) { return 0; }
+  int32_t remain = (int32_t)(peekRxReleaseUsec() - (uint32_t)esp_timer_get_time());
+  if (remain <= 0) { return 1; }
+  return (remain + 999) / 1000;
 }
 /*
 size_t MIDI_Transport_BLE::read(uint8_t* data, size_t length)
@@ -360,12 +585,14 @@ void MIDI_Transport_BLE::updateState(void)
 void MIDI_Transport_BLE::setCentralConnected(bool connected)
 {
   _central_connected = connected;
+  _rx_clock.reset();
   updateState();
 }
 
 void MIDI_Transport_BLE::setPeripheralConnected(bool connected)
 {
   _peripheral_connected = connected;
+  _rx_clock.reset();
   updateState();
   auto adv = pAdvertising;
   if (adv != nullptr) {
@@ -388,13 +615,20 @@ void MIDI_Transport_BLE::setUseTxRx(bool use_tx, bool use_rx)
   bool prev_en = _use_tx || _use_rx;
   bool new_en = use_tx || use_rx;
   if (prev_en != new_en) {
-    _rx_data.clear();
+    _rx_ring.clear();
+    _rx_frame_remain = 0;
     if (new_en) {
       if (!_is_begin) {
         _is_begin = true;
         // BLEDevice::setMTU(_mtu_size);
         BLEDevice::init(_config.device_name);
         // BLEDevice::setMTU(_mtu_size);
+#if defined (CONFIG_BLUEDROID_ENABLED)
+        BLEDevice::setCustomGapHandler(onGapEvent);
+#endif
+#if defined (CONFIG_NIMBLE_ENABLED)
+        ble_gap_event_listener_register(&_gap_listener, onGapEvent, nullptr);
+#endif
         pServer = BLEDevice::createServer();
         pServer->setCallbacks(&myServerCallbacks);
 
@@ -492,6 +726,8 @@ void MIDI_Transport_BLE::setUseTxRx(bool use_tx, bool use_rx)
                   fflush(stdout);
                   //*/
                 rc->registerForNotify(notifyCallback);
+                // セントラル接続時は接続間隔が取得できないため既定値とする
+                MIDI_Transport_BLE::setConnParams(MIDI_Transport_BLE::default_conn_interval_usec, pClient->getMTU());
                 remotecharacteristic = rc;
                 _pClient = pClient;
                 _instance->setCentralConnected(true);
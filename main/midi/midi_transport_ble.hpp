@@ -8,12 +8,82 @@
 
 namespace midi_driver {
 
+// BLE-MIDIのタイムスタンプ(送信側の13bitのmsec)を、受信側の時刻(usec)に対応付ける
+// 送信側の時刻と受信側の時刻の差のうち最小のもの(最も遅延の少なかった受信)を基準とし、
+// クロックのずれを見込んで基準を少しずつ後ろへずらしながら追従させる。
+// 基準からの遅れのおよそ95パーセンタイルを保留時間とし、接続間隔による揺らぎを吸収する
+class ble_midi_clock_t {
+public:
+  // 送信側の時刻に合わせて受信データを保留する最大時間 (usec)
+  static constexpr const uint32_t max_hold_usec = 20000;
+  // 送信側と受信側のクロックのずれとして見込む量 (ppm)
+  static constexpr const uint32_t drift_ppm = 200;
+  // 受信の間隔がこれを超えた場合はタイムスタンプの周回が判別できないため同期をやり直す (usec)
+  static constexpr const uint32_t resync_usec = 4000000;
+  // 保留時間を1回の受信ごとに調整する量 (usec)
+  static constexpr const int32_t jitter_step_usec = 20;
+
+  void reset(void) { _synced = false; }
+  // パケットを受信した時刻 (usec) を設定する。パケット内のメッセージの処理前に呼ぶこと
+  void beginPacket(uint32_t arrival_usec);
+  // タイムスタンプ(13bit, msec)のメッセージを読み出すべき受信側の時刻 (usec) を返す
+  uint32_t getReleaseUsec(uint16_t timestamp);
+
+  int32_t getJitterUsec(void) const { return _jitter_usec; }
+
+private:
+  uint32_t _arrival_usec = 0;
+  uint32_t _remote_msec = 0;
+  uint32_t _offset_usec = 0;
+  int32_t _jitter_usec = 0;
+  uint16_t _last_timestamp = 0;
+  bool _synced = false;
+};
+
+// BLE-MIDIの送信パケットの組み立て
+// メッセージごとに送信時刻のタイムスタンプを付け、同じパケット内ではランニングステータスでステータスを省略する。
+// 直前のメッセージと同じ時刻・同じステータスの場合はタイムスタンプも省略する
+class ble_midi_packer_t {
+public:
+  void setPayloadSize(size_t size) { _payload_size = size; }
+  // メッセージを追加する。パケットに入りきらない場合は何もせず false を返すので、送信してから再度追加すること
+  bool addMessage(const uint8_t* data, size_t length, uint32_t msec);
+  void clear(void);
+
+  bool empty(void) const { return _data.empty(); }
+  const uint8_t* data(void) const { return _data.data(); }
+  size_t size(void) const { return _data.size(); }
+  size_t getMessageCount(void) const { return _message_count; }
+  // 3バイトのメッセージがもう入らない場合は true
+  bool isFull(void) const { return _data.size() + 5 > _payload_size; }
+
+private:
+  std::vector<uint8_t> _data;
+  size_t _payload_size = 20;
+  size_t _message_count = 0;
+  uint32_t _first_msec = 0;
+  uint32_t _msec = 0;
+  uint8_t _running_status = 0;
+};
+
 class MIDI_Transport_BLE : public MIDI_Transport {
 public:
   struct config_t {
     const char* device_name = "KANTAN-Play";
   };
 
+  // 送信の統計情報
+  struct tx_stats_t {
+    uint32_t packets_per_sec = 0;  // 直近1秒間に送信したパケット数
+    uint32_t bytes_per_packet = 0; // 直近1秒間に送信したパケットの平均バイト数
+    uint32_t queue_depth = 0;      // 送信待ちのメッセージ数
+  };
+
+  // 接続間隔が不明な場合(セントラル接続時など)に用いる値 (usec)
+  static constexpr const uint32_t default_conn_interval_usec = 15000;
+  // 送信を溜めておく最大時間 (usec)。接続間隔が長い場合もこれ以上は溜めない
+  static constexpr const uint32_t max_tx_hold_usec = 30000;
+
   MIDI_Transport_BLE(void) = default;
   ~MIDI_Transport_BLE();
 
@@ -26,20 +96,40 @@ public:
 
   void addMessage(const uint8_t* data, size_t length) override;
   bool sendFlush(void) override;
+  uint32_t getPendingTxWaitMsec(void) const override;
+
+  tx_stats_t getTxStats(void) const {
+    auto stats = _tx_stats;
+    stats.queue_depth = _tx_packer.getMessageCount();
+    return stats;
+  }
 
-  std::vector<uint8_t> read(void) override;
+  size_t read(uint8_t* dst, size_t cap) override;
+  uint32_t getPendingRxWaitMsec(void) const override;
 
   void setUseTxRx(bool use_tx, bool use_rx) override;
 
   static void decodeReceive(const uint8_t* data, size_t length);
   void setCentralConnected(bool connected);
   void setPeripheralConnected(bool connected);
+  // 接続パラメータの通知 (interval_usec : 接続間隔, mtu : ATT_MTU。不明な場合は 0)
+  static void setConnParams(uint32_t interval_usec, uint16_t mtu);
 
 private:
+  // 前回の送信から接続間隔が経つまでの残り時間 (usec)
+  uint32_t _getTxHoldUsec(void) const;
+  void _sendPacket(void);
+  void _updateTxStats(uint32_t now_usec);
 
-  std::vector<uint8_t> _tx_data;
+  ble_midi_packer_t _tx_packer;
+  tx_stats_t _tx_stats;
   config_t _config;
-  uint8_t _tx_runningStatus = 0;
+  // 読み出し中の受信フレームの残りバイト数
+  size_t _rx_frame_remain = 0;
+  uint32_t _tx_last_send_usec = 0;
+  uint32_t _stat_window_usec = 0;
+  uint32_t _stat_packets = 0;
+  uint32_t _stat_bytes = 0;
   bool _is_begin = false;
 
   bool _central_connected = false;
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef MIDI_TRANSPORT_LOOPBACK_HPP
+#define MIDI_TRANSPORT_LOOPBACK_HPP
+
+#include "midi_driver.hpp"
+
+namespace midi_driver {
+
+// 送信したメッセージをそのまま受信側へ折り返すトランスポート
+// 実機なしで MIDIDriver の送受信経路を動作確認・計測するために使用する
+class MIDI_Transport_Loopback : public MIDI_Transport {
+public:
+  bool begin(void) override {
+    _connected = true;
+    return true;
+  }
+  void end(void) override {
+    _connected = false;
+    _rx_ring.clear();
+  }
+
+  // 受信データを外部から投入する (別タスクから投入する場合、投入するタスクは1つに限る)
+  size_t inject(const uint8_t* data, size_t length) {
+    return _rx_ring.write(data, length);
+  }
+
+  size_t read(uint8_t* dst, size_t cap) override {
+    if (_use_rx == false) { return 0; }
+    return _rx_ring.read(dst, cap);
+  }
+  void addMessage(const uint8_t* data, size_t length) override {
+    if (_use_tx == false) { return; }
+    if (_rx_ring.write(data, length) != length) {
+      ++_overflow_count;
+    }
+  }
+  bool sendFlush(void) override {
+    return _use_tx;
+  }
+
+  // 受信バッファに入りきらず破棄したメッセージの数
+  uint32_t getOverflowCount(void) const { return _overflow_count; }
+
+private:
+  spsc_ring_t<1024> _rx_ring;
+  uint32_t _overflow_count = 0;
+};
+
+} // namespace midi_driver
+
+#endif // MIDI_TRANSPORT_LOOPBACK_HPP
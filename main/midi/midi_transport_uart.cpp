@@ -8,6 +8,7 @@
 #include "../system_registry.hpp"
 
 #include <driver/uart.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 
@@ -43,55 +44,187 @@ size_t MIDI_Transport_UART::write(const uint8_t* data, size_t length)
   return uart_write_bytes(uart_num, data, length);
 }
 */
-void MIDI_Transport_UART::addMessage(const uint8_t* data, size_t length)
+// 31250bpsの回線では 1バイトの送信に 320usec かかるため、一度に多くのメッセージを送ると後続の発音が遅れる。
+// そのため送信要求をいったん溜めておき、sendFlush の時点で以下の順に並べ替えて送信する。
+//  1. リアルタイムメッセージ
+//  2. ノートオン (同じチャンネルの先行する CC/PC や、同じノートのノートオフは順序を保って先に送る)
+//  3. ノートオフ・CC・PC 等 (回線が混雑している場合、後続に依存関係のない CC/PC は次回以降に回す)
+// ノートオフはランニングステータスを維持するためベロシティ0のノートオンに変換する。
+
+static inline bool is_realtime(uint8_t status) { return status >= 0xF8; }
+static inline bool is_system(uint8_t status) { return status >= 0xF0; }
+static inline bool is_note_on(const uint8_t* data) { return (data[0] & 0xF0) == 0x90 && data[2] != 0; }
+static inline bool is_note_off(const uint8_t* data) { return (data[0] & 0xF0) == 0x90 && data[2] == 0; }
+
+void MIDI_Transport_UART::_queueMessage(const uint8_t* data, size_t length)
 {
-  if (_tx_data.size() + length >= _config.buffer_size_tx) {
-    // If the tx_data size exceeds the buffer size, send it immediately
-    sendFlush();
+  auto entry = &_tx_queue[_tx_queue_count];
+  entry->data[0] = data[0];
+  entry->data[1] = length > 1 ? data[1] : 0;
+  entry->data[2] = length > 2 ? data[2] : 0;
+  entry->length = length;
+  if ((data[0] & 0xF0) == 0x80 && length == 3) {
+    // ノートオフはベロシティ0のノートオンとして送る
+    entry->data[0] = 0x90 | (data[0] & 0x0F);
+    entry->data[2] = 0;
   }
-  if (_tx_data.empty()) {
-    _tx_runningStatus = 0;
+  _tx_emitted[_tx_queue_count] = false;
+  ++_tx_queue_count;
+}
+
+void MIDI_Transport_UART::_emitEntry(size_t index)
+{
+  auto entry = &_tx_queue[index];
+  _tx_emitted[index] = true;
+  uint8_t status = entry->data[0];
+  if (is_realtime(status)) {
+    // リアルタイムメッセージはランニングステータスに影響しない
+    _tx_data.push_back(status);
+    return;
   }
-  if (_tx_runningStatus != data[0]) {
-    _tx_runningStatus = data[0];
-    _tx_data.push_back(data[0]); // status byte
+  if (_tx_runningStatus != status || is_system(status)) {
+    _tx_runningStatus = is_system(status) ? 0 : status;
+    _tx_data.push_back(status);
   }
-  _tx_data.insert(_tx_data.end(), data + 1, data + length);
+  _tx_data.insert(_tx_data.end(), &entry->data[1], &entry->data[entry->length]);
 }
 
-bool MIDI_Transport_UART::sendFlush(void)
+void MIDI_Transport_UART::_buildTxData(bool allow_defer)
 {
-  if (_use_tx == false) { return false; }
-  uart_port_t uart_num = (uart_port_t) _config.uart_port_num;
-  if (!_tx_data.empty()) {
-    bool res = uart_write_bytes(uart_num, _tx_data.data(), _tx_data.size());
-    if (res > 0) {
-      _tx_data.clear();
-      _tx_runningStatus = 0;
+  const size_t count = _tx_queue_count;
+
+  // リアルタイムメッセージを最優先で送る
+  // ただし先行するシステムコモンメッセージ (再開前のソングポジションポインタ等) は追い越さない
+  for (size_t i = 0; i < count; ++i) {
+    if (_tx_emitted[i] || !is_realtime(_tx_queue[i].data[0])) { continue; }
+    for (size_t j = 0; j < i; ++j) {
+      if (!_tx_emitted[j] && is_system(_tx_queue[j].data[0])) { _emitEntry(j); }
     }
+    _emitEntry(i);
   }
+
+  // ノートオンを送る。先行する同チャンネルの CC/PC 等と同ノートのノートオフは順序を保つ
+  for (size_t i = 0; i < count; ++i) {
+    if (_tx_emitted[i] || !is_note_on(_tx_queue[i].data)) { continue; }
+    const uint8_t status = _tx_queue[i].data[0];
+    const uint8_t note = _tx_queue[i].data[1];
+    for (size_t j = 0; j < i; ++j) {
+      if (_tx_emitted[j]) { continue; }
+      const uint8_t* d = _tx_queue[j].data;
+      if (is_system(d[0])
+       || ((d[0] & 0x0F) == (status & 0x0F) && !is_note_on(d) && (!is_note_off(d) || d[1] == note))) {
+        _emitEntry(j);
+      }
+    }
+    _emitEntry(i);
+  }
+
+  // 回線の混雑具合を見積もり、CC/PC 等を後回しにするか判断する
+  const uint32_t wire_usec = 10 * 1000000 / _config.baud_rate;
+  bool defer = allow_defer && (getTxBacklogUsec() + _tx_data.size() * wire_usec > defer_threshold_usec);
+
+  // 残りを元の順序で送る。ノートオフが後回しにした同チャンネルのメッセージを追い越さないようにする
+  for (size_t i = 0; i < count; ++i) {
+    if (_tx_emitted[i]) { continue; }
+    const uint8_t* d = _tx_queue[i].data;
+    if (!is_note_off(d) && !is_system(d[0])) {
+      if (defer) { continue; }
+    } else {
+      for (size_t j = 0; j < i; ++j) {
+        if (!_tx_emitted[j] && (is_system(d[0]) || (_tx_queue[j].data[0] & 0x0F) == (d[0] & 0x0F))) {
+          _emitEntry(j);
+        }
+      }
+    }
+    _emitEntry(i);
+  }
+
+  // 送信済みのものを取り除き、保留したメッセージを詰める
+  size_t remain = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!_tx_emitted[i]) {
+      _tx_queue[remain] = _tx_queue[i];
+      _tx_emitted[remain] = false;
+      ++remain;
+    }
+  }
+  _tx_queue_count = remain;
+}
+
+bool MIDI_Transport_UART::_writeTxData(void)
+{
+  if (_tx_data.empty()) { return true; }
+  uart_port_t uart_num = (uart_port_t) _config.uart_port_num;
+  int res = uart_write_bytes(uart_num, _tx_data.data(), _tx_data.size());
+  if (res <= 0) { return false; }
+
+  // 回線が空くまでの時刻を更新する
+  int64_t now = esp_timer_get_time();
+  if (_wire_idle_usec < now) { _wire_idle_usec = now; }
+  _wire_idle_usec += (int64_t)res * 10 * 1000000 / _config.baud_rate;
+  _tx_data.clear();
+  _tx_runningStatus = 0;
   return true;
 }
 
-std::vector<uint8_t> MIDI_Transport_UART::read(void)
+uint32_t MIDI_Transport_UART::getTxBacklogUsec(void) const
 {
-  std::vector<uint8_t> rxValueVec;
-  if (_use_rx == true)
-  {
-    size_t length = 0;
-    uart_port_t uart_num = (uart_port_t) _config.uart_port_num;
-    uart_get_buffered_data_len(uart_num, &length);
-    if (length > 0)
-    {
-      rxValueVec.resize(length);
-      size_t read_length = uart_read_bytes(uart_num, rxValueVec.data(), length, 1);
-      if (read_length != length) {
-        rxValueVec.resize(read_length);
-        // error
-      }
+  int64_t remain = _wire_idle_usec - esp_timer_get_time();
+  return remain > 0 ? (uint32_t)remain : 0;
+}
+
+uint32_t MIDI_Transport_UART::getPendingTxWaitMsec(void) const
+{
+  if (_tx_queue_count == 0) { return 0; }
+  uint32_t backlog = getTxBacklogUsec();
+  if (backlog <= defer_threshold_usec) { return 1; }
+  return (backlog - defer_threshold_usec + 999) / 1000;
+}
+
+void MIDI_Transport_UART::addMessage(const uint8_t* data, size_t length)
+{
+  if (length == 0 || _use_tx == false) { return; }
+  if (length > 3) {
+    // 3バイトを超えるメッセージ (SysEx) は並べ替えずに、溜まっているものを送ってから続けて送る
+    _buildTxData(false);
+    _tx_runningStatus = 0;
+    _tx_data.insert(_tx_data.end(), data, data + length);
+    if (_tx_data.size() >= _config.buffer_size_tx) {
+      sendFlush();
     }
+    return;
   }
-  return rxValueVec;
+  if (_tx_queue_count >= max_tx_queue
+   || (_tx_queue_count + 1) * 3 + _tx_data.size() >= _config.buffer_size_tx) {
+    // 送信待ちが溢れる場合はいったん送信する。保留分で溢れたままなら保留せずにすべて送る
+    sendFlush();
+    if (_tx_queue_count >= max_tx_queue
+     || (_tx_queue_count + 1) * 3 + _tx_data.size() >= _config.buffer_size_tx) {
+      _buildTxData(false);
+      _writeTxData();
+    }
+  }
+  _queueMessage(data, length);
+}
+
+bool MIDI_Transport_UART::sendFlush(void)
+{
+  if (_use_tx == false) { return false; }
+  _buildTxData(true);
+  _writeTxData();
+  return true;
+}
+
+size_t MIDI_Transport_UART::read(uint8_t* dst, size_t cap)
+{
+  if (_use_rx == false) { return 0; }
+  size_t length = 0;
+  uart_port_t uart_num = (uart_port_t) _config.uart_port_num;
+  uart_get_buffered_data_len(uart_num, &length);
+  if (length > cap) { length = cap; }
+  if (length == 0) { return 0; }
+  int read_length = uart_read_bytes(uart_num, dst, length, 1);
+  return (read_length > 0) ? read_length : 0;
 }
 
 void MIDI_Transport_UART::uart_rx_task(MIDI_Transport_UART* me)
@@ -27,16 +27,38 @@ public:
   bool begin(void) override;
   void end(void) override;
   // size_t write(const uint8_t* data, size_t length) override;
-  std::vector<uint8_t> read(void) override;
+  size_t read(uint8_t* dst, size_t cap) override;
   void addMessage(const uint8_t* data, size_t length) override;
   bool sendFlush(void) override;
+  uint32_t getPendingTxWaitMsec(void) const override;
 
   void setUseTxRx(bool tx_enable, bool rx_enable) override;
-  
+
+  // 送信済みデータが回線上から送り終わるまでの見込み時間 (usec)
+  uint32_t getTxBacklogUsec(void) const;
+
 private:
+  // 送信待ちメッセージ。sendFlush 時に優先度順に並べ替えて送信する
+  struct tx_entry_t {
+    uint8_t data[3];
+    uint8_t length;
+  };
+  // 回線の混雑時に CC/PC 等を後回しにする閾値 (usec)
+  static constexpr const uint32_t defer_threshold_usec = 2000;
+  static constexpr const size_t max_tx_queue = 64;
+
   static void uart_rx_task(MIDI_Transport_UART* me);
+  void _queueMessage(const uint8_t* data, size_t length);
+  void _emitEntry(size_t index);
+  void _buildTxData(bool allow_defer);
+  bool _writeTxData(void);
+
+  tx_entry_t _tx_queue[max_tx_queue];
+  bool _tx_emitted[max_tx_queue];
+  size_t _tx_queue_count = 0;
   std::vector<uint8_t> _tx_data;
   config_t _config;
+  int64_t _wire_idle_usec = 0;
   uint8_t _tx_runningStatus = 0;
   bool _is_begin = false;
 };
@@ -7,15 +7,14 @@
 #include "../system_registry.hpp"
 
 #include <string.h>
-#include <mutex>
 
 #if __has_include(<usb/usb_host.h>)
 
 namespace midi_driver {
 
   static MIDI_Transport_USB* _instance = nullptr;
-  static std::vector<uint8_t> _rx_data;
-  static std::mutex mutex_rx;
+  // 受信した USB-MIDI イベントパケット(4バイト単位)を受信タスクへ受け渡すバッファ
+  static spsc_ring_t<1024> _rx_ring;
   static bool isMIDIReady = false;
 
 
@@ -80,13 +79,12 @@ namespace midi_driver {
           } while (!_instance->isConnected());
         }
         if (usb_midi.readPacket(&event)) {
-          {
-            std::lock_guard<std::mutex> lock(mutex_rx);
-            do {
-              uint8_t* ptr = reinterpret_cast<uint8_t*>(&event);
-              _rx_data.insert(_rx_data.end(), ptr, ptr + 4);
-            } while (usb_midi.readPacket(&event));
-          }
+          do {
+            // パケット単位で書き込むため、空きが足りない場合は破棄する
+            if (_rx_ring.getFree() >= 4) {
+              _rx_ring.write(reinterpret_cast<uint8_t*>(&event), 4);
+            }
+          } while (usb_midi.readPacket(&event));
           _instance->execTaskNotify();
         }
       }
@@ -205,14 +203,12 @@ namespace midi_driver {
     if (Device_Handle == transfer->device_handle) {
       if (transfer->status == USB_TRANSFER_STATUS_COMPLETED && USB_EP_DESC_GET_EP_DIR(transfer)) {
         uint8_t *const p = transfer->data_buffer;
-        {
-          std::lock_guard<std::mutex> lock(mutex_rx);
-          for (int i = 0; i < transfer->actual_num_bytes; i += 4) {
-            if ((p[i] + p[i+1] + p[i+2] + p[i+3]) == 0) break;
-            _rx_data.insert(_rx_data.end(), p + i, p + i + 4);
-            ESP_LOGI("", "midi: %02x %02x %02x %02x",
-                p[i], p[i+1], p[i+2], p[i+3]);
-          }
+        for (int i = 0; i + 4 <= transfer->actual_num_bytes; i += 4) {
+          if ((p[i] + p[i+1] + p[i+2] + p[i+3]) == 0) break;
+          if (_rx_ring.getFree() < 4) break;
+          _rx_ring.write(p + i, 4);
+          ESP_LOGI("", "midi: %02x %02x %02x %02x",
+              p[i], p[i+1], p[i+2], p[i+3]);
         }
         esp_err_t err = usb_host_transfer_submit(transfer);
         if (err != ESP_OK) {
@@ -528,10 +524,27 @@ void MIDI_Transport_USB::addMessage(const uint8_t* data, size_t length)
     return;
   }
 
-  // TODO:システムエクスクルーシブの送信には未対応。
-  // 必要に応じて実装すること…。
+  if (length > 3 || data[0] == 0xF0) {
+    // 送信待ちのバッファに入りきらない分は、フラッシュして空きを作りながら続きを渡す
+    size_t accepted = addSysEx(data, length);
+    while (accepted < length && _sysex_packer.available() && sendFlush()) {
+      accepted += addSysEx(&data[accepted], length - accepted);
+    }
+    if (accepted < length) {
+      // 送り切れない場合 (接続が切れた場合など) は終端を付けて打ち切る
+      ESP_LOGI("", "sysex tx buffer full");
+      _sysex_packer.abort();
+    }
+    return;
+  }
 
-  _tx_data.push_back(data[0] >> 4);
+  // Code Index Number はチャンネルメッセージではステータスの上位4bit、システムメッセージではバイト数で決まる
+  uint8_t cin = data[0] >> 4;
+  if (cin == 0x0F && data[0] < 0xF8) {
+    static constexpr const uint8_t cin_system_common[] = { 0x05, 0x02, 0x03 };
+    cin = cin_system_common[length - 1];
+  }
+  _tx_data.push_back(cin);
   _tx_data.insert(_tx_data.end(), data, data + 3);
   int remain = _midi_usb_instance->getSendBufSize() - _tx_data.size();
   if (remain - 4 <= 0) {
@@ -539,12 +552,21 @@ void MIDI_Transport_USB::addMessage(const uint8_t* data, size_t length)
   }
 }
 
+size_t MIDI_Transport_USB::addSysEx(const uint8_t* data, size_t length)
+{
+  if (_use_tx == false) { return 0; }
+  return _sysex_packer.add(data, length);
+}
+
 bool MIDI_Transport_USB::sendFlush(void)
 {
   if (_use_tx == false) {
     ESP_LOGI("", "MIDIOut is NULL or tx not enabled");
     return false;
   }
+  // チャンネルメッセージの後ろの空きをSysExのパケットで埋める。
+  // 一度に送るのはUSBの送信バッファ1つ分までとし、残りは次回以降のフラッシュで送る
+  _sysex_packer.pop(_tx_data, _midi_usb_instance->getSendBufSize());
   if (_tx_data.empty()) {
     return true;
   }
@@ -564,26 +586,18 @@ bool MIDI_Transport_USB::sendFlush(void)
   // return (err == ESP_OK);
 }
 
-std::vector<uint8_t> MIDI_Transport_USB::read(void)
+size_t MIDI_Transport_USB::read(uint8_t* dst, size_t cap)
 {
-  std::vector<uint8_t> rxValueVec;
-  std::lock_guard<std::mutex> lock(mutex_rx);
-  if (!_rx_data.empty()) {
-
-    static constexpr uint8_t cin_length_table[] = {
-       0, 0, 2, 3, 3, 1, 2, 3,
-       3, 3, 3, 3, 2, 2, 3, 1,
-    };
-    for (int i = 0; i < _rx_data.size(); i += 4) {
-      uint8_t cin = _rx_data[i] & 0x0f; // Code Index Number
-      size_t len = cin_length_table[cin];
-      if (len) {
-        rxValueVec.insert(rxValueVec.end(), _rx_data.begin() + i + 1, _rx_data.begin() + i + 1 + len);
-      }
+  size_t result = 0;
+  // パケットの途中で分割しないよう、3バイト以上の空きがある間だけ取り出す
+  while (result + 3 <= cap && _rx_ring.available() >= 4) {
+    size_t len = usb_midi_packet_length(_rx_ring.peek(0));
+    for (size_t i = 0; i < len; ++i) {
+      dst[result++] = _rx_ring.peek(1 + i);
     }
-    _rx_data.clear();
+    _rx_ring.consume(4);
   }
-  return rxValueVec;
+  return result;
 }
 
 void MIDI_Transport_USB::setConnected(bool flg)
@@ -605,6 +619,10 @@ void MIDI_Transport_USB::setUseTxRx(bool tx_enable, bool rx_enable)
   _instance = this;
 
   MIDI_Transport::setUseTxRx(tx_enable, rx_enable);
+  if (!tx_enable) {
+    // 送りかけのSysExは破棄する
+    _sysex_packer.clear();
+  }
   // M5_LOGD("uart_midi:uart_set_pin: %d", err);
 
   kanplay_ns::system_registry->runtime_info.setMidiPortStateUSB
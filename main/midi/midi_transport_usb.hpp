@@ -6,6 +6,7 @@
 #define MIDI_TRANSPORT_USB_HPP
 
 #include "midi_driver.hpp"
+#include "usb_midi_packet.hpp"
 #include "../common_define.hpp"
 
 #include <usb/usb_host.h>
@@ -30,17 +31,21 @@ public:
   bool begin(void) override;
   void end(void) override;
   // size_t write(const uint8_t* data, size_t length) override;
-  std::vector<uint8_t> read(void) override;
+  size_t read(uint8_t* dst, size_t cap) override;
   void addMessage(const uint8_t* data, size_t length) override;
+  size_t addSysEx(const uint8_t* data, size_t length) override;
   bool sendFlush(void) override;
+  uint32_t getPendingTxWaitMsec(void) const override { return _sysex_packer.available() ? 1 : 0; }
 
   void setUseTxRx(bool tx_enable, bool rx_enable) override;
 
   void setConnected(bool flg);
 
 private:
-
   std::vector<uint8_t> _tx_data;
+  // SysEx送信用のUSB-MIDIイベントパケットのバッファ
+  // チャンネルメッセージを優先して送り、USBの送信バッファの余りでSysExを少しずつ送る
+  usb_midi_sysex_packer_t _sysex_packer;
   config_t _config;
   bool _is_begin = false;
   kanplay_ns::def::command::usb_mode_t _usb_mode = kanplay_ns::def::command::usb_mode_t::usb_host;
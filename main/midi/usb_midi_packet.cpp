@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "usb_midi_packet.hpp"
+
+#include <string.h>
+
+namespace midi_driver {
+
+size_t usb_midi_packet_length(uint8_t header)
+{
+  static constexpr uint8_t cin_length_table[] = {
+     0, 0, 2, 3, 3, 1, 2, 3,
+     3, 3, 3, 3, 2, 2, 3, 1,
+  };
+  return cin_length_table[header & 0x0F];
+}
+
+size_t usb_midi_sysex_packer_t::add(const uint8_t* data, size_t length)
+{
+  size_t result = 0;
+  // どのバイトでもパケットが確定し得るため、1パケット分の空きがある間だけ受け付ける
+  // (打ち切り用の終端のパケットの分は常に空けておく)
+  while (result < length && _ring.getFree() >= 8) {
+    uint8_t byte = data[result++];
+    if (byte == 0xF0) { _open = true; }
+    _part[_part_len++] = byte;
+    if (byte == 0xF7) {
+      // 終端を含むパケット : 1バイトなら CIN 0x5、2バイトなら 0x6、3バイトなら 0x7
+      _open = false;
+      pushPacket(0x04 + _part_len);
+    } else if (_part_len == 3) {
+      // 開始または継続のパケット : CIN 0x4
+      pushPacket(0x04);
+    }
+  }
+  return result;
+}
+
+void usb_midi_sysex_packer_t::abort(void)
+{
+  if (!_open && _part_len == 0) { return; }
+  // 詰めかけのバイトは最大2バイトのため、終端を加えて1パケットに収まる
+  _part[_part_len++] = 0xF7;
+  pushPacket(0x04 + _part_len);
+  _open = false;
+}
+
+void usb_midi_sysex_packer_t::clear(void)
+{
+  _ring.clear();
+  _part_len = 0;
+  _open = false;
+}
+
+void usb_midi_sysex_packer_t::pop(std::vector<uint8_t>& dst, size_t max_size)
+{
+  while (dst.size() + 4 <= max_size && _ring.available() >= 4) {
+    for (int i = 0; i < 4; ++i) {
+      dst.push_back(_ring.peek(i));
+    }
+    _ring.consume(4);
+  }
+}
+
+void usb_midi_sysex_packer_t::pushPacket(uint8_t cin)
+{
+  uint8_t packet[4] = { cin, 0, 0, 0 };
+  memcpy(&packet[1], _part, _part_len);
+  _ring.write(packet, 4);
+  _part_len = 0;
+}
+
+} // namespace midi_driver
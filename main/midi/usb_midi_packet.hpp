@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef USB_MIDI_PACKET_HPP
+#define USB_MIDI_PACKET_HPP
+
+#include "midi_driver.hpp"
+
+namespace midi_driver {
+
+// USB-MIDIのイベントパケットの Code Index Number からMIDIのバイト数を求める
+size_t usb_midi_packet_length(uint8_t header);
+
+// SysExのバイト列をUSB-MIDIのイベントパケット(4バイト単位)に分割し、送信待ちのリングに格納する
+// 開始・継続は CIN 0x4、終端(F7)を含むパケットはバイト数に応じて CIN 0x5~0x7 とする
+// 送信途中で打ち切る場合に終端のパケットを必ず格納できるよう、リングの1パケット分を予約しておく
+class usb_midi_sysex_packer_t {
+public:
+  static constexpr const size_t ring_size = 1024;
+
+  // SysExのバイト列 (複数回に分けてもよい) を受け付け、受け付けたバイト数を返す
+  // リングの空きが足りない場合は途中までとなるので、送信して空きができてから続きを渡すこと
+  size_t add(const uint8_t* data, size_t length);
+  // 送信途中のSysExを終端(F7)で打ち切る。残りのバイトが次のSysExに混ざらないようにする
+  void abort(void);
+  void clear(void);
+
+  // 送信待ちのパケットのバイト数 (4の倍数)
+  size_t available(void) const { return _ring.available(); }
+  // 送信待ちのパケットを、dst の長さが max_size を超えない範囲で dst の末尾へ移す
+  void pop(std::vector<uint8_t>& dst, size_t max_size);
+
+private:
+  void pushPacket(uint8_t cin);
+
+  spsc_ring_t<ring_size> _ring;
+  // パケットに詰める前のSysExのバイト (最大3バイト)
+  uint8_t _part[3];
+  uint8_t _part_len = 0;
+  // F0 を受け付けてから F7 を受け付けるまでの間
+  bool _open = false;
+};
+
+} // namespace midi_driver
+
+#endif // USB_MIDI_PACKET_HPP
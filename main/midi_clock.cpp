@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_clock.hpp"
+
+#include <math.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+midi_clock_in_t midi_clock_in;
+
+// PLLのループフィルタの係数。位相誤差に対する周期の補正量(ki)と位相の補正量(kp)
+// 同期開始直後は追従を優先し、同期が確立した後は揺らぎの除去を優先する
+static constexpr const float pll_kp_acquire = 0.5f;
+static constexpr const float pll_ki_acquire = 0.125f;
+static constexpr const float pll_kp_track = 0.125f;
+static constexpr const float pll_ki_track = 0.0078125f;
+
+void midi_clock_in_t::receiveTick(uint32_t usec)
+{
+  auto state = &_work;
+  uint32_t interval = usec - _prev_usec;
+  _prev_usec = usec;
+
+  // 初回、または長時間途絶えた後は推定をやり直す
+  if (state->tick_count == 0 || interval > tick_usec_max * 4) {
+    state->tick_usec = usec;
+    state->period_usec = 0;
+    state->tick_count = 1;
+    state->tick_index = _next_index++;
+    _tick_frac = 0;
+    _phase_error_usec = 0;
+    publish();
+    return;
+  }
+
+  // 2回目のクロックで周期の初期値を決める
+  if (state->tick_count == 1) {
+    if (interval < tick_usec_min) { interval = tick_usec_min; }
+    if (interval > tick_usec_max) { interval = tick_usec_max; }
+    state->period_usec = interval;
+    state->tick_usec = usec;
+    state->tick_count = 2;
+    state->tick_index = _next_index++;
+    _tick_frac = 0;
+    publish();
+    return;
+  }
+
+  float period = state->period_usec;
+  // 予測時刻 (直近の推定時刻 + 周期) との差
+  float error = (float)(int32_t)(usec - state->tick_usec) - _tick_frac - period;
+
+  // 予測より大幅に遅い場合は、途中のクロックが欠落したものとして扱う
+  uint32_t lost = 0;
+  if (error > period * 0.75f) {
+    lost = (uint32_t)(error / period + 0.25f);
+    error -= lost * period;
+  }
+  // 1回の受信で補正する量を制限し、極端な揺らぎに引きずられないようにする
+  if (error > period) { error = period; }
+  if (error < -period) { error = -period; }
+
+  // 同期開始直後や、テンポの急な変化で誤差が大きい場合は追従を優先する
+  const bool acquire = state->tick_count < lock_tick_count || fabsf(error) > period * 0.25f;
+  const float kp = acquire ? pll_kp_acquire : pll_kp_track;
+  const float ki = acquire ? pll_ki_acquire : pll_ki_track;
+
+  // 次の推定時刻 = 予測時刻 + 位相の補正
+  float advance = period * (1 + lost) + kp * error + _tick_frac;
+  float advance_int = floorf(advance);
+  state->tick_usec += (int32_t)advance_int;
+  _tick_frac = advance - advance_int;
+
+  // 周期の補正
+  period += ki * error;
+  if (period < tick_usec_min) { period = tick_usec_min; }
+  if (period > tick_usec_max) { period = tick_usec_max; }
+  state->period_usec = period;
+
+  _next_index += lost;
+  state->tick_index = _next_index++;
+  if (state->tick_count < UINT32_MAX) { ++state->tick_count; }
+  _phase_error_usec = (int32_t)error;
+  publish();
+}
+
+void midi_clock_in_t::receiveStart(void)
+{
+  // Start の直後に受信するクロックが1拍目の頭となる
+  _next_index = 0;
+  _running.store(true, std::memory_order_release);
+}
+
+void midi_clock_in_t::receiveContinue(void)
+{
+  _running.store(true, std::memory_order_release);
+}
+
+void midi_clock_in_t::receiveStop(void)
+{
+  _running.store(false, std::memory_order_release);
+}
+
+void midi_clock_in_t::receiveSongPosition(uint16_t position)
+{
+  // 16分音符はクロック6個分
+  _next_index = position * (tick_per_beat / 4);
+}
+
+void midi_clock_in_t::reset(void)
+{
+  _work = state_t();
+  _tick_frac = 0;
+  _next_index = 0;
+  _phase_error_usec = 0;
+  _running.store(false, std::memory_order_release);
+  publish();
+}
+
+void midi_clock_in_t::publish(void)
+{
+  // シーケンス番号が奇数の間は書込み中を表す
+  _sequence.fetch_add(1, std::memory_order_acq_rel);
+  std::atomic_thread_fence(std::memory_order_release);
+  _state = _work;
+  std::atomic_thread_fence(std::memory_order_release);
+  _sequence.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void midi_clock_in_t::load(state_t* state) const
+{
+  uint32_t seq;
+  do {
+    seq = _sequence.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    *state = _state;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) || seq != _sequence.load(std::memory_order_acquire));
+}
+
+bool midi_clock_in_t::isLocked(uint32_t usec) const
+{
+  state_t state;
+  load(&state);
+  if (state.tick_count < lock_tick_count) { return false; }
+  // クロックが途絶えてから4拍分の時間が経過したら同期が外れたものとする
+  return (int32_t)(usec - state.tick_usec) < (int32_t)(state.period_usec * tick_per_beat * 4);
+}
+
+int32_t midi_clock_in_t::getBeatCycleUsec(void) const
+{
+  state_t state;
+  load(&state);
+  return (int32_t)(state.period_usec * tick_per_beat + 0.5f);
+}
+
+int32_t midi_clock_in_t::getNextBeatRemainUsec(uint32_t usec) const
+{
+  state_t state;
+  load(&state);
+  if (state.period_usec <= 0) { return -1; }
+
+  // 指定時刻の拍内の位置 (クロック単位)
+  float position = (state.tick_index % tick_per_beat) + (float)(int32_t)(usec - state.tick_usec) / state.period_usec;
+  position = fmodf(position, tick_per_beat);
+  if (position < 0) { position += tick_per_beat; }
+
+  float remain = (position < tick_per_beat / 2) ? (tick_per_beat - position) : (tick_per_beat * 2 - position);
+  return (int32_t)(remain * state.period_usec + 0.5f);
+}
+
+uint32_t midi_clock_out_t::beat(uint32_t beat_usec)
+{
+  uint32_t count = 1;
+  if (_active) {
+    // 前の拍で送信しきれなかったクロックを送信する
+    count += tick_per_beat - _tick_in_beat;
+    ++_beat_count;
+  } else {
+    _beat_count = 0;
+  }
+  _active = true;
+  _tick_usec = beat_usec;
+  _tick_frac = 0;
+  _tick_in_beat = 1;
+  return count;
+}
+
+uint32_t midi_clock_out_t::calcStep(uint32_t next_beat_usec) const
+{
+  // 次の拍の頭までの残り時間を、残りのクロック間隔の数で割る
+  const uint32_t n = tick_per_beat + 1 - _tick_in_beat;
+  int32_t span = (int32_t)(next_beat_usec - _tick_usec);
+  if (span < 0) { span = 0; }
+  if (span > (INT32_MAX >> 8)) { span = INT32_MAX >> 8; }
+  int32_t span_frac = (span << 8) - (int32_t)_tick_frac;
+  if (span_frac < 0) { span_frac = 0; }
+  return _tick_frac + span_frac / n;
+}
+
+uint32_t midi_clock_out_t::update(uint32_t usec, uint32_t next_beat_usec)
+{
+  uint32_t count = 0;
+  while (_active && _tick_in_beat < tick_per_beat) {
+    uint32_t step = calcStep(next_beat_usec);
+    uint32_t tick_usec = _tick_usec + (step >> 8);
+    if ((int32_t)(usec - tick_usec) < 0) { break; }
+    // 1usec未満の端数は次のクロックに持ち越す
+    _tick_usec = tick_usec;
+    _tick_frac = step & 0xFF;
+    ++_tick_in_beat;
+    ++count;
+  }
+  return count;
+}
+
+uint32_t midi_clock_out_t::getNextTickUsec(uint32_t next_beat_usec) const
+{
+  if (!_active || _tick_in_beat >= tick_per_beat) { return next_beat_usec; }
+  return _tick_usec + (calcStep(next_beat_usec) >> 8);
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
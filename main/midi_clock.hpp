@@ -0,0 +1,112 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_CLOCK_HPP
+#define KANPLAY_MIDI_CLOCK_HPP
+
+/*
+ - 外部MIDIクロック(24 ppqn)への同期
+   受信したタイミングクロック(0xF8)の時刻から、PLLで1クロックあたりの周期と位相を推定する。
+   受信時刻の揺らぎはPLLのループフィルタで平滑化されるため、推定値はクロック毎に少しずつ変化する。
+   受信側(task_midi)と参照側(task_kantanplay)は別タスクのため、推定値はシーケンスロックで受け渡す。
+ - MIDIクロックの送信
+   演奏タスクの拍の予定時刻を基準に、拍の間を24分割した時刻にクロックを送信する。
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class midi_clock_in_t {
+public:
+  static constexpr const uint8_t tick_per_beat = 24;
+  // 追従できるクロック周期の範囲 (usec) 30 BPM ~ 300 BPM
+  static constexpr const uint32_t tick_usec_min = 60 * 1000 * 1000 / (300 * tick_per_beat);
+  static constexpr const uint32_t tick_usec_max = 60 * 1000 * 1000 / (30 * tick_per_beat);
+  // 同期が確立したと見做すまでに必要なクロック数
+  static constexpr const uint32_t lock_tick_count = tick_per_beat;
+
+  // 受信側 (task_midi)
+  void receiveTick(uint32_t usec);              // 0xF8 Timing Clock
+  void receiveStart(void);                      // 0xFA Start
+  void receiveContinue(void);                   // 0xFB Continue
+  void receiveStop(void);                       // 0xFC Stop
+  void receiveSongPosition(uint16_t position);  // 0xF2 Song Position Pointer (16分音符単位)
+  void reset(void);
+
+  // 参照側 (task_kantanplay)
+  // 指定時刻においてクロックに同期できているか否か (一定時間クロックが途絶えた場合は同期が外れる)
+  bool isLocked(uint32_t usec) const;
+  // Start/Continue を受信して演奏中か否か
+  bool isRunning(void) const { return _running.load(std::memory_order_acquire); }
+  // 推定した拍の周期 (usec)
+  int32_t getBeatCycleUsec(void) const;
+  // 指定時刻から次の拍の頭までの時間 (usec)
+  // 直前の拍の頭から半拍未満の場合は、直前の拍を処理済みとして次の拍までの時間を返す
+  int32_t getNextBeatRemainUsec(uint32_t usec) const;
+
+  // 直近のクロックの位相誤差 (usec, 受信時刻 - 予測時刻)
+  int32_t getPhaseErrorUsec(void) const { return _phase_error_usec; }
+
+private:
+  // 参照側に公開する推定値
+  struct state_t {
+    uint32_t tick_usec = 0;   // 直近のクロックの推定時刻
+    float period_usec = 0;    // 推定したクロック周期
+    uint32_t tick_index = 0;  // 直近のクロックの Start からの通し番号
+    uint32_t tick_count = 0;  // 同期を開始してから受信したクロック数
+  };
+  void publish(void);
+  void load(state_t* state) const;
+
+  // 受信側のみが使用する状態
+  state_t _work;
+  float _tick_frac = 0;       // 推定時刻の小数部
+  uint32_t _prev_usec = 0;    // 直近のクロックの受信時刻
+  uint32_t _next_index = 0;   // 次に受信するクロックの通し番号
+  int32_t _phase_error_usec = 0;
+
+  state_t _state;
+  std::atomic<uint32_t> _sequence { 0 };
+  std::atomic<bool> _running { false };
+};
+
+extern midi_clock_in_t midi_clock_in;
+
+// 拍の予定時刻からMIDIクロックの送信時刻を求める
+// 次のクロックの時刻は、次の拍の頭までの残り時間を残りのクロック数で割って求め、割り切れない端数は持ち越す。
+// クロックの時刻は常に拍の頭を基準に決まるため、テンポやスウィングが変化しても誤差は蓄積せず、1拍あたり必ず24個となる。
+class midi_clock_out_t {
+public:
+  static constexpr const uint8_t tick_per_beat = midi_clock_in_t::tick_per_beat;
+
+  // 拍の頭で呼ぶ。beat_usec は今回の拍の頭の予定時刻 (次の拍の頭の予定時刻は update で渡す)
+  // 今回の拍の頭のクロックと、前の拍で送信しきれなかったクロックを合わせた、今すぐ送信すべきクロック数を返す
+  uint32_t beat(uint32_t beat_usec);
+  // 指定時刻までに送信すべきクロック数を返す。次の拍の頭の予定時刻はテンポの変化に応じて変わってよい
+  uint32_t update(uint32_t usec, uint32_t next_beat_usec);
+  // 次のクロックの予定時刻。拍内のクロックを送信し終えた場合は次の拍の頭の時刻を返す
+  uint32_t getNextTickUsec(uint32_t next_beat_usec) const;
+
+  void stop(void) { _active = false; }
+  bool isActive(void) const { return _active; }
+  // 送信開始からの拍数
+  uint32_t getBeatCount(void) const { return _beat_count; }
+
+private:
+  // 次のクロックの予定時刻までの時間 (1/256 usec単位)
+  uint32_t calcStep(uint32_t next_beat_usec) const;
+
+  uint32_t _tick_usec = 0;      // 直前のクロックの予定時刻 (整数部)
+  uint32_t _tick_frac = 0;      // 直前のクロックの予定時刻の端数 (1/256 usec単位)
+  uint32_t _beat_count = 0;
+  uint8_t _tick_in_beat = 0;    // 拍内で送信済みのクロック数
+  bool _active = false;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
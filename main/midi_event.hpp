@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_EVENT_HPP
+#define KANPLAY_MIDI_EVENT_HPP
+
+/*
+ - 内部のMIDI出力で受け渡すイベント
+   演奏タスクから各MIDIポートへ受け渡すメッセージを、UMP (Universal MIDI Packet) の
+   MIDI 1.0 形式の32bitワード1つに詰める。読出し側は1回の読込みでメッセージ全体を取得できる。
+    bit 31-28 : Message Type (0x1 : システムメッセージ / 0x2 : MIDI 1.0 チャンネルボイスメッセージ)
+    bit 27-24 : Group (送信元のポート midi_route_port_t を格納する)
+    bit 23-16 : ステータスバイト
+    bit 15- 8 : データバイト1
+    bit  7- 0 : データバイト2
+*/
+
+#include <stdint.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+struct midi_event_t {
+  enum message_type_t : uint8_t {
+    mt_system = 0x1,
+    mt_midi1_channel_voice = 0x2,
+  };
+
+  uint32_t word = 0;
+  // 遅延計測用のトレース番号 (0 はトレースなし)
+  uint8_t trace_id = 0;
+
+  static constexpr uint32_t pack(uint8_t status, uint8_t data1, uint8_t data2, uint8_t source) {
+    return (uint32_t)(status >= 0xF0 ? mt_system : mt_midi1_channel_voice) << 28
+         | (uint32_t)(source & 0x0F) << 24
+         | (uint32_t)status << 16
+         | (uint32_t)data1 << 8
+         | data2;
+  }
+
+  message_type_t getMessageType(void) const { return (message_type_t)(word >> 28); }
+  uint8_t getSource(void) const { return (word >> 24) & 0x0F; }
+  uint8_t getStatus(void) const { return word >> 16; }
+  uint8_t getData1(void) const { return word >> 8; }
+  uint8_t getData2(void) const { return word; }
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "midi_port_state.hpp"
+
+#include <string.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+void midi_channel_state_t::reset(void)
+{
+  memset(_sent_program, 0xFF, sizeof(_sent_program));
+  memset(_sent_volume, 0xFF, sizeof(_sent_volume));
+}
+
+bool midi_channel_state_t::update(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  uint8_t channel = status & 0x0F;
+  bool internal = (source == def::command::midi_route_port_t::mrp_internal);
+  switch (status & 0xF0) {
+  case 0xC0:
+    if (internal && _sent_program[channel] == data1) { return false; }
+    _sent_program[channel] = internal ? data1 : 0xFF;
+    break;
+  case 0xB0:
+    if (data1 == 0 || data1 == 32 || data1 == 121) {
+      // バンクセレクトやリセットオールコントローラの後は、同じ番号でも音色を送り直す
+      _sent_program[channel] = 0xFF;
+    } else if (data1 == 7) {
+      if (internal && _sent_volume[channel] == data2) { return false; }
+      _sent_volume[channel] = internal ? data2 : 0xFF;
+    }
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+void midi_route_mask_t::reset(void)
+{
+  memset(_mask, 0xFF, sizeof(_mask));
+}
+
+void midi_route_mask_t::assign(const system_registry_t::reg_midi_port_setting_t* setting, uint8_t route_port)
+{
+  uint16_t mask[def::command::max_midi_route_port][8];
+  for (int src = 0; src < def::command::max_midi_route_port; ++src) {
+    uint16_t channel_mask = setting->getRouteChannelMask(src, route_port);
+    uint8_t type_mask = setting->getRouteTypeMask(src, route_port);
+    for (int type = 0; type < 7; ++type) {
+      mask[src][type] = (type_mask & (1 << type)) ? channel_mask : 0;
+    }
+    // システムメッセージはチャンネルを持たないため、ビット0で判定する
+    mask[src][7] = (type_mask & system_registry_t::reg_midi_port_setting_t::route_type_system) ? 0xFFFF : 0;
+  }
+  memcpy(_mask, mask, sizeof(_mask));
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_MIDI_PORT_STATE_HPP
+#define KANPLAY_MIDI_PORT_STATE_HPP
+
+/*
+ - MIDI出力ポートごとの送信状態
+   ポートへ送信済みのチャンネルごとの音色と音量を保持し、演奏タスクからの重複した送信を省略する。
+   経路表 (送信元 × 送信先 ごとのチャンネル・メッセージ種別) をポートごとに展開し、送信するか否かを1回の表引きで判定する。
+*/
+
+#include "common_define.hpp"
+#include "system_registry.hpp"
+
+#include <stdint.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class midi_channel_state_t {
+public:
+  midi_channel_state_t(void) { reset(); }
+
+  // 接続先の状態が不明になった場合に、すべて未送信の扱いに戻す
+  void reset(void);
+
+  // 音色と音量のメッセージについて、このポートへ送信済みの値と同じであれば false を返す
+  // 省略するのは演奏タスクからのメッセージのみとし、外部入力のスルーは常に送信して送信済みの値を無効にする
+  bool update(uint8_t source, uint8_t status, uint8_t data1, uint8_t data2);
+
+private:
+  // 送信済みのチャンネルごとの音色と音量 (0xFF は未送信)
+  uint8_t _sent_program[def::midi::channel_max];
+  uint8_t _sent_volume[def::midi::channel_max];
+};
+
+//-------------------------------------------------------------------------
+class midi_route_mask_t {
+public:
+  midi_route_mask_t(void) { reset(); }
+
+  // すべての送信元から全メッセージを通過させる状態に戻す
+  void reset(void);
+
+  // 経路表から、route_port を送信先とする経路を展開する
+  void assign(const system_registry_t::reg_midi_port_setting_t* setting, uint8_t route_port);
+
+  // 送信元のメッセージをこのポートへ送信するか否か
+  bool isRouted(uint8_t source, uint8_t status) const
+  {
+    if (source >= def::command::max_midi_route_port) { return false; }
+    uint_fast8_t channel = (status < 0xF0) ? (status & 0x0F) : 0;
+    return (_mask[source][(status >> 4) & 7] >> channel) & 1;
+  }
+
+private:
+  // 送信元ごと・メッセージ種別ごとに、このポートへ送信するチャンネルのビットマスク
+  // 種別の添字は ステータスバイトの上位4bit の下位3bit (0x80~0xE0 が 0~6、0xF0 が 7)
+  uint16_t _mask[def::command::max_midi_route_port][8];
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
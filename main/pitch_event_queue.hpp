@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_PITCH_EVENT_QUEUE_HPP
+#define KANPLAY_PITCH_EVENT_QUEUE_HPP
+
+/*
+ - 発音・消音の予定を時刻順に保持するイベントキュー (二分ヒープ)
+   予定の変更時は古いイベントを削除せず新しいイベントを追加し、取り出し時に照合して無効なものを読み捨てる。
+   照合は利用側で行う (イベントが現在も有効か否かを返す関数を push に渡す)。
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+struct pitch_event_t
+{
+  uint32_t usec;
+  uint8_t part;
+  uint8_t pitch;
+  uint8_t serial;
+  uint8_t is_release;
+};
+
+class pitch_event_queue_t {
+public:
+  static constexpr const size_t max_event = 512;
+
+  // イベントキューの並び順 (時刻が早いものを先頭に、同時刻なら消音を発音より先に処理する)
+  // 同じ音を弾き直す場合、前の音の消音時刻は次の音の発音時刻と同じになるため、NoteOff → NoteOn の順に送る
+  static bool later(const pitch_event_t& a, const pitch_event_t& b)
+  {
+    int32_t diff = (int32_t)(a.usec - b.usec);
+    if (diff != 0) { return diff > 0; }
+    return a.is_release < b.is_release;
+  }
+
+  void clear(void) { _count = 0; }
+  bool empty(void) const { return _count == 0; }
+  size_t size(void) const { return _count; }
+  const pitch_event_t& top(void) const { return _event[0]; }
+  void pop(void)
+  {
+    std::pop_heap(&_event[0], &_event[_count], later);
+    --_count;
+  }
+
+  // イベントを追加する。満杯の場合は is_valid が false を返すイベントを取り除いてから追加する
+  // それでも空きが無い場合は false を返す
+  template <typename F>
+  bool push(const pitch_event_t& event, F is_valid)
+  {
+    if (_count >= max_event) {
+      compact(is_valid);
+      if (_count >= max_event) { return false; }
+    }
+    _event[_count++] = event;
+    std::push_heap(&_event[0], &_event[_count], later);
+    return true;
+  }
+
+  // 無効なイベントを取り除く
+  template <typename F>
+  void compact(F is_valid)
+  {
+    size_t count = 0;
+    for (size_t i = 0; i < _count; ++i) {
+      if (is_valid(_event[i])) {
+        _event[count++] = _event[i];
+      }
+    }
+    _count = count;
+    std::make_heap(&_event[0], &_event[_count], later);
+  }
+
+private:
+  pitch_event_t _event[max_event];
+  uint16_t _count = 0;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
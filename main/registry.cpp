@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <new>
 
 #if __has_include(<malloc.h>)
 #include <malloc.h>
@@ -37,9 +38,40 @@ static constexpr const uint32_t crc32_table[] = {
   0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
 };
 
+// slice-by-8 用のテーブル。[0] は crc32_table と同一で、[k] は [k-1] をさらに1バイト進めたもの
+struct crc32_slice_table_t {
+  uint32_t table[8][256];
+  constexpr crc32_slice_table_t(void) : table {} {
+    for (int i = 0; i < 256; ++i) {
+      table[0][i] = crc32_table[i];
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int i = 0; i < 256; ++i) {
+        uint32_t prev = table[k - 1][i];
+        table[k][i] = (prev >> 8) ^ crc32_table[prev & 0xFF];
+      }
+    }
+  }
+};
+static constexpr const crc32_slice_table_t crc32_slice;
+
 uint32_t calc_crc32(const void *data, size_t length, uint32_t crc_init) {
   const uint8_t *bytes = (const uint8_t *)data;
   uint32_t crc = crc_init ^ 0xFFFFFFFFUL; // 初期値
+#if defined (__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  // 8バイトずつまとめて処理する
+  auto t = crc32_slice.table;
+  for (; length >= 8; length -= 8, bytes += 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, bytes, 4);
+    memcpy(&hi, bytes + 4, 4);
+    lo ^= crc;
+    crc = t[7][ lo        & 0xFF] ^ t[6][(lo >>  8) & 0xFF]
+        ^ t[5][(lo >> 16) & 0xFF] ^ t[4][ lo >> 24        ]
+        ^ t[3][ hi        & 0xFF] ^ t[2][(hi >>  8) & 0xFF]
+        ^ t[1][(hi >> 16) & 0xFF] ^ t[0][ hi >> 24        ];
+  }
+#endif
   for (size_t i = 0; i < length; i++) {
     uint8_t index = (uint8_t)(crc ^ bytes[i]);
     crc = (crc >> 8) ^ crc32_table[index];
@@ -47,6 +79,37 @@ uint32_t calc_crc32(const void *data, size_t length, uint32_t crc_init) {
   return crc ^ 0xFFFFFFFFUL; // 最終 XOR
 }
 
+// GF(2) 上で a * b mod P を求める (ビット反転表現)
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b) {
+  uint32_t m = 1UL << 31;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) { break; }
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ 0xEDB88320UL : b >> 1;
+  }
+  return p;
+}
+
+uint32_t calc_crc32_shift(size_t length2) {
+  // x^(8 * length2) mod P を求める
+  uint32_t x2n = 1UL << 30; // x^1
+  for (int i = 0; i < 3; ++i) { x2n = crc32_multmodp(x2n, x2n); } // x^8
+  uint32_t p = 1UL << 31; // x^0
+  for (; length2; length2 >>= 1) {
+    if (length2 & 1) { p = crc32_multmodp(x2n, p); }
+    x2n = crc32_multmodp(x2n, x2n);
+  }
+  return p;
+}
+
+uint32_t calc_crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t shift) {
+  return crc32_multmodp(shift, crc1) ^ crc2;
+}
+
 //-------------------------------------------------------------------------
 
 #if __has_include (<freertos/freertos.h>)
@@ -78,11 +141,37 @@ static void* alloc_sram_anti_fragment(size_t size)
   return result;
 }
 
+void* registry_heap_alloc(size_t size, bool psram)
+{
+  void* result = nullptr;
+  if (psram) {
+    result = m5gfx::heap_alloc_psram(size);
+  }
+  if (result == nullptr) {
+    result = m5gfx::heap_alloc_dma(size);
+    if (result == nullptr) {
+      M5_LOGE("registry_heap_alloc: memory allocation failed. size:%d", (int)size);
+    }
+  }
+  return result;
+}
+
+void registry_heap_free(void* ptr)
+{
+  m5gfx::heap_free(ptr);
+}
+
 registry_base_t::registry_base_t(uint16_t history_count)
 : _history_code { 0 }
 , _history_count(history_count)
 {
   _history = nullptr;
+  // 通し番号からスロット位置をマスクで求めるため、履歴数は2のべき乗に切り上げる
+  if (_history_count & (_history_count - 1)) {
+    uint16_t count = 1;
+    while (count < _history_count) { count <<= 1; }
+    _history_count = count;
+  }
 }
 
 registry_base_t::~registry_base_t(void)
@@ -91,7 +180,7 @@ registry_base_t::~registry_base_t(void)
 void registry_base_t::init(bool psram)
 {
   if (_history_count) {
-    size_t history_size = _history_count * sizeof(history_t);
+    size_t history_size = _history_count * sizeof(history_slot_t);
     void* ptr = nullptr;
     if (psram) {
       ptr = m5gfx::heap_alloc_psram(history_size);
@@ -107,67 +196,94 @@ void registry_base_t::init(bool psram)
         }
       }
     }
-    memset(ptr, 0xFF, history_size);
-    _history = (history_t*)ptr;
+    auto slots = (history_slot_t*)ptr;
+    for (size_t i = 0; i < _history_count; ++i) {
+      // 完了ビットを立てずに初期化し、未書込みのスロットを読まないようにする
+      new (&slots[i]) history_slot_t { { 0 }, history_t() };
+    }
+    _history = slots;
   }
 }
 
 void registry_base_t::_addHistory(uint16_t index, uint32_t value, data_size_t data_size)
 {
-  uint16_t history_index = _history_code & 0xFFFF;
-  uint8_t history_uid = _history_code >> 16;
-  if (_history != nullptr) {
-    _history[history_index].value = value;
-    _history[history_index].index = index;
-    _history[history_index].data_size = data_size;
-    _history[history_index].uid = history_uid;
+  // 書込み位置を確保する。複数タスクから同時に書き込まれても同じスロットを取り合うことはない
+  history_code_t seq = _history_code.fetch_add(1, std::memory_order_acq_rel);
+  _markModified();
+  if (_history == nullptr) {
+    if (!_batch.isActive()) { _publishHistory(); }
+    return;
   }
-  if (++history_index >= _history_count)
-  {
-    history_index = 0;
-    history_uid++;
+  history_t data;
+  data.value = value;
+  data.index = index;
+  data.data_size = data_size;
+  _writeRing(_history, _history_count, seq, data);
+  if (!_batch.isActive()) { _publishHistory(); }
+}
+
+void registry_base_t::_publishHistory(void) const
+{
+  history_code_t head = _history_code.load(std::memory_order_acquire);
+  history_code_t current = _history_publish.load(std::memory_order_relaxed);
+  // 他タスクが先に進めている場合は戻さない
+  while ((int32_t)(head - current) > 0
+      && !_history_publish.compare_exchange_weak(current, head, std::memory_order_acq_rel)) {}
+}
+
+void registry_base_t::endBatch(void)
+{
+  bool notify;
+  if (_batch.end(notify)) {
+    _publishHistory();
+    if (notify) { _sendNotify(); }
   }
-  _history_code = history_index | history_uid << 16;
+}
+
+uint32_t registry_base_t::crc32_cached(uint32_t crc_init) const
+{
+  // 計算前に世代番号を取得しておくことで、計算中に変更された場合も次回に再計算される
+  uint32_t generation = getGeneration();
+  if (_crc_generation != generation) {
+    _crc_value = crc32(0);
+    size_t length = crc32_length();
+    if (_crc_length != length || _crc_shift == 0) {
+      _crc_length = length;
+      _crc_shift = calc_crc32_shift(length);
+    }
+    _crc_generation = generation;
+  }
+  return calc_crc32_combine(crc_init, _crc_value, _crc_shift);
 }
 
 
 // 変更履歴を取得する
-const registry_base_t::history_t* registry_base_t::getHistory(history_code_t &code)
-{
-  if (_history_code == code || _history == nullptr) {
-    return nullptr;
-  }
-  auto index = code & 0xFFFF;
-  if (index >= _history_count) {
-    M5_LOGE("history index out of range : %d", index);
-    return nullptr;
-  }
-  uint8_t uid = code >> 16;
-  auto res = &_history[index];
-  if (uid != res->uid) {
-    M5_LOGW("history uid looping : request:%08x  uid:%d  data uid:%d", code, uid, _history[index].uid);
-    do
-    {
-      if (++index >= _history_count) {
-        index = 0;
-        ++uid;
-      }
-      res = &_history[index];
-    } while (uid != res->uid);
-  }
-  if (++index >= _history_count) {
-    index = 0;
-    ++uid;
+bool registry_base_t::getHistory(history_code_t &code, history_t &result) const
+{
+  return _readRing(_history, _history_count, code, result);
+}
+
+bool registry_base_t::_recoverReadCode(uint32_t ring_count, uint32_t distance, history_code_t head, history_code_t &code) const
+{
+  if ((int32_t)distance < 0) {
+    M5_LOGE("history code out of range : request:%08x  head:%08x", code, head);
+    code = head;
+    return false;
   }
-  code = index | (uid << 16);
-  return res;
+  // 読出しが追いつかず上書きされた分を読み飛ばす
+  uint32_t lost = distance - ring_count;
+  _history_lost.fetch_add(lost, std::memory_order_relaxed);
+  M5_LOGW("history overrun : request:%08x  head:%08x  lost:%d", code, code + distance, lost);
+  code += lost;
+  return true;
 }
 
 
 void registry_t::assign(const registry_t &src) {
   memcpy(_reg_data, src._reg_data, _registry_size);
+  _markModified();
   if (_history_count == 0) {
-    _history_code += 1 << 16;
+    _touchHistoryCode();
   }
   _execNotify();
 }
@@ -206,6 +322,7 @@ void registry_t::init(bool psram)
   }
   if (_reg_data) {
     memset(_reg_data, 0, _registry_size);
+    _markModified();
   }
 }
 
@@ -396,27 +513,34 @@ uint32_t registry_t::crc32(uint32_t crc_init) const
 }
 //-------------------------------------------------------------------------
 
+void registry_map8_t::init(bool psram)
+{
+  registry_base_t::init(psram);
+  _data.setPsram(psram);
+}
+
 bool registry_map8_t::set8(uint16_t index, uint8_t value, bool force_notify)
 {
   bool no_change = false;
   // 既存の値を探す
   auto it = _data.find(index);
-  if (it != _data.end()) {
-    if (it->second == value) {
+  if (it != nullptr) {
+    if (it->value == value) {
       no_change = true;
     } else {
       // 値が異なる場合は更新
       if (value == _default_value) {
         _data.erase(it);
       } else {
-        it->second = value;
+        it->value = value;
       }
     }
   } else {
     if (value == _default_value) {
       no_change = true;
-    } else {
-      _data[index] = value;
+    } else if (!_data.set(index, value)) {
+      M5_LOGE("registry_map8_t::set8: memory allocation failed");
+      return false;
     }
   }
 
@@ -426,58 +550,66 @@ bool registry_map8_t::set8(uint16_t index, uint8_t value, bool force_notify)
   _addHistory(index, value, data_size_t::DATA_SIZE_8);
   _execNotify();
   return true;
-/*
-  if (value == _default_value) {
-    _data.erase(index);
-  } else {
-    _data[index] = value;
-  }
-  _addHistory(index, value, data_size_t::DATA_SIZE_8);
-  _execNotify();
-*/
 }
 
 uint8_t registry_map8_t::get8(uint16_t index) const
 {
   auto it = _data.find(index);
-  if (it == _data.end()) {
+  if (it == nullptr) {
     return _default_value;
   }
-  return it->second;
+  return it->value;
 }
 
-void registry_map8_t::assign(const registry_map8_t &src)
+bool registry_map8_t::assign(const registry_map8_t &src)
 {
-  _data = src._data;
+  if (!_data.assign(src._data)) {
+    M5_LOGE("registry_map8_t::assign: memory allocation failed");
+    return false;
+  }
+  _markModified();
   if (_history_count == 0) {
-    _history_code += 1 << 16;
+    _touchHistoryCode();
   }
   _execNotify();
+  return true;
+}
+
+uint32_t registry_map8_t::crc32(uint32_t crc_init) const
+{
+  return calc_crc32(_data.begin(), crc32_length(), crc_init);
 }
 
 //-------------------------------------------------------------------------
 
+void registry_map32_t::init(bool psram)
+{
+  registry_base_t::init(psram);
+  _data.setPsram(psram);
+}
+
 bool registry_map32_t::set32(uint16_t index, uint32_t value, bool force_notify)
 {
   bool no_change = false;
   // 既存の値を探す
   auto it = _data.find(index);
-  if (it != _data.end()) {
-    if (it->second == value) {
+  if (it != nullptr) {
+    if (it->value == value) {
       no_change = true;
     } else {
       // 値が異なる場合は更新
       if (value == _default_value) {
         _data.erase(it);
       } else {
-        it->second = value;
+        it->value = value;
       }
     }
   } else {
     if (value == _default_value) {
       no_change = true;
-    } else {
-      _data[index] = value;
+    } else if (!_data.set(index, value)) {
+      M5_LOGE("registry_map32_t::set32: memory allocation failed");
+      return false;
     }
   }
 
@@ -487,33 +619,34 @@ bool registry_map32_t::set32(uint16_t index, uint32_t value, bool force_notify)
   _addHistory(index, value, data_size_t::DATA_SIZE_32);
   _execNotify();
   return true;
-/*
-  if (value == _default_value) {
-    _data.erase(index);
-  } else {
-    _data[index] = value;
-  }
-  _addHistory(index, value, data_size_t::DATA_SIZE_32);
-  _execNotify();
-*/
 }
 
 uint32_t registry_map32_t::get32(uint16_t index) const
 {
   auto it = _data.find(index);
-  if (it == _data.end()) {
+  if (it == nullptr) {
     return _default_value;
   }
-  return it->second;
+  return it->value;
 }
 
-void registry_map32_t::assign(const registry_map32_t &src)
+bool registry_map32_t::assign(const registry_map32_t &src)
 {
-  _data = src._data;
+  if (!_data.assign(src._data)) {
+    M5_LOGE("registry_map32_t::assign: memory allocation failed");
+    return false;
+  }
+  _markModified();
   if (_history_count == 0) {
-    _history_code += 1 << 16;
+    _touchHistoryCode();
   }
   _execNotify();
+  return true;
+}
+
+uint32_t registry_map32_t::crc32(uint32_t crc_init) const
+{
+  return calc_crc32(_data.begin(), crc32_length(), crc_init);
 }
 
 //-------------------------------------------------------------------------
@@ -6,7 +6,10 @@
 
 #include <stdint.h>
 #include <stddef.h>
-#include <map>
+#include <string.h>
+#include <utility>
+#include <type_traits>
+#include <atomic>
 
 #if __has_include (<freertos/freertos.h>)
  #include <freertos/FreeRTOS.h>
@@ -16,6 +19,60 @@
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 uint32_t calc_crc32(const void *data, size_t length, uint32_t crc_init);
+// CRC32(A) と CRC32(B) から CRC32(A+B) を求める際の、B の長さに対応する乗数を求める
+uint32_t calc_crc32_shift(size_t length2);
+// CRC32(A) と CRC32(B) から CRC32(A+B) を求める。shift は calc_crc32_shift(Bの長さ) の値
+uint32_t calc_crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t shift);
+// レジストリのデータ領域を確保・解放する (psram指定時はPSRAMを優先して使用する)
+void* registry_heap_alloc(size_t size, bool psram);
+void registry_heap_free(void* ptr);
+//-------------------------------------------------------------------------
+// 変更通知をまとめるための状態。begin から end までの間の通知要求を end の時点で1回にまとめる
+class notify_batch_t {
+public:
+  void begin(void) { _depth.fetch_add(1, std::memory_order_acq_rel); }
+
+  // バッチを終了する。最も外側のバッチが終了した場合は true を返し、notify にまとめた通知の有無を返す
+  bool end(bool &notify) {
+    notify = false;
+    if (_depth.fetch_sub(1, std::memory_order_acq_rel) != 1) { return false; }
+    notify = _pending.exchange(false, std::memory_order_acq_rel);
+    return true;
+  }
+
+  // 通知要求。すぐに通知すべき場合は true を返す
+  bool request(void) {
+    _request_count.fetch_add(1, std::memory_order_relaxed);
+    if (_depth.load(std::memory_order_acquire) == 0) { return true; }
+    _pending.store(true, std::memory_order_release);
+    // 他タスクの end と競合した場合に通知を取りこぼさないよう再確認する
+    return _depth.load(std::memory_order_acquire) == 0
+        && _pending.exchange(false, std::memory_order_acq_rel);
+  }
+
+  bool isActive(void) const { return _depth.load(std::memory_order_acquire) != 0; }
+  // まとめられたものを含む通知要求の累計数
+  uint32_t getRequestCount(void) const { return _request_count.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint32_t> _request_count { 0 };
+  std::atomic<uint16_t> _depth { 0 };
+  std::atomic<bool> _pending { false };
+};
+
+// スコープ内の書込みをまとめ、スコープを抜ける時に通知を1回だけ行う
+// beginBatch / endBatch を持つ型に対して使用する
+template <typename T>
+class registry_batch_t {
+public:
+  explicit registry_batch_t(T &target) : _target { target } { _target.beginBatch(); }
+  ~registry_batch_t(void) { _target.endBatch(); }
+  registry_batch_t(const registry_batch_t&) = delete;
+  registry_batch_t& operator=(const registry_batch_t&) = delete;
+private:
+  T &_target;
+};
+
 //-------------------------------------------------------------------------
 class registry_base_t {
 public:
@@ -29,9 +86,10 @@ public:
     uint32_t value = 0;
     uint16_t index = 0;
     data_size_t data_size = DATA_NONE;
-    uint8_t uid = 0;
+    uint8_t reserved = 0;
   };
 
+  // 履歴コードは書込み通し番号。読出し側はそれぞれ自分のカーソルとして保持する
   typedef uint32_t history_code_t;
   registry_base_t(uint16_t history_count);
   virtual ~registry_base_t(void);
@@ -42,9 +100,26 @@ public:
   virtual bool set16(uint16_t index, uint16_t value, bool force_notify = false);
   virtual bool set32(uint16_t index, uint32_t value, bool force_notify = false);
   virtual uint32_t crc32(uint32_t crc_init = 0) const { return crc_init; }
-
-  const history_t* getHistory(history_code_t &code);
-  history_code_t getHistoryCode(void) const { return _history_code; }
+  // crc32 の計算対象となるバイト数
+  virtual size_t crc32_length(void) const { return 0; }
+  // crc32(crc_init) と同じ結果を返す。内容のCRCは変更があるまでキャッシュするため、未変更なら再計算しない
+  uint32_t crc32_cached(uint32_t crc_init = 0) const;
+  // 内容が変更されるたびに進む世代番号
+  uint32_t getGeneration(void) const { return _generation.load(std::memory_order_acquire); }
+
+  // 変更履歴を取得する。取得できた場合は result に値をコピーして code を進める
+  bool getHistory(history_code_t &code, history_t &result) const;
+  history_code_t getHistoryCode(void) const { return _history_publish.load(std::memory_order_acquire); }
+  // 読出しが追いつかず上書きされた履歴の累計数
+  uint32_t getHistoryLostCount(void) const { return _history_lost.load(std::memory_order_relaxed); }
+
+  // 書込みをまとめる。endBatch までに追加された履歴は endBatch の時点でまとめて読出し側に公開され、通知も1回になる
+  // 入れ子にできる。通常は registry_batch_t を使用する
+  void beginBatch(void) { _batch.begin(); }
+  void endBatch(void);
+  // 実際に購読タスクへ通知した回数と、まとめられたものを含む通知要求の回数
+  uint32_t getNotifyCount(void) const { return _notify_count.load(std::memory_order_relaxed); }
+  uint32_t getNotifyRequestCount(void) const { return _batch.getRequestCount(); }
 
 #if __has_include (<freertos/freertos.h>)
   void setNotifyTaskHandle(TaskHandle_t handle);
@@ -54,12 +129,96 @@ protected:
   void _addHistory(uint16_t index, uint32_t value, data_size_t data_size);
 #if __has_include (<freertos/freertos.h>)
   TaskHandle_t _task_handle = nullptr;
-  void _execNotify(void) const { if (_task_handle != nullptr) { xTaskNotify(_task_handle, (uint32_t)this, eNotifyAction::eSetValueWithOverwrite); } }
+  void _sendNotify(void) const {
+    _notify_count.fetch_add(1, std::memory_order_relaxed);
+    if (_task_handle != nullptr) { xTaskNotify(_task_handle, (uint32_t)this, eNotifyAction::eSetValueWithOverwrite); }
+  }
 #else
-  void _execNotify(void) const {}
+  void _sendNotify(void) const { _notify_count.fetch_add(1, std::memory_order_relaxed); }
 #endif
-  history_t* _history = nullptr;
-  history_code_t _history_code = 0;
+  void _execNotify(void) const { if (_batch.request()) { _publishHistory(); _sendNotify(); } }
+  // 書込み済みの履歴を読出し側に公開する
+  void _publishHistory(void) const;
+  // 履歴を持たないレジストリで変更を通知するために履歴コードのみを進める
+  void _touchHistoryCode(void) {
+    _history_code.fetch_add(1, std::memory_order_acq_rel);
+    if (!_batch.isActive()) { _publishHistory(); }
+  }
+  // 内容の変更を記録する (CRCキャッシュを無効化する)
+  void _markModified(void) { _generation.fetch_add(1, std::memory_order_release); }
+
+  // 履歴リングのスロット。stamp は (通し番号 << 1) | 完了ビット。書込み中は完了ビットが0になる
+  // 書込み通し番号は _history_code を共用し、格納する型だけが異なるリング (reg_midi_out_control_t など) でも使用する
+  template <typename T>
+  struct ring_slot_t {
+    std::atomic<uint32_t> stamp;
+    T data;
+  };
+  typedef ring_slot_t<history_t> history_slot_t;
+
+  // 確保済みの通し番号 seq のスロットに書き込む。ring_count は2の累乗であること
+  template <typename T>
+  static void _writeRing(ring_slot_t<T>* ring, uint32_t ring_count, history_code_t seq, const T& data) {
+    auto slot = &ring[seq & (ring_count - 1)];
+    slot->stamp.store(seq << 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->data = data;
+    slot->stamp.store((seq << 1) | 1, std::memory_order_release);
+  }
+
+  // 公開済みの範囲から code の位置のスロットを読み出す。取得できた場合は result にコピーして code を進める
+  // 読出し中に書き込まれた場合は読み直すため、書込み側を待たせることはない
+  template <typename T>
+  bool _readRing(const ring_slot_t<T>* ring, uint32_t ring_count, history_code_t &code, T &result) const {
+    if (ring == nullptr) {
+      return false;
+    }
+    for (;;) {
+      history_code_t head = _history_publish.load(std::memory_order_acquire);
+      // 上書きの判定は、バッチ中で未公開のものを含む書込み位置を基準に行う
+      uint32_t distance = _history_code.load(std::memory_order_acquire) - code;
+      if (distance > ring_count && !_recoverReadCode(ring_count, distance, head, code)) {
+        return false;
+      }
+      if ((int32_t)(head - code) <= 0) {
+        // 未公開の履歴は読まない
+        return false;
+      }
+      auto slot = &ring[code & (ring_count - 1)];
+      uint32_t expect = (code << 1) | 1;
+      uint32_t stamp = slot->stamp.load(std::memory_order_acquire);
+      if (stamp != expect) {
+        // 通し番号の差(31bit)の符号で、後続の書込みに上書きされたか、書込み完了前かを判定する
+        int32_t diff = (int32_t)(((stamp >> 1) - (expect >> 1)) << 1);
+        if (diff > 0) { continue; }
+        return false;
+      }
+      result = slot->data;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->stamp.load(std::memory_order_relaxed) != expect) {
+        // コピー中に上書きされたので読み直す
+        continue;
+      }
+      ++code;
+      return true;
+    }
+  }
+  // 読出し位置がリングの範囲外の場合の補正。上書きされた分を読み飛ばした場合は true、書込み位置より先の場合は false
+  bool _recoverReadCode(uint32_t ring_count, uint32_t distance, history_code_t head, history_code_t &code) const;
+
+  history_slot_t* _history = nullptr;
+  std::atomic<history_code_t> _history_code { 0 };
+  // 読出し側に公開済みの履歴コード。バッチ中は進めない
+  mutable std::atomic<history_code_t> _history_publish { 0 };
+  mutable notify_batch_t _batch;
+  mutable std::atomic<uint32_t> _notify_count { 0 };
+  mutable std::atomic<uint32_t> _history_lost { 0 };
+  std::atomic<uint32_t> _generation { 1 };
+  // CRCキャッシュ。_crc_generation が _generation と一致する場合に有効
+  mutable uint32_t _crc_generation = 0;
+  mutable uint32_t _crc_value = 0;
+  mutable uint32_t _crc_shift = 0;
+  mutable size_t _crc_length = 0;
   uint16_t _history_count;
 };
 
@@ -80,6 +239,7 @@ public:
   void assign(const registry_t &src);
   size_t size(void) const { return _registry_size; }
   uint32_t crc32(uint32_t crc_init = 0) const override;
+  size_t crc32_length(void) const override { return _registry_size; }
 
   // 比較オペレータ
   bool operator==(const registry_t &rhs) const;
@@ -97,25 +257,139 @@ protected:
 };
 
 
+// キーの昇順に整列した連続領域にキーと値の組を保持する疎なマップ
+// 要素はノード単位で確保せず、領域全体を memcpy でコピーできる
+template <typename T>
+class flat_map_t {
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+public:
+  // memcpy で扱うため、std::pair ではなく trivially copyable な構造体で保持する
+  struct value_type {
+    uint16_t key;
+    T value;
+  };
+
+  flat_map_t(void) = default;
+  flat_map_t(const flat_map_t&) = delete;
+  // 確保に失敗した場合に検出できるよう、代入ではなく assign を使用する
+  flat_map_t& operator=(const flat_map_t&) = delete;
+  ~flat_map_t(void) { if (_data != nullptr) { registry_heap_free(_data); } }
+
+  void setPsram(bool psram) { _psram = psram; }
+
+  value_type* begin(void) const { return _data; }
+  value_type* end(void) const { return _data + _size; }
+  size_t size(void) const { return _size; }
+  bool empty(void) const { return _size == 0; }
+
+  // 指定したキーの要素を返す。存在しない場合は nullptr
+  value_type* find(uint16_t key) const {
+    auto it = lower_bound(key);
+    return (it != end() && it->key == key) ? it : nullptr;
+  }
+
+  void erase(value_type* it) {
+    auto e = end();
+    memmove(it, it + 1, (e - (it + 1)) * sizeof(value_type));
+    --_size;
+    memset(end(), 0, sizeof(value_type));
+  }
+
+  // キーの位置に要素を挿入または上書きする。領域の確保に失敗した場合は変更せずに false を返す
+  bool set(uint16_t key, const T& value) {
+    auto it = lower_bound(key);
+    if (it == end() || it->key != key) {
+      size_t index = it - begin();
+      if (!reserve(_size + 1)) { return false; }
+      it = begin() + index;
+      memmove(it + 1, it, (_size - index) * sizeof(value_type));
+      memset(it, 0, sizeof(value_type));
+      it->key = key;
+      ++_size;
+    }
+    it->value = value;
+    return true;
+  }
+
+  bool reserve(size_t count) {
+    if (count <= _capacity) { return true; }
+    size_t capacity = _capacity ? _capacity : 8;
+    while (capacity < count) { capacity <<= 1; }
+    auto data = (value_type*)registry_heap_alloc(capacity * sizeof(value_type), _psram);
+    if (data == nullptr) { return false; }
+    // パディングを含めてCRCの計算結果を一定にするため、未使用領域はゼロで埋めておく
+    memset(data, 0, capacity * sizeof(value_type));
+    if (_data != nullptr) {
+      memcpy(data, _data, _size * sizeof(value_type));
+      registry_heap_free(_data);
+    }
+    _data = data;
+    _capacity = capacity;
+    return true;
+  }
+
+  // src の内容をコピーする。領域の確保に失敗した場合は変更せずに false を返す
+  bool assign(const flat_map_t& src) {
+    if (this == &src) { return true; }
+    if (!reserve(src._size)) { return false; }
+    memcpy(_data, src._data, src._size * sizeof(value_type));
+    if (_size > src._size) {
+      memset(_data + src._size, 0, (_size - src._size) * sizeof(value_type));
+    }
+    _size = src._size;
+    return true;
+  }
+
+  bool operator==(const flat_map_t& rhs) const {
+    if (_size != rhs._size) { return false; }
+    for (size_t i = 0; i < _size; ++i) {
+      if (_data[i].key != rhs._data[i].key || !(_data[i].value == rhs._data[i].value)) { return false; }
+    }
+    return true;
+  }
+
+private:
+  value_type* lower_bound(uint16_t key) const {
+    size_t lo = 0;
+    size_t hi = _size;
+    while (lo < hi) {
+      size_t mid = (lo + hi) >> 1;
+      if (_data[mid].key < key) { lo = mid + 1; } else { hi = mid; }
+    }
+    return _data + lo;
+  }
+
+  value_type* _data = nullptr;
+  size_t _size = 0;
+  size_t _capacity = 0;
+  bool _psram = false;
+};
+
 template <typename T>
 class registry_map_t : public registry_base_t {
 public:
-  constexpr registry_map_t(T default_value)
+  registry_map_t(T default_value)
   : registry_base_t { 0 }
   , _default_value { default_value } {};
 
-  // constexpr registry_map_t<T>(void)
-  // : registry_base_t { 0 } {};
+  void init(bool psram = false) override
+  {
+    registry_base_t::init(psram);
+    _data.setPsram(psram);
+  }
 
+  // 変更を通知した場合は true を返す。領域の確保に失敗した場合は書込みを行わず false を返す
   bool set(uint16_t index, T value, bool notify = false)
   {
     auto current = get(index);
     if (current != value) {
       notify = true;
       if (value == _default_value) {
-        _data.erase(index);
-      } else {
-        _data[index] = value;
+        auto it = _data.find(index);
+        if (it != nullptr) { _data.erase(it); }
+      } else if (!_data.set(index, value)) {
+        // 失敗の詳細は registry_heap_alloc がログに出力している
+        return false;
       }
     }
     if (notify) {
@@ -127,33 +401,35 @@ public:
   const T& get(uint16_t index) const
   {
     auto it = _data.find(index);
-    if (it == _data.end()) {
+    if (it == nullptr) {
       return _default_value;
     }
-    return it->second;
+    return it->value;
   }
-  void assign(const registry_map_t<T> &src)
+  // 領域の確保に失敗した場合は変更せずに false を返す
+  bool assign(const registry_map_t<T> &src)
   {
-    _data = src._data;
+    if (!_data.assign(src._data)) { return false; }
+    _markModified();
     if (_history_count == 0) {
-      _history_code += 1 << 16;
+      _touchHistoryCode();
     }
     _execNotify();
+    return true;
   }
   uint32_t crc32(uint32_t crc) const override {
-    for (const auto& pair : _data) {
-      crc = calc_crc32( reinterpret_cast<const uint8_t*>(&pair), sizeof(pair), crc);
-    }
-    return crc;
+    return calc_crc32(_data.begin(), crc32_length(), crc);
+  }
+  size_t crc32_length(void) const override {
+    return _data.size() * sizeof(typename flat_map_t<T>::value_type);
   }
-
 
   // 比較オペレータ
   bool operator==(const registry_map_t<T> &rhs) const { return _data == rhs._data; }
   bool operator!=(const registry_map_t<T> &rhs) const { return !operator==(rhs); }
 
 protected:
-  std::map<uint16_t, T> _data;
+  flat_map_t<T> _data;
   T _default_value;
 };
 
@@ -164,16 +440,19 @@ public:
   : registry_base_t { history_count }
   , _default_value { default_value } {};
 
-  bool set8(uint16_t index, uint8_t value, bool force_notify = false);
+  void init(bool psram = false) override;
+  bool set8(uint16_t index, uint8_t value, bool force_notify = false) override;
   uint8_t get8(uint16_t index) const;
-  void assign(const registry_map8_t &src);
+  bool assign(const registry_map8_t &src);
+  uint32_t crc32(uint32_t crc_init = 0) const override;
+  size_t crc32_length(void) const override { return _data.size() * sizeof(flat_map_t<uint8_t>::value_type); }
 
   // 比較オペレータ
   bool operator==(const registry_map8_t &rhs) const { return _data == rhs._data; }
   bool operator!=(const registry_map8_t &rhs) const { return !operator==(rhs); }
 
 protected:
-  std::map<uint16_t, uint8_t> _data;
+  flat_map_t<uint8_t> _data;
   uint8_t _default_value = 0;
 };
 
@@ -183,16 +462,19 @@ public:
   : registry_base_t { history_count }
   , _default_value { default_value } {};
 
-  bool set32(uint16_t index, uint32_t value, bool notify = false);
+  void init(bool psram = false) override;
+  bool set32(uint16_t index, uint32_t value, bool notify = false) override;
   uint32_t get32(uint16_t index) const;
-  void assign(const registry_map32_t &src);
+  bool assign(const registry_map32_t &src);
+  uint32_t crc32(uint32_t crc_init = 0) const override;
+  size_t crc32_length(void) const override { return _data.size() * sizeof(flat_map_t<uint32_t>::value_type); }
 
   // 比較オペレータ
   bool operator==(const registry_map32_t &rhs) const { return _data == rhs._data; }
   bool operator!=(const registry_map32_t &rhs) const { return !operator==(rhs); }
 
 protected:
-  std::map<uint16_t, uint32_t> _data;
+  flat_map_t<uint32_t> _data;
   uint8_t _default_value = 0;
 };
 
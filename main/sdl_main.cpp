@@ -2,7 +2,8 @@
 // Copyright (c) 2025 InstaChord Corp.
 
 #include <M5GFX.h>
-#if defined ( SDL_h_ )
+// オフライン演奏ツールのビルド時は song_renderer.cpp 側の main を使用する
+#if defined ( SDL_h_ ) && !defined ( KANPLAY_SONG_RENDERER )
 
 void setup(void);
 void loop(void);
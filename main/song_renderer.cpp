@@ -0,0 +1,337 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "song_renderer.hpp"
+
+#if defined (KANPLAY_SONG_RENDERER)
+
+#include <M5Unified.h>
+
+#include "common_define.hpp"
+#include "system_registry.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+
+bool song_renderer_t::loadSong(uint8_t* data, size_t length)
+{
+  // task_operator の読込処理と同様に、一旦バックアップ側に読み込んでから反映する
+  bool result = system_registry->backup_song_data.loadSongJSON(data, length);
+  if (!result) {
+    result = system_registry->backup_song_data.loadText(data, length);
+  }
+  if (!result) {
+    M5_LOGE("song_renderer: song load failed");
+    system_registry->backup_song_data.reset();
+    return false;
+  }
+  system_registry->song_data.assign(system_registry->backup_song_data);
+  system_registry->backup_song_data.reset();
+  system_registry->runtime_info.setPlaySlot(0);
+  system_registry->runtime_info.setSequenceStepIndex(0);
+  return true;
+}
+
+void song_renderer_t::collectEvents(uint32_t usec)
+{
+  midi_event_t midi_event;
+  while (system_registry->midi_out_control.getEvent(_history_code, midi_event)) {
+    event_t event;
+    event.usec = usec;
+    event.status = midi_event.getStatus();
+    event.data1 = midi_event.getData1();
+    event.data2 = midi_event.getData2();
+    _events.push_back(event);
+  }
+}
+
+bool song_renderer_t::render(const option_t& option)
+{
+  _events.clear();
+  _step_count = 0;
+  _rendered_usec = 0;
+  _ppq = option.ppq ? option.ppq : 480;
+  _tempo_bpm = system_registry->song_data.song_info.getTempo();
+  if (_tempo_bpm == 0) { _tempo_bpm = 120; }
+
+  const auto lost_count = system_registry->midi_out_control.getHistoryLostCount();
+  _history_code = system_registry->midi_out_control.getHistoryCode();
+
+  // 仮想時刻は 0 から開始する
+  uint32_t usec = 0;
+  _player.init(usec);
+
+  // シーケンスがあればオートソング、無ければビート演奏として自動演奏を開始する
+  const bool has_sequence = system_registry->song_data.sequence.info.getLength() > 0;
+  system_registry->runtime_info.setSequenceMode(has_sequence ? def::seqmode::seq_auto_song : def::seqmode::seq_beat_play);
+  system_registry->player_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_start } );
+
+  uint32_t end_usec = option.max_usec;
+  if (!has_sequence && end_usec > option.free_play_usec) {
+    end_usec = option.free_play_usec;
+  }
+  uint32_t stop_usec = 0;
+  bool started = false;
+  bool stopping = false;
+
+  for (;;) {
+    uint32_t next_usec = _player.procStep(usec);
+    ++_step_count;
+    collectEvents(usec);
+
+    if (!stopping) {
+      const bool running = system_registry->runtime_info.getAutoplayState() == def::play::auto_play_state_t::auto_play_running;
+      if (running) { started = true; }
+      // シーケンスの終端に達して待機状態に戻ったか、演奏時間の上限に達したら停止する
+      if ((started && !running) || usec >= end_usec) {
+        stopping = true;
+        stop_usec = usec;
+        system_registry->player_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_stop } );
+        continue;
+      }
+      if (next_usec > end_usec - usec) { next_usec = end_usec - usec; }
+    } else {
+      const uint32_t elapsed = usec - stop_usec;
+      if (elapsed >= option.tail_usec) { break; }
+      if (next_usec > option.tail_usec - elapsed) { next_usec = option.tail_usec - elapsed; }
+    }
+    // 予定時刻ちょうどで処理が残った場合も時刻を進めて無限ループを避ける
+    usec += next_usec ? next_usec : 1;
+  }
+
+  // 鳴り残りの音をすべて止める
+  system_registry->player_command.addQueueW( { def::command::play_control, def::command::play_control_t::pc_panic_stop } );
+  _player.procStep(usec);
+  ++_step_count;
+  collectEvents(usec);
+
+  _rendered_usec = usec;
+  _lost_count = system_registry->midi_out_control.getHistoryLostCount() - lost_count;
+  if (_lost_count) {
+    M5_LOGW("song_renderer: %u midi messages lost", (unsigned)_lost_count);
+  }
+  if (!started) {
+    M5_LOGE("song_renderer: autoplay did not start");
+    return false;
+  }
+  return true;
+}
+
+//-------------------------------------------------------------------------
+
+static void smf_put32(std::vector<uint8_t>& output, uint32_t value)
+{
+  output.push_back(value >> 24);
+  output.push_back(value >> 16);
+  output.push_back(value >> 8);
+  output.push_back(value);
+}
+
+static void smf_put16(std::vector<uint8_t>& output, uint16_t value)
+{
+  output.push_back(value >> 8);
+  output.push_back(value);
+}
+
+// 可変長数値 (7bitずつ上位から、最終バイト以外はbit7を立てる)
+static void smf_putVarLen(std::vector<uint8_t>& output, uint32_t value)
+{
+  uint8_t buf[5];
+  int len = 0;
+  do {
+    buf[len++] = value & 0x7F;
+    value >>= 7;
+  } while (value);
+  while (--len > 0) {
+    output.push_back(buf[len] | 0x80);
+  }
+  output.push_back(buf[0]);
+}
+
+// トラックチャンクのヘッダを追加し、長さを後から書き込むための位置を返す
+static size_t smf_beginTrack(std::vector<uint8_t>& output)
+{
+  output.insert(output.end(), { 'M', 'T', 'r', 'k' });
+  size_t pos = output.size();
+  smf_put32(output, 0);
+  return pos;
+}
+
+static void smf_endTrack(std::vector<uint8_t>& output, size_t pos)
+{
+  // End of Track
+  output.insert(output.end(), { 0x00, 0xFF, 0x2F, 0x00 });
+  uint32_t length = output.size() - pos - 4;
+  output[pos    ] = length >> 24;
+  output[pos + 1] = length >> 16;
+  output[pos + 2] = length >> 8;
+  output[pos + 3] = length;
+}
+
+void song_renderer_t::buildSMF(std::vector<uint8_t>& output) const
+{
+  // 使用されているMIDIチャンネルごとに1トラックとする
+  uint16_t channel_mask = 0;
+  for (auto& event : _events) {
+    if (event.status >= 0x80 && event.status < 0xF0) {
+      channel_mask |= 1 << (event.status & 0x0F);
+    }
+  }
+  uint16_t track_count = 1;
+  for (int ch = 0; ch < 16; ++ch) {
+    if (channel_mask & (1 << ch)) { ++track_count; }
+  }
+
+  output.clear();
+  output.insert(output.end(), { 'M', 'T', 'h', 'd' });
+  smf_put32(output, 6);
+  smf_put16(output, 1);  // format 1
+  smf_put16(output, track_count);
+  smf_put16(output, _ppq);
+
+  { // コンダクタートラック (テンポ)
+    size_t pos = smf_beginTrack(output);
+    uint32_t tempo = 60000000u / _tempo_bpm;
+    output.insert(output.end(), { 0x00, 0xFF, 0x51, 0x03 });
+    output.push_back(tempo >> 16);
+    output.push_back(tempo >> 8);
+    output.push_back(tempo);
+    smf_endTrack(output, pos);
+  }
+
+  // 時刻(usec)をティックに変換する係数。ticks = usec * ppq * bpm / 60000000
+  const uint64_t tick_mul = (uint64_t)_ppq * _tempo_bpm;
+  for (int ch = 0; ch < 16; ++ch) {
+    if (!(channel_mask & (1 << ch))) { continue; }
+    size_t pos = smf_beginTrack(output);
+    uint32_t prev_tick = 0;
+    for (auto& event : _events) {
+      if (event.status < 0x80 || event.status >= 0xF0 || (event.status & 0x0F) != ch) { continue; }
+      uint32_t tick = (uint32_t)(((uint64_t)event.usec * tick_mul + 30000000u) / 60000000u);
+      smf_putVarLen(output, tick - prev_tick);
+      prev_tick = tick;
+      output.push_back(event.status);
+      output.push_back(event.data1 & 0x7F);
+      // プログラムチェンジとチャンネルプレッシャーはデータ1バイト
+      uint8_t type = event.status & 0xF0;
+      if (type != 0xC0 && type != 0xD0) {
+        output.push_back(event.data2 & 0x7F);
+      }
+    }
+    smf_endTrack(output, pos);
+  }
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+// オフライン演奏用のコマンドラインツールのエントリポイント
+// usage: kanplay_render [-o 出力ディレクトリ] [-s 秒数] [-p 分解能] song.json ...
+// 出力ファイル名は入力ファイルの拡張子を .mid に置き換えたもの。
+// 出力したSMFのCRC32と演奏処理の速度(steps/sec)を表示するので、回帰確認やベンチマークに使用できる
+int main(int argc, char** argv)
+{
+  using namespace kanplay_ns;
+
+  song_renderer_t::option_t option;
+  std::string output_dir;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-' && i + 1 < argc) {
+      switch (argv[i][1]) {
+      case 'o': output_dir = argv[++i]; continue;
+      case 's': option.free_play_usec = atoi(argv[++i]) * 1000000u; continue;
+      case 'p': option.ppq = atoi(argv[++i]); continue;
+      default: break;
+      }
+    }
+    files.push_back(argv[i]);
+  }
+  if (files.empty()) {
+    printf("usage: %s [-o output_dir] [-s free_play_seconds] [-p ppq] song.json ...\n", argv[0]);
+    return 1;
+  }
+
+  system_registry = new system_registry_t();
+  system_registry->init();
+
+  int error_count = 0;
+  uint64_t total_steps = 0;
+  double total_sec = 0;
+  for (auto path : files) {
+    std::vector<uint8_t> data;
+    {
+      auto fp = fopen(path, "rb");
+      if (fp == nullptr) {
+        printf("%s: can not open\n", path);
+        ++error_count;
+        continue;
+      }
+      uint8_t buf[4096];
+      size_t len;
+      while (0 < (len = fread(buf, 1, sizeof(buf), fp))) {
+        data.insert(data.end(), buf, buf + len);
+      }
+      fclose(fp);
+    }
+
+    // ファイル間で設定や演奏状態が影響しないよう、毎回初期状態に戻してから演奏する
+    system_registry->reset();
+    auto renderer = new song_renderer_t();
+    bool result = renderer->loadSong(data.data(), data.size());
+    auto start = std::chrono::steady_clock::now();
+    if (result) {
+      result = renderer->render(option);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (result) {
+      std::string out_path = path;
+      if (!output_dir.empty()) {
+        auto pos = out_path.find_last_of("/\\");
+        if (pos != std::string::npos) { out_path = out_path.substr(pos + 1); }
+        out_path = output_dir + "/" + out_path;
+      }
+      auto dot = out_path.find_last_of('.');
+      auto slash = out_path.find_last_of("/\\");
+      if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        out_path.resize(dot);
+      }
+      out_path += ".mid";
+
+      std::vector<uint8_t> smf;
+      renderer->buildSMF(smf);
+      auto fp = fopen(out_path.c_str(), "wb");
+      result = (fp != nullptr) && (fwrite(smf.data(), 1, smf.size(), fp) == smf.size());
+      if (fp != nullptr) { fclose(fp); }
+
+      uint32_t steps = renderer->getStepCount();
+      printf("%s: %s  events:%u  length:%.1fsec  steps:%u  %.0f steps/sec  crc:%08x%s\n"
+            , path, out_path.c_str()
+            , (unsigned)renderer->getEvents().size()
+            , renderer->getRenderedUsec() / 1000000.0
+            , (unsigned)steps
+            , sec > 0 ? steps / sec : 0.0
+            , (unsigned)calc_crc32(smf.data(), smf.size(), 0)
+            , result ? "" : "  (write failed)");
+      total_steps += steps;
+      total_sec += sec;
+    } else {
+      printf("%s: render failed\n", path);
+    }
+    if (!result) { ++error_count; }
+    delete renderer;
+  }
+  printf("total: %u files  %llu steps  %.3fsec  %.0f steps/sec  errors:%d\n"
+        , (unsigned)files.size(), (unsigned long long)total_steps, total_sec
+        , total_sec > 0 ? total_steps / total_sec : 0.0, error_count);
+  return error_count ? 1 : 0;
+}
+
+#endif
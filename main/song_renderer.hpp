@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_SONG_RENDERER_HPP
+#define KANPLAY_SONG_RENDERER_HPP
+
+#if defined (KANPLAY_SONG_RENDERER)
+
+#include "task_kantanplay.hpp"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+// ソングデータを実時間を使わずに演奏し、出力されたMIDIメッセージをSMF(Standard MIDI File)に書き出す
+// 演奏処理は task_kantanplay_t をそのまま使用し、仮想時刻で可能な限り高速に駆動する
+class song_renderer_t {
+public:
+  struct option_t {
+    // 演奏時間の上限 (usec)
+    uint32_t max_usec = 30 * 60 * 1000000u;
+    // シーケンスの無いソングを演奏する時間 (usec)
+    uint32_t free_play_usec = 30 * 1000000u;
+    // 演奏終了後に残響や消音を待つ時間 (usec)
+    uint32_t tail_usec = 2 * 1000000u;
+    // SMFの四分音符あたりの分解能
+    uint16_t ppq = 480;
+  };
+
+  struct event_t {
+    uint32_t usec;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+  };
+
+  // ソングデータを読み込む。JSON形式で読めない場合は旧形式のテキストとして読み込む
+  bool loadSong(uint8_t* data, size_t length);
+
+  // 読み込んだソングを最後まで演奏し、出力されたMIDIメッセージを記録する
+  bool render(const option_t& option);
+
+  // 記録したMIDIメッセージを Type-1 SMF として生成する
+  void buildSMF(std::vector<uint8_t>& output) const;
+
+  const std::vector<event_t>& getEvents(void) const { return _events; }
+  // 演奏処理の呼出し回数
+  uint32_t getStepCount(void) const { return _step_count; }
+  // 演奏した時間 (仮想時刻, usec)
+  uint32_t getRenderedUsec(void) const { return _rendered_usec; }
+  // 読出しが追いつかず失われたMIDIメッセージの数
+  uint32_t getLostCount(void) const { return _lost_count; }
+
+private:
+  void collectEvents(uint32_t usec);
+
+  task_kantanplay_t _player;
+  std::vector<event_t> _events;
+  registry_t::history_code_t _history_code = 0;
+  uint32_t _step_count = 0;
+  uint32_t _rendered_usec = 0;
+  uint32_t _lost_count = 0;
+  uint16_t _tempo_bpm = 120;
+  uint16_t _ppq = 480;
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
+
+#endif
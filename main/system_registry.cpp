@@ -7,6 +7,7 @@
 
 #include <M5Unified.hpp>
 #include <set>
+#include <new>
 #include <mutex>
 
 #if !defined (M5UNIFIED_PC_BUILD)
@@ -291,6 +292,9 @@ void system_registry_t::reset(void)
   // USBホスト時パワーサプライ
   midi_port_setting.setUSBPowerEnabled(true);
 
+  // MIDIの経路表
+  midi_port_setting.resetRoute();
+
   // マスターボリューム設定
   user_setting.setMasterVolume(75);
 
@@ -598,6 +602,35 @@ M5_LOGV("checkSongModified: song_crc32=0x%08X (unchanged=0x%08X) kmap_crc32=0x%0
 
 //-------------------------------------------------------------------------
 
+void system_registry_t::sendCommand(const def::command::command_param_t& command_param, bool is_pressed, uint8_t input_source, uint8_t trace_id)
+{
+  if (reg_player_direct_command_t::isTarget(command_param)) {
+    auto operator_code = operator_command.getHistoryCode();
+    if (player_direct_command.addQueue(command_param, is_pressed, trace_id, input_source, operator_code)) {
+      operator_command.addForwarded(command_param, is_pressed);
+      return;
+    }
+    // キューが満杯の場合は通常の経路で送信する
+  }
+  operator_command.addQueue(command_param, is_pressed, trace_id, input_source);
+}
+
+bool system_registry_t::getPlayerCommand(registry_t::history_code_t* code, def::command::command_param_t* command_param, bool* is_pressed, uint8_t* trace_id, uint8_t* input_source)
+{
+  // 直接送信のコマンドは、先行するオペレータ経由のコマンドを処理し終えてから取り出す
+  // (オペレータの処理済み位置を player_command の確認より先に取得しておく必要がある)
+  const bool direct_ready = player_direct_command.isReady();
+  bool forwarded;
+  while (player_command.getQueue(code, command_param, is_pressed, trace_id, &forwarded, input_source)) {
+    if (!forwarded) { return true; }
+    // 直接送信のコマンドの位置を示す通知。まだ取り出していなければ、後続のコマンドより先にここで取り出す
+    if (player_direct_command.getQueueAtMarker(command_param, is_pressed, trace_id, input_source)) { return true; }
+  }
+  return direct_ready && player_direct_command.getQueue(command_param, is_pressed, trace_id, input_source);
+}
+
+//-------------------------------------------------------------------------
+
 // 動作に影響のあるパラメータを演奏タスクに同期する。
 // 設定のリセットやロード後に呼び出すこと。
 void system_registry_t::syncParams(void)
@@ -617,6 +650,46 @@ void system_registry_t::syncParams(void)
 
 //-------------------------------------------------------------------------
 
+system_registry_t::reg_midi_out_control_t::~reg_midi_out_control_t(void)
+{
+  if (_events != nullptr) { registry_heap_free(_events); }
+}
+
+void system_registry_t::reg_midi_out_control_t::init(bool psram)
+{
+  registry_base_t::init(psram);
+  if (_events != nullptr) { return; }
+  auto slots = (event_slot_t*)registry_heap_alloc(event_count * sizeof(event_slot_t), psram);
+  if (slots == nullptr) {
+    M5_LOGE("midi_out_control: event memory allocation failed");
+    return;
+  }
+  for (size_t i = 0; i < event_count; ++i) {
+    // 完了ビットを立てずに初期化し、未書込みのスロットを読まないようにする
+    new (&slots[i]) event_slot_t { { 0 }, midi_event_t() };
+  }
+  _events = slots;
+}
+
+void system_registry_t::reg_midi_out_control_t::_addEvent(uint32_t word, uint8_t trace_id)
+{
+  // 書込み位置を確保する。複数タスクから同時に書き込まれても同じスロットを取り合うことはない
+  history_code_t seq = _history_code.fetch_add(1, std::memory_order_acq_rel);
+  if (_events != nullptr) {
+    midi_event_t event;
+    event.word = word;
+    event.trace_id = trace_id;
+    _writeRing(_events, event_count, seq, event);
+  }
+  if (!_batch.isActive()) { _publishHistory(); }
+  _execNotify();
+}
+
+bool system_registry_t::reg_midi_out_control_t::getEvent(history_code_t &code, midi_event_t &result) const
+{
+  return _readRing(_events, event_count, code, result);
+}
+
 void system_registry_t::reg_task_status_t::setWorking(bitindex_t index)
 {
 #if !defined (M5UNIFIED_PC_BUILD)
@@ -700,6 +773,42 @@ void system_registry_t::reg_task_status_t::setSuspend(bitindex_t index)
 #endif
 }
 
+void system_registry_t::reg_task_status_t::addPlayerJitter(uint32_t late_usec)
+{
+  size_t bin = 0;
+  while (bin < max_jitter_bin - 1 && late_usec >= jitter_bin_limit_usec[bin]) { ++bin; }
+  uint16_t index = PLAYER_JITTER_HISTOGRAM + bin * 4;
+  _reg_data_32[index >> 2] += 1;
+  _reg_data_32[PLAYER_WAKE_COUNT >> 2] += 1;
+  if (_reg_data_32[PLAYER_JITTER_MAX >> 2] < late_usec) {
+    _reg_data_32[PLAYER_JITTER_MAX >> 2] = late_usec;
+  }
+}
+
+void system_registry_t::reg_task_status_t::setPlayerStepNotify(uint32_t request_count, uint32_t notify_count)
+{
+  _reg_data_32[PLAYER_STEP_NOTIFY_REQUEST >> 2] = request_count;
+  _reg_data_32[PLAYER_STEP_NOTIFY >> 2] = notify_count;
+}
+
+void system_registry_t::reg_task_status_t::setLatencyHistogram(const uint32_t* counts, uint32_t max_usec)
+{
+  for (size_t bin = 0; bin < max_latency_bin; ++bin) {
+    _reg_data_32[(LATENCY_HISTOGRAM >> 2) + bin] = counts[bin];
+  }
+  _reg_data_32[LATENCY_MAX >> 2] = max_usec;
+}
+
+void system_registry_t::reg_task_status_t::setInputTiming(def::command::input_source_t source, int32_t latency_usec, int32_t deviation_usec, int32_t tolerance_usec, uint32_t samples)
+{
+  if (source >= def::command::max_input_source) { return; }
+  uint16_t index = INPUT_TIMING + source * 16;
+  _reg_data_32[(index + INPUT_LATENCY) >> 2] = latency_usec;
+  _reg_data_32[(index + INPUT_DEVIATION) >> 2] = deviation_usec;
+  _reg_data_32[(index + INPUT_TOLERANCE) >> 2] = tolerance_usec;
+  _reg_data_32[(index + INPUT_SAMPLES) >> 2] = samples;
+}
+
 //-------------------------------------------------------------------------
 
 void system_registry_t::reg_user_setting_t::setTimeZone15min(int8_t offset)
@@ -792,6 +901,23 @@ bool system_registry_t::saveSettingInternal(JsonVariant& json_root)
     json["instachord_link_style"] = (uint8_t)midi_port_setting.getInstaChordLinkStyle();
     json["usb_mode"] = (uint8_t)midi_port_setting.getUSBMode();
     json["usb_power"] = (uint8_t)midi_port_setting.getUSBPowerEnabled();
+    json["clock_in_port"] = (uint8_t)midi_port_setting.getClockInPort();
+    json["clock_out_ports"] = midi_port_setting.getClockOutPorts();
+
+    // MIDIの経路表は初期状態と異なる経路のみ保存する
+    auto json_routing = json["routing"].to<JsonArray>();
+    for (int src = 0; src < def::command::max_midi_route_port; ++src) {
+      for (int dst = 0; dst < def::command::max_midi_route_port; ++dst) {
+        auto channel = midi_port_setting.getRouteChannelMask(src, dst);
+        auto type = midi_port_setting.getRouteTypeMask(src, dst);
+        if (channel == 0xFFFF && type == 0xFF) { continue; }
+        auto route = json_routing.add<JsonObject>();
+        route["src"] = src;
+        route["dst"] = dst;
+        route["channel"] = channel;
+        route["type"] = type;
+      }
+    }
   }
 
 /* 以下廃止、新仕様では control_mapping に統一
@@ -858,6 +984,20 @@ bool system_registry_t::loadSettingInternal(JsonVariant& json_root)
     midi_port_setting.setInstaChordLinkStyle((def::command::instachord_link_style_t)json["instachord_link_style"].as<uint8_t>());
     midi_port_setting.setUSBMode((def::command::usb_mode_t)json["usb_mode"].as<uint8_t>());
     midi_port_setting.setUSBPowerEnabled(json["usb_power"].as<bool>());
+    midi_port_setting.setClockInPort((def::command::midi_clock_port_t)json["clock_in_port"].as<uint8_t>());
+    midi_port_setting.setClockOutPorts(json["clock_out_ports"].as<uint8_t>());
+
+    midi_port_setting.resetRoute();
+    for (auto route : json["routing"].as<JsonArray>()) {
+      int src = route["src"].as<int>();
+      int dst = route["dst"].as<int>();
+      if (src < 0 || src >= def::command::max_midi_route_port || dst < 0 || dst >= def::command::max_midi_route_port) {
+        M5_LOGW("routing port error: %d -> %d", src, dst);
+        continue;
+      }
+      midi_port_setting.setRouteChannelMask(src, dst, route["channel"].as<uint16_t>());
+      midi_port_setting.setRouteTypeMask(src, dst, route["type"].as<uint8_t>());
+    }
   }
 
   {
@@ -1291,17 +1431,289 @@ static void degree_param_from_str(const char* str, degree_param_t& param)
   param.setMinorSwap(swap);
 }
 
+system_registry_t::reg_sequence_timeline_t::~reg_sequence_timeline_t(void)
+{
+  // チャンクの解放はここでのみ行う
+  for (size_t i = 0; i < _chunk_count; ++i) {
+    registry_heap_free(_chunks[i]);
+  }
+  for (size_t i = 0; i < _free_count; ++i) {
+    registry_heap_free(_free_chunks[i]);
+  }
+  if (_chunks != nullptr) {
+    registry_heap_free(_chunks);
+  }
+  if (_free_chunks != nullptr) {
+    registry_heap_free(_free_chunks);
+  }
+}
+
+system_registry_t::reg_sequence_timeline_t::chunk_t* system_registry_t::reg_sequence_timeline_t::_allocChunk(void)
+{
+  chunk_t* chunk;
+  if (_free_count) {
+    chunk = _free_chunks[--_free_count];
+  } else {
+    chunk = (chunk_t*)registry_heap_alloc(sizeof(chunk_t), _psram);
+    if (chunk == nullptr) {
+      M5_LOGE("sequence timeline: chunk allocation failed");
+      return nullptr;
+    }
+  }
+  // パディングを含めてCRCの計算結果を一定にするため、ゼロで埋めておく
+  memset((void*)chunk, 0, sizeof(chunk_t));
+  // crc_generation (0) と一致しない世代番号にして、CRCを未計算の状態にする
+  chunk->generation.store(1, std::memory_order_release);
+  return chunk;
+}
+
+void system_registry_t::reg_sequence_timeline_t::_releaseChunk(chunk_t* chunk)
+{
+  // 他タスクが古いチャンク表を辿っていても空のチャンクとして読まれるよう、要素数だけ先に戻しておく
+  chunk->count = 0;
+  _markChunkModified(chunk);
+  if (_free_chunks != nullptr && _free_count < max_chunk_count) {
+    _free_chunks[_free_count++] = chunk;
+  } else {
+    // チャンク表へ一度も登録されていないチャンクなので、他タスクから参照されることはない
+    registry_heap_free(chunk);
+  }
+}
+
+bool system_registry_t::reg_sequence_timeline_t::_allocTable(void)
+{
+  if (_chunks == nullptr) {
+    _chunks = (chunk_t**)registry_heap_alloc(max_chunk_count * sizeof(chunk_t*), _psram);
+  }
+  if (_free_chunks == nullptr) {
+    _free_chunks = (chunk_t**)registry_heap_alloc(max_chunk_count * sizeof(chunk_t*), _psram);
+  }
+  if (_chunks == nullptr || _free_chunks == nullptr) {
+    M5_LOGE("sequence timeline: chunk table allocation failed");
+    return false;
+  }
+  return true;
+}
+
+bool system_registry_t::reg_sequence_timeline_t::_insertChunk(size_t chunk_index, chunk_t* chunk)
+{
+  if (!_allocTable()) { return false; }
+  if (_chunk_count >= max_chunk_count) {
+    M5_LOGE("sequence timeline: too many chunks");
+    return false;
+  }
+  memmove(&_chunks[chunk_index + 1], &_chunks[chunk_index], (_chunk_count - chunk_index) * sizeof(chunk_t*));
+  _chunks[chunk_index] = chunk;
+  ++_chunk_count;
+  return true;
+}
+
+size_t system_registry_t::reg_sequence_timeline_t::_findChunk(uint16_t step) const
+{
+  // 先頭ステップが step 以下である最後のチャンクを探す。該当が無ければ先頭のチャンク
+  size_t lo = 1;
+  size_t hi = _chunk_count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (_chunks[mid]->data[0].first <= step) { lo = mid + 1; } else { hi = mid; }
+  }
+  return lo - 1;
+}
+
+system_registry_t::reg_sequence_timeline_t::const_iterator system_registry_t::reg_sequence_timeline_t::find(uint16_t step) const
+{
+  if (_chunk_count == 0) { return end(); }
+  size_t chunk_index = _findChunk(step);
+  auto chunk = _chunks[chunk_index];
+  auto it = std::upper_bound( chunk->data
+                            , chunk->data + chunk->count
+                            , step
+                            , [](uint16_t a, const value_type& b) { return a < b.first; }
+                            );
+  if (it == chunk->data) { return end(); }
+  return const_iterator(this, chunk_index, (it - chunk->data) - 1);
+}
+
+void system_registry_t::reg_sequence_timeline_t::getStepDescriptors(int32_t step, sequence_chord_desc_t* dst, size_t count) const
+{
+  sequence_chord_desc_t current;
+  auto next = begin();
+  if (step >= 0 && step < def::app::max_sequence_step) {
+    auto it = find(step);
+    if (it != end()) {
+      current = it->second;
+      next = ++it;
+    }
+  }
+  auto ed = end();
+  for (size_t i = 0; i < count; ++i) {
+    int32_t s = step + (int32_t)i;
+    while (next != ed && (int32_t)next->first <= s) {
+      current = next->second;
+      ++next;
+    }
+    dst[i] = (s < 0 || s >= def::app::max_sequence_step) ? sequence_chord_desc_t() : current;
+  }
+}
+
+bool system_registry_t::reg_sequence_timeline_t::setStepDescriptor(uint16_t step, const sequence_chord_desc_t& value)
+{
+  // 最大値チェック
+  if (step >= def::app::max_sequence_step) { return false; }
+
+  if (_chunk_count == 0) {
+    auto chunk = _allocChunk();
+    if (chunk == nullptr) { return false; }
+    if (!_insertChunk(0, chunk)) {
+      _releaseChunk(chunk);
+      return false;
+    }
+  }
+
+  size_t chunk_index = _findChunk(step);
+  auto chunk = _chunks[chunk_index];
+  auto pos = std::upper_bound( chunk->data
+                             , chunk->data + chunk->count
+                             , step
+                             , [](uint16_t a, const value_type& b) { return a < b.first; }
+                             );
+  if (pos != chunk->data && (pos - 1)->first == step) {
+    // 指定ステップと同じ要素が見つかった場合、その位置に上書きする
+    (pos - 1)->second = value;
+    _markChunkModified(chunk);
+    _markModified();
+    return true;
+  }
+
+  if (chunk->count >= chunk_capacity) {
+    // チャンクが満杯の場合は新しいチャンクを後ろに追加する
+    auto new_chunk = _allocChunk();
+    if (new_chunk == nullptr) { return false; }
+    if (!_insertChunk(chunk_index + 1, new_chunk)) {
+      _releaseChunk(new_chunk);
+      return false;
+    }
+    size_t index = pos - chunk->data;
+    if (index == chunk_capacity && chunk_index + 2 == _chunk_count) {
+      // 末尾への追加(録音時など)は分割せずに新しいチャンクへ入れ、チャンクを満杯のまま保つ
+      chunk = new_chunk;
+      pos = chunk->data;
+    } else {
+      // 後半の要素を新しいチャンクへ移す
+      size_t half = chunk_capacity >> 1;
+      std::copy(chunk->data + half, chunk->data + chunk_capacity, new_chunk->data);
+      new_chunk->count = chunk_capacity - half;
+      chunk->count = half;
+      memset((void*)(chunk->data + half), 0, (chunk_capacity - half) * sizeof(value_type));
+      _markChunkModified(chunk);
+      if (index > half) {
+        chunk = new_chunk;
+        index -= half;
+      }
+      pos = chunk->data + index;
+    }
+  }
+
+  // 挿入位置以降の要素をチャンク内で1つ後ろにシフトする
+  std::copy_backward(pos, chunk->data + chunk->count, chunk->data + chunk->count + 1);
+  pos->first = step;
+  pos->second = value;
+  ++chunk->count;
+  _markChunkModified(chunk);
+  ++_data_count;
+  _markModified();
+  return true;
+}
+
+void system_registry_t::reg_sequence_timeline_t::clear(void)
+{
+  size_t chunk_count = _chunk_count;
+  _chunk_count = 0;
+  _data_count = 0;
+  for (size_t i = 0; i < chunk_count; ++i) {
+    _releaseChunk(_chunks[i]);
+  }
+  _markModified();
+}
+
+void system_registry_t::reg_sequence_timeline_t::deleteAfter(uint16_t step)
+{
+  // 先頭ステップが step 以降のチャンクは丸ごと空きリストへ戻す
+  while (_chunk_count && _chunks[_chunk_count - 1]->data[0].first >= step) {
+    auto chunk = _chunks[--_chunk_count];
+    _data_count -= chunk->count;
+    _releaseChunk(chunk);
+  }
+  if (_chunk_count) {
+    auto chunk = _chunks[_chunk_count - 1];
+    auto pos = std::lower_bound( chunk->data
+                               , chunk->data + chunk->count
+                               , step
+                               , [](const value_type& a, uint16_t b) { return a.first < b; }
+                               );
+    size_t count = pos - chunk->data;
+    if (count != chunk->count) {
+      memset((void*)pos, 0, (chunk->count - count) * sizeof(value_type));
+      _data_count -= chunk->count - count;
+      chunk->count = count;
+      _markChunkModified(chunk);
+    }
+  }
+  _markModified();
+}
+
+uint32_t system_registry_t::reg_sequence_timeline_t::crc32(uint32_t crc_init) const
+{
+  uint32_t crc = crc_init;
+  for (size_t i = 0; i < _chunk_count; ++i) {
+    auto chunk = _chunks[i];
+    // 計算前に世代番号を取得し、計算中に変更されなかった場合のみ結果を保持する (crc32_cached と同様)
+    uint32_t generation = chunk->generation.load(std::memory_order_acquire);
+    uint32_t chunk_crc = chunk->crc;
+    uint32_t chunk_shift = chunk->crc_shift;
+    if (chunk->crc_generation != generation) {
+      size_t length = chunk->count * sizeof(value_type);
+      chunk_crc = calc_crc32(chunk->data, length, 0);
+      chunk_shift = calc_crc32_shift(length);
+      if (chunk->generation.load(std::memory_order_acquire) == generation) {
+        chunk->crc = chunk_crc;
+        chunk->crc_shift = chunk_shift;
+        chunk->crc_generation = generation;
+      }
+    }
+    crc = calc_crc32_combine(crc, chunk_crc, chunk_shift);
+  }
+  return crc;
+}
+
+void system_registry_t::reg_sequence_timeline_t::assign(const reg_sequence_timeline_t &src)
+{
+  if (this == &src) { return; }
+  clear();
+  for (size_t i = 0; i < src._chunk_count; ++i) {
+    auto chunk = _allocChunk();
+    if (chunk == nullptr) { break; }
+    if (!_insertChunk(_chunk_count, chunk)) {
+      _releaseChunk(chunk);
+      break;
+    }
+    // 世代番号とCRCキャッシュはコピーせず、次回の crc32 で計算する
+    auto src_chunk = src._chunks[i];
+    chunk->count = src_chunk->count;
+    memcpy((void*)chunk->data, (const void*)src_chunk->data, sizeof(chunk->data));
+    _data_count += chunk->count;
+  }
+  _markModified();
+}
+
 bool system_registry_t::reg_sequence_timeline_t::saveJson(JsonVariant &json)
 {
   char buf[32];
   sequence_chord_desc_t prev_desc;
   prev_desc.setSlotIndex(0xFF); // 強制的に最初のデータを保存させるため
 
-  auto it = begin();
-  auto it_e = end();
-  for (; it != it_e; ++it)
+  for (auto &pair : *this)
   {
-    auto &pair = *it;
     if (prev_desc == pair.second) { continue; }
 
     itoa(pair.first, buf, 10);
@@ -1339,10 +1751,7 @@ bool system_registry_t::reg_sequence_timeline_t::saveJson(JsonVariant &json)
 
 bool system_registry_t::reg_sequence_timeline_t::loadJson(const JsonVariant &json)
 {
-  // decltype(_data) tmpdata;
-  auto it = begin();
-  size_t count = 0;
-  size_t limit = max_count();
+  clear();
 
   sequence_chord_desc_t desc;
   for (auto kvp : json.as<JsonObject>())
@@ -1397,13 +1806,9 @@ bool system_registry_t::reg_sequence_timeline_t::loadJson(const JsonVariant &jso
         }
       }
     }
-    it->first = step;
-    it->second = desc;
-    ++it;
-    ++count;
-    if (count >= limit) { break; }
+    // 保存データはステップ順のため、通常は末尾への追加となる
+    setStepDescriptor(step, desc);
   }
-  _data_count = count;
 
   return true;
 }
@@ -1441,6 +1846,19 @@ static bool saveSongInternal(system_registry_t::song_data_t* song, JsonVariant &
   json["swing"] = song->song_info.getSwing();
   json["base_key"] = system_registry->runtime_info.getMasterKey();
 
+  if (song->groove.getSteps() > 0)
+  { // グルーブテンプレートは有効な場合のみ保存する
+    auto json_groove = json["groove"].to<JsonObject>();
+    json_groove["steps"] = song->groove.getSteps();
+    auto timing = json_groove["timing"].to<JsonArray>();
+    auto velocity = json_groove["velocity"].to<JsonArray>();
+    for (int step = 0; step < song->groove.getSteps(); ++step)
+    {
+      timing.add(song->groove.getTiming(step));
+      velocity.add(song->groove.getVelocity(step));
+    }
+  }
+
   if (song->sequence.info.getLength() > 0)
   {
     auto json_sequence = json["sequence"].to<JsonVariant>();
@@ -1561,6 +1979,25 @@ static bool loadSongInternal(system_registry_t::song_data_t* song, const JsonVar
 
   system_registry->runtime_info.setMasterKey(json["base_key"].as<int>());
 
+  {
+    song->groove.reset();
+    auto json_groove = json["groove"].as<JsonObject>();
+    auto timing = json_groove["timing"].as<JsonArray>();
+    auto velocity = json_groove["velocity"].as<JsonArray>();
+    int steps = json_groove["steps"].as<int>();
+    if (steps != 16 && steps != 32) {
+      if (json_groove.size()) { M5_LOGW("groove steps error: %d", steps); }
+    } else {
+      // 省略された要素はタイミング 0、ベロシティ 100% とする
+      for (int step = 0; step < steps; ++step)
+      {
+        song->groove.setTiming(step, timing[step].as<int>());
+        song->groove.setVelocity(step, velocity[step].isNull() ? 100 : velocity[step].as<int>());
+      }
+      song->groove.setSteps(steps);
+    }
+  }
+
   {
     loadSequenceInternal(&(song->sequence), json["sequence"].as<JsonVariant>());
     system_registry->runtime_info.setSequenceStepIndex(0);
@@ -10,6 +10,7 @@
 
 #include "registry.hpp"
 #include "common_define.hpp"
+#include "midi_event.hpp"
 
 #include <string.h>
 #include <stdio.h>
@@ -71,15 +72,27 @@ public:
         bool check(const def::command::command_param_t& command_param) const;
         uint32_t getChangeCounter(void) const { return _working_command_change_counter; }
 
+        // 変更通知をまとめる (registry_base_t と同様)
+        void beginBatch(void) { _batch.begin(); }
+        void endBatch(void) { bool notify; if (_batch.end(notify) && notify) { _sendNotify(); } }
+        uint32_t getNotifyCount(void) const { return _notify_count.load(std::memory_order_relaxed); }
+        uint32_t getNotifyRequestCount(void) const { return _batch.getRequestCount(); }
+
 #if __has_include (<freertos/FreeRTOS.h>)
         void setNotifyTaskHandle(TaskHandle_t handle);
 protected:
-        void _execNotify(void) const { if (_task_handle != nullptr) { xTaskNotify(_task_handle, (uint32_t)this, eNotifyAction::eSetValueWithOverwrite); } }
+        void _sendNotify(void) const {
+            _notify_count.fetch_add(1, std::memory_order_relaxed);
+            if (_task_handle != nullptr) { xTaskNotify(_task_handle, (uint32_t)this, eNotifyAction::eSetValueWithOverwrite); }
+        }
         TaskHandle_t _task_handle = nullptr;
 #else
 protected:
-        void _execNotify(void) const {}
+        void _sendNotify(void) const { _notify_count.fetch_add(1, std::memory_order_relaxed); }
 #endif
+        void _execNotify(void) const { if (_batch.request()) { _sendNotify(); } }
+        mutable notify_batch_t _batch;
+        mutable std::atomic<uint32_t> _notify_count { 0 };
         uint32_t _working_command_change_counter = 0;
     } working_command;
 
@@ -157,7 +170,7 @@ protected:
 
     // MIDIポートに関する設定情報
     struct reg_midi_port_setting_t : public registry_t {
-        reg_midi_port_setting_t(void) : registry_t(8, 0, DATA_SIZE_8) {}
+        reg_midi_port_setting_t(void) : registry_t(ROUTE_MATRIX + def::command::max_midi_route_port * def::command::max_midi_route_port * 4, 0, DATA_SIZE_8) {}
         enum index_t : uint16_t {
             PORT_C_MIDI,
             BLE_MIDI,
@@ -167,7 +180,12 @@ protected:
             INSTACHORD_LINK_STYLE,
             USB_POWER_ENABLED, // USB給電 オン・オフ
             USB_MODE,          // USBモード(Host/Device)
+            CLOCK_IN_PORT,     // 外部MIDIクロックを受信するポート
+            CLOCK_OUT_PORTS,   // MIDIクロックを送信するポート (midi_clock_port_t のビット)
+            ROUTE_MATRIX = 16, // MIDIの経路表 (送信元 × 送信先 ごとに 4Byte : チャンネルのビットマスク 2Byte, メッセージ種別のビットマスク 1Byte)
         };
+        // 経路表のメッセージ種別のビット。bit0~6 は 0x80~0xE0 のチャンネルメッセージ、bit7 はシステムメッセージ
+        static constexpr const uint8_t route_type_system = 0x80;
         void setPortCMIDI(def::command::ex_midi_mode_t mode) { set8(PORT_C_MIDI, static_cast<uint8_t>(mode)); }
         def::command::ex_midi_mode_t getPortCMIDI(void) const { return static_cast<def::command::ex_midi_mode_t>(get8(PORT_C_MIDI)); }
 
@@ -191,6 +209,45 @@ protected:
 
         void setUSBMode(def::command::usb_mode_t mode) { set8(USB_MODE, static_cast<uint8_t>(mode)); }
         def::command::usb_mode_t getUSBMode(void) const { return static_cast<def::command::usb_mode_t>(get8(USB_MODE)); }
+
+        void setClockInPort(def::command::midi_clock_port_t port) { set8(CLOCK_IN_PORT, static_cast<uint8_t>(port)); }
+        def::command::midi_clock_port_t getClockInPort(void) const { return static_cast<def::command::midi_clock_port_t>(get8(CLOCK_IN_PORT)); }
+
+        void setClockOutPorts(uint8_t port_bits) { set8(CLOCK_OUT_PORTS, port_bits); }
+        uint8_t getClockOutPorts(void) const { return get8(CLOCK_OUT_PORTS); }
+        void setClockOutEnabled(def::command::midi_clock_port_t port, bool enabled) {
+            uint8_t bits = getClockOutPorts() & ~(1 << port);
+            setClockOutPorts(bits | (enabled << port));
+        }
+        bool getClockOutEnabled(def::command::midi_clock_port_t port) const { return getClockOutPorts() & (1 << port); }
+
+        // 送信元から送信先へ通過させるチャンネル (bit0 が ch1)
+        void setRouteChannelMask(uint8_t src, uint8_t dst, uint16_t mask) {
+            if (src >= def::command::max_midi_route_port || dst >= def::command::max_midi_route_port) { return; }
+            set16(ROUTE_MATRIX + (src * def::command::max_midi_route_port + dst) * 4, mask);
+        }
+        uint16_t getRouteChannelMask(uint8_t src, uint8_t dst) const {
+            if (src >= def::command::max_midi_route_port || dst >= def::command::max_midi_route_port) { return 0; }
+            return get16(ROUTE_MATRIX + (src * def::command::max_midi_route_port + dst) * 4);
+        }
+        // 送信元から送信先へ通過させるメッセージ種別
+        void setRouteTypeMask(uint8_t src, uint8_t dst, uint8_t mask) {
+            if (src >= def::command::max_midi_route_port || dst >= def::command::max_midi_route_port) { return; }
+            set8(ROUTE_MATRIX + (src * def::command::max_midi_route_port + dst) * 4 + 2, mask);
+        }
+        uint8_t getRouteTypeMask(uint8_t src, uint8_t dst) const {
+            if (src >= def::command::max_midi_route_port || dst >= def::command::max_midi_route_port) { return 0; }
+            return get8(ROUTE_MATRIX + (src * def::command::max_midi_route_port + dst) * 4 + 2);
+        }
+        // 経路表を初期状態 (すべての送信元からすべての送信先へ全メッセージを通過させる) に戻す
+        void resetRoute(void) {
+            for (int src = 0; src < def::command::max_midi_route_port; ++src) {
+                for (int dst = 0; dst < def::command::max_midi_route_port; ++dst) {
+                    setRouteChannelMask(src, dst, 0xFFFF);
+                    setRouteTypeMask(src, dst, 0xFF);
+                }
+            }
+        }
     } midi_port_setting;
 
     // 実行時に変化する保存されない情報 (設定画面が存在しない可変情報)
@@ -477,10 +534,10 @@ protected:
         void setPopup(bool is_success, def::notify_type_t notify) { set8(is_success ? SUCCESS_NOTIFY : ERROR_NOTIFY, notify, true); }
         void setMessage(def::notify_type_t notify) { set8(MESSAGE, notify, true); }
         bool getPopupHistory(history_code_t &code, def::notify_type_t &notify_type, category_t &category) {
-            auto history = getHistory(code);
-            if (history == nullptr) { return false; }
-            notify_type = static_cast<def::notify_type_t>(history->value);
-            category = static_cast<category_t>(history->index);
+            history_t history;
+            if (!getHistory(code, history)) { return false; }
+            notify_type = static_cast<def::notify_type_t>(history.value);
+            category = static_cast<category_t>(history.index);
             return true;
         }
     } popup_notify;
@@ -535,7 +592,7 @@ protected:
     };
 
     struct reg_task_status_t : public registry_t {
-        reg_task_status_t(void) : registry_t(64, 0, DATA_SIZE_32) {}
+        reg_task_status_t(void) : registry_t(0x8C + def::command::max_input_source * 16, 0, DATA_SIZE_32) {}
         enum bitindex_t : uint32_t {
             TASK_SPI,
             TASK_I2S,
@@ -565,13 +622,54 @@ protected:
             TASK_MIDI_USB_COUNTER = 0x2C,
             TASK_MIDI_BLE_COUNTER = 0x30,
             TASK_MIDI_WIFI_COUNTER = 0x34,
+            PLAYER_JITTER_HISTOGRAM = 0x38, // 演奏タスクの起床遅れのヒストグラム (max_jitter_bin 個)
+            PLAYER_JITTER_MAX = 0x58,       // 演奏タスクの起床遅れの最大値 (usec)
+            PLAYER_WAKE_COUNT = 0x5C,       // 演奏タスクのタイマー起床回数
+            PLAYER_STEP_NOTIFY_REQUEST = 0x60, // 直前の1ステップで発生した通知要求の数 (まとめる前)
+            PLAYER_STEP_NOTIFY = 0x64,      // 直前の1ステップで実際に行った通知の数 (まとめた後)
+            LATENCY_HISTOGRAM = 0x68,       // 入力からMIDI送信までの遅延のヒストグラム (max_latency_bin 個, 遅延計測の保存時に更新)
+            LATENCY_MAX = 0x88,             // 入力からMIDI送信までの遅延の最大値 (usec)
+            INPUT_TIMING = 0x8C,            // 入力元ごとの入力タイミングの推定値 (16Byte × 入力元の数)
+        };
+        // INPUT_TIMING の入力元ごとの項目
+        enum input_timing_index_t : uint16_t {
+            INPUT_LATENCY = 0x00,     // 拍に対する入力の遅れの平均 (usec, 負の値は先走り)
+            INPUT_DEVIATION = 0x04,   // 遅れのばらつき (平均絶対偏差, usec)
+            INPUT_TOLERANCE = 0x08,   // 拍の直後の入力をその拍の演奏として扱う許容時間 (usec)
+            INPUT_SAMPLES = 0x0C,     // 推定に使用した入力の数
         };
+        // 起床遅れのヒストグラムの各区間の上限値 (usec) 最後の区間は上限なし
+        static constexpr const size_t max_jitter_bin = 8;
+        static constexpr const uint32_t jitter_bin_limit_usec[max_jitter_bin - 1] = { 50, 100, 200, 500, 1000, 2000, 5000 };
+        // 遅延のヒストグラムの区間数 (区間の上限値は latency_trace_t::bin_limit_usec)
+        static constexpr const size_t max_latency_bin = 8;
+
         void setWorking(bitindex_t index);
         void setSuspend(bitindex_t index);
         bool isWorking(void) const { return get32(TASK_STATUS); }
         uint32_t getLowPowerCounter(void) const { return get32(LOW_POWER_COUNTER); }
         uint32_t getHighPowerCounter(void) const { return get32(HIGH_POWER_COUNTER); }
         uint32_t getWorkingCounter(index_t index) const { return get32(index); }
+
+        // 演奏タスクの予定時刻に対する実際の起床時刻の遅れを記録する
+        void addPlayerJitter(uint32_t late_usec);
+        uint32_t getPlayerJitterCount(uint8_t bin) const { return bin < max_jitter_bin ? get32(PLAYER_JITTER_HISTOGRAM + bin * 4) : 0; }
+        uint32_t getPlayerJitterMax(void) const { return get32(PLAYER_JITTER_MAX); }
+        uint32_t getPlayerWakeCount(void) const { return get32(PLAYER_WAKE_COUNT); }
+
+        // 演奏ステップ1回あたりのレジストリ通知数を記録する
+        void setPlayerStepNotify(uint32_t request_count, uint32_t notify_count);
+        uint32_t getPlayerStepNotifyRequest(void) const { return get32(PLAYER_STEP_NOTIFY_REQUEST); }
+        uint32_t getPlayerStepNotify(void) const { return get32(PLAYER_STEP_NOTIFY); }
+
+        // 入力からMIDI送信までの遅延の集計結果を記録する
+        void setLatencyHistogram(const uint32_t* counts, uint32_t max_usec);
+        uint32_t getLatencyCount(uint8_t bin) const { return bin < max_latency_bin ? get32(LATENCY_HISTOGRAM + bin * 4) : 0; }
+        uint32_t getLatencyMax(void) const { return get32(LATENCY_MAX); }
+
+        // 入力元ごとの入力タイミングの推定値を記録する
+        void setInputTiming(def::command::input_source_t source, int32_t latency_usec, int32_t deviation_usec, int32_t tolerance_usec, uint32_t samples);
+        int32_t getInputTiming(def::command::input_source_t source, input_timing_index_t index) const { return source < def::command::max_input_source ? (int32_t)get32(INPUT_TIMING + source * 16 + index) : 0; }
     };
 
     struct reg_internal_input_t : public registry_t {
@@ -632,15 +730,25 @@ protected:
 
     // MIDI出力コントロール
     struct reg_midi_out_control_t : public registry_base_t {
-        // 読み出しには非対応、値をセットすると履歴として取得できる
-        reg_midi_out_control_t(void) : registry_base_t(256) {}
-
-        void setMessage(uint8_t status, uint8_t data1, uint8_t data2 = 0) {
-            set16(status, data1 + (data2 << 8), true);
-        }
-        void setNoteVelocity(uint8_t channel, uint8_t note, uint8_t value) {
+        // 読み出しには非対応、メッセージをセットすると getEvent で順に取得できる
+        // メッセージは registry_base_t の履歴ではなく、midi_event_t を格納する専用のリングに書き込む。
+        // 書込み通し番号(履歴コード)・バッチ・通知の仕組みは registry_base_t のものを共用する
+        static constexpr const size_t event_count = 256;  // 2の累乗であること
+
+        reg_midi_out_control_t(void) : registry_base_t(0) {}
+        ~reg_midi_out_control_t(void);
+        void init(bool psram = false) override;
+
+        // trace_id は遅延計測用 (0 はトレースなし)
+        // source は送信元のポート (midi_route_port_t)。演奏タスクからの出力は mrp_internal、外部入力のスルーは受信したポート
+        void setMessage(uint8_t status, uint8_t data1, uint8_t data2 = 0, uint8_t trace_id = 0, uint8_t source = def::command::mrp_internal) {
+            _addEvent(midi_event_t::pack(status, data1, data2, source), trace_id);
+        }
+        // 出力メッセージを取得する。取得できた場合は result にコピーして code を進める (getHistory と同じ使い方)
+        bool getEvent(history_code_t &code, midi_event_t &result) const;
+        void setNoteVelocity(uint8_t channel, uint8_t note, uint8_t value, uint8_t trace_id = 0) {
             uint8_t status = 0x80 + ((value & 0x80) >> 3);
-            setMessage((status | channel), note, value & 0x7F);
+            setMessage((status | channel), note, value & 0x7F, trace_id);
         }
         void setProgramChange(uint8_t channel, uint8_t value) {
             if (_program_number[channel] == value) { return; }
@@ -664,6 +772,11 @@ protected:
             return _channel_volume[channel] & 0x7F;
         }
     protected:
+        // 書込み・読出しは registry_base_t の履歴と同じ _writeRing / _readRing で行う
+        typedef ring_slot_t<midi_event_t> event_slot_t;
+        void _addEvent(uint32_t word, uint8_t trace_id);
+
+        event_slot_t* _events = nullptr;
         uint8_t _channel_volume[def::midi::channel_max] = { 128, 128, 128, 128,  128, 128, 128, 128,  128, 128, 128, 128,  128, 128, 128, 128,   };
         uint8_t _program_number[def::midi::channel_max] = { 128, 128, 128, 128,  128, 128, 128, 128,  128, 128, 128, 128,  128, 128, 128, 128,   };
     } midi_out_control;
@@ -763,8 +876,8 @@ protected:
             part_info.reset();
         }
         uint32_t crc32(uint32_t crc = 0) const {
-            crc = arpeggio.crc32(crc);
-            crc = part_info.crc32(crc);
+            crc = arpeggio.crc32_cached(crc);
+            crc = part_info.crc32_cached(crc);
             return crc;
         }
         bool operator== (const kanplay_part_t &src) const {
@@ -838,7 +951,7 @@ protected:
             for (int i = 0; i < def::app::max_chord_part; ++i) {
                 crc = chord_part[i].crc32(crc);
             }
-            crc = slot_info.crc32(crc);
+            crc = slot_info.crc32_cached(crc);
             return crc;
         }
 
@@ -956,98 +1069,107 @@ protected:
         uint8_t getConfirm_Paste(void) const { return get8(CONFIRM_PASTE); }
     };
 
-    struct reg_sequence_timeline_t : public registry_t {
-        reg_sequence_timeline_t(void) : registry_t(8192, 0, DATA_SIZE_32) {}
-        std::pair<uint32_t, sequence_chord_desc_t>* begin(void) const {
-            return (std::pair<uint32_t, sequence_chord_desc_t>*)_reg_data;
-        }
-        std::pair<uint32_t, sequence_chord_desc_t>* end(void) const {
-            return (std::pair<uint32_t, sequence_chord_desc_t>*)(_reg_data) + _data_count;
-        }
-        size_t max_count(void) const {
-            return _registry_size / sizeof(std::pair<uint32_t, sequence_chord_desc_t>);
-        }
+    // シーケンス演奏のステップ情報。ステップ番号の昇順に並べた要素を固定長のチャンクに分けて保持する
+    // 挿入・削除の移動量はチャンク内に収まり、探索はチャンク先頭の二分探索とチャンク内の二分探索で行う
+    struct reg_sequence_timeline_t : public registry_base_t {
+        typedef std::pair<uint32_t, sequence_chord_desc_t> value_type;
+        // 1チャンクあたりの要素数
+        static constexpr const size_t chunk_capacity = 128;
+        // チャンクは分割時に半数ずつに分かれるため、末尾以外のチャンクは半分以上埋まっている
+        // チャンク表は最大数で確保して再確保しないようにし、演奏中に他タスクから参照されても無効にならないようにする
+        // 不要になったチャンクも解放せずに空きリストへ戻して再利用し、参照中のタスクが解放済みの領域を読まないようにする
+        static constexpr const size_t max_chunk_count = (def::app::max_sequence_step + (chunk_capacity >> 1) - 1) / (chunk_capacity >> 1) + 2;
 
-        // 指定したステップと同値かそれより小さい最大のステップを持つ要素のイテレータを返す
-        std::pair<uint32_t, sequence_chord_desc_t>* find(uint16_t step) const {
-            if (step >= def::app::max_sequence_step) { return nullptr; }
-            auto bg = begin();
-            auto ed = end();
-            // upper_boundでstepより大きい最初の要素を見つける
-            auto it = std::upper_bound( bg
-                                      , ed
-                                      , step
-                                      , [](const auto& a, const auto& b) { return a < b.first; }
-                                      );
-            if (it == bg) { return nullptr; }
-            return --it;
-        }
-        sequence_chord_desc_t getStepDescriptor(uint16_t step) const {
-            // 指定した位置またはその直前のステップ情報を返す
-            auto it = find(step);
-            if (it != nullptr) { if (it->first <= step) { return it->second; } }
-            return sequence_chord_desc_t();
+        reg_sequence_timeline_t(void) : registry_base_t(0) {}
+        reg_sequence_timeline_t(const reg_sequence_timeline_t&) = delete;
+        ~reg_sequence_timeline_t(void);
+
+        void init(bool psram = false) override {
+            registry_base_t::init(psram);
+            _psram = psram;
         }
 
-        // 指定したステップに対して値を設定する
-        bool setStepDescriptor(uint16_t step, const sequence_chord_desc_t& value) {
-            // 最大値チェック
-            if (step >= def::app::max_sequence_step) { return false; }
-            if (_data_count >= max_count()) { return false; }
+    protected:
+        struct chunk_t {
+            uint16_t count;
+            // 内容を変更するたびに進める世代番号。CRCの計算中に変更された場合に検出できるよう atomic とする
+            std::atomic<uint32_t> generation;
+            // チャンク内の要素のCRCと、その長さ分のシフト値 (crc_generation が generation と一致する場合に有効)
+            uint32_t crc_generation;
+            uint32_t crc;
+            uint32_t crc_shift;
+            value_type data[chunk_capacity];
+        };
 
-            // 対象ステップの要素を探索
-            auto it = find(step);
-            auto insert_pos = begin();
-            if (it != nullptr) {
-                if (it->first < step) {
-                    // 指定ステップより前の要素が見つかった場合、その次の位置に挿入する
-                    insert_pos = it + 1;
-                } else {
-                    // 指定ステップと同じ要素が見つかった場合、その位置に上書きする
-                    it->second = value;
-                    return true;
+    public:
+        class const_iterator {
+        public:
+            const_iterator(const reg_sequence_timeline_t* owner, size_t chunk_index, size_t index)
+            : _owner { owner }, _chunk_index { chunk_index }, _index { index } {}
+            const value_type& operator*(void) const { return _owner->_chunks[_chunk_index]->data[_index]; }
+            const value_type* operator->(void) const { return &_owner->_chunks[_chunk_index]->data[_index]; }
+            const_iterator& operator++(void) {
+                if (++_index >= _owner->_chunks[_chunk_index]->count) {
+                    ++_chunk_index;
+                    _index = 0;
                 }
-            } else {
-                // 指定ステップより前の要素が存在しない場合、先頭に挿入する
-                insert_pos = begin();
+                return *this;
             }
+            bool operator==(const const_iterator& rhs) const { return _chunk_index == rhs._chunk_index && _index == rhs._index; }
+            bool operator!=(const const_iterator& rhs) const { return !operator==(rhs); }
+        private:
+            const reg_sequence_timeline_t* _owner;
+            size_t _chunk_index;
+            size_t _index;
+        };
+        const_iterator begin(void) const { return const_iterator(this, 0, 0); }
+        const_iterator end(void) const { return const_iterator(this, _chunk_count, 0); }
+        size_t size(void) const { return _data_count; }
 
-            // 挿入位置以降の要素を1つ後ろにシフトする
-            auto e = end();
-            for (auto shift_it = e; shift_it != insert_pos; ) {
-                --shift_it;
-                *(shift_it + 1) = *shift_it;
-            }
-            // 新しい要素を挿入する
-            insert_pos->first = step;
-            insert_pos->second = value;
-            ++_data_count;
-            return true;
-        }
-        void clear(void) { _data_count = 0; }
-        void deleteAfter(uint16_t step) {
-            // 指定したステップ以降のデータを削除する
+        // 指定したステップと同値かそれより小さい最大のステップを持つ要素のイテレータを返す。無い場合は end()
+        const_iterator find(uint16_t step) const;
+
+        sequence_chord_desc_t getStepDescriptor(uint16_t step) const {
+            // 指定した位置またはその直前のステップ情報を返す
+            if (step >= def::app::max_sequence_step) { return sequence_chord_desc_t(); }
             auto it = find(step);
-            if (it != nullptr) {
-                if (it->first < step) {
-                    ++it;
-                }
-                size_t index = it - begin();
-                _data_count = index;
-            }
+            if (it != end()) { return it->second; }
+            return sequence_chord_desc_t();
         }
+        // 連続した count 個のステップ情報を dst に取得する。探索は先頭の1回のみ行い、以降は順に辿る
+        void getStepDescriptors(int32_t step, sequence_chord_desc_t* dst, size_t count) const;
+
+        // 指定したステップに対して値を設定する
+        bool setStepDescriptor(uint16_t step, const sequence_chord_desc_t& value);
+        void clear(void);
+        // 指定したステップ以降のデータを削除する
+        void deleteAfter(uint16_t step);
         bool saveJson(JsonVariant &json);
         bool loadJson(const JsonVariant &json);
-        uint32_t crc32(uint32_t crc_init) const override {
-            return calc_crc32(_reg_data, _data_count * sizeof(std::pair<uint32_t, sequence_chord_desc_t>), crc_init);
-        }
-        void assign(const reg_sequence_timeline_t &src) {
-            _data_count = src._data_count;
-            memcpy(_reg_data, src._reg_data, _registry_size);
+        // 変更のあったチャンクのみCRCを再計算し、チャンクごとのCRCを連結して全体のCRCを求める
+        uint32_t crc32(uint32_t crc_init) const override;
+        size_t crc32_length(void) const override {
+            return _data_count * sizeof(value_type);
         }
+        void assign(const reg_sequence_timeline_t &src);
 
     protected:
+        chunk_t* _allocChunk(void);
+        // 使わなくなったチャンクを空きリストへ戻す
+        void _releaseChunk(chunk_t* chunk);
+        bool _allocTable(void);
+        bool _insertChunk(size_t chunk_index, chunk_t* chunk);
+        // チャンクの内容の変更を記録する (チャンクのCRCキャッシュを無効化する)
+        static void _markChunkModified(chunk_t* chunk) { chunk->generation.fetch_add(1, std::memory_order_release); }
+        // 指定したステップが含まれるべきチャンクの番号を返す
+        size_t _findChunk(uint16_t step) const;
+
+        chunk_t** _chunks = nullptr;
+        chunk_t** _free_chunks = nullptr;
+        size_t _chunk_count = 0;
+        size_t _free_count = 0;
         size_t _data_count = 0;
+        bool _psram = false;
     };
 #if 0
     // シーケンス演奏パターン情報
@@ -1145,8 +1267,8 @@ protected:
             timeline.clear();
         }
         uint32_t crc32(uint32_t crc) const {
-            crc = info.crc32(crc);
-            crc = timeline.crc32(crc);
+            crc = info.crc32_cached(crc);
+            crc = timeline.crc32_cached(crc);
             return crc;
         }
         sequence_chord_desc_t getStepDescriptor(uint16_t step) const {
@@ -1155,6 +1277,15 @@ protected:
             }
             return timeline.getStepDescriptor(step);
         }
+        // 連続した count 個のステップ情報を取得する。範囲外のステップは空の情報とする
+        void getStepDescriptors(int32_t step, sequence_chord_desc_t* dst, size_t count) const {
+            timeline.getStepDescriptors(step, dst, count);
+            int32_t length = info.getLength();
+            for (size_t i = 0; i < count; ++i) {
+                int32_t s = step + (int32_t)i;
+                if (s < 0 || s >= length) { dst[i] = sequence_chord_desc_t(); }
+            }
+        }
         void setStepDescriptor(uint16_t step, const sequence_chord_desc_t& value) {
             if (step >= def::app::max_sequence_step) {
                 return;
@@ -1182,18 +1313,27 @@ protected:
         reg_command_request_t(void) : registry_base_t(64) {}
         enum index_t : uint16_t {
             COMMAND_RELEASED = 0,
+            COMMAND_RELEASED_FORWARDED = 1, // 演奏タスクへ直接送信済みのコマンド (通知のみ)
             COMMAND_PRESSED = 2,
+            COMMAND_PRESSED_FORWARDED = 3,  // 演奏タスクへ直接送信済みのコマンド (通知のみ)
         };
 
-        bool getQueue(history_code_t *code, def::command::command_param_t *command_param, bool *is_pressed) {
-            auto history = getHistory(*code);
-            if (history == nullptr) { return false; }
-            *command_param = static_cast<def::command::command_param_t>(history->value);
-            *is_pressed = history->index == COMMAND_PRESSED;
+        // 上位ビットには遅延計測用のトレース番号と入力元を格納する (0 はトレースなし・入力元不明)
+        bool getQueue(history_code_t *code, def::command::command_param_t *command_param, bool *is_pressed, uint8_t *trace_id = nullptr, bool *forwarded = nullptr, uint8_t *input_source = nullptr) {
+            history_t history;
+            if (!getHistory(*code, history)) { return false; }
+            *command_param = static_cast<def::command::command_param_t>((uint16_t)history.value);
+            *is_pressed = history.index & COMMAND_PRESSED;
+            if (trace_id) { *trace_id = history.value >> 16; }
+            if (forwarded) { *forwarded = history.index & COMMAND_RELEASED_FORWARDED; }
+            if (input_source) { *input_source = history.value >> 24; }
             return true;
         }
-        void addQueue(const def::command::command_param_t& command_param, bool is_pressed = true)
-        { set16(is_pressed ? COMMAND_PRESSED : COMMAND_RELEASED, command_param.raw, true); }
+        void addQueue(const def::command::command_param_t& command_param, bool is_pressed = true, uint8_t trace_id = 0, uint8_t input_source = 0)
+        { set32(is_pressed ? COMMAND_PRESSED : COMMAND_RELEASED, command_param.raw | (trace_id << 16) | (input_source << 24), true); }
+        // 演奏タスクへ直接送信したコマンドを、操作履歴の更新のために通知する
+        void addForwarded(const def::command::command_param_t& command_param, bool is_pressed)
+        { set16(is_pressed ? COMMAND_PRESSED_FORWARDED : COMMAND_RELEASED_FORWARDED, command_param.raw, true); }
 
         void addQueueW(const def::command::command_param_t& command_param) {
             addQueue(command_param, true);
@@ -1201,6 +1341,91 @@ protected:
         }
     };
 
+    // 演奏操作のコマンドを task_commander から task_kantanplay へ直接渡すキュー (単一書込み・単一読出し)
+    // operator_command と player_command を経由する2回のタスク切替を省いて、押下から発音予約までの遅延を短縮する。
+    // オペレータ経由のコマンドとの順序を保つため、追加時点の operator_command の履歴コードを記録しておき、
+    // オペレータがそこまで処理を終えるまでは取り出さない。
+    // また、オペレータは直接送信済みのコマンドの位置を player_command に通知として追加する。
+    // 演奏部がこの通知を読んだ時点で未処理であれば取り出し、後から送信されたオペレータ経由のコマンドに追い越されないようにする。
+    struct reg_player_direct_command_t : public registry_base_t {
+#if __has_include (<freertos/FreeRTOS.h>)
+        using registry_base_t::setNotifyTaskHandle;
+#endif
+        reg_player_direct_command_t(void) : registry_base_t(0) {}
+
+        // 直接送信の対象となるコマンドか否か
+        static bool isTarget(const def::command::command_param_t& command_param) {
+            switch (command_param.getCommand()) {
+            case def::command::set_velocity:
+            case def::command::chord_degree:
+            case def::command::note_button:
+            case def::command::drum_button:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // 書込み側 (task_commander) キューが満杯の場合は false を返すので、通常の経路で送信すること
+        bool addQueue(const def::command::command_param_t& command_param, bool is_pressed, uint8_t trace_id, uint8_t input_source, history_code_t operator_code) {
+            uint32_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) >= max_queue) { return false; }
+            auto entry = &_queue[tail & (max_queue - 1)];
+            entry->value = command_param.raw | (trace_id << 16) | (is_pressed << 24) | ((input_source & 0x7F) << 25);
+            entry->operator_code = operator_code;
+            _tail.store(tail + 1, std::memory_order_release);
+            _execNotify();
+            return true;
+        }
+
+        // 読出し側 (task_kantanplay) 取り出せる状態か否か。player_command より先に確認すること
+        bool isReady(void) const {
+            uint32_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire)) { return false; }
+            return (int32_t)(_operator_code.load(std::memory_order_acquire) - _queue[head & (max_queue - 1)].operator_code) >= 0;
+        }
+        bool getQueue(def::command::command_param_t *command_param, bool *is_pressed, uint8_t *trace_id, uint8_t *input_source) {
+            uint32_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire)) { return false; }
+            uint32_t value = _queue[head & (max_queue - 1)].value;
+            _head.store(head + 1, std::memory_order_release);
+            *command_param = static_cast<def::command::command_param_t>((uint16_t)value);
+            *trace_id = value >> 16;
+            *is_pressed = (value >> 24) & 1;
+            *input_source = value >> 25;
+            return true;
+        }
+
+        // 読出し側 player_command から直接送信のコマンドの位置を示す通知を取り出した時に呼ぶ
+        // 該当するコマンドを既に取り出していれば false を返す
+        bool getQueueAtMarker(def::command::command_param_t *command_param, bool *is_pressed, uint8_t *trace_id, uint8_t *input_source) {
+            // 通知は直接送信したコマンドと同じ順に届くため、通知の通し番号がキューの読出し位置より前であれば処理済み
+            uint32_t marker = _marker++;
+            if ((int32_t)(marker - _head.load(std::memory_order_relaxed)) < 0) { return false; }
+            return getQueue(command_param, is_pressed, trace_id, input_source);
+        }
+
+        // オペレータ側 operator_command の処理済み位置を更新する
+        void setOperatorCode(history_code_t code) {
+            _operator_code.store(code, std::memory_order_release);
+            // オペレータの処理待ちのコマンドがあれば演奏タスクを起こす
+            if (_head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_acquire)) { _execNotify(); }
+        }
+
+    private:
+        static constexpr const size_t max_queue = 32;
+        struct entry_t {
+            uint32_t value;
+            history_code_t operator_code;
+        };
+        entry_t _queue[max_queue];
+        std::atomic<uint32_t> _head { 0 };
+        std::atomic<uint32_t> _tail { 0 };
+        std::atomic<history_code_t> _operator_code { 0 };
+        // 読出し側が受け取った位置の通知の数
+        uint32_t _marker = 0;
+    };
+
     struct reg_song_info_t : public registry_t {
         reg_song_info_t(void) : registry_t(8, 0, DATA_SIZE_8) {}
         enum index_t : uint16_t {
@@ -1226,9 +1451,46 @@ protected:
         }
     };
 
+    // グルーブテンプレート (ステップ毎のタイミングのずれとベロシティの倍率)
+    struct reg_song_groove_t : public registry_t {
+        reg_song_groove_t(void) : registry_t(4 + def::app::max_groove_step * 2, 0, DATA_SIZE_8) {}
+        enum index_t : uint16_t {
+            STEPS,
+            TIMING_0 = 4,
+            VELOCITY_0 = TIMING_0 + def::app::max_groove_step,
+        };
+        // テンプレートのステップ数 (16 または 32、0 はグルーブ無効)
+        void setSteps(uint8_t steps) { set8(STEPS, (steps == 16 || steps == 32) ? steps : 0); }
+        uint8_t getSteps(void) const { return get8(STEPS); }
+        // タイミングのずれ (1ステップの長さに対する百分率 -50 ~ +50、正の値で遅らせる)
+        void setTiming(uint8_t step, int percent) {
+            if (step >= def::app::max_groove_step) { return; }
+            if (percent < -def::app::groove_timing_percent_max) { percent = -def::app::groove_timing_percent_max; }
+            if (percent >  def::app::groove_timing_percent_max) { percent =  def::app::groove_timing_percent_max; }
+            set8(TIMING_0 + step, (uint8_t)(int8_t)percent);
+        }
+        int8_t getTiming(uint8_t step) const { return step < def::app::max_groove_step ? (int8_t)get8(TIMING_0 + step) : 0; }
+        // ベロシティの倍率 (百分率 0 ~ 200)
+        void setVelocity(uint8_t step, int percent) {
+            if (step >= def::app::max_groove_step) { return; }
+            if (percent < 0) { percent = 0; }
+            if (percent > def::app::groove_velocity_percent_max) { percent = def::app::groove_velocity_percent_max; }
+            set8(VELOCITY_0 + step, percent);
+        }
+        uint8_t getVelocity(uint8_t step) const { return step < def::app::max_groove_step ? get8(VELOCITY_0 + step) : 100; }
+        void reset(void) {
+            setSteps(0);
+            for (int i = 0; i < def::app::max_groove_step; ++i) {
+                setTiming(i, 0);
+                setVelocity(i, 100);
+            }
+        }
+    };
+
     // ソングデータ
     struct song_data_t {
         reg_song_info_t song_info;
+        reg_song_groove_t groove;
         sequence_data_t sequence;
 
         kanplay_slot_t slot[def::app::max_slot];
@@ -1241,6 +1503,7 @@ protected:
 
         void init(bool psram = false) {
             song_info.init(psram);
+            groove.init(psram);
             sequence.init(true);
             for (int i = 0; i < def::app::max_slot; ++i) {
                 slot[i].init(psram);
@@ -1250,13 +1513,18 @@ protected:
             }
         }
         uint32_t crc32(uint32_t crc = 0) const {
-            crc = song_info.crc32(crc);
+            // 各レジストリのCRCはキャッシュされ、変更されたものだけが再計算される
+            crc = song_info.crc32_cached(crc);
+            // グルーヴ未使用の場合は含めず、グルーヴ導入前のソングとCRCが一致するようにする
+            if (groove.getSteps() != 0) {
+                crc = groove.crc32_cached(crc);
+            }
             crc = sequence.crc32(crc);
             for (int i = 0; i < def::app::max_slot; ++i) {
                 crc = slot[i].crc32(crc);
             }
             for (int i = 0; i < def::app::max_chord_part; ++i) {
-                crc = chord_part_drum[i].crc32(crc);
+                crc = chord_part_drum[i].crc32_cached(crc);
             }
             return crc;
         }
@@ -1269,6 +1537,7 @@ protected:
 
         bool assign(const song_data_t &src) {
             song_info.assign(src.song_info);
+            groove.assign(src.groove);
             sequence.assign(src.sequence);
             for (int i = 0; i < def::app::max_slot; ++i) {
                 slot[i].assign(src.slot[i]);
@@ -1280,6 +1549,7 @@ protected:
         }
         void reset(void) {
             song_info.reset();
+            groove.reset();
             sequence.reset();
             for (int i = 0; i < def::app::max_slot; ++i) {
                 slot[i].reset();
@@ -1292,6 +1562,7 @@ protected:
         // 比較オペレータ
         bool operator== (const song_data_t &src) const {
             if (song_info != src.song_info) { return false; }
+            if (groove != src.groove) { return false; }
             if (sequence.info != src.sequence.info) { return false; }
             for (int i = 0; i < def::app::max_slot; ++i) {
                 if (slot[i] != src.slot[i]) { return false; }
@@ -1437,9 +1708,9 @@ protected:
             midinote.init(psram);
         }
         uint32_t crc32(uint32_t crc = 0) const {
-            crc = internal.crc32(crc);
-            crc = external.crc32(crc);
-            crc = midinote.crc32(crc);
+            crc = internal.crc32_cached(crc);
+            crc = external.crc32_cached(crc);
+            crc = midinote.crc32_cached(crc);
             return crc;
         }
         size_t saveJSON(uint8_t* data, size_t data_length);
@@ -1467,6 +1738,7 @@ protected:
 
     reg_command_request_t  operator_command;    // コマンダーからオペレータへの全体的な動作指示
     reg_command_request_t  player_command;      // オペレータから演奏部への指示に限定したコマンド
+    reg_player_direct_command_t player_direct_command; // コマンダーから演奏部へ直接渡す演奏操作コマンド
 
     reg_chord_play_t       chord_play;          // コード演奏情報
     song_data_t            song_data;           // 演奏対象のソングデータ スロット1~8のデータ (保存用)
@@ -1506,6 +1778,13 @@ protected:
 
     void checkSongModified(void) const;
 
+    // コマンダーからコマンドを送信する。演奏操作のコマンドはオペレータを経由せず演奏部へ直接送信し、
+    // オペレータには操作履歴の更新のため送信済みとして通知する
+    void sendCommand(const def::command::command_param_t& command_param, bool is_pressed, uint8_t input_source, uint8_t trace_id = 0);
+
+    // 演奏部が処理するコマンドを取り出す。オペレータ経由のコマンドと直接送信のコマンドを、コマンダーが送信した順に返す
+    bool getPlayerCommand(registry_t::history_code_t* code, def::command::command_param_t* command_param, bool* is_pressed, uint8_t* trace_id, uint8_t* input_source);
+
     static constexpr const size_t raw_wave_length = 320;
     std::pair<uint8_t, uint8_t> raw_wave[raw_wave_length] = { { 128, 128 },};
     uint16_t raw_wave_pos = 0;
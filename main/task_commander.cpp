@@ -7,6 +7,7 @@
 
 #include "task_commander.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
@@ -27,10 +28,12 @@ class commander_t {
   const uint16_t _thresh_release;
   const uint8_t _bitlength = 1; // ボタンひとつあたりのビット数 (通常は 1。 アナログ扱いの PortB は 8bitとする) 
   const bool _use_internal_imu = false;
+  // 入力元 (演奏タスクで入力タイミングの傾向を入力元ごとに推定するために使用する)
+  const def::command::input_source_t _input_source;
 
 public:
 
-  commander_t(uint8_t bitlen, bool use_internal_imu, uint32_t chattering_bitmask)
+  commander_t(uint8_t bitlen, bool use_internal_imu, uint32_t chattering_bitmask, def::command::input_source_t input_source)
   : _chattering_target_bitmask { chattering_bitmask }
   , _mask_all       { (uint16_t)((1 << bitlen)- 1 ) }
   , _mask_single    { (uint16_t)( 1 <<(bitlen - 1)) }
@@ -38,6 +41,7 @@ public:
   , _thresh_release { (uint16_t)( _mask_all - _thresh_press ) }
   , _bitlength { bitlen }
   , _use_internal_imu { use_internal_imu }
+  , _input_source { input_source }
   {}
 
   void start(void)
@@ -124,7 +128,7 @@ public:
               if (velocity < 1) { velocity = 1; }
               if (velocity > 255) { velocity = 255; }
             }
-            system_registry->operator_command.addQueue( { def::command::set_velocity, velocity } );
+            system_registry->sendCommand( { def::command::set_velocity, velocity }, true, _input_source);
             break;
           }
         }
@@ -137,7 +141,7 @@ public:
 // M5_LOGV("command_param:%04x", command_param.raw);
         uint8_t command = command_param.getCommand();
         if (command == 0) { continue; }
-        system_registry->operator_command.addQueue(command_param, pressed);
+        system_registry->sendCommand(command_param, pressed, _input_source, latency_trace.begin(command_param, pressed));
       }
     }
     return delay_msec;
@@ -208,7 +212,7 @@ public:
               if (velocity < 1) { velocity = 1; }
               if (velocity > 255) { velocity = 255; }
             }
-            system_registry->operator_command.addQueue( { def::command::set_velocity, velocity } );
+            system_registry->sendCommand( { def::command::set_velocity, velocity }, true, _input_source);
             break;
           }
         }
@@ -221,7 +225,7 @@ public:
 // M5_LOGV("command_param:%04x", command_param.raw);
         uint8_t command = command_param.getCommand();
         if (command == 0) { continue; }
-        system_registry->operator_command.addQueue(command_param, pressed);
+        system_registry->sendCommand(command_param, pressed, _input_source, latency_trace.begin(command_param, pressed));
       }
     }
     return delay_msec;
@@ -259,7 +263,7 @@ public:
           case def::command::chord_degree:
           case def::command::note_button:
           case def::command::drum_button:
-            system_registry->operator_command.addQueue( { def::command::set_velocity, velocity } );
+            system_registry->sendCommand( { def::command::set_velocity, velocity }, true, _input_source);
             break;
           }
         }
@@ -272,7 +276,7 @@ public:
 // M5_LOGV("command_param:%04x", command_param.raw);
         uint8_t command = command_param.getCommand();
         if (command == 0) { continue; }
-        system_registry->operator_command.addQueue(command_param, pressed);
+        system_registry->sendCommand(command_param, pressed, _input_source, latency_trace.begin(command_param, pressed));
       }
     }
     return delay_msec;
@@ -280,9 +284,9 @@ public:
 #endif
 };
 
-static commander_t commander_internal { 1, true , (1 << def::hw::max_rgb_led) - 1};
-static commander_t commander_port_a   { 1, false, ~0u };
-static commander_t commander_port_b   { 8, false, ~0u };
+static commander_t commander_internal { 1, true , (1 << def::hw::max_rgb_led) - 1, def::command::insrc_internal };
+static commander_t commander_port_a   { 1, false, ~0u, def::command::insrc_port_a };
+static commander_t commander_port_b   { 8, false, ~0u, def::command::insrc_port_b };
 
 void task_commander_t::start(void)
 {
@@ -351,12 +355,12 @@ void task_commander_t::task_func(task_commander_t* me)
 
     bool hit = 0;
 
-    const registry_t::history_t* history = nullptr;
-    while (nullptr != (history = system_registry->internal_input.getHistory(me->_internal_input_history_code)))
+    registry_t::history_t history;
+    while (system_registry->internal_input.getHistory(me->_internal_input_history_code, history))
     {
       hit = true;
-      if (history->index == system_registry_t::reg_internal_input_t::BUTTON_BITMASK) {
-        auto result = commander_internal.update(history->value, M5.millis(), &system_registry->command_mapping_current);
+      if (history.index == system_registry_t::reg_internal_input_t::BUTTON_BITMASK) {
+        auto result = commander_internal.update(history.value, M5.millis(), &system_registry->command_mapping_current);
         if (delay_msec > result) {
           delay_msec = result;
         }
@@ -370,18 +374,18 @@ void task_commander_t::task_func(task_commander_t* me)
     }
 
     bool hit_a = false, hit_b = false;
-    while (nullptr != (history = system_registry->external_input.getHistory(me->_external_input_history_code)))
+    while (system_registry->external_input.getHistory(me->_external_input_history_code, history))
     {
-      if (history->index == system_registry_t::reg_external_input_t::PORTA_BITMASK_BYTE0) {
+      if (history.index == system_registry_t::reg_external_input_t::PORTA_BITMASK_BYTE0) {
         hit_a = true;
-        auto result = commander_port_a.update(history->value, M5.millis(), &system_registry->command_mapping_external);
+        auto result = commander_port_a.update(history.value, M5.millis(), &system_registry->command_mapping_external);
         if (delay_msec > result) {
           delay_msec = result;
         }
       } else
-      if (history->index == system_registry_t::reg_external_input_t::PORTB_BITMASK_BYTE0) {
+      if (history.index == system_registry_t::reg_external_input_t::PORTB_BITMASK_BYTE0) {
         hit_b = true;
-        auto result = commander_port_b.update(history->value, M5.millis(), &system_registry->command_mapping_port_b);
+        auto result = commander_port_b.update(history.value, M5.millis(), &system_registry->command_mapping_port_b);
         if (delay_msec > result) {
           delay_msec = result;
         }
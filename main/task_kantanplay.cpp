@@ -7,17 +7,50 @@
 
 #include "task_kantanplay.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
 
-#include "kantan-music/include/KANTANMusic.h"
+#if defined (M5UNIFIED_PC_BUILD)
+#include <thread>
+#include <chrono>
+#endif
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 
-void task_kantanplay_t::start(void)
+// 演奏ステップの処理で書き込むレジストリの変更通知をまとめ、購読タスクの起床をステップ毎に1回にする
+struct step_batch_t {
+  registry_batch_t<registry_base_t> chord_play { system_registry->chord_play };
+  registry_batch_t<registry_base_t> runtime_info { system_registry->runtime_info };
+  registry_batch_t<registry_base_t> midi_out_control { system_registry->midi_out_control };
+  registry_batch_t<system_registry_t::reg_working_command_t> working_command { system_registry->working_command };
+
+  // 上記レジストリの通知要求数(まとめる前)と通知数(まとめた後)の累計
+  static uint32_t getRequestCount(void) {
+    return system_registry->chord_play.getNotifyRequestCount()
+         + system_registry->runtime_info.getNotifyRequestCount()
+         + system_registry->midi_out_control.getNotifyRequestCount()
+         + system_registry->working_command.getNotifyRequestCount();
+  }
+  static uint32_t getNotifyCount(void) {
+    return system_registry->chord_play.getNotifyCount()
+         + system_registry->runtime_info.getNotifyCount()
+         + system_registry->midi_out_control.getNotifyCount()
+         + system_registry->working_command.getNotifyCount();
+  }
+};
+
+void task_kantanplay_t::init(uint32_t usec)
 {
-  memset(_midi_pitch_manage, 0xFF, sizeof(_midi_pitch_manage));
+  memset(_midi_pitch_manage, 0, sizeof(_midi_pitch_manage));
+  _pitch_event.clear();
+
+  _prev_usec = usec;
+  _current_usec = usec;
+}
 
-  _current_usec = M5.micros();
+void task_kantanplay_t::start(void)
+{
+  init(M5.micros());
 
 #if defined (M5UNIFIED_PC_BUILD)
   auto thread = SDL_CreateThread((SDL_ThreadFunction)task_func, "kanplay", this);
@@ -25,49 +58,154 @@ void task_kantanplay_t::start(void)
   TaskHandle_t handle = nullptr;
   xTaskCreatePinnedToCore((TaskFunction_t)task_func, "kanplay", 1024*3, this, def::system::task_priority_kantanplay, &handle, def::system::task_cpu_kantanplay);
   system_registry->player_command.setNotifyTaskHandle(handle);
+  system_registry->player_direct_command.setNotifyTaskHandle(handle);
 #endif
 }
 
+#if !defined (M5UNIFIED_PC_BUILD)
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+static void IRAM_ATTR wake_timer_callback(void* arg)
+{
+  BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR((TaskHandle_t)arg, &xHigherPriorityTaskWoken);
+  if (xHigherPriorityTaskWoken) {
+    portYIELD_FROM_ISR();
+  }
+}
+#else
+static void wake_timer_callback(void* arg)
+{
+  xTaskNotifyGive((TaskHandle_t)arg);
+}
+#endif
+#endif
+
+// 時刻を usec に進めて、自動演奏・発音消音の処理を1回行う
+uint32_t task_kantanplay_t::procTick(uint32_t usec)
+{
+  sustainProc();
+  _prev_usec = _current_usec;
+  _current_usec = usec;
+  auto next1 = autoProc();
+  auto next2 = chordProc();
+  return next1 < next2 ? next1 : next2;
+}
+
+uint32_t task_kantanplay_t::procStep(uint32_t usec)
+{
+  uint32_t next_usec;
+  do {
+    next_usec = procTick(usec);
+  } while (commandProccessor());
+  _trace_id = 0;
+  prefetchStepPlan();
+  prewarmChannelState();
+  return next_usec;
+}
+
 void task_kantanplay_t::task_func(task_kantanplay_t* me)
 {
+#if !defined (M5UNIFIED_PC_BUILD)
+  // 次回イベント時刻に正確に起床するため、ティック単位の待機ではなく高分解能タイマーを使用する
+  {
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = wake_timer_callback;
+    timer_args.arg = xTaskGetCurrentTaskHandle();
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+    timer_args.dispatch_method = ESP_TIMER_ISR;
+#else
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+#endif
+    timer_args.name = "kanplay";
+    if (ESP_OK != esp_timer_create(&timer_args, &me->_wake_timer)) {
+      M5_LOGE("kanplay: wake timer create failed");
+      me->_wake_timer = nullptr;
+    }
+  }
+#endif
+
   for (;;) {
     uint32_t next_usec;
     do {
-      me->sustainProc();
-      me->_prev_usec = me->_current_usec;
-      me->_current_usec = M5.micros();
-      auto next1 = me->autoProc();
-      auto next2 = me->chordProc();
-      next_usec = next1 < next2 ? next1 : next2;
+      next_usec = me->procTick(M5.micros());
     } while (me->commandProccessor());
+    me->_trace_id = 0;
+
+    // 待機に入る前に、この先のステップの発音予定を作成しておく
+    me->prefetchStepPlan();
+    // スロットやソングが切り替わっていれば、次の発音より先に音色と音量を送信しておく
+    me->prewarmChannelState();
+
+    // 次回イベントの予定時刻
+    const uint32_t deadline_usec = me->_current_usec + next_usec;
+    const bool has_deadline = next_usec < INT32_MAX;
 
 #if !defined (M5UNIFIED_PC_BUILD)
     if (ulTaskNotifyTake(pdTRUE, 0) == false)
 #endif
     {
+      int32_t wait_usec = (int32_t)(deadline_usec - M5.micros());
 #if defined (M5UNIFIED_PC_BUILD)
-      M5.delay(1);
+      // PCビルドではコマンド通知がないため、1msec以内の間隔でコマンドを確認しつつ予定時刻まで待機する
+      if (wait_usec > 1000) { wait_usec = 1000; }
+      if (wait_usec > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(wait_usec));
+      }
+      if (has_deadline) {
+        int32_t late_usec = (int32_t)(M5.micros() - deadline_usec);
+        if (late_usec >= 0) {
+          system_registry->task_status.addPlayerJitter(late_usec);
+        }
+      }
 #else
-      int next_msec = (next_usec + 128) >> 10;
-      if (next_msec)
+      if (wait_usec > 0)
       {
+        bool timer_started = false;
+        if (has_deadline && me->_wake_timer != nullptr) {
+          timer_started = (ESP_OK == esp_timer_start_once(me->_wake_timer, wait_usec));
+        }
         system_registry->task_status.setSuspend(system_registry_t::reg_task_status_t::bitindex_t::TASK_KANTANPLAY);
-        ulTaskNotifyTake(pdTRUE, next_msec);
+        if (timer_started || !has_deadline) {
+          ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        } else {
+          // タイマーが使用できない場合はティック単位で待機する
+          ulTaskNotifyTake(pdTRUE, (wait_usec + 128) >> 10);
+        }
         system_registry->task_status.setWorking(system_registry_t::reg_task_status_t::bitindex_t::TASK_KANTANPLAY);
+        if (timer_started) {
+          esp_timer_stop(me->_wake_timer);
+          // 予定時刻以降に起床した場合のみ遅れを記録する (コマンド通知による早期起床は除外)
+          int32_t late_usec = (int32_t)(M5.micros() - deadline_usec);
+          if (late_usec >= 0) {
+            system_registry->task_status.addPlayerJitter(late_usec);
+          }
+        }
       } else {
         taskYIELD();
       }
-      #endif
+#endif
     }
   }
 }
 
+uint8_t task_kantanplay_t::takeTraceId(void)
+{
+  auto trace_id = _trace_id;
+  if (trace_id) {
+    _trace_id = 0;
+    latency_trace.mark(trace_id, latency_trace_t::stage_note);
+  }
+  return trace_id;
+}
+
 bool task_kantanplay_t::commandProccessor(void)
 {
   def::command::command_param_t command_param;
   bool is_pressed;
-  if (false == system_registry->player_command.getQueue(&_player_command_history_code, &command_param, &is_pressed))
-  { return false; }
+  if (!system_registry->getPlayerCommand(&_player_command_history_code, &command_param, &is_pressed, &_trace_id, &_input_source)) {
+    return false;
+  }
+  latency_trace.mark(_trace_id, latency_trace_t::stage_player);
 // printf("commandProccessor: %d, %d, isPressed %d\n", command_param.getCommand(), command_param.getParam(), is_pressed);
   switch (command_param.getCommand()) {
   default:
@@ -236,12 +374,8 @@ void task_kantanplay_t::sustainProc(void)
   }
   _sustain_state = sustain_state;
 
-  int32_t release_usec = 0; 
-  if (sustain_state == def::play::sustain_state_t::sustain_on)
-  {
-    // ノートオフの予定時間を最大値(約2000秒)にすることで実質的にノートオフを無効化する
-    release_usec = INT32_MAX; 
-  } else {
+  bool sustain_on = (sustain_state == def::play::sustain_state_t::sustain_on);
+  if (!sustain_on) {
     // 動作中のコードボタンの表示を解除
     system_registry->working_command.clear( { def::command::chord_degree, _current_option.main_degree } );
   }
@@ -251,8 +385,15 @@ void task_kantanplay_t::sustainProc(void)
     for (int part = 0; part < def::app::max_chord_part; ++part) {
       for (int pitch = 0; pitch < def::app::max_pitch_with_drum; ++pitch) {
         auto manage = &_midi_pitch_manage[part][pitch][max_manage_history - 1];
-        if (manage->release_usec >= 0) {
-          manage->release_usec = release_usec;
+        if (manage->flags & pm_release_pending) {
+          if (sustain_on) {
+            // 消音時刻を未定にすることでノートオフを無効化する
+            manage->flags |= pm_release_hold;
+          } else {
+            manage->flags &= ~pm_release_hold;
+            manage->release_usec = _current_usec;
+            pushPitchEvent(part, pitch, manage, true);
+          }
         }
       }
     }
@@ -284,8 +425,10 @@ uint32_t task_kantanplay_t::autoProc(void)
         if (_current_beat_index < step_per_beat - 1) {
           remain_usec += _auto_play_offbeat_cycle_usec[1 & _current_beat_index];
         }
-        // オフビートの演奏を行う
+        // オフビートの演奏を行う (グルーブのために前倒しした分は発音を遅らせる)
+        _groove_lead_usec = _auto_play_offbeat_lead_usec;
         chordBeat(false);
+        _groove_lead_usec = 0;
       }
     }
     _auto_play_offbeat_remain_usec = remain_usec;
@@ -298,7 +441,9 @@ uint32_t task_kantanplay_t::autoProc(void)
   if (_auto_play_onbeat_remain_usec >= 0) {
     int remain_usec = _auto_play_onbeat_remain_usec - progress_usec;
     if (remain_usec < 0) {
-      _auto_play_input_tolerating_remain_usec = def::app::input_tolerating_msec * 1000 + remain_usec;
+      // 今回のオンビートの予定時刻
+      const uint32_t beat_usec = _current_usec + remain_usec;
+      _auto_play_input_tolerating_remain_usec = def::app::input_tolerating_max_msec * 1000 + remain_usec;
       auto autoplay_state = system_registry->runtime_info.getGuiAutoplayState();
       if (autoplay_state == def::play::auto_play_state_t::auto_play_running)
       {
@@ -321,6 +466,18 @@ uint32_t task_kantanplay_t::autoProc(void)
         // 次回のオンビート自動演奏までの時間を更新する
         remain_usec += onbeat_cycle_usec;
 
+        if (midi_clock_in.isRunning() && midi_clock_in.isLocked(_current_usec)) {
+          // 外部MIDIクロックに同期中は、クロックから推定した次の拍の頭に合わせる
+          // (推定値はPLLで平滑化されているため、拍毎の補正量は小さい)
+          int32_t clock_remain_usec = midi_clock_in.getNextBeatRemainUsec(_current_usec);
+          if (clock_remain_usec >= 0) {
+            remain_usec = clock_remain_usec;
+          }
+        }
+
+        // MIDIクロックは拍の演奏より先に送信する
+        clockOutBeat(beat_usec);
+
         switch (system_registry->runtime_info.getSequenceMode()) {
         // オートソング(シーケンス演奏)の場合はステップを進める
         case def::seqmode::seq_auto_song:
@@ -345,59 +502,109 @@ uint32_t task_kantanplay_t::autoProc(void)
     }
   }
 
+  auto clock_remain_usec = clockOutProc();
+  if (next_event_timing > clock_remain_usec) {
+    next_event_timing = clock_remain_usec;
+  }
+
   return next_event_timing;
 }
 
+void task_kantanplay_t::sendClockTick(uint32_t count)
+{
+  if (count == 0) { return; }
+  registry_batch_t<registry_base_t> batch { system_registry->midi_out_control };
+  do {
+    system_registry->midi_out_control.setMessage(0xF8, 0); // Timing Clock
+  } while (--count);
+}
+
+void task_kantanplay_t::clockOutBeat(uint32_t beat_usec)
+{
+  if (system_registry->midi_port_setting.getClockOutPorts() == 0) { return; }
+  if (!_clock_out.isActive()) {
+    if (_clock_out_paused) {
+      // 一時停止からの再開は、停止した位置を通知してから Continue を送信する
+      system_registry->midi_out_control.setMessage(0xF2, _clock_out_position & 0x7F, (_clock_out_position >> 7) & 0x7F);
+      system_registry->midi_out_control.setMessage(0xFB, 0); // Continue
+    } else {
+      _clock_out_position = 0;
+      system_registry->midi_out_control.setMessage(0xFA, 0); // Start
+    }
+    _clock_out_paused = false;
+  }
+  sendClockTick(_clock_out.beat(beat_usec));
+}
+
+uint32_t task_kantanplay_t::clockOutProc(void)
+{
+  if (!_clock_out.isActive()) { return INT32_MAX; }
+
+  auto autoplay_state = system_registry->runtime_info.getGuiAutoplayState();
+  if (autoplay_state != def::play::auto_play_state_t::auto_play_running
+   || system_registry->midi_port_setting.getClockOutPorts() == 0) {
+    // 自動演奏が止まったらクロックの送信を停止する
+    system_registry->midi_out_control.setMessage(0xFC, 0); // Stop
+    _clock_out_paused = (autoplay_state == def::play::auto_play_state_t::auto_play_paused);
+    if (_clock_out_paused) {
+      // 送信済みの拍の次の拍から再開する
+      uint32_t position = _clock_out_position + (_clock_out.getBeatCount() + 1) * 4;
+      _clock_out_position = position < 0x3FFF ? position : 0x3FFF;
+    }
+    _clock_out.stop();
+    return INT32_MAX;
+  }
+
+  // オンビートの予定がない場合は次の拍の頭が決まるまで待つ
+  if (_auto_play_onbeat_remain_usec < 0) { return INT32_MAX; }
+  const uint32_t next_beat_usec = _current_usec + _auto_play_onbeat_remain_usec;
+  sendClockTick(_clock_out.update(_current_usec, next_beat_usec));
+  return _clock_out.getNextTickUsec(next_beat_usec) - _current_usec;
+}
+
 uint32_t task_kantanplay_t::chordProc(void)
 {
   uint32_t next_event_timing = INT32_MAX;
   const int progress_usec = (int32_t)(_current_usec - _prev_usec);
 
-  for (int part = 0; part < def::app::max_chord_part; ++part) {
-    bool hit_flg = false;
-    for (int pitch = 0; pitch < def::app::max_pitch_with_drum; ++pitch) {
-      for (int m = 0; m < max_manage_history; ++m) {
-        auto manage = &_midi_pitch_manage[part][pitch][m];
-
-        int press_usec = manage->press_usec;
-        if (press_usec >= 0) {
-          press_usec -= progress_usec;
-          if (press_usec < 0) {
-            auto note_number = manage->note_number;
-            auto midi_ch = manage->midi_ch;
-            auto velocity = manage->velocity;
-            if (velocity) {
-              velocity |= 0x80;
-              // system_registry->midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
-              system_registry->midi_out_control.setNoteVelocity(midi_ch, note_number, velocity);
-              hit_flg = true;
-            }
-          } else if (next_event_timing > press_usec) {
-            next_event_timing = press_usec;
-          }
-          manage->press_usec = press_usec;
-        }
-
-        int release_usec = manage->release_usec;
-        if (release_usec >= 0) {
-          release_usec -= progress_usec;
-          if (release_usec < 0) {
-            auto note_number = manage->note_number;
-            auto midi_ch = manage->midi_ch;
-            // 同じノートナンバーの音が他のピッチで鳴っていない場合は音を停止する
-            if (0 == checkOtherPitchNote(part, pitch, midi_ch, note_number)) {
-              system_registry->midi_out_control.setNoteVelocity(manage->midi_ch, manage->note_number, 0);
-            }
-            manage->note_number = 0xFF;
-            manage->velocity = 0;
-          } else if (next_event_timing > release_usec) {
-            next_event_timing = release_usec;
-          }
-          manage->release_usec = release_usec;
-        }
+  // 予定時刻に達したイベントだけをキューの先頭から取り出して処理する
+  uint32_t hit_part_bits = 0;
+  while (!_pitch_event.empty()) {
+    const auto event = _pitch_event.top();
+    auto manage = getPitchEventTarget(event);
+    if (manage != nullptr) {
+      int32_t remain_usec = (int32_t)(event.usec - _current_usec);
+      if (remain_usec > 0) {
+        next_event_timing = remain_usec;
+        break;
+      }
+    }
+    _pitch_event.pop();
+    if (manage == nullptr) { continue; } // 予定が変更・取消済みのイベントは読み捨てる
+
+    auto note_number = manage->note_number;
+    auto midi_ch = manage->midi_ch;
+    if (!event.is_release) {
+      manage->flags &= ~pm_press_pending;
+      auto velocity = manage->velocity;
+      if (velocity) {
+        velocity |= 0x80;
+        system_registry->midi_out_control.setNoteVelocity(midi_ch, note_number, velocity, takeTraceId());
+        manage->flags |= pm_sounding;
+        hit_part_bits |= 1 << event.part;
+      }
+    } else {
+      manage->flags &= ~(pm_press_pending | pm_release_pending);
+      // 同じノートナンバーの音が他のピッチで鳴っていない場合は音を停止する
+      if (releaseSoundingNote(event.part, event.pitch, manage)) {
+        system_registry->midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
       }
+      manage->note_number = 0xFF;
+      manage->velocity = 0;
     }
-    if (hit_flg) {
+  }
+  for (int part = 0; hit_part_bits; ++part, hit_part_bits >>= 1) {
+    if (hit_part_bits & 1) {
       system_registry->runtime_info.hitPartEffect(part);
     }
   }
@@ -436,6 +643,10 @@ void task_kantanplay_t::procChordDegree(const def::command::command_param_t& com
   const auto autoplay_state = system_registry->runtime_info.getGuiAutoplayState();
   const bool is_auto = autoplay_state == def::play::auto_play_state_t::auto_play_running;
 
+  if (is_auto && is_pressed) {
+    updateInputTiming();
+  }
+
   auto current_degree = system_registry->chord_play.getChordDegree();
   // 現在のDegreeと異なる場合
   if (current_degree != degree) {
@@ -445,13 +656,16 @@ void task_kantanplay_t::procChordDegree(const def::command::command_param_t& com
     }
     system_registry->chord_play.setChordDegree(degree);
 
-    if (is_auto && _auto_play_input_tolerating_remain_usec > 0) {
+    if (is_auto && isLateInput()) {
       auto step_per_beat = system_registry->current_slot->slot_info.getStepPerBeat();
       // 自動演奏でオモテ拍の直後にDegreeボタンが押された場合 (オフビートが鳴る前に押された場合)
       // ユーザーの演奏タイミングが遅れたものと見做してオモテ拍の処理を強制的に行うことで、
       // 演奏サイクルが乱れないようにする。
       _current_beat_index = step_per_beat - 1;
+      // 拍をやり直すだけなので、グルーブテンプレート上の位置は進めない
+      --_groove_beat;
 
+      step_batch_t batch;
       chordStepAdvance(true);
     }
   }
@@ -478,6 +692,41 @@ void task_kantanplay_t::procChordDegree(const def::command::command_param_t& com
   }
 }
 
+void task_kantanplay_t::updateInputTiming(void)
+{
+  if (_input_source >= def::command::max_input_source) { return; }
+
+  const int32_t window_usec = def::app::input_tolerating_max_msec * 1000;
+  int32_t offset_usec;
+  if (_auto_play_input_tolerating_remain_usec > 0) {
+    // 直前の拍より遅れた入力
+    offset_usec = window_usec - _auto_play_input_tolerating_remain_usec;
+  } else if (0 <= _auto_play_onbeat_remain_usec && _auto_play_onbeat_remain_usec < window_usec) {
+    // 次の拍より先走った入力
+    offset_usec = -_auto_play_onbeat_remain_usec;
+  } else {
+    // 拍から離れた入力は意図したタイミングと見做し、推定には使用しない
+    return;
+  }
+  auto timing = &_input_timing[_input_source];
+  timing->addSample(offset_usec);
+  system_registry->task_status.setInputTiming((def::command::input_source_t)_input_source, timing->getLatencyUsec(), timing->getDeviationUsec(), timing->getToleranceUsec(), timing->getSamples());
+}
+
+bool task_kantanplay_t::isLateInput(void)
+{
+  if (_auto_play_input_tolerating_remain_usec <= 0) { return false; }
+
+  // 拍の頭からの経過時間
+  int32_t elapsed_usec = def::app::input_tolerating_max_msec * 1000 - _auto_play_input_tolerating_remain_usec;
+  if (_input_source >= def::command::max_input_source) {
+    return elapsed_usec < def::app::input_tolerating_msec * 1000;
+  }
+  const uint_fast8_t step_per_beat = system_registry->current_slot->slot_info.getStepPerBeat();
+  int32_t step_cycle_usec = (step_per_beat > 1) ? getOnbeatCycle() / step_per_beat : 0;
+  return _input_timing[_input_source].isLateInput(elapsed_usec, step_cycle_usec);
+}
+
 void task_kantanplay_t::updateNextOptions(void)
 {
   _pressed_option.setModifier(system_registry->chord_play.getChordModifier());
@@ -580,7 +829,8 @@ void task_kantanplay_t::procChordBeat(const def::command::command_param_t& comma
         // ウラ拍のタイミングを更新する
         // _auto_play_offbeat_cycle_usecの配列0と1はスウィングを考慮したオフビートの時間間隔を保持する
         uint32_t step_cycle_usec = offbeat_cycle_usec;
-        _auto_play_offbeat_remain_usec = step_cycle_usec;
+        _auto_play_offbeat_lead_usec = _groove.getLeadUsec();
+        _auto_play_offbeat_remain_usec = step_cycle_usec - _auto_play_offbeat_lead_usec;
         _auto_play_offbeat_cycle_usec[0] = step_cycle_usec;
         _auto_play_offbeat_cycle_usec[1] = step_cycle_usec;
       }
@@ -599,11 +849,19 @@ void task_kantanplay_t::chordBeat(const bool on_beat)
   setSustain(false);
 
   do {
-    // アルペジエータのステップを進める
-    chordStepAdvance();
+    uint32_t request_count = step_batch_t::getRequestCount();
+    uint32_t notify_count = step_batch_t::getNotifyCount();
+    {
+      step_batch_t batch;
 
-    // 現在位置の演奏
-    chordStepPlay();
+      // アルペジエータのステップを進める
+      chordStepAdvance();
+
+      // 現在位置の演奏
+      chordStepPlay();
+    }
+    system_registry->task_status.setPlayerStepNotify(step_batch_t::getRequestCount() - request_count,
+                                                     step_batch_t::getNotifyCount() - notify_count);
   } while (--advance);
 }
 
@@ -641,6 +899,10 @@ int32_t task_kantanplay_t::getOnbeatCycle(void)
 // オンビート演奏の間隔を取得する (曲のテンポから計算する)
 int32_t task_kantanplay_t::getOnbeatCycleBySongTempo(void)
 {
+  // 外部MIDIクロックに同期中は、クロックから推定したテンポを曲のテンポとして扱う
+  if (midi_clock_in.isLocked(_current_usec)) {
+    return midi_clock_in.getBeatCycleUsec();
+  }
   auto tempo = system_registry->song_data.song_info.getTempo();
   if (tempo < def::app::tempo_bpm_min) { tempo = def::app::tempo_bpm_default; }
 
@@ -663,12 +925,24 @@ void task_kantanplay_t::updateOffbeatTiming(void)
     swing_0_usec = step_cycle_usec + (step_cycle_usec * swing / 10000);
     swing_1_usec = step_cycle_usec * 2 - swing_0_usec;
   }
+  // グルーブに前に突っ込むステップがある場合は、ウラ拍全体をその分だけ前倒しする
+  updateGroove();
+  _auto_play_offbeat_lead_usec = _groove.getLeadUsec();
+
   // オフビートの間隔を求める (スイングに対応させる)
-  _auto_play_offbeat_remain_usec = swing_0_usec;
+  _auto_play_offbeat_remain_usec = swing_0_usec - _auto_play_offbeat_lead_usec;
   _auto_play_offbeat_cycle_usec[0] = swing_1_usec;
   _auto_play_offbeat_cycle_usec[1] = swing_0_usec;
 }
 
+// グルーブテンプレートの表を現在のテンポに合わせる (テンプレートかテンポが変わった時のみ作り直される)
+void task_kantanplay_t::updateGroove(void)
+{
+  const uint_fast8_t step_per_beat = system_registry->current_slot->slot_info.getStepPerBeat();
+  if (step_per_beat == 0) { return; }
+  _groove.update(system_registry->song_data.groove, getOnbeatCycle() / step_per_beat);
+}
+
 // スイングの計算 (スイングのパラメータに基づいて、オモテ拍側の比率増加分を計算する)
 // 得られる値 0 - 3333 (オモテ拍の時間間隔にこの値を掛けて / 10000 するとスイング比率が反映された値になる)
 int32_t task_kantanplay_t::calcSwing_x100(void)
@@ -733,6 +1007,7 @@ void task_kantanplay_t::chordStepAdvance(bool disable_note_off)
   if (on_beat)
   { // オンビート (オモテ拍) の場合、アルペジエータを先頭に戻す判定を実施
     _current_beat_index = 0;
+    ++_groove_beat;
 
     // 先頭に戻すフラグ (強制的に戻す)
     bool force_reset = false;
@@ -771,6 +1046,11 @@ void task_kantanplay_t::chordStepAdvance(bool disable_note_off)
       system_registry->working_command.set( { def::command::chord_degree, _current_option.main_degree.getDegree() } );
     }
 
+    // 強制的に先頭に戻す場合はグルーブテンプレートも先頭から適用する
+    if (force_reset) {
+      _groove_beat = 0;
+    }
+
     uint_fast8_t enabledCounter = 0;
     uint_fast8_t firstStepCounter = 0;
 // printf("DEBUG 2 : %d \n", step_reset);
@@ -883,136 +1163,253 @@ void task_kantanplay_t::chordStepAdvance(bool disable_note_off)
   }
 }
 
-void task_kantanplay_t::chordStepPlay(void)
+// 現在の演奏オプションからノート番号計算用のオプションを設定し、スロットのキーを返す
+int task_kantanplay_t::makeNoteOptions(KANTANMusic_GetMidiNoteNumberOptions* options)
 {
-  auto degree = _current_option.main_degree;  //system_registry->chord_play.getChordDegree();
-  if (degree.getDegree() == 0) {
-    // コードが選ばれていない場合は終了
-    return;
-  }
   int master_key = system_registry->runtime_info.getMasterKey();
   int slot_key = master_key + (int8_t)system_registry->current_slot->slot_info.getKeyOffset();
   while (slot_key < 0) { slot_key += 12; }
   while (slot_key >= 12) { slot_key -= 12; }
 
-  KANTANMusic_GetMidiNoteNumberOptions options;
-  KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(&options);
-  options.minor_swap          = _current_option.getMinorSwap();
-  options.semitone_shift      = _current_option.getSemitoneShift();
-  options.modifier            = _current_option.getModifier();
-  options.bass_degree         = _current_option.getBassDegree();
-  options.bass_semitone_shift = _current_option.getBassSemitoneShift();
+  KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(options);
+  options->minor_swap          = _current_option.getMinorSwap();
+  options->semitone_shift      = _current_option.getSemitoneShift();
+  options->modifier            = _current_option.getModifier();
+  options->bass_degree         = _current_option.getBassDegree();
+  options->bass_semitone_shift = _current_option.getBassSemitoneShift();
+  return slot_key;
+}
 
-// M5_LOGE("key: %d, minor_swap: %d, modifier: %d, semitone: %d", key, minor_swap, (int)modifier, semitone);
-  for (int part = 0; part < def::app::max_chord_part; ++part) {
-    bool part_en = system_registry->chord_play.getPartEnable(part);
-    uint8_t midi_ch = part;
-    auto chord_part = &system_registry->current_slot->chord_part[part];
-    auto part_info = &chord_part->part_info;
-    options.position = part_info->getPosition();
-    options.voicing = part_info->getVoicing();
-
-    int displacement_usec = 1000 * part_info->getStrokeSpeed();
-    int autorelease_usec = 1000 * def::app::autorelease_msec;
-    int32_t press_usec = 0;
-    int step = system_registry->chord_play.getPartStep(part);
-    if (step < 0) {
-      continue;
+// 指定パート・ステップの発音予定を返す。作成済みの内容が現在の設定と一致しなければ作り直す
+const task_kantanplay_t::step_plan_t* task_kantanplay_t::getStepPlan(uint8_t part, int step, int degree, int slot_key, KANTANMusic_GetMidiNoteNumberOptions* options)
+{
+  auto chord_part = &system_registry->current_slot->chord_part[part];
+  auto part_info = &chord_part->part_info;
+  options->position = part_info->getPosition();
+  options->voicing = part_info->getVoicing();
+
+  // 世代番号は内容を読む前に取得しておき、作成中に変更された場合も次回に作り直されるようにする
+  step_plan_key_t key;
+  key.chord_part = chord_part;
+  key.arpeggio_generation = chord_part->arpeggio.getGeneration();
+  key.part_info_generation = part_info->getGeneration();
+  key.drum_generation = system_registry->song_data.chord_part_drum[part].getGeneration();
+  key.voicing_key = voicing_cache_t::makeKey(degree, slot_key, options);
+  key.press_velocity = _press_velocity;
+  key.part_enable = system_registry->chord_play.getPartEnable(part);
+
+  auto plan = &_step_plan[part][step & (max_step_plan - 1)];
+  if (!_step_plan_prefetch || plan->step != step || !(plan->key == key)) {
+    buildStepPlan(plan, part, step, degree, slot_key, options);
+    plan->key = key;
+    // オプションがキーに詰められない場合は再利用しない
+    plan->step = key.voicing_key ? step : -1;
+  }
+  return plan;
+}
+
+void task_kantanplay_t::buildStepPlan(step_plan_t* plan, uint8_t part, int step, int degree, int slot_key, const KANTANMusic_GetMidiNoteNumberOptions* options)
+{
+  bool part_en = system_registry->chord_play.getPartEnable(part);
+  uint8_t midi_ch = part;
+  auto chord_part = &system_registry->current_slot->chord_part[part];
+  auto part_info = &chord_part->part_info;
+
+  int displacement_usec = 1000 * part_info->getStrokeSpeed();
+  int autorelease_usec = 1000 * def::app::autorelease_msec;
+  int32_t press_usec = 0;
+
+  int pitch_flow = 1;
+  int pitch_index = 0;
+  int pitch_last = def::app::max_pitch_with_drum;
+
+  // ドラムパートの場合の処理分岐
+  bool is_drum = (part_info->isDrumPart());
+  bool mute = false;
+  if (is_drum) {
+    displacement_usec = 0;
+    midi_ch = def::midi::channel_10;
+  } else {
+    switch (chord_part->arpeggio.getStyle(step))
+    {
+    default:
+    case def::play::arpeggio_style_t::same_time:
+      displacement_usec = 0;
+      break;
+
+    case def::play::arpeggio_style_t::high_to_low:
+      pitch_flow = 1;
+      pitch_index = 0;
+      pitch_last = def::app::max_pitch_with_drum;
+      break;
+
+    case def::play::arpeggio_style_t::low_to_high:
+      pitch_flow = -1;
+      pitch_index = def::app::max_pitch_with_drum - 1;
+      pitch_last = -1;
+      break;
+
+    case def::play::arpeggio_style_t::mute:
+      mute = true;
+      // ミュート処理は同時発音ではなく高速ダウンストロークとして扱う
+
+      // ミュート処理の時はリリースまでの時間はストロークスピードの 2倍とする
+      autorelease_usec = displacement_usec * 2;
+
+      // ミュート処理の時はストロークスピードは 1/4 とする。
+      displacement_usec >>= 2;
+      pitch_flow = -1;
+      pitch_index = def::app::max_pitch_with_drum - 1;
+      pitch_last = -1;
+      break;
     }
-    bool flg_use = false;
+  }
+
+  // 同じコード・キー・ボイシングが続く間はキャッシュ済みのノート番号を使用する
+  const uint8_t* voicing_notes = is_drum ? nullptr : _voicing_cache[part].getNotes(degree, slot_key, options);
 
-    int pitch_flow = 1;
-    int pitch_index = 0;
-    int pitch_last = def::app::max_pitch_with_drum;
+  plan->midi_ch = midi_ch;
+  plan->count = 0;
+  for (; pitch_index != pitch_last; pitch_index += pitch_flow) {
+    int velocity = 0;
+    if (part_en) { velocity = chord_part->arpeggio.getVelocity(step, pitch_index); }
+    if (velocity) {
+      if (0 < velocity) {
+        velocity = velocity * _press_velocity / 100;
+        if (velocity > 127) { velocity = 127; }
+        if (velocity < 1) { velocity = 1; }
+      }
+    } else {
+      if (!mute) {
+        continue;
+      }
+      // if (manage->velocity == 0
+      //  && manage->midi_ch == midi_ch) {
+      //     continue;
+      //  }
+    }
 
-    // ドラムパートの場合の処理分岐
-    bool is_drum = (part_info->isDrumPart());
-    bool mute = false;
+    uint32_t note = 0;
     if (is_drum) {
-      displacement_usec = 0;
-      midi_ch = def::midi::channel_10;
+      note = system_registry->song_data.chord_part_drum[part].getDrumNoteNumber(pitch_index);
     } else {
-      switch (chord_part->arpeggio.getStyle(step))
-      {
-      default:
-      case def::play::arpeggio_style_t::same_time:
-        displacement_usec = 0;
-        break;
+      if (pitch_index >= def::app::max_pitch_without_drum) { continue; }
+      note = voicing_notes[pitch_index];
+    }
+    auto event = &plan->event[plan->count++];
+    event->press_usec = press_usec;
+    event->release_usec = press_usec + autorelease_usec;
+    event->pitch = pitch_index;
+    event->note = note;
+    event->velocity = velocity;
+    press_usec += displacement_usec;
+  }
+}
 
-      case def::play::arpeggio_style_t::high_to_low:
-        pitch_flow = 1;
-        pitch_index = 0;
-        pitch_last = def::app::max_pitch_with_drum;
-        break;
+// 演奏待機中に、各パートの現在のステップに続く数ステップ分の発音予定を作成しておく
+void task_kantanplay_t::prefetchStepPlan(void)
+{
+  if (!_step_plan_prefetch) { return; }
+  auto degree = _current_option.main_degree.getDegree();
+  if (degree == 0) { return; }
 
-      case def::play::arpeggio_style_t::low_to_high:
-        pitch_flow = -1;
-        pitch_index = def::app::max_pitch_with_drum - 1;
-        pitch_last = -1;
-        break;
+  KANTANMusic_GetMidiNoteNumberOptions options;
+  int slot_key = makeNoteOptions(&options);
 
-      case def::play::arpeggio_style_t::mute:
-        mute = true;
-        // ミュート処理は同時発音ではなく高速ダウンストロークとして扱う
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    int step = system_registry->chord_play.getPartStep(part);
+    if (step < 0) { continue; }
+    int loop_step = system_registry->current_slot->chord_part[part].part_info.getLoopStep();
+    for (size_t i = 1; i < max_step_plan; ++i) {
+      int next_step = step + i;
+      // ループ終端を超える場合は先頭に戻る
+      if (next_step > loop_step) { next_step -= loop_step + 1; }
+      if (next_step < 0 || next_step >= def::app::max_arpeggio_step) { break; }
+      getStepPlan(part, next_step, degree, slot_key, &options);
+    }
+  }
+}
 
-        // ミュート処理の時はリリースまでの時間はストロークスピードの 2倍とする
-        autorelease_usec = displacement_usec * 2;
+void task_kantanplay_t::chordStepPlay(void)
+{
+  auto degree = _current_option.main_degree;  //system_registry->chord_play.getChordDegree();
+  if (degree.getDegree() == 0) {
+    // コードが選ばれていない場合は終了
+    return;
+  }
 
-        // ミュート処理の時はストロークスピードは 1/4 とする。
-        displacement_usec >>= 2;
-        pitch_flow = -1;
-        pitch_index = def::app::max_pitch_with_drum - 1;
-        pitch_last = -1;
-        break;
-      }
-    }
+  KANTANMusic_GetMidiNoteNumberOptions options;
+  int slot_key = makeNoteOptions(&options);
 
-    for (; pitch_index != pitch_last; pitch_index += pitch_flow) {
-      int velocity = 0;
-      if (part_en) { velocity = chord_part->arpeggio.getVelocity(step, pitch_index); }
-      if (velocity) {
-        if (0 < velocity) {
-          velocity = velocity * _press_velocity / 100;
-          if (velocity > 127) { velocity = 127; }
-          if (velocity < 1) { velocity = 1; }
-        }
-      } else {
-        if (!mute) {
-          continue;
-        }
-        // if (manage->velocity == 0
-        //  && manage->midi_ch == midi_ch) {
-        //     continue;
-        //  }
-      }
+  // グルーブによる今回のステップの発音の遅れとベロシティの倍率 (表はテンプレートかテンポが変わった時のみ作り直す)
+  // オモテ拍は前倒しできないため、前に突っ込むずれは 0 として扱う
+  updateGroove();
+  const uint32_t groove_step = _groove_beat * system_registry->current_slot->slot_info.getStepPerBeat() + _current_beat_index;
+  int32_t groove_delay_usec = _groove.getOffsetUsec(groove_step) + _groove_lead_usec;
+  if (groove_delay_usec < 0) { groove_delay_usec = 0; }
+  const uint_fast16_t groove_velocity = _groove.getVelocity(groove_step);
 
-      uint32_t note = 0;
-      if (is_drum) {
-        note = system_registry->song_data.chord_part_drum[part].getDrumNoteNumber(pitch_index);
-      } else {
-        if (pitch_index >= 6) { continue; }
-        note = KANTANMusic_GetMidiNoteNumber(
-          6 - pitch_index
-          , degree.getDegree()
-          , slot_key
-          , &options
-        );
+// M5_LOGE("key: %d, minor_swap: %d, modifier: %d, semitone: %d", key, minor_swap, (int)modifier, semitone);
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    int step = system_registry->chord_play.getPartStep(part);
+    if (step < 0) {
+      continue;
+    }
+    // 先読み済みの発音予定があればそれを使用し、無ければここで作成する
+    auto plan = getStepPlan(part, step, degree.getDegree(), slot_key, &options);
+    for (size_t i = 0; i < plan->count; ++i) {
+      auto event = &plan->event[i];
+      int velocity = event->velocity;
+      if (groove_velocity != 100 && velocity > 0) {
+        velocity = velocity * groove_velocity / 100;
+        if (velocity > 127) { velocity = 127; }
+        if (velocity < 1) { velocity = 1; }
       }
-      setPitchManage(part, pitch_index, midi_ch, note, velocity, press_usec, press_usec + autorelease_usec);
-      press_usec += displacement_usec;
-      flg_use = true;
+      setPitchManage(part, event->pitch, plan->midi_ch, event->note, velocity, event->press_usec + groove_delay_usec, event->release_usec + groove_delay_usec);
     }
-    if (flg_use) {
-      uint8_t program = part_info->getTone();
-      uint8_t max_chvol = system_registry->runtime_info.getMIDIChannelVolumeMax();
-      uint16_t chvolume = part_info->getVolume() * max_chvol / 100;
-      if (chvolume > 127) { chvolume = 127; }
-      system_registry->midi_out_control.setProgramChange(midi_ch, program);
-      system_registry->midi_out_control.setChannelVolume(midi_ch, chvolume);
+    if (plan->count) {
+      setPartChannelState(part, plan->midi_ch);
     }
   }
 }
 
+void task_kantanplay_t::setPartChannelState(uint8_t part, uint8_t midi_ch)
+{
+  auto part_info = &system_registry->current_slot->chord_part[part].part_info;
+  uint8_t program = part_info->getTone();
+  uint8_t max_chvol = system_registry->runtime_info.getMIDIChannelVolumeMax();
+  uint16_t chvolume = part_info->getVolume() * max_chvol / 100;
+  if (chvolume > 127) { chvolume = 127; }
+  system_registry->midi_out_control.setProgramChange(midi_ch, program);
+  system_registry->midi_out_control.setChannelVolume(midi_ch, chvolume);
+}
+
+void task_kantanplay_t::prewarmChannelState(void)
+{
+  // 演奏対象のスロットはスロット選択の時点で切り替わり、次のステップの発音時に音色と音量が送信される。
+  // その時点でまとめて送信すると、低速なUARTではコードの発音が遅れるため、待機中に先に送信しておく。
+  // (切替後の最初のステップを待たずに送信するだけで、最終的に送信される内容は変わらない)
+  if (!_channel_prewarm) { return; }
+  auto slot = system_registry->current_slot;
+  uint32_t generation = 0;
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    generation += slot->chord_part[part].part_info.getGeneration();
+  }
+  uint8_t max_chvol = system_registry->runtime_info.getMIDIChannelVolumeMax();
+  if (_prewarm_slot == slot && _prewarm_generation == generation && _prewarm_chvol_max == max_chvol) { return; }
+  _prewarm_slot = slot;
+  _prewarm_generation = generation;
+  _prewarm_chvol_max = max_chvol;
+
+  registry_batch_t<registry_base_t> batch { system_registry->midi_out_control };
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    auto part_info = &slot->chord_part[part].part_info;
+    if (!part_info->getEnabled()) { continue; }
+    uint8_t midi_ch = part_info->isDrumPart() ? def::midi::channel_10 : part;
+    setPartChannelState(part, midi_ch);
+  }
+}
+
 void task_kantanplay_t::addSequence(void)
 {
   auto mode = system_registry->runtime_info.getGuiMode();
@@ -1189,14 +1586,9 @@ void task_kantanplay_t::procSoundEffect(const def::command::command_param_t& com
       note = system_registry->song_data.chord_part_drum[part_index].getDrumNoteNumber(pitch_index);
       midi_ch = def::midi::channel_10;
     } else {
-      if (pitch_index < 0 || pitch_index > 5) { continue; }
-
-      note = KANTANMusic_GetMidiNoteNumber(
-          6 - pitch_index
-        , degree
-        , slot_key
-        , &options
-      );
+      if (pitch_index < 0 || pitch_index >= def::app::max_pitch_without_drum) { continue; }
+
+      note = _voicing_cache[part_index].getNotes(degree, slot_key, &options)[pitch_index];
     }
     setPitchManage(part_index, pitch_index, midi_ch, note, velocity, press_usec, press_usec + autorelease_usec);
     press_usec += displacement_usec;
@@ -1290,25 +1682,56 @@ void task_kantanplay_t::allPartsNoteOff(void)
 
 
 
-// 指定したノートナンバーの音が他のピッチでも鳴っている数を調べる関数
-int32_t task_kantanplay_t::checkOtherPitchNote(int part, int pitch, int midi_ch, int note_number)
+void task_kantanplay_t::pushPitchEvent(uint8_t part, uint8_t pitch, const midi_pitch_manage_t* manage, bool is_release)
 {
-  int count = 0;
+  pitch_event_t event;
+  event.usec = is_release ? manage->release_usec : manage->press_usec;
+  event.part = part;
+  event.pitch = pitch;
+  event.serial = manage->serial;
+  event.is_release = is_release;
+  // 満杯の場合は予定が変更・取消済みのイベントを取り除いてから追加する
+  if (!_pitch_event.push(event, [this](const pitch_event_t& e) { return getPitchEventTarget(e) != nullptr; })) {
+    M5_LOGE("pitch event queue overflow");
+  }
+}
+
+task_kantanplay_t::midi_pitch_manage_t* task_kantanplay_t::getPitchEventTarget(const pitch_event_t& event)
+{
+  auto manage = _midi_pitch_manage[event.part][event.pitch];
+  for (int m = 0; m < max_manage_history; ++m) {
+    if (manage[m].serial != event.serial) { continue; }
+    if (event.is_release) {
+      if ((manage[m].flags & (pm_release_pending | pm_release_hold)) != pm_release_pending) { return nullptr; }
+      if (manage[m].release_usec != event.usec) { return nullptr; }
+    } else {
+      if ((manage[m].flags & pm_press_pending) == 0) { return nullptr; }
+      if (manage[m].press_usec != event.usec) { return nullptr; }
+    }
+    return &manage[m];
+  }
+  return nullptr;
+}
+
+bool task_kantanplay_t::releaseSoundingNote(int part, int pitch, midi_pitch_manage_t* manage)
+{
+  manage->flags &= ~pm_sounding;
+  auto midi_ch = manage->midi_ch;
+  auto note_number = manage->note_number;
+  if (midi_ch >= def::midi::channel_max || note_number >= def::midi::max_note) { return false; }
+  // 同じパートの他のピッチで同じ音が鳴っている場合は停止しない
   for (int p = 0; p < def::app::max_pitch_with_drum; ++p) {
     if (p == pitch) { continue; }
     for (int m = 0; m < max_manage_history; ++m) {
-      auto manage = &_midi_pitch_manage[part][p][m];
-      // まだ鳴っていない音や鳴り終わった音は除外する
-      if (manage->press_usec >= 0 || manage->release_usec < 0) { continue; }
-      if (manage->note_number != note_number || manage->midi_ch != midi_ch) { continue; }
-      if (manage->velocity == 0) { continue; }
-      ++count;
+      auto other = &_midi_pitch_manage[part][p][m];
+      if ((other->flags & pm_sounding)
+       && other->note_number == note_number
+       && other->midi_ch == midi_ch) {
+        return false;
+      }
     }
   }
-  // if (count) {
-  //   M5_LOGV("checkOtherPitchNote: %d", count);
-  // }
-  return count;
+  return true;
 }
 
 void task_kantanplay_t::chordNoteOff(int part)
@@ -1317,11 +1740,11 @@ void task_kantanplay_t::chordNoteOff(int part)
   for (int pitch_index = 0; pitch_index < def::app::max_pitch_with_drum; ++pitch_index) {
     for (int m = 0; m < max_manage_history; ++m) {
       auto manage = &_midi_pitch_manage[part][pitch_index][m];
-      if (manage->press_usec >= 0 || manage->release_usec >= 0) {
+      if (manage->flags & (pm_press_pending | pm_release_pending)) {
+        releaseSoundingNote(part, pitch_index, manage);
         auto note = manage->note_number;
         manage->velocity = 0;
-        manage->press_usec = -1;
-        manage->release_usec = -1;
+        manage->flags = 0;
         manage->note_number = 0xFF;
         auto midi_ch = manage->midi_ch;
         if (note < def::midi::max_note && midi_ch < def::midi::channel_max) {
@@ -1336,50 +1759,63 @@ void task_kantanplay_t::setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi
 {
   auto manage = &_midi_pitch_manage[part][pitch][0];
   { // 履歴末尾のデータが消失する前に、管理している音を停止する
-    if (manage[0].press_usec < 0 && manage[0].release_usec >= 0)
+    if ((manage[0].flags & (pm_press_pending | pm_release_pending)) == pm_release_pending)
     {
-      manage[0].release_usec = -1;
-      manage[0].press_usec = -1;
+      manage[0].flags &= ~(pm_release_pending | pm_release_hold);
 
       // 同じノートナンバーの音が他のピッチで鳴っていない場合は音を停止する
-      if (0 == checkOtherPitchNote(part, pitch, midi_ch, note_number)) {
-// M5_LOGV("stop note: %d, pitch: %d, midi_ch: %d, note_number: %d, velocity: %d, press_usec: %d, release_usec: %d", part, pitch, midi_ch, note_number, velocity, press_usec, release_usec);
-        system_registry->midi_out_control.setNoteVelocity(midi_ch, note_number, 0);
+      if (releaseSoundingNote(part, pitch, &manage[0])) {
+        system_registry->midi_out_control.setNoteVelocity(manage[0].midi_ch, manage[0].note_number, 0);
       }
     }
   }
 
+  uint8_t serial = manage[max_manage_history - 1].serial + 1;
+
   // 履歴をずらす
   memmove(&(_midi_pitch_manage[part][pitch][0]), &(_midi_pitch_manage[part][pitch][1]), sizeof(midi_pitch_manage_t) * (max_manage_history - 1));
 
+  const uint32_t press_at = _current_usec + press_usec;
+  uint32_t release_at = _current_usec + release_usec;
+
   // 今回指定された音よりも後のタイミングで処理される予定だった音を探し、予定をキャンセルしたり早めたりする
   for (int m = 0; m < max_manage_history - 1; ++m) {
-    if (manage[m].press_usec >= press_usec) {
-      manage[m].press_usec = -1;
-      manage[m].release_usec = -1;
+    auto flags = manage[m].flags;
+    if ((flags & pm_press_pending) && (int32_t)(manage[m].press_usec - press_at) >= 0) {
+      manage[m].flags = 0;
     } else
-    if (manage[m].release_usec > press_usec) {
-//M5_LOGV("short note_number: %d, press_usec: %d, release_usec: %d", note_number, press_usec, manage[m].release_usec);
-      manage[m].release_usec = press_usec;
+    if ((flags & pm_release_pending)
+     && ((flags & pm_release_hold) || (int32_t)(manage[m].release_usec - press_at) > 0)) {
+      manage[m].release_usec = press_at;
+      manage[m].flags = flags & ~pm_release_hold;
+      pushPitchEvent(part, pitch, &manage[m], true);
     }
   }
 
+  uint8_t flags = pm_press_pending | pm_release_pending;
   if (velocity < 0 || note_number == 0)
   { // マイナスベロシティやノートナンバー0 は停止処理に変換する
     velocity = 0;
-    release_usec = press_usec;
-    press_usec = -1;
+    release_at = press_at;
+    flags = pm_release_pending;
   }
 
   // if ((velocity > 127) { velocity = 127; }
 
   {
   // M5_LOGV("part: %d, pitch: %d, midi_ch: %d, note_number: %d, velocity: %d, press_usec: %d, release_usec: %d", part, pitch, midi_ch, note_number, velocity, press_usec, release_usec);
-    manage[max_manage_history - 1].note_number = note_number;
-    manage[max_manage_history - 1].midi_ch = midi_ch;
-    manage[max_manage_history - 1].velocity = velocity;
-    manage[max_manage_history - 1].release_usec = release_usec;
-    manage[max_manage_history - 1].press_usec = press_usec;
+    auto dst = &manage[max_manage_history - 1];
+    dst->note_number = note_number;
+    dst->midi_ch = midi_ch;
+    dst->velocity = velocity;
+    dst->release_usec = release_at;
+    dst->press_usec = press_at;
+    dst->serial = serial;
+    dst->flags = flags;
+    if (flags & pm_press_pending) {
+      pushPitchEvent(part, pitch, dst, false);
+    }
+    pushPitchEvent(part, pitch, dst, true);
   }
 }
 
@@ -1425,7 +1861,7 @@ void task_kantanplay_t::procNoteButton(const def::command::command_param_t& comm
     system_registry->midi_out_control.setProgramChange(midi_ch, program);
     system_registry->midi_out_control.setNoteVelocity(midi_ch, note, 0);
     uint8_t velocity = 0x80 | (_press_velocity > 127 ? 127 : _press_velocity);
-    system_registry->midi_out_control.setNoteVelocity(midi_ch, note, velocity);
+    system_registry->midi_out_control.setNoteVelocity(midi_ch, note, velocity, takeTraceId());
   }
 }
 
@@ -1462,7 +1898,7 @@ void task_kantanplay_t::procDrumButton(const def::command::command_param_t& comm
     system_registry->midi_out_control.setChannelVolume(midi_ch, chvolume);
 
     uint8_t velocity = 0x80 | (_press_velocity > 127 ? 127 : _press_velocity);
-    system_registry->midi_out_control.setNoteVelocity(def::midi::channel_10, note, velocity);
+    system_registry->midi_out_control.setNoteVelocity(def::midi::channel_10, note, velocity, takeTraceId());
   }
 }
 
@@ -5,16 +5,52 @@
 #define KANPLAY_TASK_KANTANPLAY_HPP
 
 #include "system_registry.hpp"
+#include "midi_clock.hpp"
+#include "groove.hpp"
+#include "input_timing.hpp"
+#include "pitch_event_queue.hpp"
+#include "voicing_cache.hpp"
+
+#include "kantan-music/include/KANTANMusic.h"
+
+// M5UNIFIED_PC_BUILD の定義を取り込んでから判定する (インクルード順によってメンバ構成が変わらないようにする)
+#include <M5Unified.h>
+
+#if !defined (M5UNIFIED_PC_BUILD)
+#include <esp_timer.h>
+#endif
 
 namespace kanplay_ns {
 //-------------------------------------------------------------------------
 class task_kantanplay_t {
 public:
   void start(void);
+
+  // 演奏処理の状態を初期化する。usec は基準となる現在時刻
+  void init(uint32_t usec);
+
+  // 指定時刻での演奏処理を、受信済みのコマンドが無くなるまで行う。次回処理までの待機時間(usec)を返す
+  // 実時間のタスクを使わずに仮想時刻で駆動する場合(オフライン演奏)に使用する
+  uint32_t procStep(uint32_t usec);
+
+  // 発音予定の先読みと再利用を行うか否か (既定は有効)
+  // 無効にすると毎ステップその場で作成する。先読みした場合と出力が一致することの検証に使用する
+  void setStepPlanPrefetch(bool enable) { _step_plan_prefetch = enable; }
+
+  // 待機中に音色と音量を先行送信するか否か (既定は有効)
+  // 無効にすると切替後の最初のステップの発音時に送信する。送信のタイミングの比較に使用する
+  void setChannelPrewarm(bool enable) { _channel_prewarm = enable; }
 private:
   registry_t::history_code_t _player_command_history_code = 0;
+#if !defined (M5UNIFIED_PC_BUILD)
+  // 次回イベント時刻に演奏タスクを起床させるタイマー
+  esp_timer_handle_t _wake_timer = nullptr;
+#endif
   static void task_func(task_kantanplay_t* me);
   bool commandProccessor(void);
+  // 受信したコマンドのトレース番号を取り出して、ノート出力段階への到達を記録する
+  uint8_t takeTraceId(void);
+  uint32_t procTick(uint32_t usec);
 
 /*
 ////
@@ -90,9 +126,16 @@ Degree操作コマンド {
   // 自動演奏(ウラ拍)の間隔時間 (usec) ※スイングに対応するため2つ用意する
   int32_t _auto_play_offbeat_cycle_usec[2] = { 0, };
 
+  // 自動演奏(ウラ拍)をグルーブのために前倒しした時間 (usec)
+  int32_t _auto_play_offbeat_lead_usec = 0;
+
   // 自動演奏時のユーザーによるオンビート操作の遅延許容の残り時間 (usec)
+  // 拍の頭で許容時間の最大値を設定し、入力元ごとの許容時間との比較には経過時間に換算して使用する
   int32_t _auto_play_input_tolerating_remain_usec = -1;
 
+  // 入力元ごとの入力タイミングの推定
+  input_timing_t _input_timing[def::command::max_input_source];
+
   // オンビート演奏間の経過時間 (usec)
   int32_t _reactive_onbeat_cycle_usec = -1;
 
@@ -117,10 +160,20 @@ Degree操作コマンド {
   int32_t calcSwing_x100(void);
   int32_t calcStepAdvance(const bool on_beat);
   void updateOffbeatTiming(void);
+  void updateGroove(void);
+  // 入力タイミングの推定に今回の入力を反映する
+  void updateInputTiming(void);
+  // 今回の入力が直前の拍に遅れて押されたものか否か
+  bool isLateInput(void);
   void setOnbeatCycle(int32_t usec = -1);
   int32_t getOnbeatCycle(void);
   int32_t getOnbeatCycleBySongTempo(void);
   uint32_t autoProc(void);
+  // MIDIクロック送信 : 拍の頭で呼ぶ
+  void clockOutBeat(uint32_t beat_usec);
+  // MIDIクロック送信 : 毎回呼ぶ。次のクロックまでの時間を返す
+  uint32_t clockOutProc(void);
+  void sendClockTick(uint32_t count);
   uint32_t chordProc(void);
   void sustainProc(void);
   void setSustain(bool sustain_on);
@@ -143,19 +196,96 @@ Degree操作コマンド {
 
   void setPitchManage(uint8_t part, uint8_t pitch, uint8_t midi_ch, uint8_t note_number, int8_t velocity, int32_t press_usec, int32_t release_usec);
 
+  enum pitch_manage_flag_t : uint8_t {
+    pm_press_pending   = 0x01, // 発音待ち
+    pm_release_pending = 0x02, // 消音待ち
+    pm_release_hold    = 0x04, // サステインにより消音時刻未定
+    pm_sounding        = 0x08, // 発音済みで消音していない
+  };
+
   struct midi_pitch_manage_t
   {
-    int32_t press_usec;
-    int32_t release_usec;
+    uint32_t press_usec;    // 発音予定時刻 (M5.micros 基準の絶対時刻)
+    uint32_t release_usec;  // 消音予定時刻 (M5.micros 基準の絶対時刻)
     uint8_t midi_ch;
     uint8_t note_number;
     uint8_t velocity;
+    uint8_t serial;         // イベントキューとの照合用の通し番号
+    uint8_t flags;          // pitch_manage_flag_t の組合せ
   };
   // ピッチごとの演奏情報 (履歴を最大2個分持てるようにする)
   // 履歴の配列は 0 が古い。max_manage_history - 1 が最新
   static constexpr const size_t max_manage_history = 3;
   midi_pitch_manage_t _midi_pitch_manage[def::app::max_chord_part][def::app::max_pitch_with_drum][max_manage_history];
-  int32_t checkOtherPitchNote(int part, int pitch, int midi_ch, int note_number);
+
+  // 発音・消音の予定を時刻順に保持するイベントキュー
+  pitch_event_queue_t _pitch_event;
+  void pushPitchEvent(uint8_t part, uint8_t pitch, const midi_pitch_manage_t* manage, bool is_release);
+  // イベントが現在も有効であれば対象の演奏情報を返す
+  midi_pitch_manage_t* getPitchEventTarget(const pitch_event_t& event);
+
+  // 発音済みの音を管理対象から外し、同じパートの他のピッチで同じ音が鳴っていなければ true を返す
+  bool releaseSoundingNote(int part, int pitch, midi_pitch_manage_t* manage);
+
+  // ボイシング計算結果のキャッシュ。パートごとに直近のオプションに対する全ピッチ分のノート番号を保持する
+  voicing_cache_t _voicing_cache[def::app::max_chord_part];
+
+  // ステップごとの発音予定。アルペジオパターン・奏法・ボイシングを解決済みのもの
+  // 演奏待機中に数ステップ先まで作成しておき、ステップ演奏時はこれを登録するだけで済ませる
+  // 作成時に参照したレジストリの世代番号等をキーとして保持し、内容が変わった場合は作り直す
+  struct step_plan_key_t
+  {
+    const void* chord_part = nullptr;   // 対象パートのデータ (スロット切替の検出用)
+    uint32_t arpeggio_generation = 0;
+    uint32_t part_info_generation = 0;
+    uint32_t drum_generation = 0;
+    uint32_t voicing_key = 0;           // ボイシング計算のオプション (voicing_cache_t::makeKey)
+    uint8_t press_velocity = 0;
+    bool part_enable = false;
+    bool operator==(const step_plan_key_t& rhs) const {
+      return chord_part == rhs.chord_part
+          && arpeggio_generation == rhs.arpeggio_generation
+          && part_info_generation == rhs.part_info_generation
+          && drum_generation == rhs.drum_generation
+          && voicing_key == rhs.voicing_key
+          && press_velocity == rhs.press_velocity
+          && part_enable == rhs.part_enable;
+    }
+  };
+  struct step_plan_event_t
+  {
+    int32_t press_usec;   // ステップ演奏時点からの発音までの時間
+    int32_t release_usec; // ステップ演奏時点からの消音までの時間
+    uint8_t pitch;
+    uint8_t note;
+    int8_t velocity;
+  };
+  struct step_plan_t
+  {
+    step_plan_key_t key;
+    int16_t step = -1;    // -1 は無効
+    uint8_t midi_ch = 0;
+    uint8_t count = 0;
+    step_plan_event_t event[def::app::max_pitch_with_drum];
+  };
+  // 先読みするステップ数 (2のべき乗)。ステップ番号の下位ビットで格納位置を決める
+  static constexpr const size_t max_step_plan = 4;
+  step_plan_t _step_plan[def::app::max_chord_part][max_step_plan];
+  bool _step_plan_prefetch = true;
+  int makeNoteOptions(KANTANMusic_GetMidiNoteNumberOptions* options);
+  const step_plan_t* getStepPlan(uint8_t part, int step, int degree, int slot_key, KANTANMusic_GetMidiNoteNumberOptions* options);
+  void buildStepPlan(step_plan_t* plan, uint8_t part, int step, int degree, int slot_key, const KANTANMusic_GetMidiNoteNumberOptions* options);
+  void prefetchStepPlan(void);
+
+  // パートの音色と音量を midi_out_control に設定する (変化がなければ送信されない)
+  void setPartChannelState(uint8_t part, uint8_t midi_ch);
+  // スロットやソングの切替後、次のステップを待たずに演奏待機中に音色と音量を送信しておく
+  void prewarmChannelState(void);
+  // 先行送信済みのスロットと、その時点のパート情報の世代番号の合計・チャンネルボリュームの最大値
+  const void* _prewarm_slot = nullptr;
+  uint32_t _prewarm_generation = 0;
+  uint8_t _prewarm_chvol_max = 0;
+  bool _channel_prewarm = true;
 
   struct midi_note_manage_t
   {
@@ -174,6 +304,25 @@ Degree操作コマンド {
   // 演奏時のベロシティ
   uint8_t _press_velocity;
 
+  // 最後に受信したコマンドの遅延計測用トレース番号 (0 はトレースなし)
+  uint8_t _trace_id = 0;
+  // 最後に受信したコマンドの入力元
+  uint8_t _input_source = def::command::insrc_unknown;
+
+  // グルーブテンプレートを現在のテンポで展開した表
+  groove_table_t _groove;
+  // ステップを強制的に先頭に戻してからの拍数。グルーブテンプレート上の位置は 拍数 × 1拍のステップ数 + 拍内の位置 とする
+  uint32_t _groove_beat = 0;
+  // 今回のステップの演奏が前倒しされている時間 (usec)
+  int32_t _groove_lead_usec = 0;
+
+  // MIDIクロック送信
+  midi_clock_out_t _clock_out;
+  // 一時停止した位置 (Song Position Pointer, 16分音符単位)
+  uint16_t _clock_out_position = 0;
+  // 一時停止中か否か (再開時に Start ではなく Continue を送信する)
+  bool _clock_out_paused = false;
+
   bool _step_reset_request = false;
 };
 
@@ -7,6 +7,9 @@
 
 #include "common_define.hpp"
 #include "system_registry.hpp"
+#include "latency_trace.hpp"
+#include "midi_clock.hpp"
+#include "midi_port_state.hpp"
 // #include "driver_midi.hpp"
 
 #include "midi/midi_transport_uart.hpp"
@@ -24,11 +27,22 @@ class subtask_midi_t {
 private:
   midi_driver::MIDIDriver _midi;
   system_registry_t::reg_task_status_t::bitindex_t _task_status_index;
+  // 経路表におけるこのポートの番号 (送信先として、また外部入力をスルーする際の送信元として使用する)
+  def::command::midi_route_port_t _route_port;
+  // 経路表のうち、このポートを送信先とする経路を展開したもの
+  midi_route_mask_t _route_mask;
 
 // インスタコードリンク判定フラグ
   bool _flg_instachord_link = false;
   bool _flg_instachord_out = false;
   bool _flg_instachord_pad = false;
+  // 外部MIDIクロック受信フラグ
+  bool _flg_clock_in = false;
+  // MIDIクロック送信フラグ (無効の場合はクロック・Start/Stop・Song Position Pointerを送信しない)
+  bool _flg_clock_out = false;
+
+  // このポートへ送信済みのチャンネルごとの音色と音量
+  midi_channel_state_t _channel_state;
 
 #if __has_include(<freertos/freertos.h>)
   TaskHandle_t _handle = nullptr;
@@ -37,10 +51,17 @@ private:
 #endif
 
 public:
-  subtask_midi_t(midi_driver::MIDI_Transport* transport, system_registry_t::reg_task_status_t::bitindex_t task_status_index)
+  subtask_midi_t(midi_driver::MIDI_Transport* transport, system_registry_t::reg_task_status_t::bitindex_t task_status_index, def::command::midi_route_port_t route_port)
   : _midi { transport }
   , _task_status_index { task_status_index }
+  , _route_port { route_port }
+  {
+  }
+
+  // 経路表から、このポートを送信先とする経路を展開する
+  void setRoute(const system_registry_t::reg_midi_port_setting_t* setting)
   {
+    _route_mask.assign(setting, _route_port);
   }
 
   void start(void)
@@ -71,6 +92,9 @@ public:
     _flg_instachord_pad = (style == def::command::instachord_link_style_t::icls_pad);
   }
 
+  void setClockIn(bool enable) { _flg_clock_in = enable; }
+  void setClockOut(bool enable) { _flg_clock_out = enable; }
+
   static void task_func(subtask_midi_t* me)
   {
     auto midi = &(me->_midi);
@@ -99,7 +123,12 @@ public:
       {
         system_registry->task_status.setSuspend(me->_task_status_index);
         // ulTaskNotifyTake(pdTRUE, (prev_tx_enable) ? 32 : 512);
-        ulTaskNotifyTake(pdTRUE, 2048);
+        // 送信保留中のメッセージがある場合は、回線が空く頃に起床して送信する
+        // 受信データが読み出し時刻を待っている場合も同様に、その時刻に起床する
+        uint32_t wait_msec = midi->getPendingTxWaitMsec();
+        uint32_t rx_wait_msec = midi->getPendingRxWaitMsec();
+        if (rx_wait_msec && (wait_msec == 0 || wait_msec > rx_wait_msec)) { wait_msec = rx_wait_msec; }
+        ulTaskNotifyTake(pdTRUE, (wait_msec && wait_msec < 2048) ? wait_msec : 2048);
         system_registry->task_status.setWorking(me->_task_status_index);
       } 
 #endif
@@ -121,8 +150,37 @@ public:
 
           do {
             ++rx_count;
-//  printf("status:%02x  len:%d  data:%02x %02x\n", message.status, message.data.size(), message.data[0], message.data[1]);
+//  printf("status:%02x  len:%d  data:%02x %02x\n", message.status, message.length, message.data[0], message.data[1]);
 //  fflush(stdout);
+            if (message.truncated) {
+              M5_LOGW("midi: SysEx truncated to %u bytes (total %u)", message.length, (unsigned)midi->getSysExTruncatedCount());
+            }
+            if (me->_flg_clock_in && message.status >= 0xF0) {
+              // 外部MIDIクロックに同期した自動演奏
+              switch (message.status) {
+              default: break;
+              case 0xF8: // Timing Clock
+                midi_clock_in.receiveTick(M5.micros());
+                break;
+              case 0xFA: // Start
+              case 0xFB: // Continue
+                if (message.status == 0xFA) {
+                  midi_clock_in.receiveStart();
+                } else {
+                  midi_clock_in.receiveContinue();
+                }
+                system_registry->operator_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_start } );
+                break;
+              case 0xFC: // Stop
+                midi_clock_in.receiveStop();
+                system_registry->operator_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_stop } );
+                break;
+              case 0xF2: // Song Position Pointer
+                midi_clock_in.receiveSongPosition(message.data[0] | (message.data[1] << 7));
+                break;
+              }
+              continue;
+            }
             // MIDIスルーフラグ
             bool midi_thru = true;
             uint8_t channel = message.channel;
@@ -182,24 +240,32 @@ public:
               for (auto command_param : command_param_array.array) {
                 uint8_t command = command_param.getCommand();
                 if (command == 0) { continue; }
-                system_registry->operator_command.addQueue(command_param, velocity ? true : false);
+                bool pressed = velocity ? true : false;
+                system_registry->operator_command.addQueue(command_param, pressed, latency_trace.begin(command_param, pressed), def::command::insrc_midi);
               }
             }
-            if (midi_thru == true && message.data.size() > 1 && message.data.size() <= 2) {
+            if (midi_thru == true && message.status < 0xF0 && message.length == 2) {
               // MIDIノートがコマンドマッピングされていない場合
-              system_registry->midi_out_control.setMessage(message.status, message.data[0], message.data[1]);
+              system_registry->midi_out_control.setMessage(message.status, message.data[0], message.data[1], 0, me->_route_port);
             }
           } while (midi->receiveMessage(&message));
         }
       }
 
-      bool queued = false;
+      // 送信保留中のメッセージがあれば今回のフラッシュで送信を試みる
+      bool queued = (midi->getPendingTxWaitMsec() != 0);
+      // 今回のフラッシュで送信する遅延計測対象のトレース番号
+      static constexpr const int max_trace_count = 8;
+      uint8_t trace_list[max_trace_count];
+      int trace_count = 0;
       if (prev_tx_enable != tx_enable) {
         prev_tx_enable = tx_enable;
         if (tx_enable) {
           prev_midi_volume = 255;
           prev_slot_key = 255;
           history_code_midi_out = system_registry->midi_out_control.getHistoryCode();
+          // 接続先の状態は不明なため、音色と音量はすべて送り直す
+          me->_channel_state.reset();
           for (int i = 0; i < 16; ++i) { // CC#120はすべてのMIDI音を停止する
             midi->sendControlChange(def::midi::channel_1 + i, 120, 0);
           }
@@ -232,23 +298,41 @@ public:
             midi->sendControlChange(def::midi::channel_1, 98,  7);
             midi->sendControlChange(def::midi::channel_1,  6, midi_volume);
             for (int i = 0; i < 16; ++i) {
-              // チャンネルボリュームおよびプログラムチェンジを設定
+              // チャンネルボリュームおよびプログラムチェンジを設定 (このポートへ送信済みの値と同じ場合は省略する)
               uint8_t vol = system_registry->midi_out_control.getChannelVolume(i);
               uint8_t prg = system_registry->midi_out_control.getProgramChange(i);
-              midi->sendControlChange(def::midi::channel_1 + i, 7, vol);
-              midi->sendProgramChange(def::midi::channel_1 + i, prg);
+              if (me->_channel_state.update(def::command::midi_route_port_t::mrp_internal, 0xB0 | i, 7, vol)) {
+                midi->sendControlChange(def::midi::channel_1 + i, 7, vol);
+              }
+              if (me->_channel_state.update(def::command::midi_route_port_t::mrp_internal, 0xC0 | i, prg, 0)) {
+                midi->sendProgramChange(def::midi::channel_1 + i, prg);
+              }
   // printf("MIDI Channel %d Volume: %d, Program: %d\n", i, vol, prg);
   // fflush(stdout);
             }
             queued = true;
           }
 
-          const registry_t::history_t* history;
-          while (nullptr != (history = system_registry->midi_out_control.getHistory(history_code_midi_out))) {
-            uint8_t status = history->index & 0xFF;
-//          uint8_t midi_ch = status & 0x0F;
-            uint8_t data1 = history->value & 0xFF;
-            uint8_t data2 = (history->value >> 8) & 0xFF;
+          midi_event_t event;
+          while (system_registry->midi_out_control.getEvent(history_code_midi_out, event)) {
+            uint8_t status = event.getStatus();
+            uint8_t data1 = event.getData1();
+            uint8_t data2 = event.getData2();
+            uint8_t trace_id = event.trace_id;
+            uint8_t source = event.getSource();
+            if (!me->_route_mask.isRouted(source, status)) {
+              continue;
+            }
+            if (!me->_flg_clock_out && (status == 0xF2 || status == 0xF8 || status == 0xFA || status == 0xFB || status == 0xFC)) {
+              continue;
+            }
+            if (!me->_channel_state.update(source, status, data1, data2)) {
+              continue;
+            }
+            if (trace_id) {
+              latency_trace.mark(trace_id, latency_trace_t::stage_midi);
+              if (trace_count < max_trace_count) { trace_list[trace_count++] = trace_id; }
+            }
             midi->sendMessage(status, data1, data2);
             queued = true;
           }
@@ -257,6 +341,9 @@ public:
           // MIDI送信バッファをフラッシュ
           if (midi->sendFlush()) {
             tx_count++;
+            for (int i = 0; i < trace_count; ++i) {
+              latency_trace.mark(trace_list[i], latency_trace_t::stage_flush);
+            }
           };
         }
       }
@@ -290,16 +377,16 @@ static subtask_midi_t* subtask_array[] = {};
 static midi_driver::MIDI_Transport_UART in_uart_midi_transport; // かんぷれ内部MIDI
 static midi_driver::MIDI_Transport_UART portc_midi_transport; // PortC外部MIDI
 
-static subtask_midi_t in_uart_midi_subtask { &in_uart_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL };
-static subtask_midi_t portc_midi_subtask { &portc_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_EXTERNAL };
+static subtask_midi_t in_uart_midi_subtask { &in_uart_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_INTERNAL, def::command::mrp_internal };
+static subtask_midi_t portc_midi_subtask { &portc_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_EXTERNAL, def::command::mrp_portc };
 
 #ifdef MIDI_TRANSPORT_BLE_HPP
 static midi_driver::MIDI_Transport_BLE ble_midi_transport; // BLE-MIDI
-static subtask_midi_t ble_midi_subtask { &ble_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_BLE };
+static subtask_midi_t ble_midi_subtask { &ble_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_BLE, def::command::mrp_ble };
 #endif
 #ifdef MIDI_TRANSPORT_USB_HPP
 static midi_driver::MIDI_Transport_USB usb_midi_transport; // USB-MIDI
-static subtask_midi_t usb_midi_subtask { &usb_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_USB };
+static subtask_midi_t usb_midi_subtask { &usb_midi_transport, system_registry_t::reg_task_status_t::bitindex_t::TASK_MIDI_USB, def::command::mrp_usb };
 #endif
 
 
@@ -394,6 +481,9 @@ void task_midi_t::task_func(task_midi_t* me)
   auto prev_iclink_port = def::command::instachord_link_port_t::iclp_off;
   auto prev_iclink_dev = def::command::instachord_link_dev_t::icld_kanplay;
   auto prev_iclink_style = def::command::instachord_link_style_t::icls_button;
+  auto prev_clock_port = def::command::midi_clock_port_t::mcp_off;
+  uint8_t prev_clock_out_ports = 0;
+  uint32_t prev_setting_generation = 0;
 
   for (;;) {
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
@@ -438,6 +528,39 @@ void task_midi_t::task_func(task_midi_t* me)
       system_registry->runtime_info.setMIDIChannelVolumeMax(chvol_max);
     }
 
+    // 設定が変更された場合は経路表を展開し直す
+    auto setting_generation = system_registry->midi_port_setting.getGeneration();
+    if (prev_setting_generation != setting_generation) {
+      prev_setting_generation = setting_generation;
+      for (auto subtask : subtask_array) {
+        subtask->setRoute(&system_registry->midi_port_setting);
+      }
+    }
+
+    auto clock_port = system_registry->midi_port_setting.getClockInPort();
+    if (prev_clock_port != clock_port) {
+      prev_clock_port = clock_port;
+      midi_clock_in.reset();
+      portc_midi_subtask.setClockIn(clock_port == def::command::midi_clock_port_t::mcp_portc);
+#ifdef MIDI_TRANSPORT_BLE_HPP
+      ble_midi_subtask.setClockIn(clock_port == def::command::midi_clock_port_t::mcp_ble);
+#endif
+#ifdef MIDI_TRANSPORT_USB_HPP
+      usb_midi_subtask.setClockIn(clock_port == def::command::midi_clock_port_t::mcp_usb);
+#endif
+    }
+    auto clock_out_ports = system_registry->midi_port_setting.getClockOutPorts();
+    if (prev_clock_out_ports != clock_out_ports) {
+      prev_clock_out_ports = clock_out_ports;
+      portc_midi_subtask.setClockOut(system_registry->midi_port_setting.getClockOutEnabled(def::command::midi_clock_port_t::mcp_portc));
+#ifdef MIDI_TRANSPORT_BLE_HPP
+      ble_midi_subtask.setClockOut(system_registry->midi_port_setting.getClockOutEnabled(def::command::midi_clock_port_t::mcp_ble));
+#endif
+#ifdef MIDI_TRANSPORT_USB_HPP
+      usb_midi_subtask.setClockOut(system_registry->midi_port_setting.getClockOutEnabled(def::command::midi_clock_port_t::mcp_usb));
+#endif
+    }
+
     auto portc_setting = system_registry->midi_port_setting.getPortCMIDI();
     bool portc_out = portc_setting & def::command::ex_midi_mode_t::midi_output;
     bool portc_in  = portc_setting & def::command::ex_midi_mode_t::midi_input;
@@ -9,6 +9,7 @@
 #include "system_registry.hpp"
 #include "file_manage.hpp"
 #include "menu_data.hpp"
+#include "latency_trace.hpp"
 
 #if !defined (M5UNIFIED_PC_BUILD)
 #include <nvs_flash.h>
@@ -200,9 +201,19 @@ void task_operator_t::task_func(task_operator_t* me)
 
     bool is_pressed;
     def::command::command_param_t command_param;
-    while (system_registry->operator_command.getQueue(&me->_history_code, &command_param, &is_pressed))
+    while (system_registry->operator_command.getQueue(&me->_history_code, &command_param, &is_pressed, &me->_trace_id, &me->_forwarded, &me->_input_source))
     {
+      latency_trace.mark(me->_trace_id, latency_trace_t::stage_operator);
       me->commandProccessor(command_param, is_pressed);
+      if (me->_forwarded) {
+        // 演奏タスクへ直接送信済みのコマンドの位置を通知し、後続のコマンドとの順序を演奏タスクが判断できるようにする
+        system_registry->player_command.addForwarded(command_param, is_pressed);
+      }
+      me->_trace_id = 0;
+      me->_forwarded = false;
+      me->_input_source = def::command::insrc_unknown;
+      // 処理済みの位置を通知し、この位置を待っている直接送信のコマンドを演奏タスクが処理できるようにする
+      system_registry->player_direct_command.setOperatorCode(me->_history_code);
 #if !defined (M5UNIFIED_PC_BUILD)
       // commander側で待機中の処理があり得るためここでYIELD処理を行う
       taskYIELD();
@@ -379,7 +390,10 @@ void task_operator_t::commandProccessor(const def::command::command_param_t& com
   case def::command::chord_step_reset_request:
   case def::command::autoplay_switch:
   case def::command::play_control:
-    system_registry->player_command.addQueue(command_param, is_pressed);
+    // 演奏タスクへ直接送信済みのコマンドは操作履歴の更新のみ行う
+    if (!_forwarded) {
+      system_registry->player_command.addQueue(command_param, is_pressed, _trace_id, _input_source);
+    }
     break;
 
   case def::command::chord_modifier:
@@ -726,6 +740,22 @@ void task_operator_t::commandProccessor(const def::command::command_param_t& com
         nvs_flash_erase();
 #endif
         break;
+
+      case def::command::system_control_t::sc_latency_dump:
+        {
+          // 入力からMIDI送信までの集計結果を task_status に写してからファイルへ保存する
+          static_assert(system_registry_t::reg_task_status_t::max_latency_bin == latency_trace_t::max_bin, "latency histogram size mismatch");
+          uint32_t counts[latency_trace_t::max_bin];
+          for (size_t bin = 0; bin < latency_trace_t::max_bin; ++bin) {
+            counts[bin] = latency_trace.getCount(latency_trace_t::stage_input, bin);
+          }
+          system_registry->task_status.setLatencyHistogram(counts, latency_trace.getMax(latency_trace_t::stage_input));
+          latency_trace.printLog();
+          if (!latency_trace.dump()) {
+            M5_LOGE("latency trace dump failed");
+          }
+        }
+        break;
       }
     }
     break;
@@ -13,6 +13,12 @@ public:
   void start(void);
 private:
   registry_t::history_code_t _history_code = 0;
+  // 処理中のコマンドの遅延計測用トレース番号 (0 はトレースなし)
+  uint8_t _trace_id = 0;
+  // 処理中のコマンドが演奏タスクへ直接送信済みか否か
+  bool _forwarded = false;
+  // 処理中のコマンドの入力元
+  uint8_t _input_source = def::command::insrc_unknown;
   // 前回発動したコマンド
 
   static constexpr const size_t max_command_history = 4;
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "voicing_cache.hpp"
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+uint32_t voicing_cache_t::makeKey(int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions* options)
+{
+  if ((uint32_t)degree > 7 || (uint32_t)key > 15
+   || (uint32_t)options->voicing > 7 || (uint32_t)options->modifier > 15
+   || (uint32_t)(options->position + 64) > 127
+   || (uint32_t)(options->semitone_shift + 2) > 3
+   || (uint32_t)options->bass_degree > 7
+   || (uint32_t)(options->bass_semitone_shift + 2) > 3) {
+    return 0;
+  }
+  return 1u << 31
+       | degree
+       | key << 3
+       | options->voicing << 7
+       | options->modifier << 10
+       | (options->position + 64) << 14
+       | (options->minor_swap ? 1 : 0) << 21
+       | (options->semitone_shift + 2) << 22
+       | options->bass_degree << 24
+       | (options->bass_semitone_shift + 2) << 27;
+}
+
+const uint8_t* voicing_cache_t::getNotes(int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions* options)
+{
+  uint32_t cache_key = makeKey(degree, key, options);
+  if (cache_key == 0 || cache_key != _key) {
+    for (int pitch_index = 0; pitch_index < def::app::max_pitch_without_drum; ++pitch_index) {
+      _note[pitch_index] = KANTANMusic_GetMidiNoteNumber(
+        def::app::max_pitch_without_drum - pitch_index
+        , degree
+        , key
+        , options
+      );
+    }
+    _key = cache_key;
+  }
+  return _note;
+}
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
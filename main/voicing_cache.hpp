@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#ifndef KANPLAY_VOICING_CACHE_HPP
+#define KANPLAY_VOICING_CACHE_HPP
+
+/*
+ - ボイシング計算結果のキャッシュ
+   KANTANMusic_GetMidiNoteNumber で求めた全ピッチ分のノート番号を、直近のオプションについて保持する。
+   オプションは一つの値 (キー) に詰めて比較し、前回と同じであれば計算を省略する。
+*/
+
+#include "common_define.hpp"
+
+#include <stdint.h>
+
+namespace kanplay_ns {
+//-------------------------------------------------------------------------
+class voicing_cache_t {
+public:
+  // ボイシング計算に影響するオプションを一つの値に詰める。詰められない値の場合は 0 を返す
+  static uint32_t makeKey(int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions* options);
+
+  // 全ピッチのノート番号を取得する。オプションが前回と同じならキャッシュを返す
+  const uint8_t* getNotes(int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions* options);
+
+private:
+  uint32_t _key = 0; // オプションを詰めたキー (0 は無効)
+  uint8_t _note[def::app::max_pitch_without_drum];
+};
+
+//-------------------------------------------------------------------------
+}; // namespace kanplay_ns
+
+#endif
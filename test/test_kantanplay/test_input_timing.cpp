@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// input_timing_t : 演奏者ごとの押下タイミングを模擬し、固定の許容時間と推定に基づく許容時間で拍への割当ての正しさを比較する
+
+#include <unity.h>
+
+#include "input_timing.hpp"
+#include "common_define.hpp"
+
+#include <random>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+// テンポ120・1拍2ステップ相当
+static constexpr const int32_t beat_usec = 500000;
+static constexpr const int32_t step_cycle_usec = beat_usec / 2;
+static constexpr const int32_t window_usec = def::app::input_tolerating_max_msec * 1000;
+
+struct player_model_t {
+  const char* name;
+  int32_t bias_usec;      // 意図した拍に対する押下の遅れ (負の値は先走り)
+  int32_t jitter_usec;    // 押下のばらつき (標準偏差)
+  int32_t drift_usec;     // 後半の押下に加える遅れ (途中で癖が変わる演奏者)
+};
+
+struct sim_result_t {
+  int presses = 0;
+  int fixed_correct = 0;
+  int adaptive_correct = 0;
+  int32_t latency_usec = 0;
+  int32_t tolerance_usec = 0;
+};
+
+// 全ての押下はいずれかのオモテ拍を意図したものとし、その拍に割り当てられた場合を正解とする
+// 拍より前の押下は次のオモテ拍でそのまま反映され、拍の後の押下は遅れと判定された場合のみその拍に割り当てられる
+static sim_result_t simulate(const player_model_t& model, int press_count, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> jitter(0.0, model.jitter_usec);
+  input_timing_t timing;
+  sim_result_t result;
+  for (int i = 0; i < press_count; ++i) {
+    int32_t offset = model.bias_usec + (int32_t)jitter(rng);
+    if (i >= press_count / 2) { offset += model.drift_usec; }
+    if (offset <= -beat_usec / 2) { offset = -beat_usec / 2 + 1; }
+
+    // 直前の拍からの経過時間 (task_kantanplay_t::updateInputTiming と同じ条件で推定に使用する)
+    const int32_t elapsed_usec = offset >= 0 ? offset : beat_usec + offset;
+    const bool in_late_window = elapsed_usec < window_usec;
+    bool fixed_ok = true;
+    bool adaptive_ok = true;
+    if (offset >= 0) {
+      fixed_ok = in_late_window && elapsed_usec < def::app::input_tolerating_msec * 1000;
+      adaptive_ok = in_late_window && timing.isLateInput(elapsed_usec, step_cycle_usec);
+    }
+    if (in_late_window) {
+      timing.addSample(elapsed_usec);
+    } else if (beat_usec - elapsed_usec < window_usec) {
+      timing.addSample(elapsed_usec - beat_usec);
+    }
+    ++result.presses;
+    result.fixed_correct += fixed_ok;
+    result.adaptive_correct += adaptive_ok;
+  }
+  result.latency_usec = timing.getLatencyUsec();
+  result.tolerance_usec = timing.getToleranceUsec();
+  return result;
+}
+} // namespace
+
+// 許容時間は入力が揃うまで既定値、以降は推定値に従い、最初のウラ拍の位置を超えないこと
+void test_input_timing_tolerance(void)
+{
+  input_timing_t timing;
+  const int32_t def_usec = def::app::input_tolerating_msec * 1000;
+  TEST_ASSERT_EQUAL(def_usec, timing.getToleranceUsec());
+  for (uint32_t i = 0; i + 1 < input_timing_t::min_samples; ++i) { timing.addSample(90000); }
+  TEST_ASSERT_EQUAL(def_usec, timing.getToleranceUsec());
+  timing.addSample(90000);
+  TEST_ASSERT_EQUAL(90000, timing.getToleranceUsec());
+  TEST_ASSERT_TRUE(timing.isLateInput(89000, 0));
+  TEST_ASSERT_FALSE(timing.isLateInput(90000, 0));
+  // ウラ拍が許容時間より手前にある場合はウラ拍の位置まで
+  TEST_ASSERT_TRUE(timing.isLateInput(59000, 60000));
+  TEST_ASSERT_FALSE(timing.isLateInput(60000, 60000));
+  // ウラ拍が既定値より手前でも既定値までは許容する
+  TEST_ASSERT_TRUE(timing.isLateInput(def_usec - 1, 30000));
+
+  // 先走る演奏者は最小値まで狭める
+  timing.reset();
+  for (int i = 0; i < 16; ++i) { timing.addSample(-30000); }
+  TEST_ASSERT_EQUAL(-30000, timing.getLatencyUsec());
+  TEST_ASSERT_EQUAL(def::app::input_tolerating_min_msec * 1000, timing.getToleranceUsec());
+  TEST_ASSERT_FALSE(timing.isLateInput(def::app::input_tolerating_min_msec * 1000, step_cycle_usec));
+}
+
+// 押下タイミングの傾向が異なる演奏者ごとに、拍への割当てが正しかった割合を比較する
+void test_input_timing_simulation(void)
+{
+  static const player_model_t models[] = {
+    { "on time      ",      0,  8000,     0 },
+    { "early  -30ms ", -30000, 10000,     0 },
+    { "late   +30ms ",  30000, 10000,     0 },
+    { "late   +60ms ",  60000, 12000,     0 },
+    { "drift 0->55ms",      0,  8000, 55000 },
+  };
+  char msg[128];
+  TEST_MESSAGE("player          presses  fixed 50ms  adaptive   latency  tolerance");
+  for (size_t m = 0; m < sizeof(models) / sizeof(models[0]); ++m) {
+    auto& model = models[m];
+    auto result = simulate(model, 2000, 19 + m);
+    snprintf(msg, sizeof(msg), "%s  %7d  %9.1f%%  %7.1f%%  %6.1fms  %7.1fms", model.name, result.presses
+            , 100.0 * result.fixed_correct / result.presses, 100.0 * result.adaptive_correct / result.presses
+            , result.latency_usec / 1000.0, result.tolerance_usec / 1000.0);
+    TEST_MESSAGE(msg);
+
+    // 推定した遅れは演奏者の癖 (後半の値) に追従する
+    TEST_ASSERT_INT32_WITHIN(5000, model.bias_usec + model.drift_usec, result.latency_usec);
+    // どの演奏者でも固定の許容時間より大きく悪化しない
+    // (ばらつきの小さい演奏者は許容時間が最小値まで狭まるため、ばらつきの裾の押下が 1% 程度次の拍に回る)
+    TEST_ASSERT_GREATER_OR_EQUAL(result.fixed_correct - result.presses / 100, result.adaptive_correct);
+    TEST_ASSERT_GREATER_OR_EQUAL(result.presses * 97 / 100, result.adaptive_correct);
+  }
+  // 大きく遅れる演奏者は固定の許容時間では大半の押下が次の拍に回る
+  auto late = simulate(models[3], 2000, 22);
+  TEST_ASSERT_LESS_THAN(late.presses / 2, late.fixed_correct);
+}
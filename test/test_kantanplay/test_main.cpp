@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// 演奏処理の単体テスト (pio test -e native_test)
+
+#include <unity.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// test_input_timing.cpp
+void test_input_timing_tolerance(void);
+void test_input_timing_simulation(void);
+
+// test_pitch_event_queue.cpp
+void test_pitch_event_queue_order(void);
+void test_pitch_event_queue_strum(void);
+
+// test_voicing_cache.cpp
+void test_voicing_cache_key(void);
+void test_voicing_cache_notes(void);
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_input_timing_tolerance);
+  RUN_TEST(test_input_timing_simulation);
+  RUN_TEST(test_pitch_event_queue_order);
+  RUN_TEST(test_pitch_event_queue_strum);
+  RUN_TEST(test_voicing_cache_key);
+  RUN_TEST(test_voicing_cache_notes);
+  return UNITY_END();
+}
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// 発音・消音の予定の処理 : 従来の全エントリ走査と pitch_event_queue_t (二分ヒープ) の比較
+
+#include <unity.h>
+
+#include "common_define.hpp"
+#include "pitch_event_queue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <tuple>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+static constexpr const int max_part = def::app::max_chord_part;
+static constexpr const int max_pitch = def::app::max_pitch_with_drum;
+static constexpr const int max_history = 3;
+
+// 出力されたノートオン・オフ (時刻, パート, ピッチ, ノートオンか否か)
+typedef std::tuple<uint32_t, uint8_t, uint8_t, bool> note_event_t;
+
+// 従来の処理。ピッチごとの予定を残り時間で持ち、起床のたびに全エントリ (6パート x 7ピッチ x 履歴3) の残り時間を減算する
+struct legacy_scheduler_t {
+  struct manage_t { int32_t press_usec; int32_t release_usec; };
+  manage_t manage[max_part][max_pitch][max_history];
+  uint32_t prev_usec = 0;
+  std::vector<note_event_t>* output;
+
+  legacy_scheduler_t(void) { memset(manage, 0xFF, sizeof(manage)); }
+
+  void setPitchManage(uint8_t part, uint8_t pitch, int32_t press_usec, int32_t release_usec)
+  {
+    auto m = manage[part][pitch];
+    memmove(&m[0], &m[1], sizeof(manage_t) * (max_history - 1));
+    for (int i = 0; i < max_history - 1; ++i) {
+      if (m[i].press_usec >= press_usec) {
+        m[i].press_usec = -1;
+        m[i].release_usec = -1;
+      } else if (m[i].release_usec > press_usec) {
+        m[i].release_usec = press_usec;
+      }
+    }
+    m[max_history - 1].press_usec = press_usec;
+    m[max_history - 1].release_usec = release_usec;
+  }
+
+  // 次回起床までの時間を返す
+  uint32_t proc(uint32_t usec)
+  {
+    uint32_t next = INT32_MAX;
+    const int32_t progress = (int32_t)(usec - prev_usec);
+    prev_usec = usec;
+    for (int part = 0; part < max_part; ++part) {
+      for (int pitch = 0; pitch < max_pitch; ++pitch) {
+        for (int i = 0; i < max_history; ++i) {
+          auto m = &manage[part][pitch][i];
+          int32_t press = m->press_usec;
+          if (press >= 0) {
+            press -= progress;
+            if (press <= 0) {
+              output->emplace_back(usec, part, pitch, true);
+              press = -1;
+            } else if (next > (uint32_t)press) { next = press; }
+            m->press_usec = press;
+          }
+          int32_t release = m->release_usec;
+          if (release >= 0) {
+            release -= progress;
+            if (release <= 0) {
+              output->emplace_back(usec, part, pitch, false);
+              release = -1;
+            } else if (next > (uint32_t)release) { next = release; }
+            m->release_usec = release;
+          }
+        }
+      }
+    }
+    return next;
+  }
+};
+
+// 現在の処理。予定を絶対時刻で持ち、イベントキューの先頭から予定時刻に達したものだけを取り出す
+// (task_kantanplay_t::setPitchManage / chordProc の予定管理部分と同じ手順)
+struct queue_scheduler_t {
+  enum : uint8_t { press_pending = 0x01, release_pending = 0x02 };
+  struct manage_t { uint32_t press_usec; uint32_t release_usec; uint8_t serial; uint8_t flags; };
+  manage_t manage[max_part][max_pitch][max_history];
+  pitch_event_queue_t queue;
+  uint32_t current_usec = 0;
+  std::vector<note_event_t>* output;
+
+  queue_scheduler_t(void) { memset(manage, 0, sizeof(manage)); }
+
+  manage_t* getTarget(const pitch_event_t& event)
+  {
+    auto m = manage[event.part][event.pitch];
+    for (int i = 0; i < max_history; ++i) {
+      if (m[i].serial != event.serial) { continue; }
+      if (event.is_release) {
+        if (!(m[i].flags & release_pending) || m[i].release_usec != event.usec) { return nullptr; }
+      } else {
+        if (!(m[i].flags & press_pending) || m[i].press_usec != event.usec) { return nullptr; }
+      }
+      return &m[i];
+    }
+    return nullptr;
+  }
+
+  void push(uint8_t part, uint8_t pitch, const manage_t* m, bool is_release)
+  {
+    pitch_event_t event { is_release ? m->release_usec : m->press_usec, part, pitch, m->serial, is_release };
+    TEST_ASSERT_TRUE(queue.push(event, [this](const pitch_event_t& e) { return getTarget(e) != nullptr; }));
+  }
+
+  void setPitchManage(uint8_t part, uint8_t pitch, int32_t press_usec, int32_t release_usec)
+  {
+    auto m = manage[part][pitch];
+    uint8_t serial = m[max_history - 1].serial + 1;
+    memmove(&m[0], &m[1], sizeof(manage_t) * (max_history - 1));
+    const uint32_t press_at = current_usec + press_usec;
+    for (int i = 0; i < max_history - 1; ++i) {
+      auto flags = m[i].flags;
+      if ((flags & press_pending) && (int32_t)(m[i].press_usec - press_at) >= 0) {
+        m[i].flags = 0;
+      } else if ((flags & release_pending) && (int32_t)(m[i].release_usec - press_at) > 0) {
+        m[i].release_usec = press_at;
+        push(part, pitch, &m[i], true);
+      }
+    }
+    auto dst = &m[max_history - 1];
+    dst->press_usec = press_at;
+    dst->release_usec = current_usec + release_usec;
+    dst->serial = serial;
+    dst->flags = press_pending | release_pending;
+    push(part, pitch, dst, false);
+    push(part, pitch, dst, true);
+  }
+
+  uint32_t proc(uint32_t usec)
+  {
+    current_usec = usec;
+    while (!queue.empty()) {
+      const auto event = queue.top();
+      auto m = getTarget(event);
+      if (m != nullptr && (int32_t)(event.usec - usec) > 0) {
+        return event.usec - usec;
+      }
+      queue.pop();
+      if (m == nullptr) { continue; }
+      if (event.is_release) {
+        m->flags = 0;
+      } else {
+        m->flags &= ~press_pending;
+      }
+      output->emplace_back(usec, event.part, event.pitch, !event.is_release);
+    }
+    return INT32_MAX;
+  }
+};
+
+struct bench_result_t {
+  std::vector<note_event_t> output;
+  uint32_t wake_count = 0;
+  double sec = 0;
+};
+
+struct pattern_t {
+  const char* name;
+  uint8_t parts;          // 演奏するパート数
+  uint32_t step_usec;     // ステップの間隔
+  uint32_t length_steps;  // 音の長さ (ステップ数)
+  uint32_t wake_usec;     // 発音予定とは別に起床する間隔 (MIDIクロック送信等。0 は無し)
+};
+
+// 各パートがステップごとに6音をストロークで弾く。音の長さが次のステップより長い場合は次のステップの発音で短縮される
+// ストロークの間隔はパートごとに乱数で変え、同時刻のイベントも含めて密に並ぶようにする
+template <typename T>
+void run_pattern(T& scheduler, bench_result_t& result, const pattern_t& pattern, uint32_t total_usec)
+{
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> stroke(0, 8);
+  scheduler.output = &result.output;
+  uint32_t usec = 0;
+  uint32_t next_step = 0;
+  uint32_t next_tick = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (usec < total_usec) {
+    if (usec == next_step) {
+      scheduler.proc(usec);
+      for (int part = 0; part < pattern.parts; ++part) {
+        int32_t stroke_usec = stroke(rng) * 1000;
+        for (int pitch = 0; pitch < def::app::max_pitch_without_drum; ++pitch) {
+          scheduler.setPitchManage(part, pitch, pitch * stroke_usec, pattern.step_usec * pattern.length_steps);
+        }
+      }
+      next_step += pattern.step_usec;
+    }
+    if (pattern.wake_usec && usec == next_tick) { next_tick += pattern.wake_usec; }
+    uint32_t wait = std::min<uint32_t>(scheduler.proc(usec), next_step - usec);
+    if (pattern.wake_usec) { wait = std::min<uint32_t>(wait, next_tick - usec); }
+    ++result.wake_count;
+    usec += wait;
+  }
+  result.sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::sort(result.output.begin(), result.output.end());
+}
+}
+
+void test_pitch_event_queue_strum(void)
+{
+  static constexpr const uint32_t total_usec = 60 * 1000000;
+  static constexpr const pattern_t patterns[] = {
+    // 6パートが 200BPM の16分音符 (75msec) ごとにストロークし、次の次のステップまで伸ばす
+    { "dense 6-part strum", 6, 75000, 2, 0 },
+    // 上記に加えて 200BPM の MIDIクロック (24ppq, 12.5msec) の送信でも起床する
+    { "dense + midi clock", 6, 75000, 2, 12500 },
+    // 2パートが 120BPM の全音符ごとに弾き、MIDIクロックの送信で起床する
+    { "sparse + midi clock", 2, 2000000, 1, 20833 },
+  };
+  char msg[160];
+
+  for (auto &pattern : patterns) {
+    bench_result_t legacy_result;
+    bench_result_t queue_result;
+    double legacy_sec = 1e9;
+    double queue_sec = 1e9;
+    // 測定のばらつきを抑えるため数回実行して最短の時間を採る
+    for (int i = 0; i < 5; ++i) {
+      auto legacy = new legacy_scheduler_t();
+      legacy_result = bench_result_t();
+      run_pattern(*legacy, legacy_result, pattern, total_usec);
+      legacy_sec = std::min(legacy_sec, legacy_result.sec);
+      delete legacy;
+
+      auto queue = new queue_scheduler_t();
+      queue_result = bench_result_t();
+      run_pattern(*queue, queue_result, pattern, total_usec);
+      queue_sec = std::min(queue_sec, queue_result.sec);
+      delete queue;
+    }
+
+    // 同じ入力に対して、出力されるノートオン・オフが時刻も含めて一致すること
+    TEST_ASSERT_EQUAL(legacy_result.output.size(), queue_result.output.size());
+    TEST_ASSERT_TRUE(legacy_result.output == queue_result.output);
+    TEST_ASSERT_EQUAL(legacy_result.wake_count, queue_result.wake_count);
+
+    snprintf(msg, sizeof(msg), "%s  notes:%u  wakes:%u", pattern.name, (unsigned)queue_result.output.size(), queue_result.wake_count);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  legacy scan : %7.1f nsec/wake", legacy_sec * 1e9 / legacy_result.wake_count);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  event queue : %7.1f nsec/wake", queue_sec * 1e9 / queue_result.wake_count);
+    TEST_MESSAGE(msg);
+  }
+}
+
+void test_pitch_event_queue_order(void)
+{
+  // 同時刻では消音を先に取り出す (弾き直しで NoteOff → NoteOn の順になるようにする)
+  pitch_event_queue_t queue;
+  auto valid = [](const pitch_event_t&) { return true; };
+  queue.push({ 1000, 0, 0, 1, 0 }, valid);
+  queue.push({ 1000, 0, 0, 0, 1 }, valid);
+  queue.push({  500, 0, 1, 0, 0 }, valid);
+  // 時刻の比較は32bitの周回を考慮する
+  queue.push({ 0xFFFFFF00u, 0, 2, 0, 0 }, valid);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFF00u, queue.top().usec);
+  queue.pop();
+  TEST_ASSERT_EQUAL_UINT32(500, queue.top().usec);
+  queue.pop();
+  TEST_ASSERT_EQUAL_UINT32(1000, queue.top().usec);
+  TEST_ASSERT_EQUAL(1, queue.top().is_release);
+  queue.pop();
+  TEST_ASSERT_EQUAL(0, queue.top().is_release);
+  queue.pop();
+  TEST_ASSERT_TRUE(queue.empty());
+
+  // 満杯の場合は無効なイベントを取り除いてから追加する
+  for (size_t i = 0; i < pitch_event_queue_t::max_event; ++i) {
+    TEST_ASSERT_TRUE(queue.push({ (uint32_t)i, 0, 0, (uint8_t)(i & 1), 0 }, valid));
+  }
+  TEST_ASSERT_FALSE(queue.push({ 0, 0, 0, 0, 0 }, valid));
+  auto odd_only = [](const pitch_event_t& e) { return e.serial == 1; };
+  TEST_ASSERT_TRUE(queue.push({ 10000, 0, 0, 1, 0 }, odd_only));
+  TEST_ASSERT_EQUAL(pitch_event_queue_t::max_event / 2 + 1, queue.size());
+  TEST_ASSERT_EQUAL_UINT32(1, queue.top().usec);
+}
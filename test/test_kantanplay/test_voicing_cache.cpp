@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// voicing_cache_t (ボイシング計算結果のキャッシュ) と KANTANMusic_GetMidiNoteNumber の全オプションの組合せでの一致確認
+
+#include <unity.h>
+
+#include "voicing_cache.hpp"
+
+#include <chrono>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+// 演奏時に取り得るオプションの全組合せについて fn(degree, key, options) を呼ぶ
+template <typename F>
+uint32_t for_each_options(F fn)
+{
+  uint32_t count = 0;
+  KANTANMusic_GetMidiNoteNumberOptions options;
+  KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(&options);
+  for (int voicing = 0; voicing < KANTANMusic_MAX_VOICING; ++voicing) {
+    options.voicing = (KANTANMusic_Voicing)voicing;
+    for (int modifier = 0; modifier < KANTANMusic_MAX_MODIFIER; ++modifier) {
+      // KANTANMusic_Modifier_RESERVED は利用できない値のため除外する
+      if (modifier == KANTANMusic_Modifier_RESERVED) { continue; }
+      options.modifier = (KANTANMusic_Modifier)modifier;
+      for (int position = def::app::min_position; position <= def::app::max_position; ++position) {
+        options.position = position;
+        for (int bass_degree = 0; bass_degree <= 7; ++bass_degree) {
+          options.bass_degree = bass_degree;
+          for (int bass_shift = -1; bass_shift <= 1; ++bass_shift) {
+            options.bass_semitone_shift = bass_shift;
+            for (int shift = -1; shift <= 1; ++shift) {
+              options.semitone_shift = shift;
+              for (int swap = 0; swap < 2; ++swap) {
+                options.minor_swap = swap;
+                for (int key = 0; key < 12; ++key) {
+                  for (int degree = 1; degree <= 7; ++degree) {
+                    fn(degree, key, options);
+                    ++count;
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return count;
+}
+}
+
+void test_voicing_cache_key(void)
+{
+  // キーから全てのオプションを復元できること (異なるオプションが同じキーにならないこと) を全組合せで確認する
+  uint32_t error = 0;
+  uint32_t count = for_each_options([&](int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions& options) {
+    uint32_t k = voicing_cache_t::makeKey(degree, key, &options);
+    if (k == 0
+     || (int)(k & 7) != degree
+     || (int)((k >> 3) & 15) != key
+     || (int)((k >> 7) & 7) != options.voicing
+     || (int)((k >> 10) & 15) != options.modifier
+     || (int)((k >> 14) & 127) - 64 != options.position
+     || (bool)((k >> 21) & 1) != options.minor_swap
+     || (int)((k >> 22) & 3) - 2 != options.semitone_shift
+     || (int)((k >> 24) & 7) != options.bass_degree
+     || (int)((k >> 27) & 3) - 2 != options.bass_semitone_shift) {
+      ++error;
+    }
+  });
+  char msg[96];
+  snprintf(msg, sizeof(msg), "combinations:%u", count);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(0, error);
+
+  // キーに詰められない値は 0 (キャッシュしない) になること
+  KANTANMusic_GetMidiNoteNumberOptions options;
+  KANTANMusic_GetMidiNoteNumber_SetDefaultOptions(&options);
+  TEST_ASSERT_NOT_EQUAL(0, voicing_cache_t::makeKey(1, 0, &options));
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(8, 0, &options));
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(-1, 0, &options));
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(1, 16, &options));
+  options.position = 64;
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(1, 0, &options));
+  options.position = -65;
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(1, 0, &options));
+  options.position = 0;
+  options.semitone_shift = 2;
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(1, 0, &options));
+  options.semitone_shift = 0;
+  options.bass_semitone_shift = -3;
+  TEST_ASSERT_EQUAL_UINT32(0, voicing_cache_t::makeKey(1, 0, &options));
+}
+
+void test_voicing_cache_notes(void)
+{
+  // 全組合せについて、キャッシュ未使用時 (前回と異なるオプション) と使用時 (同じオプションの2回目) の結果が
+  // KANTANMusic_GetMidiNoteNumber を直接呼んだ結果と一致することを確認する
+  voicing_cache_t cache;
+  uint32_t error = 0;
+  auto start = std::chrono::steady_clock::now();
+  uint32_t count = for_each_options([&](int degree, int key, const KANTANMusic_GetMidiNoteNumberOptions& options) {
+    uint8_t expected[def::app::max_pitch_without_drum];
+    for (int i = 0; i < def::app::max_pitch_without_drum; ++i) {
+      expected[i] = KANTANMusic_GetMidiNoteNumber(def::app::max_pitch_without_drum - i, degree, key, &options);
+    }
+    for (int repeat = 0; repeat < 2; ++repeat) {
+      auto notes = cache.getNotes(degree, key, &options);
+      for (int i = 0; i < def::app::max_pitch_without_drum; ++i) {
+        if (notes[i] != expected[i]) { ++error; }
+      }
+    }
+  });
+  double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  char msg[96];
+  snprintf(msg, sizeof(msg), "combinations:%u  %.1f sec", count, sec);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL_UINT32(0, error);
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// MIDIドライバの単体テスト (pio test -e native_test)
+
+#include <unity.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// test_midi_decoder.cpp
+void test_midi_decoder_corpus(void);
+void test_midi_decoder_fuzz(void);
+void test_midi_decoder_sysex_truncated(void);
+void test_midi_decoder_realtime_in_message(void);
+void test_midi_decoder_throughput(void);
+
+// test_usb_midi_packet.cpp
+void test_usb_midi_packet_roundtrip(void);
+void test_usb_midi_packet_abort(void);
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_midi_decoder_corpus);
+  RUN_TEST(test_midi_decoder_fuzz);
+  RUN_TEST(test_midi_decoder_sysex_truncated);
+  RUN_TEST(test_midi_decoder_realtime_in_message);
+  RUN_TEST(test_midi_decoder_throughput);
+  RUN_TEST(test_usb_midi_packet_roundtrip);
+  RUN_TEST(test_usb_midi_packet_abort);
+  return UNITY_END();
+}
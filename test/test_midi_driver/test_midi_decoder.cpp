@@ -0,0 +1,410 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// MIDI_Decoder : 従来の std::vector によるデコーダとの出力比較と処理速度の計測
+
+#include <unity.h>
+
+#include "midi/midi_driver.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace midi_driver;
+
+namespace {
+
+// デコード結果 (ステータス, データバイト列, 切り詰めの有無)
+struct decoded_t {
+  uint8_t status;
+  std::vector<uint8_t> data;
+  bool truncated;
+  bool operator==(const decoded_t& rhs) const { return status == rhs.status && data == rhs.data && truncated == rhs.truncated; }
+};
+
+static int getDataByteLength(uint8_t status)
+{
+  if (status < 0x80) { return -1; }
+  static constexpr const uint8_t length_0x80_0xE0[] = { 2, 2, 2, 2, 1, 1, 2, 0 };
+  if (status < 0xF0) { return length_0x80_0xE0[(status >> 4) - 8]; }
+  static constexpr const uint8_t length_0xF0[] = { 0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  return length_0xF0[status & 0x0F];
+}
+
+// 従来のデコーダ。受信データを std::vector に溜め、メッセージを取り出すたびに先頭を erase する
+struct legacy_decoder_t {
+  struct message_t {
+    std::vector<uint8_t> data;
+    uint8_t status;
+  };
+  std::vector<uint8_t> _data;
+  uint8_t _runningStatus = 0;
+
+  void addData(const uint8_t* data, size_t length) { _data.insert(_data.end(), data, data + length); }
+
+  bool popMessage(message_t* message)
+  {
+    if (_data.empty()) { return false; }
+    size_t index = 0;
+    if (_data[index] & 0x80) {
+      message->status = _data[index++];
+      _runningStatus = message->status;
+    } else {
+      if (_runningStatus < 0x80) {
+        while (index < _data.size() && (_data[index] & 0x80) == 0) { ++index; }
+        _data.erase(_data.begin(), _data.begin() + index);
+        return false;
+      }
+      message->status = _runningStatus;
+    }
+    int dataByteLength = getDataByteLength(message->status);
+    if (dataByteLength == 0) {
+      _runningStatus = 0;
+      if (message->status == 0xF0) {
+        size_t index_end = index;
+        while (index_end < _data.size() && ((_data[index_end] & 0x80) == 0)) { ++index_end; }
+        if (index_end == _data.size()) { return false; }
+        auto data = _data[index_end];
+        if (data > 0xF7) {
+          message->status = data;
+          message->data.clear();
+          _data.erase(_data.begin() + index_end);
+          return true;
+        }
+        message->data.assign(_data.begin() + index, _data.begin() + index_end);
+        _data.erase(_data.begin(), _data.begin() + index_end);
+        return true;
+      }
+    }
+    if (index + dataByteLength > _data.size()) { return false; }
+    message->data.assign(_data.begin() + index, _data.begin() + index + dataByteLength);
+    _data.erase(_data.begin(), _data.begin() + index + dataByteLength);
+    return true;
+  }
+};
+
+// 従来のデコーダは false を返した時にも不正なデータを読み捨てている場合があるため、進展が無くなるまで呼び出す
+static size_t drain(legacy_decoder_t& decoder, std::vector<decoded_t>* output)
+{
+  size_t count = 0;
+  legacy_decoder_t::message_t message;
+  for (;;) {
+    size_t before = decoder._data.size();
+    if (decoder.popMessage(&message)) {
+      ++count;
+      if (output) {
+        // 現行のデコーダは sysex_buffer_size を超えた分を切り詰めるため、比較用に合わせる
+        bool truncated = message.data.size() > MIDI_Decoder::sysex_buffer_size;
+        if (truncated) { message.data.resize(MIDI_Decoder::sysex_buffer_size); }
+        output->push_back({ message.status, message.data, truncated });
+      }
+      continue;
+    }
+    if (decoder._data.size() == before) { break; }
+  }
+  return count;
+}
+
+static size_t drain(MIDI_Decoder& decoder, std::vector<decoded_t>* output)
+{
+  size_t count = 0;
+  MIDI_Message message;
+  while (decoder.popMessage(&message)) {
+    ++count;
+    if (output) {
+      auto data = message.getData();
+      output->push_back({ message.status, std::vector<uint8_t>(data, data + message.size()), message.truncated });
+    }
+  }
+  return count;
+}
+
+// 受信データを chunk バイトずつ与えてデコードする
+template <typename T>
+static std::vector<decoded_t> decode(const std::vector<uint8_t>& stream, size_t chunk)
+{
+  auto decoder = new T();
+  std::vector<decoded_t> output;
+  for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+    decoder->addData(&stream[pos], std::min(chunk, stream.size() - pos));
+    drain(*decoder, &output);
+  }
+  delete decoder;
+  return output;
+}
+
+// 従来のデコーダが正しく扱える範囲のランダムな受信データを生成する
+// 従来のデコーダには以下の問題があるため、比較用のデータには含めない (現行のデコーダの挙動は個別のテストで確認する)
+//  - チャンネルメッセージの途中に割り込んだシステム・リアルタイム・メッセージをデータバイトとして扱う
+//  - システム・リアルタイム・メッセージの後でランニングステータスが解除される
+//  - システムコモンメッセージの後に続くデータバイトをランニングステータスとして扱う
+struct stream_generator_t {
+  std::mt19937 rng;
+  std::vector<uint8_t> stream;
+  // 従来のデコーダの _runningStatus の状態
+  uint8_t running_status = 0;
+  // 両方のデコーダでステータスが不明となり、データバイトが読み捨てられる状態か否か
+  bool stray_ok = true;
+
+  stream_generator_t(uint32_t seed) : rng(seed) {}
+
+  uint32_t random(uint32_t n) { return rng() % n; }
+  uint8_t data(void) { return random(0x80); }
+  uint8_t realtime(void) { static constexpr const uint8_t rt[] = { 0xF8, 0xFA, 0xFB, 0xFC, 0xFE, 0xFF }; return rt[random(sizeof(rt))]; }
+
+  void channelMessage(void)
+  {
+    uint8_t status = 0x80 + random(0x70);
+    if (running_status >= 0x80 && running_status < 0xF0 && random(2)) {
+      status = running_status;
+    } else {
+      stream.push_back(status);
+    }
+    for (int i = 0; i < getDataByteLength(status); ++i) { stream.push_back(data()); }
+    running_status = status;
+    stray_ok = false;
+  }
+
+  void systemCommon(void)
+  {
+    static constexpr const uint8_t sc[] = { 0xF1, 0xF2, 0xF3, 0xF6 };
+    uint8_t status = sc[random(sizeof(sc))];
+    stream.push_back(status);
+    int length = getDataByteLength(status);
+    for (int i = 0; i < length; ++i) { stream.push_back(data()); }
+    running_status = length ? status : 0;
+    stray_ok = (length == 0);
+  }
+
+  void sysex(size_t length)
+  {
+    stream.push_back(0xF0);
+    for (size_t i = 0; i < length; ++i) {
+      if (random(64) == 0) { stream.push_back(realtime()); }
+      stream.push_back(data());
+    }
+    running_status = 0;
+    // 大半は F7 で終端し、一部は次のメッセージのステータスバイトで終端する
+    if (random(4)) {
+      stream.push_back(0xF7);
+      stray_ok = true;
+    } else {
+      channelMessage();
+    }
+  }
+
+  void generate(size_t count)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      uint32_t r = random(100);
+      if (r < 60) {
+        channelMessage();
+      } else if (r < 70) {
+        systemCommon();
+      } else if (r < 85) {
+        stream.push_back(realtime());
+        running_status = 0;
+      } else if (r < 95) {
+        sysex(random(4) ? random(64) : 400 + random(800));
+      } else if (stray_ok) {
+        // ステータスが不明なデータバイト
+        for (uint32_t j = 1 + random(3); j; --j) { stream.push_back(data()); }
+      }
+    }
+  }
+};
+
+static void assert_same(const std::vector<uint8_t>& stream, size_t chunk)
+{
+  auto legacy = decode<legacy_decoder_t>(stream, chunk);
+  auto current = decode<MIDI_Decoder>(stream, chunk);
+  TEST_ASSERT_EQUAL(legacy.size(), current.size());
+  for (size_t i = 0; i < legacy.size(); ++i) {
+    TEST_ASSERT_EQUAL_UINT8(legacy[i].status, current[i].status);
+    TEST_ASSERT_EQUAL(legacy[i].data.size(), current[i].data.size());
+    TEST_ASSERT_TRUE(legacy[i].data == current[i].data);
+    TEST_ASSERT_EQUAL(legacy[i].truncated, current[i].truncated);
+  }
+}
+
+} // namespace
+
+// 代表的な受信データについて、受信の区切り位置を変えても従来のデコーダと同じ出力になること
+void test_midi_decoder_corpus(void)
+{
+  static const std::vector<std::vector<uint8_t>> corpus = {
+    { 0x90, 0x3C, 0x40, 0x80, 0x3C, 0x00 },                         // ノートオン・オフ
+    { 0x90, 0x3C, 0x40, 0x3E, 0x40, 0x40, 0x40, 0x3C, 0x00 },       // ランニングステータス
+    { 0xC0, 0x05, 0x06, 0xD0, 0x7F, 0x10 },                         // データバイト1個のメッセージ
+    { 0xE0, 0x00, 0x40, 0xB0, 0x07, 0x64 },                         // ピッチベンド・コントロールチェンジ
+    { 0xF8, 0xFA, 0xF8, 0xFC, 0xFE, 0xFF },                         // システム・リアルタイム
+    { 0xF2, 0x10, 0x02, 0xF3, 0x01, 0xF1, 0x23, 0xF6 },             // システムコモン
+    { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 },                         // SysEx (GM System On)
+    { 0xF0, 0x43, 0x10, 0xF8, 0x4C, 0x00, 0xF8, 0x00, 0x7E, 0x00, 0xF7 }, // SysEx中のシステム・リアルタイム
+    { 0xF0, 0x01, 0x02, 0x90, 0x3C, 0x40 },                         // F7の無いSysEx
+    { 0xF0, 0xF7, 0xF7, 0xF0, 0xF7 },                               // 空のSysExと単独のF7
+    { 0x3C, 0x40, 0x7F, 0x90, 0x3C, 0x40 },                         // 先頭のステータスが不明なデータバイト
+    { 0xF8, 0x12, 0x90, 0x3C, 0x40 },                               // システム・リアルタイム後の不明なデータバイト
+    { 0xF4, 0xF5, 0xF9, 0xFD, 0xC1, 0x00 },                         // 未定義のステータス
+  };
+  for (auto& stream : corpus) {
+    for (size_t chunk = 1; chunk <= stream.size(); ++chunk) {
+      assert_same(stream, chunk);
+    }
+  }
+
+  // 境界付近の長さのSysEx
+  for (size_t length : { MIDI_Decoder::sysex_buffer_size - 1, MIDI_Decoder::sysex_buffer_size, MIDI_Decoder::sysex_buffer_size + 1, (size_t)4000 }) {
+    std::vector<uint8_t> stream = { 0xF0 };
+    for (size_t i = 0; i < length; ++i) { stream.push_back(i & 0x7F); }
+    stream.push_back(0xF7);
+    stream.insert(stream.end(), { 0x90, 0x3C, 0x40 });
+    for (size_t chunk : { (size_t)1, (size_t)3, (size_t)64, (size_t)1000 }) {
+      assert_same(stream, chunk);
+    }
+  }
+}
+
+// ランダムな受信データ・受信の区切り位置について、従来のデコーダと同じ出力になること
+void test_midi_decoder_fuzz(void)
+{
+  size_t total_message = 0;
+  size_t total_truncated = 0;
+  for (uint32_t seed = 1; seed <= 500; ++seed) {
+    stream_generator_t gen(seed);
+    gen.generate(200);
+    // 従来のデコーダは終端していないSysExを保持し続けるため、最後にF7で終端しておく
+    gen.stream.push_back(0xF7);
+    size_t chunk = 1 + gen.random(128);
+    assert_same(gen.stream, chunk);
+    auto current = decode<MIDI_Decoder>(gen.stream, chunk);
+    total_message += current.size();
+    for (auto& m : current) { total_truncated += m.truncated; }
+  }
+  char msg[128];
+  snprintf(msg, sizeof(msg), "fuzz : %u messages (%u sysex truncated)", (unsigned)total_message, (unsigned)total_truncated);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_GREATER_THAN(0, total_truncated);
+}
+
+// sysex_buffer_size を超えるSysExは切り詰めて出力し、truncated と getSysExTruncatedCount で検出できること
+void test_midi_decoder_sysex_truncated(void)
+{
+  MIDI_Decoder decoder;
+  MIDI_Message message;
+  std::vector<uint8_t> stream = { 0xF0 };
+  for (size_t i = 0; i < 1000; ++i) { stream.push_back(i & 0x7F); }
+  stream.insert(stream.end(), { 0xF7, 0xF0, 0x01, 0x02, 0xF7 });
+
+  // 1000バイトのSysExはリングバッファに一度に入らないため分割して与える
+  std::vector<decoded_t> output;
+  for (size_t pos = 0; pos < stream.size(); pos += 256) {
+    decoder.addData(&stream[pos], std::min<size_t>(256, stream.size() - pos));
+    drain(decoder, &output);
+  }
+  TEST_ASSERT_EQUAL(0, decoder.getOverflowCount());
+  TEST_ASSERT_EQUAL(4, output.size());
+  TEST_ASSERT_EQUAL_UINT8(0xF0, output[0].status);
+  TEST_ASSERT_EQUAL(MIDI_Decoder::sysex_buffer_size, output[0].data.size());
+  TEST_ASSERT_TRUE(output[0].truncated);
+  TEST_ASSERT_TRUE(std::equal(output[0].data.begin(), output[0].data.end(), stream.begin() + 1));
+  TEST_ASSERT_EQUAL_UINT8(0xF7, output[1].status);
+  TEST_ASSERT_FALSE(output[1].truncated);
+  TEST_ASSERT_EQUAL_UINT8(0xF0, output[2].status);
+  TEST_ASSERT_EQUAL(2, output[2].data.size());
+  TEST_ASSERT_FALSE(output[2].truncated);
+  TEST_ASSERT_EQUAL(1, decoder.getSysExTruncatedCount());
+
+  // 切り詰めの途中で clear した場合は、次のSysExに持ち越さないこと
+  decoder.addData(stream.data(), 600);
+  TEST_ASSERT_FALSE(decoder.popMessage(&message));
+  decoder.clear();
+  static constexpr const uint8_t short_sysex[] = { 0xF0, 0x7E, 0xF7 };
+  decoder.addData(short_sysex, sizeof(short_sysex));
+  TEST_ASSERT_TRUE(decoder.popMessage(&message));
+  TEST_ASSERT_EQUAL_UINT8(0xF0, message.status);
+  TEST_ASSERT_EQUAL(1, message.length);
+  TEST_ASSERT_FALSE(message.truncated);
+  TEST_ASSERT_EQUAL(1, decoder.getSysExTruncatedCount());
+}
+
+// 従来のデコーダと異なる挙動 : チャンネルメッセージの途中のシステム・リアルタイム・メッセージを先に出力し、ランニングステータスを維持する
+void test_midi_decoder_realtime_in_message(void)
+{
+  static constexpr const uint8_t stream[] = { 0x90, 0x3C, 0xF8, 0x40, 0xFE, 0x3E, 0x41 };
+  MIDI_Decoder decoder;
+  decoder.addData(stream, sizeof(stream));
+  std::vector<decoded_t> output;
+  drain(decoder, &output);
+  TEST_ASSERT_EQUAL(4, output.size());
+  TEST_ASSERT_TRUE(output[0] == (decoded_t{ 0xF8, {}, false }));
+  TEST_ASSERT_TRUE(output[1] == (decoded_t{ 0x90, { 0x3C, 0x40 }, false }));
+  TEST_ASSERT_TRUE(output[2] == (decoded_t{ 0xFE, {}, false }));
+  TEST_ASSERT_TRUE(output[3] == (decoded_t{ 0x90, { 0x3E, 0x41 }, false }));
+}
+
+// 1秒あたりのデコード数 (従来のデコーダとの比較)
+void test_midi_decoder_throughput(void)
+{
+  // 演奏中の典型的な受信データ : ランニングステータスのノート・CCとMIDIクロック、時折SysEx
+  std::mt19937 rng(1234);
+  std::vector<uint8_t> stream;
+  uint8_t running_status = 0;
+  while (stream.size() < (1 << 20)) {
+    uint32_t r = rng() % 100;
+    if (r < 70) {
+      uint8_t status = (rng() % 4) ? 0x90 | (rng() % 6) : 0xB0;
+      if (status != running_status) { stream.push_back(status); }
+      stream.push_back(rng() & 0x7F);
+      stream.push_back(rng() & 0x7F);
+      running_status = status;
+    } else if (r < 98) {
+      stream.push_back(0xF8);
+      running_status = 0;
+    } else {
+      stream.push_back(0xF0);
+      for (int i = 0, n = 8 + rng() % 32; i < n; ++i) { stream.push_back(rng() & 0x7F); }
+      stream.push_back(0xF7);
+      running_status = 0;
+    }
+  }
+
+  char msg[128];
+  for (size_t chunk : { (size_t)20, (size_t)256 }) {
+    double legacy_sec = 1e9, current_sec = 1e9;
+    size_t legacy_count = 0, current_count = 0;
+    for (int trial = 0; trial < 3; ++trial) {
+      {
+        legacy_decoder_t decoder;
+        auto start = std::chrono::steady_clock::now();
+        legacy_count = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+          decoder.addData(&stream[pos], std::min(chunk, stream.size() - pos));
+          legacy_count += drain(decoder, nullptr);
+        }
+        legacy_sec = std::min(legacy_sec, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      }
+      {
+        auto decoder = new MIDI_Decoder();
+        auto start = std::chrono::steady_clock::now();
+        current_count = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+          decoder->addData(&stream[pos], std::min(chunk, stream.size() - pos));
+          current_count += drain(*decoder, nullptr);
+        }
+        current_sec = std::min(current_sec, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        delete decoder;
+      }
+    }
+    TEST_ASSERT_EQUAL(legacy_count, current_count);
+    snprintf(msg, sizeof(msg), "chunk:%3u bytes  messages:%u", (unsigned)chunk, (unsigned)current_count);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  legacy vector : %7.2f Mmsg/sec", legacy_count / legacy_sec * 1e-6);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  ring buffer   : %7.2f Mmsg/sec", current_count / current_sec * 1e-6);
+    TEST_MESSAGE(msg);
+  }
+}
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// usb_midi_sysex_packer_t (SysExのUSB-MIDIイベントパケットへの分割) と受信側のパケットの復元の往復
+
+#include <unity.h>
+
+#include "midi/usb_midi_packet.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace midi_driver;
+
+namespace {
+static constexpr const size_t usb_buf_size = 64; // USBの送信バッファ1つ分
+
+struct receiver_t {
+  MIDI_Decoder decoder;
+  std::vector<uint8_t> bytes;                 // パケットから復元したバイト列
+  std::vector<std::vector<uint8_t>> sysex;    // デコーダが出力したSysExのデータ
+  int truncated = 0;
+  bool packet_error = false;
+
+  // 1回のフラッシュで送られたパケットを受信側と同じ手順で復元し、デコーダに与える
+  void receive(const std::vector<uint8_t>& packets)
+  {
+    std::vector<uint8_t> chunk;
+    for (size_t i = 0; i + 4 <= packets.size(); i += 4) {
+      uint8_t cin = packets[i] & 0x0F;
+      size_t len = usb_midi_packet_length(packets[i]);
+      // 開始・継続のパケットは3バイトで終端を含まず、終端のパケットは最後のバイトが F7 であること
+      if (cin < 0x04 || cin > 0x07) { packet_error = true; }
+      if (cin == 0x04 && std::find(&packets[i + 1], &packets[i + 4], 0xF7) != &packets[i + 4]) { packet_error = true; }
+      if (cin != 0x04 && packets[i + len] != 0xF7) { packet_error = true; }
+      chunk.insert(chunk.end(), &packets[i + 1], &packets[i + 1 + len]);
+    }
+    bytes.insert(bytes.end(), chunk.begin(), chunk.end());
+    decoder.addData(chunk.data(), chunk.size());
+    MIDI_Message message;
+    while (decoder.popMessage(&message)) {
+      if (message.status != 0xF0) { continue; }
+      sysex.emplace_back(message.getData(), message.getData() + message.size());
+      truncated += message.truncated;
+    }
+  }
+};
+
+// USBの送信と同様に、送信バッファ1つ分ずつ取り出して送る
+static int flush(usb_midi_sysex_packer_t& packer, receiver_t& receiver)
+{
+  std::vector<uint8_t> packets;
+  packer.pop(packets, usb_buf_size);
+  if (packets.empty()) { return 0; }
+  receiver.receive(packets);
+  return 1;
+}
+
+// MIDI_Transport_USB::addMessage と同じ手順で、入りきらない分はフラッシュしながら続きを渡す
+static int send_sysex(usb_midi_sysex_packer_t& packer, receiver_t& receiver, const std::vector<uint8_t>& data, std::mt19937& rng)
+{
+  int flush_count = 0;
+  size_t accepted = 0;
+  while (accepted < data.size()) {
+    size_t chunk = 1 + rng() % 300;
+    if (chunk > data.size() - accepted) { chunk = data.size() - accepted; }
+    size_t n = packer.add(&data[accepted], chunk);
+    accepted += n;
+    if (n < chunk || (rng() % 4) == 0) { flush_count += flush(packer, receiver); }
+  }
+  return flush_count;
+}
+
+static std::vector<uint8_t> make_sysex(size_t payload, std::mt19937& rng)
+{
+  std::vector<uint8_t> data { 0xF0 };
+  for (size_t i = 0; i < payload; ++i) { data.push_back(rng() & 0x7F); }
+  data.push_back(0xF7);
+  return data;
+}
+} // namespace
+
+// 様々な長さのSysExを任意の区切りで渡しても、受信側で元のバイト列とメッセージに戻ること
+void test_usb_midi_packet_roundtrip(void)
+{
+  std::mt19937 rng(22);
+  usb_midi_sysex_packer_t packer;
+  receiver_t receiver;
+  std::vector<uint8_t> expected;
+  std::vector<std::vector<uint8_t>> expected_sysex;
+
+  for (int i = 0; i < 300; ++i) {
+    // 終端のパケットが1~3バイトの全ての場合と、デコーダのバッファに収まる長さを中心にする
+    size_t payload = (i < 12) ? i : rng() % MIDI_Decoder::sysex_buffer_size;
+    auto data = make_sysex(payload, rng);
+    expected.insert(expected.end(), data.begin(), data.end());
+    expected_sysex.emplace_back(data.begin() + 1, data.end() - 1);
+    send_sysex(packer, receiver, data, rng);
+  }
+  while (flush(packer, receiver)) {}
+  TEST_ASSERT_FALSE(receiver.packet_error);
+  TEST_ASSERT_TRUE(receiver.bytes == expected);
+  TEST_ASSERT_EQUAL(expected_sysex.size(), receiver.sysex.size());
+  TEST_ASSERT_TRUE(receiver.sysex == expected_sysex);
+  TEST_ASSERT_EQUAL(0, receiver.truncated);
+
+  // 64KBのダンプ : リングの容量を超える分は送信しながら続きを渡す
+  receiver_t dump_receiver;
+  auto dump = make_sysex(65536 - 2, rng);
+  int flush_count = send_sysex(packer, dump_receiver, dump, rng);
+  while (flush(packer, dump_receiver)) { ++flush_count; }
+  TEST_ASSERT_FALSE(dump_receiver.packet_error);
+  TEST_ASSERT_TRUE(dump_receiver.bytes == dump);
+  TEST_ASSERT_EQUAL(1, dump_receiver.truncated);
+  // 1パケット3バイトで、USBの送信バッファ1つに16パケット
+  TEST_ASSERT_EQUAL((65536 + 47) / 48, flush_count);
+
+  char msg[96];
+  snprintf(msg, sizeof(msg), "300 sysex (%u bytes) ok, 64KB dump : %d flushes of %u bytes", (unsigned)expected.size(), flush_count, (unsigned)usb_buf_size);
+  TEST_MESSAGE(msg);
+}
+
+// 送信途中で打ち切った場合は終端で閉じ、次のSysExに途中のバイトが混ざらないこと
+void test_usb_midi_packet_abort(void)
+{
+  std::mt19937 rng(220);
+  for (size_t payload : { 1000, 1001, 1002 }) {
+    usb_midi_sysex_packer_t packer;
+    receiver_t receiver;
+    auto data = make_sysex(payload, rng);
+    // 送信できない間にリングが一杯になり、途中までしか受け付けられない
+    size_t accepted = packer.add(data.data(), data.size());
+    TEST_ASSERT_LESS_THAN(data.size(), accepted);
+    TEST_ASSERT_GREATER_THAN(usb_midi_sysex_packer_t::ring_size / 2, accepted);
+    packer.abort();
+    // 終端のパケットは予約した空きに必ず入る
+    TEST_ASSERT_EQUAL(0, packer.available() % 4);
+    while (flush(packer, receiver)) {}
+
+    auto next = make_sysex(5, rng);
+    TEST_ASSERT_EQUAL(next.size(), packer.add(next.data(), next.size()));
+    while (flush(packer, receiver)) {}
+
+    std::vector<uint8_t> expected(data.begin(), data.begin() + accepted);
+    expected.push_back(0xF7);
+    expected.insert(expected.end(), next.begin(), next.end());
+    TEST_ASSERT_FALSE(receiver.packet_error);
+    TEST_ASSERT_TRUE(receiver.bytes == expected);
+    TEST_ASSERT_EQUAL(2, receiver.sysex.size());
+    TEST_ASSERT_TRUE(receiver.sysex[1] == std::vector<uint8_t>(next.begin() + 1, next.end() - 1));
+
+    // 閉じた後や送信途中でない場合の打ち切りは何もしない
+    packer.abort();
+    TEST_ASSERT_EQUAL(0, packer.available());
+  }
+}
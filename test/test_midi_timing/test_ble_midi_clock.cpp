@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// ble_midi_clock_t (BLE-MIDIの受信タイムスタンプによる読み出し時刻の決定) の検証
+
+#include <unity.h>
+
+#include "midi/midi_transport_ble.hpp"
+
+#include <math.h>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace midi_driver;
+
+namespace {
+struct stats_t {
+  double mean = 0;
+  double sd = 0;
+};
+stats_t calc_stats(const std::vector<double>& values)
+{
+  stats_t result;
+  for (double v : values) { result.mean += v; }
+  result.mean /= values.size();
+  for (double v : values) { result.sd += (v - result.mean) * (v - result.mean); }
+  result.sd = sqrt(result.sd / values.size());
+  return result;
+}
+}
+
+void test_ble_midi_clock_jitter(void)
+{
+  // 120 BPM の16分音符で、半分の確率で2msec間隔の3音の和音を10分間送信する
+  // 送信側のクロックは +80ppm ずれており、接続イベントは 0~0.3msec 遅れ、5% は1接続間隔分再送で遅れるものとする
+  // 送信時刻に対する遅れの標準偏差を、受信した時刻そのままの場合と、読み出し時刻に揃えた場合とで比較する
+  char msg[160];
+  for (double interval : { 7.5, 11.25, 15.0 }) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    ble_midi_clock_t clock;
+
+    std::vector<double> events;
+    for (double t = 1000; t < 600000; t += 125) {
+      events.push_back(t);
+      if (uniform(rng) < 0.5) {
+        events.push_back(t + 2);
+        events.push_back(t + 4);
+      }
+    }
+
+    std::vector<double> arrival_delay;
+    std::vector<double> release_delay;
+    double max_hold = 0;
+    size_t index = 0;
+    for (double conn = 0; conn < 600500; conn += interval) {
+      double arrival = conn + uniform(rng) * 0.3 + (uniform(rng) < 0.05 ? interval : 0);
+      clock.beginPacket((uint32_t)(arrival * 1000));
+      for (; index < events.size() && events[index] <= conn; ++index) {
+        double remote_msec = events[index] * (1 + 80e-6) + 12345.0;
+        uint16_t timestamp = ((uint32_t)remote_msec) & 0x1FFF;
+        double release = clock.getReleaseUsec(timestamp) / 1000.0;
+        // 同期が落ち着くまでの最初の10秒は集計しない
+        if (events[index] < 10000) { continue; }
+        arrival_delay.push_back(arrival - events[index]);
+        release_delay.push_back(release - events[index]);
+        if (max_hold < release - arrival) { max_hold = release - arrival; }
+      }
+    }
+    auto raw = calc_stats(arrival_delay);
+    auto rel = calc_stats(release_delay);
+    snprintf(msg, sizeof(msg), "interval %5.2f ms : arrival sd %.2f ms (mean %.2f) -> release sd %.2f ms (mean %.2f), max hold %.1f ms"
+            , interval, raw.sd, raw.mean, rel.sd, rel.mean, max_hold);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN_MESSAGE(raw.sd * 0.6, rel.sd, msg);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(ble_midi_clock_t::max_hold_usec / 1000.0, max_hold, msg);
+  }
+}
+
+void test_ble_midi_clock_timestamp_wrap(void)
+{
+  // 13bitのタイムスタンプ (8192msec) の周回を跨いでも、読み出し時刻が送信間隔どおりに進むこと
+  ble_midi_clock_t clock;
+  const uint32_t delay_usec = 3000;
+  uint32_t prev_release = 0;
+  for (uint32_t remote_msec = 8000; remote_msec < 8000 + 20000; remote_msec += 100) {
+    uint32_t arrival = 0xFFFF0000u + remote_msec * 1000 + delay_usec;
+    clock.beginPacket(arrival);
+    uint32_t release = clock.getReleaseUsec(remote_msec & 0x1FFF);
+    TEST_ASSERT_TRUE((int32_t)(release - arrival) >= 0);
+    TEST_ASSERT_TRUE((int32_t)(release - arrival) <= (int32_t)ble_midi_clock_t::max_hold_usec);
+    if (remote_msec > 8000) {
+      TEST_ASSERT_INT32_WITHIN(1000, 100000, (int32_t)(release - prev_release));
+    }
+    prev_release = release;
+  }
+}
+
+void test_ble_midi_clock_resync(void)
+{
+  // 受信が resync_usec 以上途絶えた後は、古い基準に引きずられずに受信直後の時刻で読み出すこと
+  ble_midi_clock_t clock;
+  uint32_t arrival = 1000000;
+  for (uint32_t remote_msec = 0; remote_msec < 1000; remote_msec += 10, arrival += 10000) {
+    clock.beginPacket(arrival);
+    clock.getReleaseUsec(remote_msec);
+  }
+  // 送信側が再起動してタイムスタンプが飛んだものとする
+  arrival += ble_midi_clock_t::resync_usec + 1000;
+  clock.beginPacket(arrival);
+  uint32_t release = clock.getReleaseUsec(5000);
+  TEST_ASSERT_TRUE((int32_t)(release - arrival) >= 0);
+  TEST_ASSERT_TRUE((int32_t)(release - arrival) <= (int32_t)ble_midi_clock_t::max_hold_usec);
+  // 再同期後の次のメッセージは、送信間隔どおりに読み出すこと
+  arrival += 10000;
+  clock.beginPacket(arrival);
+  TEST_ASSERT_INT32_WITHIN(1000, 10000, (int32_t)(clock.getReleaseUsec(5010) - release));
+}
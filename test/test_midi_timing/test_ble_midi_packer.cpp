@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// ble_midi_packer_t (BLE-MIDIの送信パケットの組み立て) の検証
+
+#include <unity.h>
+
+#include "midi/midi_transport_ble.hpp"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+
+using namespace midi_driver;
+
+void test_ble_midi_packer_layout(void)
+{
+  ble_midi_packer_t packer;
+  packer.setPayloadSize(20);
+  const uint8_t note_on_60[] = { 0x90, 60, 100 };
+  const uint8_t note_on_64[] = { 0x90, 64, 100 };
+  const uint8_t note_off_60[] = { 0x80, 60, 0 };
+  const uint8_t clock[] = { 0xF8 };
+
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_60, 3, 1000));
+  // 同じ時刻・同じステータス : タイムスタンプもステータスも省略
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_64, 3, 1000));
+  // 時刻だけ異なる : タイムスタンプを付けてランニングステータス
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_64, 3, 1007));
+  // リアルタイムメッセージの後はステータスを付け直す
+  TEST_ASSERT_TRUE(packer.addMessage(clock, 1, 1009));
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_60, 3, 1010));
+  TEST_ASSERT_TRUE(packer.addMessage(note_off_60, 3, 1020));
+
+  static constexpr const uint8_t expected[] = {
+    0x87,                   // ヘッダ (1000msec の上位6bit)
+    0xE8, 0x90, 60, 100,    // 1000msec
+                64, 100,    // 1000msec (省略)
+    0xEF,       64, 100,    // 1007msec (ランニングステータス)
+    0xF1, 0xF8,             // 1009msec
+    0xF2, 0x90, 60, 100,    // 1010msec
+    0xFC, 0x80, 60, 0,      // 1020msec
+  };
+  TEST_ASSERT_EQUAL(sizeof(expected), packer.size());
+  TEST_ASSERT_TRUE(std::equal(expected, expected + sizeof(expected), packer.data()));
+  TEST_ASSERT_EQUAL(6, packer.getMessageCount());
+  TEST_ASSERT_TRUE(packer.isFull());
+  // 入りきらないメッセージは追加せずに false を返す
+  TEST_ASSERT_FALSE(packer.addMessage(note_on_64, 3, 1020));
+  TEST_ASSERT_EQUAL(sizeof(expected), packer.size());
+
+  // 先頭のメッセージから128msec以上経過したメッセージは別パケットにする
+  packer.clear();
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_60, 3, 2000));
+  TEST_ASSERT_TRUE(packer.addMessage(note_on_64, 3, 2127));
+  TEST_ASSERT_FALSE(packer.addMessage(note_off_60, 3, 2128));
+}
+
+namespace {
+struct packet_count_t {
+  size_t packets = 0;
+  size_t bytes = 0;
+  void add(size_t size) { ++packets; bytes += size; }
+  double getBytesPerPacket(void) const { return packets ? (double)bytes / packets : 0; }
+};
+}
+
+void test_ble_midi_packer_efficiency(void)
+{
+  // MTU 23 (ペイロード20バイト) で、500msecごとに前の和音のノートオフ6音と、6~12msec間隔のストローク6音を10秒間送信する
+  // 従来の送信 (演奏タスクから受け取った分をフラッシュごとに1パケットで送る) と、
+  // sendFlush と同じく前回の送信から接続間隔が経つまでパケットを溜める送信とで、パケット数と1パケットあたりのバイト数を比べる
+  char msg[160];
+  for (double interval : { 7.5, 15.0, 30.0 }) {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<std::pair<double, uint8_t> > events;
+    for (double t = 100; t < 10000; t += 500) {
+      double x = t;
+      for (int i = 0; i < 6; ++i) { events.push_back({ x, 0x80 }); }
+      for (int i = 0; i < 6; ++i) { events.push_back({ x, 0x90 }); x += 6 + uniform(rng) * 6; }
+    }
+
+    // 従来の送信 : 同じ msec に受け取ったメッセージを1パケットにまとめ、同じステータスはタイムスタンプを共有する
+    packet_count_t old_count;
+    for (size_t i = 0; i < events.size(); ) {
+      std::vector<uint8_t> data;
+      uint8_t running_status = 0;
+      uint32_t msec = (uint32_t)events[i].first;
+      for (; i < events.size() && (uint32_t)events[i].first == msec && data.size() + 5 <= 20; ++i) {
+        if (data.empty()) { data.push_back(0x80 | ((msec >> 7) & 0x3F)); }
+        if (running_status != events[i].second) {
+          running_status = events[i].second;
+          data.push_back(0x80 | (msec & 0x7F));
+          data.push_back(running_status);
+        }
+        data.push_back(60);
+        data.push_back(100);
+      }
+      old_count.add(data.size());
+    }
+
+    // 新しい送信 : 満杯になるか、前回の送信から接続間隔 (最大 max_tx_hold_usec) が経つまで溜める
+    packet_count_t new_count;
+    ble_midi_packer_t packer;
+    packer.setPayloadSize(20);
+    const double hold = std::min(interval, MIDI_Transport_BLE::max_tx_hold_usec / 1000.0);
+    double last_send = -1e9;
+    size_t index = 0;
+    // 演奏タスクのループを 0.25msec 刻みで模擬する
+    for (double t = 0; t < 10100; t += 0.25) {
+      for (; index < events.size() && events[index].first <= t; ++index) {
+        const uint8_t message[] = { events[index].second, 60, 100 };
+        uint32_t msec = (uint32_t)events[index].first;
+        if (!packer.addMessage(message, 3, msec)) {
+          new_count.add(packer.size());
+          packer.clear();
+          last_send = t;
+          packer.addMessage(message, 3, msec);
+        }
+        if (packer.isFull()) {
+          new_count.add(packer.size());
+          packer.clear();
+          last_send = t;
+        }
+      }
+      if (!packer.empty() && t - last_send >= hold) {
+        new_count.add(packer.size());
+        packer.clear();
+        last_send = t;
+      }
+    }
+
+    snprintf(msg, sizeof(msg), "interval %5.2f ms : flush per drain %zu packets (%.1f B/packet) -> packed %zu packets (%.1f B/packet)"
+            , interval, old_count.packets, old_count.getBytesPerPacket(), new_count.packets, new_count.getBytesPerPacket());
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(old_count.packets, new_count.packets, msg);
+    if (interval >= 15.0) {
+      // 接続間隔が長いほど1パケットにまとまり、パケット数が減ること
+      TEST_ASSERT_LESS_THAN_MESSAGE(old_count.packets * 0.8, new_count.packets, msg);
+      TEST_ASSERT_GREATER_THAN(old_count.getBytesPerPacket(), new_count.getBytesPerPacket());
+    }
+  }
+}
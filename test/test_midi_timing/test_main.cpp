@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// MIDIのタイミング処理の単体テスト (pio test -e native_test)
+
+#include <unity.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// test_midi_clock_in.cpp
+void test_midi_clock_in_jitter(void);
+void test_midi_clock_in_tempo_step(void);
+void test_midi_clock_in_lost_tick(void);
+
+// test_midi_clock_out.cpp
+void test_midi_clock_out_ten_minutes(void);
+void test_midi_clock_out_tempo_change(void);
+void test_midi_clock_out_catch_up(void);
+
+// test_ble_midi_clock.cpp
+void test_ble_midi_clock_jitter(void);
+void test_ble_midi_clock_timestamp_wrap(void);
+void test_ble_midi_clock_resync(void);
+
+// test_ble_midi_packer.cpp
+void test_ble_midi_packer_layout(void);
+void test_ble_midi_packer_efficiency(void);
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_midi_clock_in_jitter);
+  RUN_TEST(test_midi_clock_in_tempo_step);
+  RUN_TEST(test_midi_clock_in_lost_tick);
+  RUN_TEST(test_midi_clock_out_ten_minutes);
+  RUN_TEST(test_midi_clock_out_tempo_change);
+  RUN_TEST(test_midi_clock_out_catch_up);
+  RUN_TEST(test_ble_midi_clock_jitter);
+  RUN_TEST(test_ble_midi_clock_timestamp_wrap);
+  RUN_TEST(test_ble_midi_clock_resync);
+  RUN_TEST(test_ble_midi_packer_layout);
+  RUN_TEST(test_ble_midi_packer_efficiency);
+  return UNITY_END();
+}
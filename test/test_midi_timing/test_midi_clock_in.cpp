@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// midi_clock_in_t (外部MIDIクロックへのPLL同期) の検証
+
+#include <unity.h>
+
+#include "midi_clock.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace kanplay_ns;
+
+static constexpr const uint32_t tick_per_beat = midi_clock_in_t::tick_per_beat;
+
+static uint32_t beat_usec_from_bpm(uint32_t bpm)
+{
+  return 60 * 1000 * 1000 / bpm;
+}
+
+// 理想のクロックに ±jitter_usec の一様な揺らぎを加えて受信させ、
+// 拍の1/4の位置で求めた次の拍の頭の予測時刻と、理想の拍の頭との差を集計する
+static void run_jitter(uint32_t bpm, uint32_t jitter_usec, std::vector<int32_t>* errors)
+{
+  midi_clock_in_t clock;
+  std::mt19937 rng(bpm);
+  std::uniform_int_distribution<int32_t> jitter(-(int32_t)jitter_usec, (int32_t)jitter_usec);
+
+  const double beat_usec = beat_usec_from_bpm(bpm);
+  const double tick_usec = beat_usec / tick_per_beat;
+  // 32bitの時刻の折り返しを跨ぐように開始する
+  const uint32_t origin = 0xFFF00000u;
+
+  clock.receiveStart();
+  const uint32_t total_beats = 64;
+  // 同期確立後の揺らぎに対する精度を見るため、最初の8拍は集計しない
+  const uint32_t skip_beats = 8;
+  for (uint32_t i = 0; i < total_beats * tick_per_beat; ++i) {
+    uint32_t usec = origin + (uint32_t)(int64_t)(i * tick_usec + 0.5) + jitter(rng);
+    clock.receiveTick(usec);
+    if (i % tick_per_beat != tick_per_beat / 4 || i < skip_beats * tick_per_beat) { continue; }
+    TEST_ASSERT_TRUE(clock.isLocked(usec));
+    uint32_t predicted = usec + clock.getNextBeatRemainUsec(usec);
+    uint32_t ideal = origin + (uint32_t)(int64_t)((i / tick_per_beat + 1) * beat_usec + 0.5);
+    errors->push_back(abs((int32_t)(predicted - ideal)));
+  }
+}
+
+static int32_t percentile(std::vector<int32_t> values, uint32_t percent)
+{
+  std::sort(values.begin(), values.end());
+  size_t index = (values.size() - 1) * percent / 100;
+  return values[index];
+}
+
+void test_midi_clock_in_jitter(void)
+{
+  char msg[128];
+  for (uint32_t bpm : { 60u, 120u, 174u }) {
+    std::vector<int32_t> errors;
+    run_jitter(bpm, 2000, &errors);
+    int32_t median = percentile(errors, 50);
+    int32_t p99 = percentile(errors, 99);
+    snprintf(msg, sizeof(msg), "bpm %3u, jitter +-2000us : next beat error median %5d us, p99 %5d us", (unsigned)bpm, (int)median, (int)p99);
+    TEST_MESSAGE(msg);
+    // 個々のクロックの揺らぎ (±2msec) より十分小さい誤差で拍の頭を予測できること
+    TEST_ASSERT_LESS_THAN_MESSAGE(1000, median, msg);
+    TEST_ASSERT_LESS_THAN_MESSAGE(2000, p99, msg);
+  }
+}
+
+void test_midi_clock_in_tempo_step(void)
+{
+  // 100 BPM で同期した後に 130 BPM へ変化させ、拍の周期の推定が 1% 以内に収まるまでの拍数を求める
+  midi_clock_in_t clock;
+  char msg[128];
+  uint32_t usec = 0x10000;
+  clock.receiveStart();
+  const uint32_t tick_100 = beat_usec_from_bpm(100) / tick_per_beat;
+  for (uint32_t i = 0; i < 16 * tick_per_beat; ++i) {
+    usec += tick_100;
+    clock.receiveTick(usec);
+  }
+  TEST_ASSERT_INT_WITHIN(beat_usec_from_bpm(100) / 100, beat_usec_from_bpm(100), clock.getBeatCycleUsec());
+
+  const uint32_t beat_130 = beat_usec_from_bpm(130);
+  const uint32_t tick_130 = beat_130 / tick_per_beat;
+  uint32_t settled_tick = UINT32_MAX;
+  for (uint32_t i = 0; i < 16 * tick_per_beat; ++i) {
+    usec += tick_130;
+    clock.receiveTick(usec);
+    bool within = abs(clock.getBeatCycleUsec() - (int32_t)beat_130) <= (int32_t)beat_130 / 100;
+    if (!within) { settled_tick = UINT32_MAX; }
+    else if (settled_tick == UINT32_MAX) { settled_tick = i + 1; }
+  }
+  snprintf(msg, sizeof(msg), "100 -> 130 bpm : beat cycle within 1%% after %u ticks (%.2f beats)", (unsigned)settled_tick, settled_tick / (double)tick_per_beat);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(3 * tick_per_beat, settled_tick, msg);
+  TEST_ASSERT_TRUE(clock.isLocked(usec));
+}
+
+void test_midi_clock_in_lost_tick(void)
+{
+  // 途中のクロックが欠落してもテンポの変化とは見做さず、通し番号を進めて拍の位置を保つこと
+  midi_clock_in_t clock;
+  const uint32_t beat_usec = beat_usec_from_bpm(120);
+  const uint32_t tick_usec = beat_usec / tick_per_beat;
+  uint32_t usec = 0x10000;
+  clock.receiveStart();
+  // 4拍目の途中のクロックを2個欠落させ、8拍目の頭から6個目のクロックまで受信させる
+  const uint32_t last_index = 8 * tick_per_beat + 6;
+  for (uint32_t i = 0; i <= last_index; ++i) {
+    if (i != 4 * tick_per_beat + 3 && i != 4 * tick_per_beat + 4) {
+      clock.receiveTick(usec);
+    }
+    if (i != last_index) { usec += tick_usec; }
+  }
+  TEST_ASSERT_INT_WITHIN(beat_usec / 200, beat_usec, clock.getBeatCycleUsec());
+  // 次の拍の頭まではクロック18個分
+  TEST_ASSERT_INT_WITHIN(100, (tick_per_beat - 6) * tick_usec, clock.getNextBeatRemainUsec(usec));
+}
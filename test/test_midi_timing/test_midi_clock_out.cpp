@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// midi_clock_out_t (拍の予定時刻からのMIDIクロック送信) の検証
+
+#include <unity.h>
+
+#include "midi_clock.hpp"
+
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+static constexpr const uint32_t tick_per_beat = midi_clock_out_t::tick_per_beat;
+
+void test_midi_clock_out_ten_minutes(void)
+{
+  // 10分間の送信で、1拍あたりのクロック数と、クロック間隔の理想値 (拍の周期 / 24) からのずれを確認する
+  // 時刻の32bitの折り返しを跨ぎ、演奏タスクの起床は最大50usec遅れるものとする
+  char msg[128];
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint32_t> late(0, 49);
+  for (uint32_t bpm : { 37u, 90u, 120u, 173u, 240u }) {
+    midi_clock_out_t clock;
+    const uint32_t cycle = (60 * 1000 * 1000 + bpm / 2) / bpm;
+    const double ideal_spacing = cycle / (double)tick_per_beat;
+    uint32_t beat = 0xFFFF0000u;
+    uint32_t ticks = clock.beat(beat);
+    uint32_t ticks_in_beat = 1;
+    uint32_t prev_tick = beat;
+    uint32_t beats = 0;
+    uint32_t bad_beats = 0;
+    double max_error = 0;
+
+    const uint64_t total_usec = 600ull * 1000 * 1000;
+    for (uint64_t elapsed = 0; elapsed < total_usec; ) {
+      const uint32_t next = beat + cycle;
+      const uint32_t tick = clock.getNextTickUsec(next);
+      if ((int32_t)(tick - next) >= 0) {
+        // 拍の頭
+        if (ticks_in_beat != tick_per_beat) { ++bad_beats; }
+        beat = next;
+        ticks += clock.beat(beat);
+        ticks_in_beat = 1;
+        elapsed += cycle;
+        ++beats;
+      } else {
+        uint32_t count = clock.update(tick + late(rng), next);
+        ticks += count;
+        ticks_in_beat += count;
+      }
+      // 予定時刻どうしの間隔を理想値と比較する
+      uint32_t tick_usec = ((int32_t)(tick - next) >= 0) ? beat : tick;
+      double error = fabs((double)(int32_t)(tick_usec - prev_tick) - ideal_spacing);
+      if (max_error < error) { max_error = error; }
+      prev_tick = tick_usec;
+    }
+    snprintf(msg, sizeof(msg), "bpm %3u : %u beats, %u ticks, beats without 24 ticks %u, max spacing error %.2f us", (unsigned)bpm, (unsigned)beats, (unsigned)ticks, (unsigned)bad_beats, max_error);
+    TEST_MESSAGE(msg);
+    // 最後の拍の頭のクロックを含めて 拍数 × 24 + 1 個
+    TEST_ASSERT_EQUAL_UINT32(beats * tick_per_beat + 1, ticks);
+    TEST_ASSERT_EQUAL_UINT32(0, bad_beats);
+    TEST_ASSERT_LESS_THAN_MESSAGE(1.0, max_error, msg);
+  }
+}
+
+void test_midi_clock_out_tempo_change(void)
+{
+  // 拍の途中で次の拍の頭が遅くなっても、残りのクロックは新しい拍の頭までに均等に収まること
+  midi_clock_out_t clock;
+  const uint32_t beat = 1000;
+  const uint32_t cycle_120 = 500000;
+  const uint32_t cycle_90 = 666667;
+  uint32_t next = beat + cycle_120;
+  uint32_t count = clock.beat(beat);
+  uint32_t prev = beat;
+  uint32_t change_tick = 0;
+  for (;;) {
+    uint32_t tick = clock.getNextTickUsec(next);
+    if (tick == next) { break; }
+    TEST_ASSERT_TRUE((int32_t)(tick - prev) > 0);
+    prev = tick;
+    count += clock.update(tick, next);
+    if (count == tick_per_beat / 2) {
+      // 拍の頭を含めて12個送信した時点で、テンポを 120 BPM から 90 BPM に変える
+      next = beat + cycle_90;
+      change_tick = tick;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(tick_per_beat, count);
+  // 変更後の間隔は (新しい拍の頭 - 変更時のクロック) を残りの13区間で割ったもの
+  uint32_t spacing = (next - change_tick) / (tick_per_beat + 1 - tick_per_beat / 2);
+  TEST_ASSERT_UINT32_WITHIN(1, spacing, next - prev);
+}
+
+void test_midi_clock_out_catch_up(void)
+{
+  // 拍の途中で送信が滞った場合、次の拍の頭で残りのクロックをまとめて送信し、1拍あたり24個を保つこと
+  midi_clock_out_t clock;
+  const uint32_t cycle = 500000;
+  uint32_t beat = 0;
+  TEST_ASSERT_EQUAL_UINT32(1, clock.beat(beat));
+  // 拍の頭を含めて12個送信した後、半拍の直前で送信が止まる
+  TEST_ASSERT_EQUAL_UINT32(11, clock.update(beat + cycle / 2 - 100, beat + cycle));
+  beat += cycle;
+  // 前の拍の残り12個 + 今回の拍の頭の1個
+  TEST_ASSERT_EQUAL_UINT32(13, clock.beat(beat));
+  TEST_ASSERT_EQUAL_UINT32(1, clock.getBeatCount());
+}
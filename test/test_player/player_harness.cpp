@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+#include "player_harness.hpp"
+
+#include "file_manage.hpp"
+
+namespace kanplay_ns {
+
+bool player_harness_t::loadPreset(const char* filename)
+{
+  // コマンドキューやMIDI出力の履歴も前回の演奏の影響が残らないよう、レジストリ全体を作り直す
+  delete system_registry;
+  system_registry = new system_registry_t();
+  system_registry->init();
+
+  int size = storage_incbin.getFileSize(filename);
+  if (size <= 0) { return false; }
+  std::vector<uint8_t> data(size);
+  if (size != storage_incbin.loadFromFileToMemory(filename, data.data(), size)) { return false; }
+
+  bool result = system_registry->backup_song_data.loadSongJSON(data.data(), data.size());
+  if (result) {
+    system_registry->song_data.assign(system_registry->backup_song_data);
+  }
+  system_registry->backup_song_data.reset();
+  system_registry->runtime_info.setPlaySlot(0);
+  system_registry->runtime_info.setSequenceStepIndex(0);
+  return result;
+}
+
+void player_harness_t::start(bool step_plan_prefetch)
+{
+  events.clear();
+  usec = 0;
+  step_count = 0;
+  _history_code = system_registry->midi_out_control.getHistoryCode();
+
+  player.reset(new task_kantanplay_t());
+  player->setStepPlanPrefetch(step_plan_prefetch);
+  player->init(usec);
+
+  const bool has_sequence = system_registry->song_data.sequence.info.getLength() > 0;
+  system_registry->runtime_info.setSequenceMode(has_sequence ? def::seqmode::seq_auto_song : def::seqmode::seq_beat_play);
+  system_registry->player_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_start } );
+}
+
+void player_harness_t::runUntil(uint32_t end_usec, const std::function<void(void)>& after_step)
+{
+  while (usec < end_usec) {
+    uint32_t next_usec = player->procStep(usec);
+    ++step_count;
+    collectEvents();
+    if (after_step) { after_step(); }
+    if (next_usec > end_usec - usec) { next_usec = end_usec - usec; }
+    usec += next_usec ? next_usec : 1;
+  }
+}
+
+void player_harness_t::wake(void)
+{
+  player->procStep(usec);
+  collectEvents();
+}
+
+void player_harness_t::stop(void)
+{
+  system_registry->player_command.addQueue( { def::command::autoplay_switch, def::command::autoplay_switch_t::autoplay_stop } );
+  system_registry->player_command.addQueueW( { def::command::play_control, def::command::play_control_t::pc_panic_stop } );
+  player->procStep(usec);
+  collectEvents();
+}
+
+void player_harness_t::collectEvents(void)
+{
+  midi_event_t midi_event;
+  while (system_registry->midi_out_control.getEvent(_history_code, midi_event)) {
+    events.push_back( { usec, midi_event.getStatus(), midi_event.getData1(), midi_event.getData2() } );
+  }
+}
+
+} // namespace kanplay_ns
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// task_kantanplay_t を実時間のタスクを使わずに仮想時刻で駆動し、MIDI出力を記録する (song_renderer_t と同様の手順)
+
+#ifndef KANPLAY_TEST_PLAYER_HARNESS_HPP
+#define KANPLAY_TEST_PLAYER_HARNESS_HPP
+
+#include "task_kantanplay.hpp"
+#include "system_registry.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace kanplay_ns {
+
+struct player_harness_t {
+  struct event_t {
+    uint32_t usec;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    bool operator==(const event_t& rhs) const {
+      return usec == rhs.usec && status == rhs.status && data1 == rhs.data1 && data2 == rhs.data2;
+    }
+  };
+
+  std::unique_ptr<task_kantanplay_t> player;
+  std::vector<event_t> events;
+  uint32_t usec = 0;
+  uint32_t step_count = 0;
+
+  // レジストリを作り直し、内蔵プリセットのソングを読み込む
+  bool loadPreset(const char* filename);
+
+  // 演奏処理を初期化して自動演奏を開始する
+  void start(bool step_plan_prefetch = true);
+
+  // 指定時刻まで、演奏処理が要求する時刻ごとに procStep を呼び出す
+  // after_step が指定されていれば procStep の直後 (発音予定の先読みの後、次のステップの処理の前) に呼び出す
+  void runUntil(uint32_t end_usec, const std::function<void(void)>& after_step = nullptr);
+
+  // コマンド通知で演奏タスクが待機を中断した場合と同様に、現在の時刻で procStep を呼び出す
+  // runUntil の after_step の中から呼び出してもよい (次の処理の予定時刻は変わらない)
+  void wake(void);
+
+  // 鳴り残りの音をすべて止める
+  void stop(void);
+
+private:
+  registry_t::history_code_t _history_code = 0;
+  void collectEvents(void);
+};
+
+} // namespace kanplay_ns
+
+#endif
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// midi_channel_state_t と音色・音量の先行送信 : スロット切替ごとにポートへ送信するバイト数と、最初のコードの前に並ぶバイト数
+
+#include <unity.h>
+
+#include "player_harness.hpp"
+#include "midi_port_state.hpp"
+
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+static constexpr const uint8_t source_internal = def::command::midi_route_port_t::mrp_internal;
+static constexpr const uint8_t source_external = def::command::midi_route_port_t::mrp_portc;
+
+// ランニングステータスを使わない場合の1メッセージのバイト数
+static int message_bytes(uint8_t status)
+{
+  return ((status & 0xE0) == 0xC0) ? 2 : 3;
+}
+
+static bool is_channel_state(uint8_t status, uint8_t data1)
+{
+  return (status & 0xF0) == 0xC0 || ((status & 0xF0) == 0xB0 && data1 == 7);
+}
+
+// task_midi のマスターボリューム変更時の処理と同じ手順で、このポートへ送信するバイト数を求める
+static int volume_sweep(midi_channel_state_t& state, const uint8_t* volume, const uint8_t* program)
+{
+  int bytes = 3 * 3; // NRPN (CC99/98/6)
+  for (int ch = 0; ch < 16; ++ch) {
+    if (state.update(source_internal, 0xB0 | ch, 7, volume[ch])) { bytes += 3; }
+    if (state.update(source_internal, 0xC0 | ch, program[ch], 0)) { bytes += 2; }
+  }
+  return bytes;
+}
+
+struct slot_switch_result_t {
+  int switches = 0;
+  int raw_bytes = 0;    // 演奏タスクが出力した音色・音量のバイト数
+  int sent_bytes = 0;   // ポートの送信状態で重複を省略した後のバイト数
+  int ahead_bytes = 0;  // 切替後の最初のノートオンと同じ時刻に送信された音色・音量のバイト数
+  int ahead_max = 0;
+};
+
+// スロット0と1を一定間隔で交互に切り替えながら自動演奏する
+// スロット1は一部のパートの音色と音量だけを変えたものとする
+static bool run_slot_switch(bool prewarm, slot_switch_result_t& result)
+{
+  player_harness_t harness;
+  if (!harness.loadPreset("Pop01_16beatSw.json")) { return false; }
+  auto& slot = system_registry->song_data.slot;
+  slot[1].assign(slot[0]);
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    auto part_info = &slot[1].chord_part[part].part_info;
+    if (part & 1) { part_info->setTone((part_info->getTone() + 1) & 0x7F); }
+    if (part & 2) { part_info->setVolume(part_info->getVolume() / 2); }
+  }
+
+  harness.start();
+  harness.player->setChannelPrewarm(prewarm);
+  system_registry->runtime_info.setSequenceMode(def::seqmode::seq_beat_play);
+  system_registry->player_command.addQueue( { def::command::set_velocity, 100 } );
+  system_registry->player_command.addQueueW( { def::command::chord_degree, 1 } );
+
+  static constexpr const uint32_t interval_usec = 1700000;
+  static constexpr const int switch_count = 20;
+  uint32_t next_switch_usec = 2000000;
+  uint8_t slot_index = 0;
+  std::vector<size_t> switch_index;
+  harness.runUntil(next_switch_usec + interval_usec * switch_count, [&]() {
+    if (harness.usec < next_switch_usec) { return; }
+    next_switch_usec += interval_usec;
+    // スロット選択は task_operator から player_command に転送され、演奏タスクが待機を中断する
+    slot_index ^= 1;
+    system_registry->runtime_info.setPlaySlot(slot_index);
+    system_registry->player_command.addQueue( { def::command::slot_select, 1 + slot_index }, true );
+    switch_index.push_back(harness.events.size());
+    harness.wake();
+  });
+  harness.stop();
+
+  midi_channel_state_t port_state;
+  size_t switch_pos = 0;
+  for (size_t i = 0; i < harness.events.size(); ++i) {
+    auto& event = harness.events[i];
+    bool after_switch = switch_pos < switch_index.size() && i >= switch_index[switch_pos];
+    if (after_switch && (event.status & 0xF0) == 0x90 && event.data2) {
+      // 切替後の最初のノートオン : 同じ時刻に並んだ音色・音量はコードより先に送信されるため発音を遅らせる
+      int ahead = 0;
+      for (size_t j = switch_index[switch_pos]; j < i; ++j) {
+        auto& prev = harness.events[j];
+        if (prev.usec == event.usec && is_channel_state(prev.status, prev.data1)) { ahead += message_bytes(prev.status); }
+      }
+      result.ahead_bytes += ahead;
+      if (result.ahead_max < ahead) { result.ahead_max = ahead; }
+      ++switch_pos;
+    }
+    if (!is_channel_state(event.status, event.data1)) { continue; }
+    if (switch_index.empty() || i < switch_index[0]) {
+      // 演奏開始時の送信は集計しない
+      port_state.update(source_internal, event.status, event.data1, event.data2);
+      continue;
+    }
+    result.raw_bytes += message_bytes(event.status);
+    if (port_state.update(source_internal, event.status, event.data1, event.data2)) {
+      result.sent_bytes += message_bytes(event.status);
+    }
+  }
+  result.switches = switch_pos;
+  return (int)switch_index.size() == switch_count;
+}
+} // namespace
+
+// マスターボリューム変更時の全チャンネルの送り直しは、変化したチャンネルのみとなること
+// 外部入力のスルーやバンクセレクトの後は、同じ値でも送り直すこと
+void test_channel_state_volume_sweep(void)
+{
+  std::mt19937 rng(20);
+  uint8_t volume[16];
+  uint8_t program[16];
+  for (int ch = 0; ch < 16; ++ch) {
+    volume[ch] = rng() & 0x7F;
+    program[ch] = rng() & 0x7F;
+  }
+  midi_channel_state_t state;
+  // 送信の有効化直後は接続先の状態が不明なため、すべて送信する
+  const int full_bytes = 3 * 3 + 16 * (3 + 2);
+  TEST_ASSERT_EQUAL(full_bytes, volume_sweep(state, volume, program));
+  TEST_ASSERT_EQUAL(3 * 3, volume_sweep(state, volume, program));
+  volume[3] ^= 1;
+  TEST_ASSERT_EQUAL(3 * 3 + 3, volume_sweep(state, volume, program));
+
+  // 外部入力のスルーは送信済みと同じ値でも送信し、以降の演奏タスクからの送信は省略しない
+  TEST_ASSERT_TRUE(state.update(source_external, 0xC0, program[0], 0));
+  TEST_ASSERT_TRUE(state.update(source_external, 0xB1, 7, volume[1]));
+  // バンクセレクト・リセットオールコントローラの後は音色を送り直す
+  TEST_ASSERT_TRUE(state.update(source_internal, 0xB2, 0, 1));
+  TEST_ASSERT_TRUE(state.update(source_external, 0xB4, 121, 0));
+  TEST_ASSERT_EQUAL(3 * 3 + 2 + 3 + 2 + 2, volume_sweep(state, volume, program));
+  TEST_ASSERT_FALSE(state.update(source_internal, 0xC0, program[0], 0));
+
+  state.reset();
+  TEST_ASSERT_EQUAL(full_bytes, volume_sweep(state, volume, program));
+
+  char msg[96];
+  snprintf(msg, sizeof(msg), "master volume sweep : %d bytes -> %d bytes (unchanged channels)", full_bytes, 3 * 3);
+  TEST_MESSAGE(msg);
+}
+
+// スロット切替ごとに送信する音色・音量のバイト数と、切替後の最初のコードの前に並ぶバイト数
+// 先行送信の有無で送信する内容は変わらず、最初のコードの前には並ばないこと
+void test_channel_state_slot_change(void)
+{
+  slot_switch_result_t direct;
+  slot_switch_result_t prewarm;
+  TEST_ASSERT_TRUE(run_slot_switch(false, direct));
+  TEST_ASSERT_TRUE(run_slot_switch(true, prewarm));
+
+  char msg[128];
+  TEST_MESSAGE("slot change      switches  output B/switch  sent B/switch  ahead of 1st chord B/switch (max)");
+  for (int i = 0; i < 2; ++i) {
+    auto& r = i ? prewarm : direct;
+    snprintf(msg, sizeof(msg), "%-15s  %8d  %15.1f  %13.1f  %11.1f (%d)", i ? "prewarm" : "at first note", r.switches
+            , (double)r.raw_bytes / r.switches, (double)r.sent_bytes / r.switches, (double)r.ahead_bytes / r.switches, r.ahead_max);
+    TEST_MESSAGE(msg);
+  }
+  TEST_ASSERT_EQUAL(direct.switches, prewarm.switches);
+  TEST_ASSERT_GREATER_THAN(0, prewarm.sent_bytes);
+  TEST_ASSERT_EQUAL(direct.sent_bytes, prewarm.sent_bytes);
+  TEST_ASSERT_GREATER_THAN(0, direct.ahead_bytes);
+  TEST_ASSERT_EQUAL(0, prewarm.ahead_bytes);
+}
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// グルーブテンプレート上の位置 : 自動演奏中に遅れて押されたコードで拍をやり直しても、テンプレートが拍からずれないこと
+
+#include <unity.h>
+
+#include "player_harness.hpp"
+
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+
+static constexpr const uint8_t step_per_beat = 4;
+static constexpr const uint8_t groove_steps = 16;
+
+// テンプレートのステップごとに異なるベロシティの倍率を設定し、発音のベロシティから適用されたステップを求める
+static uint8_t groove_velocity(uint8_t step) { return 40 + step * 5; }
+
+struct note_t {
+  uint32_t usec;
+  int groove_step;  // ベロシティから求めたテンプレート上の位置
+  int part_step;    // 発音時のアルペジオのステップ位置
+};
+
+// パート1のみ、全ステップで1音ずつベロシティ100で鳴らす設定にする
+static void setup_song(void)
+{
+  auto slot = system_registry->current_slot;
+  slot->slot_info.setStepPerBeat(step_per_beat);
+  for (int part = 0; part < def::app::max_chord_part; ++part) {
+    auto chord_part = &slot->chord_part[part];
+    chord_part->part_info.setEnabled(part == 0);
+    if (part) { continue; }
+    chord_part->part_info.setLoopStep(groove_steps - 1);
+    chord_part->part_info.setAnchorStep(0);
+    chord_part->arpeggio.reset();
+    for (int step = 0; step < groove_steps; ++step) {
+      chord_part->arpeggio.setVelocity(step, 0, 100);
+      chord_part->arpeggio.setStyle(step, def::play::arpeggio_style_t::same_time);
+    }
+  }
+  system_registry->song_data.song_info.setTempo(120);
+  system_registry->song_data.song_info.setSwing(0);
+  auto groove = &system_registry->song_data.groove;
+  groove->setSteps(groove_steps);
+  for (int step = 0; step < groove_steps; ++step) {
+    groove->setTiming(step, 0);
+    groove->setVelocity(step, groove_velocity(step));
+  }
+}
+
+} // namespace
+
+void test_groove_step_late_input(void)
+{
+  player_harness_t harness;
+  TEST_ASSERT_TRUE(harness.loadPreset("Simple_Piano.json"));
+  setup_song();
+  harness.start();
+  system_registry->runtime_info.setSequenceMode(def::seqmode::seq_beat_play);
+  system_registry->player_command.addQueue( { def::command::set_velocity, 100 } );
+  system_registry->player_command.addQueueW( { def::command::chord_degree, 1 } );
+
+  std::vector<note_t> notes;
+  size_t event_index = 0;
+  auto collect = [&]() {
+    for (; event_index < harness.events.size(); ++event_index) {
+      auto& event = harness.events[event_index];
+      if ((event.status & 0xF0) != 0x90 || event.data2 == 0) { continue; }
+      notes.push_back( { event.usec, (event.data2 - groove_velocity(0)) / 5, system_registry->chord_play.getPartStep(0) } );
+    }
+  };
+
+  // 演奏が安定してから、オモテ拍の発音を待つ
+  harness.runUntil(3000000, collect);
+  size_t note_count = notes.size();
+  while (notes.size() == note_count || (notes.back().part_step % step_per_beat) != 0) {
+    note_count = notes.size();
+    harness.runUntil(harness.usec + 1000, collect);
+  }
+  // オモテ拍の 5msec 後に別のコードを押す (遅れた入力として拍をやり直す)
+  const uint32_t press_usec = notes.back().usec + 5000;
+  harness.runUntil(press_usec, collect);
+  system_registry->player_command.addQueueW( { def::command::chord_degree, 4 } );
+  harness.runUntil(6000000, collect);
+  harness.stop();
+
+  char msg[128];
+  int restart_count = 0;
+  int misaligned_count = 0;
+  int jump_count = 0;
+  for (size_t i = 0; i < notes.size(); ++i) {
+    auto& note = notes[i];
+    // テンプレート上の拍内の位置が、アルペジオのステップの拍内の位置と一致すること
+    if ((note.groove_step % step_per_beat) != (note.part_step % step_per_beat)) {
+      if (misaligned_count++ == 0) {
+        snprintf(msg, sizeof(msg), "misaligned at %u usec : groove step %d  part step %d", note.usec, note.groove_step, note.part_step);
+        TEST_MESSAGE(msg);
+      }
+    }
+    if (i == 0) { continue; }
+    // 遅れた入力ではアルペジオは先頭からやり直すが、テンプレートは拍に沿って進み続けること
+    if (note.part_step != (notes[i - 1].part_step + 1) % groove_steps) { ++restart_count; }
+    if (note.groove_step != (notes[i - 1].groove_step + 1) % groove_steps) {
+      if (jump_count++ == 0) {
+        snprintf(msg, sizeof(msg), "groove step jumped at %u usec : %d -> %d", note.usec, notes[i - 1].groove_step, note.groove_step);
+        TEST_MESSAGE(msg);
+      }
+    }
+  }
+  snprintf(msg, sizeof(msg), "notes:%u  late press at %u usec  arpeggio restarts:%d  misaligned:%d  groove jumps:%d"
+          , (unsigned)notes.size(), press_usec, restart_count, misaligned_count, jump_count);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_TRUE(notes.size() > 30);
+  // 遅れた入力として処理され、アルペジオが先頭からやり直されたこと
+  TEST_ASSERT_EQUAL(1, restart_count);
+  TEST_ASSERT_EQUAL(0, misaligned_count);
+  TEST_ASSERT_EQUAL(0, jump_count);
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// 演奏処理・システムレジストリの単体テスト (pio test -e native_test_player)
+
+#include <unity.h>
+
+namespace kanplay_ns {
+// file_manage.cpp が使用する。テストではSPIを使用しないため何もしない
+void spi_lock(void) {}
+void spi_unlock(void) {}
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// test_sequence_timeline.cpp
+void test_sequence_timeline_crc(void);
+void test_sequence_timeline_crc_concurrent(void);
+void test_sequence_timeline_benchmark(void);
+
+// test_step_plan.cpp
+void test_step_plan_prefetch_parity(void);
+void test_step_plan_prefetch_invalidate(void);
+
+// test_groove_step.cpp
+void test_groove_step_late_input(void);
+
+// test_channel_state.cpp
+void test_channel_state_volume_sweep(void);
+void test_channel_state_slot_change(void);
+
+// test_midi_route.cpp
+void test_midi_route_mask(void);
+void test_midi_route_benchmark(void);
+
+// test_midi_event.cpp
+void test_midi_event_readers(void);
+void test_midi_event_benchmark(void);
+
+// test_player_command.cpp
+void test_player_command_order(void);
+void test_player_command_latency(void);
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sequence_timeline_crc);
+  RUN_TEST(test_sequence_timeline_crc_concurrent);
+  RUN_TEST(test_sequence_timeline_benchmark);
+  RUN_TEST(test_step_plan_prefetch_parity);
+  RUN_TEST(test_step_plan_prefetch_invalidate);
+  RUN_TEST(test_groove_step_late_input);
+  RUN_TEST(test_channel_state_volume_sweep);
+  RUN_TEST(test_channel_state_slot_change);
+  RUN_TEST(test_midi_route_mask);
+  RUN_TEST(test_midi_route_benchmark);
+  RUN_TEST(test_midi_event_readers);
+  RUN_TEST(test_midi_event_benchmark);
+  RUN_TEST(test_player_command_order);
+  RUN_TEST(test_player_command_latency);
+  return UNITY_END();
+}
@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// reg_midi_out_control_t : midi_event_t のリングへの書込み (encode) と複数の読出し側による取得 (dispatch)
+
+#include <unity.h>
+
+#include "system_registry.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+typedef system_registry_t::reg_midi_out_control_t midi_out_t;
+
+// 従来の midi_out_control 相当。registry_base_t の履歴に status を index、残りを value に格納する
+struct legacy_midi_out_t : public registry_base_t {
+  legacy_midi_out_t(void) : registry_base_t(256) {}
+  void setMessage(uint8_t status, uint8_t data1, uint8_t data2 = 0, uint8_t trace_id = 0, uint8_t source = def::command::mrp_internal) {
+    set32(status, data1 + (data2 << 8) + (trace_id << 16) + (source << 24), true);
+  }
+  void setNoteVelocity(uint8_t channel, uint8_t note, uint8_t value, uint8_t trace_id = 0) {
+    uint8_t status = 0x80 + ((value & 0x80) >> 3);
+    setMessage((status | channel), note, value & 0x7F, trace_id);
+  }
+  // 読出し側で履歴からメッセージを組み立て直す
+  bool getEvent(history_code_t &code, midi_event_t &result) const {
+    history_t history;
+    if (!getHistory(code, history)) { return false; }
+    result.word = midi_event_t::pack(history.index, history.value, history.value >> 8, history.value >> 24);
+    result.trace_id = history.value >> 16;
+    return true;
+  }
+};
+
+// 計算結果を使用しないループが最適化で削除されないようにする
+static volatile uint32_t benchmark_sink;
+
+// 読出し側ごとにカーソルを持ち、書き込まれた分を全て取得する
+template <typename T>
+static uint32_t drain(const T& midi_out, std::vector<registry_base_t::history_code_t>& codes)
+{
+  uint32_t sum = 0;
+  midi_event_t event;
+  for (auto& code : codes) {
+    while (midi_out.getEvent(code, event)) { sum += event.word + event.trace_id; }
+  }
+  return sum;
+}
+
+// events 個のノートオンを書き込み、readers 個の読出し側がそれぞれ取得する処理を loop 回繰り返す
+// 書込み1回あたりと、読出し側1つの取得1回あたりの処理時間 [nsec] を返す
+template <typename T>
+static void measure(T& midi_out, int readers, int events, int loop, double& encode_nsec, double& dispatch_nsec)
+{
+  std::vector<registry_base_t::history_code_t> codes(readers, midi_out.getHistoryCode());
+  double encode_sec = 0, dispatch_sec = 0;
+  uint32_t sum = 0;
+  for (int i = 0; i < loop; ++i) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int e = 0; e < events; ++e) {
+      midi_out.setNoteVelocity(e & 0x0F, 36 + (e & 0x3F), 0x80 | (e & 0x7F), e);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    sum += drain(midi_out, codes);
+    auto t2 = std::chrono::steady_clock::now();
+    encode_sec += std::chrono::duration<double>(t1 - t0).count();
+    dispatch_sec += std::chrono::duration<double>(t2 - t1).count();
+  }
+  benchmark_sink = sum;
+  encode_nsec = encode_sec * 1e9 / ((double)loop * events);
+  dispatch_nsec = dispatch_sec * 1e9 / ((double)loop * events * readers);
+}
+} // namespace
+
+// 互換の setNoteVelocity / setProgramChange / setControlChange が従来と同じメッセージを書き込むこと
+// 別スレッドから書き込み中でも、各読出し側が順序どおりに欠けや破損なく取得できること
+void test_midi_event_readers(void)
+{
+  std::unique_ptr<midi_out_t> midi_out { new midi_out_t() };
+  std::unique_ptr<legacy_midi_out_t> legacy { new legacy_midi_out_t() };
+  midi_out->init();
+  legacy->init();
+
+  auto code = midi_out->getHistoryCode();
+  auto legacy_code = legacy->getHistoryCode();
+  midi_out->setNoteVelocity(3, 60, 0x80 | 100, 7);
+  midi_out->setNoteVelocity(3, 60, 0);
+  midi_out->setProgramChange(9, 25);
+  midi_out->setProgramChange(9, 25);  // 同じ音色は送らない
+  midi_out->setControlChange(0, 64, 127);
+  midi_out->setMessage(0xF8, 0, 0, 0, def::command::mrp_ble);
+  legacy->setNoteVelocity(3, 60, 0x80 | 100, 7);
+  legacy->setNoteVelocity(3, 60, 0);
+  legacy->setMessage(0xC9, 25);
+  legacy->setMessage(0xB0, 64, 127);
+  legacy->setMessage(0xF8, 0, 0, 0, def::command::mrp_ble);
+
+  midi_event_t event, expected;
+  int count = 0;
+  while (midi_out->getEvent(code, event)) {
+    TEST_ASSERT_TRUE(legacy->getEvent(legacy_code, expected));
+    TEST_ASSERT_EQUAL_UINT32(expected.word, event.word);
+    TEST_ASSERT_EQUAL_UINT8(expected.trace_id, event.trace_id);
+    ++count;
+  }
+  TEST_ASSERT_FALSE(legacy->getEvent(legacy_code, expected));
+  TEST_ASSERT_EQUAL(5, count);
+
+  // 通し番号を data1・data2 と trace_id に分けて書き込み、読出し側で連続していることを確認する
+  static constexpr const int reader_count = 4;
+  static constexpr const uint32_t write_count = 200000;
+  std::atomic<bool> done { false };
+  std::atomic<int> ready { 0 };
+  uint32_t received[reader_count] = {};
+  uint32_t skipped[reader_count] = {};
+  uint32_t errors[reader_count] = {};
+  std::vector<std::thread> readers;
+  auto start = midi_out->getHistoryCode();
+  for (int r = 0; r < reader_count; ++r) {
+    readers.emplace_back([&, r]() {
+      auto code = start;
+      uint32_t next = 0;
+      midi_event_t event;
+      ready.fetch_add(1);
+      for (;;) {
+        bool finished = done.load(std::memory_order_acquire);
+        while (midi_out->getEvent(code, event)) {
+          uint32_t seq = event.getData1() | event.getData2() << 7 | (event.getStatus() & 0x0F) << 14;
+          if (event.getStatus() >> 4 != 0x9 || (uint8_t)seq != event.trace_id || seq < next) { ++errors[r]; }
+          if (seq > next) { skipped[r] += seq - next; }
+          next = seq + 1;
+          ++received[r];
+        }
+        if (finished) { break; }
+        std::this_thread::yield();
+      }
+      skipped[r] += write_count - next;
+    });
+  }
+  while (ready.load() < reader_count) { std::this_thread::yield(); }
+  for (uint32_t seq = 0; seq < write_count; ++seq) {
+    midi_out->setMessage(0x90 | ((seq >> 14) & 0x0F), seq & 0x7F, (seq >> 7) & 0x7F, seq);
+  }
+  done.store(true, std::memory_order_release);
+  for (auto& t : readers) { t.join(); }
+
+  uint32_t total_skipped = 0;
+  for (int r = 0; r < reader_count; ++r) {
+    TEST_ASSERT_EQUAL(0, errors[r]);
+    TEST_ASSERT_EQUAL_UINT32(write_count, received[r] + skipped[r]);
+    total_skipped += skipped[r];
+  }
+  // 読み飛ばした分は全て上書きによるもので、getHistoryLostCount に計上されている
+  TEST_ASSERT_EQUAL_UINT32(total_skipped, midi_out->getHistoryLostCount());
+  char msg[96];
+  snprintf(msg, sizeof(msg), "%d readers x %u events  overrun:%u", reader_count, write_count, total_skipped);
+  TEST_MESSAGE(msg);
+}
+
+// 1イベントあたりの書込み (encode) と、読出し側1つあたりの取得 (dispatch) の処理時間
+// 従来の履歴に格納して読出し側でメッセージを組み立て直す場合と比較する
+void test_midi_event_benchmark(void)
+{
+  char msg[128];
+  static constexpr const int events = 64;
+  static constexpr const int loop = 20000;
+  snprintf(msg, sizeof(msg), "%d events per burst           history    event ring  [nsec/event]", events);
+  TEST_MESSAGE(msg);
+  for (int readers : { 1, 2, 4 }) {
+    std::unique_ptr<midi_out_t> midi_out { new midi_out_t() };
+    std::unique_ptr<legacy_midi_out_t> legacy { new legacy_midi_out_t() };
+    midi_out->init();
+    legacy->init();
+    double legacy_encode, legacy_dispatch, encode, dispatch;
+    measure(*legacy, readers, events, loop, legacy_encode, legacy_dispatch);
+    measure(*midi_out, readers, events, loop, encode, dispatch);
+    TEST_ASSERT_EQUAL_UINT32(0, midi_out->getHistoryLostCount());
+    snprintf(msg, sizeof(msg), "  readers:%d  encode   :  %8.2f  %10.2f", readers, legacy_encode, encode);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  readers:%d  dispatch :  %8.2f  %10.2f", readers, legacy_dispatch, dispatch);
+    TEST_MESSAGE(msg);
+  }
+}
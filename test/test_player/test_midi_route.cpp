@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// midi_route_mask_t : 経路表の展開と送信判定、全ポートが midi_out_control を読み出す場合の処理能力
+
+#include <unity.h>
+
+#include "midi_port_state.hpp"
+#include "system_registry.hpp"
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+typedef system_registry_t::reg_midi_port_setting_t port_setting_t;
+static constexpr const uint8_t max_port = def::command::max_midi_route_port;
+
+// 経路表の定義どおりに送信するか否かを求める (展開した表を使わない場合の判定)
+static bool reference_routed(const port_setting_t& setting, uint8_t src, uint8_t dst, uint8_t status)
+{
+  if (src >= max_port) { return false; }
+  uint8_t type_mask = setting.getRouteTypeMask(src, dst);
+  if (status >= 0xF0) { return type_mask & port_setting_t::route_type_system; }
+  if (!(type_mask & (1 << ((status >> 4) - 8)))) { return false; }
+  return (setting.getRouteChannelMask(src, dst) >> (status & 0x0F)) & 1;
+}
+
+// 全ての送信元・ステータスバイトについて、展開した表による判定が経路表の定義と一致すること
+static bool check_all(const port_setting_t& setting)
+{
+  for (uint8_t dst = 0; dst < max_port; ++dst) {
+    midi_route_mask_t mask;
+    mask.assign(&setting, dst);
+    for (int src = 0; src <= max_port; ++src) {
+      for (int status = 0x80; status <= 0xFF; ++status) {
+        if (mask.isRouted(src, status) != reference_routed(setting, src, dst, status)) { return false; }
+      }
+    }
+  }
+  return true;
+}
+
+// ドラムはUSBのみ、それ以外の演奏はBLEのみへ送り、Port Cの入力はノートのみUSBへスルーする設定
+static void setup_split_route(port_setting_t& setting)
+{
+  setting.resetRoute();
+  for (uint8_t src = 0; src < max_port; ++src) {
+    for (uint8_t dst = 0; dst < max_port; ++dst) {
+      setting.setRouteChannelMask(src, dst, 0);
+      setting.setRouteTypeMask(src, dst, 0);
+    }
+  }
+  const uint16_t drum = 1 << def::midi::channel_10;
+  setting.setRouteChannelMask(def::command::mrp_internal, def::command::mrp_internal, 0xFFFF);
+  setting.setRouteTypeMask(def::command::mrp_internal, def::command::mrp_internal, 0xFF);
+  setting.setRouteChannelMask(def::command::mrp_internal, def::command::mrp_usb, drum);
+  setting.setRouteTypeMask(def::command::mrp_internal, def::command::mrp_usb, 0xFF);
+  setting.setRouteChannelMask(def::command::mrp_internal, def::command::mrp_ble, 0xFFFF & ~drum);
+  setting.setRouteTypeMask(def::command::mrp_internal, def::command::mrp_ble, 0x7F);
+  setting.setRouteChannelMask(def::command::mrp_portc, def::command::mrp_usb, 0xFFFF);
+  setting.setRouteTypeMask(def::command::mrp_portc, def::command::mrp_usb, 0x03); // 0x80, 0x90
+  setting.setRouteChannelMask(def::command::mrp_internal, def::command::mrp_portc, 0xFFFF);
+  setting.setRouteTypeMask(def::command::mrp_internal, def::command::mrp_portc, port_setting_t::route_type_system);
+}
+} // namespace
+
+// 送信元 × 送信先 ごとのチャンネル・メッセージ種別の指定が、[送信元][種別] のチャンネルのビットマスクへ正しく展開されること
+void test_midi_route_mask(void)
+{
+  std::unique_ptr<port_setting_t> setting { new port_setting_t() };
+  setting->init();
+
+  // 初期状態は全て通過させる
+  setting->resetRoute();
+  TEST_ASSERT_TRUE(check_all(*setting));
+  midi_route_mask_t mask;
+  TEST_ASSERT_TRUE(mask.isRouted(def::command::mrp_usb, 0x9F));
+  TEST_ASSERT_TRUE(mask.isRouted(def::command::mrp_internal, 0xF8));
+  TEST_ASSERT_FALSE(mask.isRouted(max_port, 0x90));
+
+  // 用途別の振り分け
+  setup_split_route(*setting);
+  TEST_ASSERT_TRUE(check_all(*setting));
+  midi_route_mask_t usb, ble, portc;
+  usb.assign(setting.get(), def::command::mrp_usb);
+  ble.assign(setting.get(), def::command::mrp_ble);
+  portc.assign(setting.get(), def::command::mrp_portc);
+  TEST_ASSERT_TRUE(usb.isRouted(def::command::mrp_internal, 0x99));
+  TEST_ASSERT_FALSE(usb.isRouted(def::command::mrp_internal, 0x90));
+  TEST_ASSERT_FALSE(ble.isRouted(def::command::mrp_internal, 0x99));
+  TEST_ASSERT_TRUE(ble.isRouted(def::command::mrp_internal, 0xC0));
+  TEST_ASSERT_FALSE(ble.isRouted(def::command::mrp_internal, 0xF8)); // システムメッセージは種別のビット7
+  TEST_ASSERT_TRUE(usb.isRouted(def::command::mrp_portc, 0x83));
+  TEST_ASSERT_TRUE(usb.isRouted(def::command::mrp_portc, 0x93));
+  TEST_ASSERT_FALSE(usb.isRouted(def::command::mrp_portc, 0xB3));
+  TEST_ASSERT_FALSE(ble.isRouted(def::command::mrp_portc, 0x93));
+  // システムメッセージのみの経路ではチャンネルメッセージは通過しない
+  TEST_ASSERT_TRUE(portc.isRouted(def::command::mrp_internal, 0xF8));
+  TEST_ASSERT_TRUE(portc.isRouted(def::command::mrp_internal, 0xFA));
+  TEST_ASSERT_FALSE(portc.isRouted(def::command::mrp_internal, 0x90));
+
+  // ランダムな経路表 (全通過・遮断・単一チャンネルなどの境界を含む)
+  std::mt19937 rng(21);
+  for (int i = 0; i < 200; ++i) {
+    for (uint8_t src = 0; src < max_port; ++src) {
+      for (uint8_t dst = 0; dst < max_port; ++dst) {
+        uint16_t channel;
+        switch (rng() % 4) {
+        case 0:  channel = 0; break;
+        case 1:  channel = 0xFFFF; break;
+        case 2:  channel = 1 << (rng() % 16); break;
+        default: channel = rng(); break;
+        }
+        setting->setRouteChannelMask(src, dst, channel);
+        setting->setRouteTypeMask(src, dst, rng());
+      }
+    }
+    TEST_ASSERT_TRUE(check_all(*setting));
+  }
+}
+
+// 全ての送信先ポートが midi_out_control の履歴を読み出し、経路の判定と音色・音量の重複省略を行う場合の処理能力
+// 比較として、展開した表を使わずに毎回レジストリの経路表を参照して判定する場合も計測する
+void test_midi_route_benchmark(void)
+{
+  std::unique_ptr<port_setting_t> setting { new port_setting_t() };
+  setting->init();
+  setup_split_route(*setting);
+  std::unique_ptr<system_registry_t::reg_midi_out_control_t> midi_out { new system_registry_t::reg_midi_out_control_t() };
+  midi_out->init();
+
+  // 演奏タスクからの出力を主とし、外部入力のスルーとMIDIクロックを混ぜる
+  std::mt19937 rng(2100);
+  struct message_t { uint8_t status, data1, data2, source; };
+  std::vector<message_t> messages(4096);
+  for (auto& m : messages) {
+    uint32_t r = rng() % 100;
+    m.source = (r < 70) ? def::command::mrp_internal : 1 + (r % (max_port - 1));
+    uint32_t kind = rng() % 16;
+    if (kind == 0) {
+      m.status = 0xF8;
+    } else if (kind < 3) {
+      m.status = 0xB0 | (rng() % 16);
+    } else if (kind < 4) {
+      m.status = 0xC0 | (rng() % 16);
+    } else {
+      m.status = 0x90 | (rng() % 16);
+    }
+    m.data1 = (m.status == 0xF8) ? 0 : ((m.status & 0xF0) == 0xB0 ? ((rng() & 1) ? 7 : 64) : rng() & 0x7F);
+    m.data2 = rng() & 0x7F;
+  }
+
+  struct port_t {
+    midi_route_mask_t route;
+    midi_channel_state_t channel_state;
+    registry_t::history_code_t code;
+    uint32_t routed = 0;
+    uint32_t sent = 0;
+  };
+  char msg[128];
+  static constexpr const int chunk = 32; // 送信タスクが一度の起床で読み出す件数
+  static constexpr const int total = 400000;
+  for (int method = 0; method < 2; ++method) {
+    port_t port[max_port];
+    for (uint8_t dst = 0; dst < max_port; ++dst) {
+      port[dst].route.assign(setting.get(), dst);
+      port[dst].code = midi_out->getHistoryCode();
+    }
+    uint32_t expected_routed[max_port] = { 0 };
+    double drain_sec = 0;
+    for (int written = 0; written < total; written += chunk) {
+      for (int i = 0; i < chunk; ++i) {
+        auto& m = messages[(written + i) & 4095];
+        midi_out->setMessage(m.status, m.data1, m.data2, 0, m.source);
+        for (uint8_t dst = 0; dst < max_port; ++dst) {
+          expected_routed[dst] += reference_routed(*setting, m.source, dst, m.status);
+        }
+      }
+      auto t0 = std::chrono::steady_clock::now();
+      for (uint8_t dst = 0; dst < max_port; ++dst) {
+        auto p = &port[dst];
+        midi_event_t event;
+        while (midi_out->getEvent(p->code, event)) {
+          uint8_t status = event.getStatus();
+          uint8_t source = event.getSource();
+          bool routed = method ? p->route.isRouted(source, status) : reference_routed(*setting, source, dst, status);
+          if (!routed) { continue; }
+          ++p->routed;
+          if (p->channel_state.update(source, status, event.getData1(), event.getData2())) { ++p->sent; }
+        }
+      }
+      drain_sec += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+    uint32_t routed_total = 0;
+    for (uint8_t dst = 0; dst < max_port; ++dst) {
+      TEST_ASSERT_EQUAL_UINT32(expected_routed[dst], port[dst].routed);
+      routed_total += port[dst].routed;
+    }
+    snprintf(msg, sizeof(msg), "%s  %d messages x %d ports : %6.2f M decisions/sec  %6.2f M routed/sec"
+            , method ? "route mask table" : "registry lookup ", total, max_port
+            , total * max_port / drain_sec * 1e-6, routed_total / drain_sec * 1e-6);
+    TEST_MESSAGE(msg);
+    if (method) {
+      snprintf(msg, sizeof(msg), "  routed per port  internal:%u  portc:%u  ble:%u  usb:%u  (sent after channel state : %u %u %u %u)"
+              , port[0].routed, port[1].routed, port[2].routed, port[3].routed, port[0].sent, port[1].sent, port[2].sent, port[3].sent);
+      TEST_MESSAGE(msg);
+    }
+  }
+}
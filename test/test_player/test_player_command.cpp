@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// コマンダーから演奏部へのコマンドの受け渡し : 直接送信とオペレータ経由の順序の保証と、押下から取り出しまでの遅延
+
+#include <unity.h>
+
+#include "system_registry.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+
+struct command_t {
+  def::command::command_param_t command_param;
+  bool is_pressed;
+};
+
+// task_operator のコマンド処理ループのうち、演奏部への受け渡しに関わる部分
+// (演奏操作のコマンドを player_command へ追加し、直接送信済みのコマンドは位置の通知のみ行う)
+struct operator_model_t {
+  std::atomic<bool> done { false };
+  std::atomic<uint32_t> forwarded_count { 0 };
+  std::thread thread;
+
+  void start(void) {
+    done = false;
+    // スレッドの起動を待たずに送信が始まっても取りこぼさないよう、読出し位置は起動前に取得する
+    registry_t::history_code_t start_code = system_registry->operator_command.getHistoryCode();
+    thread = std::thread([this, start_code]() {
+      registry_t::history_code_t code = start_code;
+      while (!done.load(std::memory_order_acquire)) {
+        def::command::command_param_t command_param;
+        bool is_pressed;
+        uint8_t trace_id;
+        bool forwarded;
+        uint8_t input_source;
+        while (system_registry->operator_command.getQueue(&code, &command_param, &is_pressed, &trace_id, &forwarded, &input_source)) {
+          if (forwarded) {
+            ++forwarded_count;
+            system_registry->player_command.addForwarded(command_param, is_pressed);
+          } else {
+            system_registry->player_command.addQueue(command_param, is_pressed, trace_id, input_source);
+          }
+          system_registry->player_direct_command.setOperatorCode(code);
+        }
+        std::this_thread::yield();
+      }
+    });
+  }
+  void stop(void) {
+    done.store(true, std::memory_order_release);
+    thread.join();
+  }
+};
+
+static void reset_registry(void)
+{
+  delete system_registry;
+  system_registry = new system_registry_t();
+  system_registry->init();
+}
+
+} // namespace
+
+// 直接送信の対象とそれ以外のコマンドを混在させて連続で送信し、演奏部が送信した順に取り出せること
+// 直接送信のキューが満杯になり通常の経路に切り替わる場合も含める
+void test_player_command_order(void)
+{
+  reset_registry();
+  static constexpr const int command_count = 20000;
+  std::mt19937 rng(15);
+  std::vector<command_t> commands(command_count);
+  int direct_target_count = 0;
+  for (int i = 0; i < command_count; ++i) {
+    static constexpr const def::command::command_t types[] = {
+      def::command::chord_degree, def::command::note_button, def::command::drum_button, def::command::set_velocity,
+      def::command::chord_step_reset_request, def::command::autoplay_switch,
+    };
+    auto type = types[rng() % (sizeof(types) / sizeof(types[0]))];
+    commands[i].command_param = { type, i & 0x7F };
+    commands[i].is_pressed = rng() & 1;
+    if (system_registry_t::reg_player_direct_command_t::isTarget(commands[i].command_param)) { ++direct_target_count; }
+  }
+
+  // 送信を始める前に読出し位置を取得する。後から取得すると直接送信の位置の通知を読み飛ばし、キューとの対応がずれる
+  registry_t::history_code_t code = system_registry->player_command.getHistoryCode();
+  operator_model_t op;
+  op.start();
+  std::atomic<int> received { 0 };
+  std::atomic<bool> timeout { false };
+  std::thread commander([&]() {
+    for (int i = 0; i < command_count && !timeout.load(); ++i) {
+      // 履歴が上書きされない範囲で先行して送信する (直接送信のキューの容量を超える場合がある)
+      while (i - received.load(std::memory_order_acquire) >= 48 && !timeout.load()) { std::this_thread::yield(); }
+      system_registry->sendCommand(commands[i].command_param, commands[i].is_pressed, def::command::insrc_unknown);
+    }
+  });
+
+  int mismatch_index = -1;
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+  while (received.load() < command_count && std::chrono::steady_clock::now() < until) {
+    def::command::command_param_t command_param;
+    bool is_pressed;
+    uint8_t trace_id;
+    uint8_t input_source;
+    if (!system_registry->getPlayerCommand(&code, &command_param, &is_pressed, &trace_id, &input_source)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int index = received.load();
+    if (mismatch_index < 0 && (command_param != commands[index].command_param || is_pressed != commands[index].is_pressed)) {
+      mismatch_index = index;
+    }
+    received.store(index + 1, std::memory_order_release);
+  }
+  timeout.store(true);
+  commander.join();
+  op.stop();
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "commands:%d  direct target:%d  sent direct:%u  received:%d  first mismatch:%d"
+          , command_count, direct_target_count, (unsigned)op.forwarded_count.load(), received.load(), mismatch_index);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL(command_count, received.load());
+  TEST_ASSERT_EQUAL(-1, mismatch_index);
+  TEST_ASSERT_TRUE(op.forwarded_count.load() > 0);
+  TEST_ASSERT_EQUAL(0, system_registry->operator_command.getHistoryLostCount());
+  TEST_ASSERT_EQUAL(0, system_registry->player_command.getHistoryLostCount());
+}
+
+// 押下 (コマンダーの送信) から演奏部がコマンドを取り出すまでの遅延の中央値と99パーセンタイル
+// 直接送信と従来のオペレータ経由の経路を比較する。各タスクはスレッドで模擬し、受信を待つ間は他のスレッドに譲る
+void test_player_command_latency(void)
+{
+  reset_registry();
+  operator_model_t op;
+  op.start();
+
+  std::atomic<uint32_t> received { 0 };
+  std::atomic<int64_t> received_nsec { 0 };
+  std::atomic<bool> done { false };
+  registry_t::history_code_t start_code = system_registry->player_command.getHistoryCode();
+  std::thread player([&]() {
+    registry_t::history_code_t code = start_code;
+    while (!done.load(std::memory_order_acquire)) {
+      def::command::command_param_t command_param;
+      bool is_pressed;
+      uint8_t trace_id;
+      uint8_t input_source;
+      if (system_registry->getPlayerCommand(&code, &command_param, &is_pressed, &trace_id, &input_source)) {
+        received_nsec.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        received.fetch_add(1, std::memory_order_release);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  static constexpr const int press_count = 2000;
+  static const char* const path_name[] = { "direct  ", "operator" };
+  double median[2], p99[2];
+  for (int path = 0; path < 2; ++path) {
+    std::vector<double> latency;
+    latency.reserve(press_count);
+    for (int i = 0; i < press_count; ++i) {
+      // 押下の間隔を空け、オペレータと演奏部が処理を終えて待機している状態から送信する
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      const uint32_t prev = received.load(std::memory_order_acquire);
+      const def::command::command_param_t command_param { def::command::chord_degree, 1 + (i & 7) };
+      const auto start = std::chrono::steady_clock::now();
+      if (path == 0) {
+        system_registry->sendCommand(command_param, i & 1, def::command::insrc_unknown);
+      } else {
+        // 従来の経路 : オペレータが player_command へ転送する
+        system_registry->operator_command.addQueue(command_param, i & 1);
+      }
+      while (received.load(std::memory_order_acquire) == prev) { std::this_thread::yield(); }
+      latency.push_back((received_nsec.load(std::memory_order_relaxed) - start.time_since_epoch().count()) * 1e-3);
+    }
+    std::sort(latency.begin(), latency.end());
+    median[path] = latency[press_count / 2];
+    p99[path] = latency[press_count * 99 / 100];
+  }
+  done.store(true, std::memory_order_release);
+  player.join();
+  op.stop();
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "press to player, %d presses   median     p99  [usec]", press_count);
+  TEST_MESSAGE(msg);
+  for (int path = 0; path < 2; ++path) {
+    snprintf(msg, sizeof(msg), "  %s : %8.1f %8.1f", path_name[path], median[path], p99[path]);
+    TEST_MESSAGE(msg);
+  }
+  TEST_ASSERT_EQUAL(press_count * 2, received.load());
+}
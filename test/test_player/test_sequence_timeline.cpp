@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// reg_sequence_timeline_t : チャンクごとのCRCキャッシュの検証と、録音・挿入の処理時間
+
+#include <unity.h>
+
+#include "system_registry.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+typedef system_registry_t::reg_sequence_timeline_t timeline_t;
+static constexpr const uint16_t max_step = def::app::max_sequence_step;
+
+static sequence_chord_desc_t make_desc(uint32_t value)
+{
+  sequence_chord_desc_t desc;
+  memcpy((void*)&desc, &value, sizeof(desc));
+  return desc;
+}
+
+// 要素を順に並べた連続領域のCRC (チャンクに分けない場合の計算結果)
+static uint32_t reference_crc32(const timeline_t& timeline, uint32_t crc_init)
+{
+  std::vector<timeline_t::value_type> flat;
+  flat.reserve(timeline.size());
+  for (auto& pair : timeline) { flat.push_back(pair); }
+  return calc_crc32(flat.data(), flat.size() * sizeof(timeline_t::value_type), crc_init);
+}
+} // namespace
+
+// 挿入・上書き・削除のたびに、チャンクごとのCRCを連結した結果が全体を続けて計算した結果と一致すること
+void test_sequence_timeline_crc(void)
+{
+  std::mt19937 rng(12);
+  std::unique_ptr<timeline_t> timeline { new timeline_t() };
+  std::unique_ptr<timeline_t> copy { new timeline_t() };
+  timeline->init();
+  copy->init();
+  std::map<uint16_t, uint32_t> model;
+
+  for (int i = 0; i < 20000; ++i) {
+    uint32_t r = rng() % 100;
+    if (r < 90) {
+      uint16_t step = rng() % 4000;
+      uint32_t value = rng();
+      TEST_ASSERT_TRUE(timeline->setStepDescriptor(step, make_desc(value)));
+      model[step] = value;
+    } else if (r < 92) {
+      uint16_t step = rng() % 4000;
+      timeline->deleteAfter(step);
+      model.erase(model.lower_bound(step), model.end());
+    } else if (r < 93) {
+      copy->assign(*timeline);
+      TEST_ASSERT_EQUAL_UINT32(reference_crc32(*timeline, 0), copy->crc32(0));
+    }
+    if ((i % 16) == 0) {
+      uint32_t init = rng();
+      TEST_ASSERT_EQUAL(model.size(), timeline->size());
+      TEST_ASSERT_EQUAL_UINT32(reference_crc32(*timeline, init), timeline->crc32(init));
+      TEST_ASSERT_EQUAL_UINT32(reference_crc32(*timeline, init), timeline->crc32_cached(init));
+    }
+  }
+  auto it = timeline->begin();
+  for (auto& kv : model) {
+    TEST_ASSERT_EQUAL(kv.first, it->first);
+    TEST_ASSERT_EQUAL_UINT32(kv.second, it->second.toUint32());
+    ++it;
+  }
+  timeline->clear();
+  TEST_ASSERT_EQUAL_UINT32(0x55AA55AA, timeline->crc32(0x55AA55AA));
+}
+
+// 別タスクが crc32 を計算している最中に書き込まれても、古い内容のCRCがキャッシュに残らないこと
+void test_sequence_timeline_crc_concurrent(void)
+{
+  std::unique_ptr<timeline_t> timeline { new timeline_t() };
+  timeline->init();
+  for (uint16_t step = 0; step < max_step; ++step) {
+    timeline->setStepDescriptor(step, make_desc(step));
+  }
+
+  // 両方のスレッドが譲らずに一定時間動き続け、計算の途中に書込みが割り込む機会を作る
+  // 全チャンクに書き込むことで、読出し側は毎回ほぼ全てのチャンクを再計算することになる
+  // 複数コアでは並行して動くため検出しやすいが、単一コアではタイムスライスの切替えが計算中に起きた場合のみ検出できる
+  static constexpr const int round_count = 50;
+  int stale_count = 0;
+  uint32_t crc_count = 0;
+  uint32_t write_count = 0;
+  for (int round = 0; round < round_count; ++round) {
+    std::atomic<bool> done { false };
+    std::atomic<bool> ready { false };
+    std::thread reader([&]() {
+      ready.store(true);
+      while (!done.load(std::memory_order_acquire)) {
+        timeline->crc32(0);
+        ++crc_count;
+      }
+    });
+    while (!ready.load()) { std::this_thread::yield(); }
+    std::mt19937 rng(round);
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+    while (std::chrono::steady_clock::now() < until) {
+      timeline->setStepDescriptor(rng() % max_step, make_desc(rng()));
+      ++write_count;
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+    if (timeline->crc32(0) != reference_crc32(*timeline, 0)) { ++stale_count; }
+  }
+  char msg[96];
+  snprintf(msg, sizeof(msg), "rounds:%d  writes:%u  concurrent crc32 calls:%u  stale:%d", round_count, write_count, crc_count, stale_count);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_EQUAL(0, stale_count);
+}
+
+// 録音 (末尾への追加と上書き) と、最悪ケースの挿入 (常に先頭へ挿入) の1回あたりの処理時間
+// 録音中は書込みのたびにソングの変更検出で crc32 が呼ばれるため、その処理時間も計測する
+void test_sequence_timeline_benchmark(void)
+{
+  char msg[128];
+  static constexpr const int record_count = 100000;
+
+  {
+    // ループ録音 : 最大ステップまで順に書き込み、先頭に戻って上書きを続ける
+    std::unique_ptr<timeline_t> timeline { new timeline_t() };
+    timeline->init();
+    double write_sec = 0, crc_sec = 0;
+    uint32_t crc = 0;
+    for (int i = 0; i < record_count; ++i) {
+      auto t0 = std::chrono::steady_clock::now();
+      timeline->setStepDescriptor(i % max_step, make_desc(i));
+      auto t1 = std::chrono::steady_clock::now();
+      crc = timeline->crc32(0);
+      auto t2 = std::chrono::steady_clock::now();
+      write_sec += std::chrono::duration<double>(t1 - t0).count();
+      crc_sec += std::chrono::duration<double>(t2 - t1).count();
+    }
+    TEST_ASSERT_EQUAL(max_step, timeline->size());
+    TEST_ASSERT_EQUAL_UINT32(reference_crc32(*timeline, 0), crc);
+
+    // 比較用 : キャッシュを使わずに全要素のCRCを計算する場合
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; ++i) { crc = reference_crc32(*timeline, 0); }
+    double full_usec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e6 / 100;
+
+    snprintf(msg, sizeof(msg), "live record %d writes (%u steps)", record_count, (unsigned)timeline->size());
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  setStepDescriptor : %8.1f nsec/write", write_sec * 1e9 / record_count);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  crc32 (cached)    : %8.2f usec/write", crc_sec * 1e6 / record_count);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  crc32 (full)      : %8.2f usec", full_usec);
+    TEST_MESSAGE(msg);
+  }
+
+  for (int order = 0; order < 2; ++order) {
+    // 最悪ケース : 末尾から先頭に向かって挿入し、毎回チャンク内の全要素を移動させる
+    // 比較としてランダムな順序での挿入も計測する
+    std::vector<uint16_t> steps(max_step);
+    for (uint16_t i = 0; i < max_step; ++i) { steps[i] = max_step - 1 - i; }
+    if (order) { std::shuffle(steps.begin(), steps.end(), std::mt19937(1200)); }
+    std::unique_ptr<timeline_t> timeline { new timeline_t() };
+    timeline->init();
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto step : steps) { timeline->setStepDescriptor(step, make_desc(step)); }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    TEST_ASSERT_EQUAL(max_step, timeline->size());
+    TEST_ASSERT_EQUAL_UINT32(reference_crc32(*timeline, 0), timeline->crc32(0));
+    snprintf(msg, sizeof(msg), "%s insert %u steps : %8.1f nsec/insert", order ? "random " : "reverse", (unsigned)max_step, sec * 1e9 / max_step);
+    TEST_MESSAGE(msg);
+  }
+}
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// 発音予定 (step_plan_t) の先読み・再利用を行った場合と、毎ステップその場で作成した場合の出力の比較
+
+#include <unity.h>
+
+#include "player_harness.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+
+static constexpr const char* presets[] = {
+  "Pop01_16beatSw.json",
+  "Ballade01_Lovin.json",
+  "Punk01_Linda.json",
+  "Rock01_Iine.json",
+  "Simple_Guitarx2.json",
+};
+
+static bool render(std::vector<player_harness_t::event_t>& events, const char* filename, bool prefetch, uint32_t length_usec, const std::function<void(void)>& after_step = nullptr)
+{
+  player_harness_t harness;
+  if (!harness.loadPreset(filename)) { return false; }
+  harness.start(prefetch);
+  harness.runUntil(length_usec, after_step);
+  harness.stop();
+  events = std::move(harness.events);
+  return true;
+}
+
+static void assert_same_events(const std::vector<player_harness_t::event_t>& expected, const std::vector<player_harness_t::event_t>& actual, const char* label)
+{
+  char msg[128];
+  size_t count = std::min(expected.size(), actual.size());
+  for (size_t i = 0; i < count; ++i) {
+    if (!(expected[i] == actual[i])) {
+      snprintf(msg, sizeof(msg), "%s: event %u differs  usec %u:%02x %02x %02x  usec %u:%02x %02x %02x", label, (unsigned)i
+              , expected[i].usec, expected[i].status, expected[i].data1, expected[i].data2
+              , actual[i].usec, actual[i].status, actual[i].data1, actual[i].data2);
+      TEST_FAIL_MESSAGE(msg);
+    }
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(expected.size(), actual.size(), label);
+}
+
+// 次に発音するステップ以降に影響する設定を1つ変更する
+// 先読み済みの発音予定が作り直されることを確認するため、現在のステップの次のステップを主に対象とする
+static void edit_next_step(std::mt19937& rng)
+{
+  const uint8_t part = rng() % def::app::max_chord_part;
+  auto chord_part = &system_registry->current_slot->chord_part[part];
+  auto part_info = &chord_part->part_info;
+  int step = system_registry->chord_play.getPartStep(part);
+  int next_step = step + 1;
+  if (next_step > part_info->getLoopStep()) { next_step = 0; }
+  if (next_step >= def::app::max_arpeggio_step) { next_step = 0; }
+
+  switch (rng() % 9) {
+  default:
+  case 0:
+    chord_part->arpeggio.setVelocity(next_step, rng() % def::app::max_pitch_with_drum, (rng() % 3) ? 1 + rng() % 100 : 0);
+    break;
+  case 1:
+    chord_part->arpeggio.setStyle(next_step, (def::play::arpeggio_style_t)(rng() % def::play::arpeggio_style_t::arpeggio_style_max));
+    break;
+  case 2:
+    part_info->setVoicing(rng() % (KANTANMusic_Voicing_Ukulele + 1));
+    break;
+  case 3:
+    part_info->setPosition((int)(rng() % 5) - 2);
+    break;
+  case 4:
+    part_info->setStrokeSpeed(rng() % 40);
+    break;
+  case 5:
+    system_registry->song_data.chord_part_drum[part].setDrumNoteNumber(rng() % def::app::max_pitch_with_drum, 35 + rng() % 40);
+    break;
+  case 6:
+    system_registry->chord_play.setPartEnable(part, !system_registry->chord_play.getPartEnable(part));
+    break;
+  case 7:
+    system_registry->runtime_info.setMasterKey(rng() % 12);
+    break;
+  case 8:
+    system_registry->player_command.addQueue( { def::command::set_velocity, (int)(20 + rng() % 100) } );
+    break;
+  }
+}
+
+} // namespace
+
+// 自動演奏の出力が、先読みの有無によらず一致すること
+void test_step_plan_prefetch_parity(void)
+{
+  char msg[128];
+  for (auto filename : presets) {
+    std::vector<player_harness_t::event_t> direct, prefetch;
+    TEST_ASSERT_TRUE_MESSAGE(render(direct, filename, false, 20000000), filename);
+    TEST_ASSERT_TRUE_MESSAGE(render(prefetch, filename, true, 20000000), filename);
+    TEST_ASSERT_TRUE_MESSAGE(direct.size() > 200, filename);
+    assert_same_events(direct, prefetch, filename);
+    snprintf(msg, sizeof(msg), "%-24s events:%u", filename, (unsigned)direct.size());
+    TEST_MESSAGE(msg);
+  }
+}
+
+// 先読みの後・次のステップの発音の前に設定を変更した場合も、毎ステップその場で作成した場合と出力が一致すること
+void test_step_plan_prefetch_invalidate(void)
+{
+  char msg[128];
+  for (auto filename : presets) {
+    std::vector<player_harness_t::event_t> result[2];
+    int edit_count = 0;
+    for (int prefetch = 0; prefetch < 2; ++prefetch) {
+      std::mt19937 rng(13);
+      uint32_t next_edit_usec = 1000000;
+      edit_count = 0;
+      player_harness_t harness;
+      TEST_ASSERT_TRUE_MESSAGE(harness.loadPreset(filename), filename);
+      harness.start(prefetch);
+      // procStep の直後 (先読みの後) に呼ばれる。演奏処理が要求する時刻ごとに呼ばれるため、一定間隔で変更する
+      harness.runUntil(20000000, [&]() {
+        if (harness.usec < next_edit_usec) { return; }
+        next_edit_usec = harness.usec + 40000 + rng() % 80000;
+        edit_next_step(rng);
+        ++edit_count;
+      });
+      harness.stop();
+      result[prefetch] = std::move(harness.events);
+    }
+    assert_same_events(result[0], result[1], filename);
+
+    // 変更が出力に反映されていること (変更しない場合と出力が異なること)
+    std::vector<player_harness_t::event_t> unedited;
+    TEST_ASSERT_TRUE_MESSAGE(render(unedited, filename, true, 20000000), filename);
+    TEST_ASSERT_TRUE_MESSAGE(edit_count > 50, filename);
+    TEST_ASSERT_FALSE_MESSAGE(unedited == result[1], filename);
+
+    snprintf(msg, sizeof(msg), "%-24s edits:%d  events:%u", filename, edit_count, (unsigned)result[1].size());
+    TEST_MESSAGE(msg);
+  }
+}
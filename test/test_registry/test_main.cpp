@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// レジストリの単体テスト (pio test -e native_test)
+
+#include <unity.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// test_registry_history.cpp
+void test_registry_history_overrun(void);
+void test_registry_history_mpmc(void);
+
+// test_registry_crc.cpp
+void test_registry_crc_parity(void);
+void test_registry_crc_cached(void);
+void test_registry_crc_benchmark(void);
+
+// test_registry_map.cpp
+void test_registry_map_model(void);
+void test_registry_map_benchmark(void);
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_registry_history_overrun);
+  RUN_TEST(test_registry_history_mpmc);
+  RUN_TEST(test_registry_crc_parity);
+  RUN_TEST(test_registry_crc_cached);
+  RUN_TEST(test_registry_crc_benchmark);
+  RUN_TEST(test_registry_map_model);
+  RUN_TEST(test_registry_map_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// calc_crc32 (slice-by-8) / calc_crc32_combine / crc32_cached と従来の1バイトずつの calc_crc32 の比較
+
+#include <unity.h>
+
+#include "registry.hpp"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+
+// 従来の calc_crc32。テーブルを1バイトずつ引く
+struct legacy_crc32_t {
+  uint32_t table[256];
+  legacy_crc32_t(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) { c = (c & 1) ? (c >> 1) ^ 0xEDB88320UL : (c >> 1); }
+      table[i] = c;
+    }
+  }
+  uint32_t calc(const void *data, size_t length, uint32_t crc_init) const {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = crc_init ^ 0xFFFFFFFFUL;
+    for (size_t i = 0; i < length; i++) {
+      crc = (crc >> 8) ^ table[(uint8_t)(crc ^ bytes[i])];
+    }
+    return crc ^ 0xFFFFFFFFUL;
+  }
+};
+static const legacy_crc32_t legacy_crc32;
+
+// registry_map の内容をマップの連続領域と同じ配置 (キーの昇順・パディングはゼロ) で書き出す
+template <typename T>
+static std::vector<uint8_t> flatten(const std::map<uint16_t, T>& map)
+{
+  typedef typename flat_map_t<T>::value_type value_type;
+  std::vector<uint8_t> result(map.size() * sizeof(value_type), 0);
+  auto dst = (value_type*)result.data();
+  for (auto& kv : map) {
+    dst->key = kv.first;
+    dst->value = kv.second;
+    ++dst;
+  }
+  return result;
+}
+
+} // namespace
+
+// calc_crc32 と calc_crc32_combine が従来の計算と一致すること
+void test_registry_crc_parity(void)
+{
+  std::mt19937 rng(8);
+  std::vector<uint8_t> buf(4096 + 8);
+  for (auto& b : buf) { b = rng(); }
+
+  // 長さ・先頭アドレスの境界 (slice-by-8 の端数処理) と初期値の組み合わせ
+  for (size_t offset = 0; offset < 8; ++offset) {
+    for (size_t length = 0; length <= 300; ++length) {
+      uint32_t init = (length & 1) ? rng() : 0;
+      TEST_ASSERT_EQUAL_UINT32(legacy_crc32.calc(&buf[offset], length, init), calc_crc32(&buf[offset], length, init));
+    }
+  }
+  for (size_t length : { 1024, 4095, 4096 }) {
+    TEST_ASSERT_EQUAL_UINT32(legacy_crc32.calc(buf.data(), length, 0), calc_crc32(buf.data(), length, 0));
+  }
+
+  // CRC(A) に CRC(B) を連結した結果が、A+B を続けて計算した結果と一致すること
+  for (int i = 0; i < 2000; ++i) {
+    size_t length_a = rng() % 600;
+    size_t length_b = rng() % 600;
+    uint32_t init = (i & 1) ? rng() : 0;
+    uint32_t crc_a = legacy_crc32.calc(buf.data(), length_a, init);
+    uint32_t crc_b = legacy_crc32.calc(&buf[length_a], length_b, 0);
+    uint32_t expected = legacy_crc32.calc(buf.data(), length_a + length_b, init);
+    TEST_ASSERT_EQUAL_UINT32(expected, calc_crc32_combine(crc_a, crc_b, calc_crc32_shift(length_b)));
+    // crc32_cached の使い方 : 直前までの値を初期値として B を計算した結果と一致すること
+    TEST_ASSERT_EQUAL_UINT32(legacy_crc32.calc(&buf[length_a], length_b, crc_a), calc_crc32_combine(crc_a, crc_b, calc_crc32_shift(length_b)));
+  }
+}
+
+// crc32_cached が変更のたびに従来の計算と一致し、未変更の間は再計算せずに同じ値を返すこと
+void test_registry_crc_cached(void)
+{
+  std::mt19937 rng(80);
+
+  registry_t reg { 200, 0, registry_t::DATA_SIZE_8 };
+  registry_t reg_copy { 200, 0, registry_t::DATA_SIZE_8 };
+  reg.init();
+  reg_copy.init();
+  registry_map8_t map8 { 0 };
+  map8.init();
+  registry_map32_t map32 { 0 };
+  map32.init();
+  std::map<uint16_t, uint8_t> ref8;
+  std::map<uint16_t, uint32_t> ref32;
+
+  uint32_t chain = 0x12345678;
+  for (int i = 0; i < 3000; ++i) {
+    switch (rng() % 6) {
+    case 0: reg.set8(rng() % 200, rng()); break;
+    case 1: reg.set32((rng() % 50) * 4, rng()); break;
+    case 2: {
+        uint16_t key = rng() % 64;
+        uint8_t value = (rng() % 4) ? rng() : 0;
+        map8.set8(key, value);
+        if (value) { ref8[key] = value; } else { ref8.erase(key); }
+      }
+      break;
+    case 3: {
+        uint16_t key = rng() % 64;
+        uint32_t value = (rng() % 4) ? rng() : 0;
+        map32.set32(key, value);
+        if (value) { ref32[key] = value; } else { ref32.erase(key); }
+      }
+      break;
+    case 4: reg_copy.assign(reg); break;
+    default: break; // 変更なし
+    }
+    auto flat8 = flatten(ref8);
+    auto flat32 = flatten(ref32);
+    uint32_t expected = legacy_crc32.calc(reg.getBuffer(), reg.size(), chain);
+    expected = legacy_crc32.calc(reg_copy.getBuffer(), reg_copy.size(), expected);
+    expected = legacy_crc32.calc(flat8.data(), flat8.size(), expected);
+    expected = legacy_crc32.calc(flat32.data(), flat32.size(), expected);
+
+    uint32_t cached = reg.crc32_cached(chain);
+    cached = reg_copy.crc32_cached(cached);
+    cached = map8.crc32_cached(cached);
+    cached = map32.crc32_cached(cached);
+    TEST_ASSERT_EQUAL_UINT32(expected, cached);
+
+    uint32_t full = reg.crc32(chain);
+    full = reg_copy.crc32(full);
+    full = map8.crc32(full);
+    full = map32.crc32(full);
+    TEST_ASSERT_EQUAL_UINT32(expected, full);
+  }
+
+  // 空のマップ (長さ0) は初期値をそのまま返す
+  registry_map8_t empty { 0 };
+  empty.init();
+  TEST_ASSERT_EQUAL_UINT32(0xCAFEBABE, empty.crc32_cached(0xCAFEBABE));
+  TEST_ASSERT_EQUAL_UINT32(0, empty.crc32_cached(0));
+
+  // 未変更の間は世代番号が進まない
+  uint32_t generation = reg.getGeneration();
+  reg.crc32_cached(0);
+  reg.set8(0, reg.get8(0));
+  TEST_ASSERT_EQUAL_UINT32(generation, reg.getGeneration());
+  reg.set8(0, reg.get8(0) + 1);
+  TEST_ASSERT_NOT_EQUAL(generation, reg.getGeneration());
+}
+
+// 全体を毎回計算する場合と、変更されたレジストリだけを再計算する場合の比較
+// 曲データ相当 (設定・パート情報などの小さなレジストリ多数とシーケンス相当の大きなレジストリ) について、
+// 1回の変更ごとに全体のCRCを求める
+void test_registry_crc_benchmark(void)
+{
+  char msg[128];
+
+  // calc_crc32 単体 : 従来の1バイトずつの計算との比較
+  {
+    std::vector<uint8_t> buf(64 * 1024);
+    std::mt19937 rng(800);
+    for (auto& b : buf) { b = rng(); }
+    static constexpr const int loop = 200;
+    uint32_t crc_legacy = 0, crc_slice = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loop; ++i) { crc_legacy = legacy_crc32.calc(buf.data(), buf.size(), crc_legacy); }
+    double legacy_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loop; ++i) { crc_slice = calc_crc32(buf.data(), buf.size(), crc_slice); }
+    double slice_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    TEST_ASSERT_EQUAL_UINT32(crc_legacy, crc_slice);
+    snprintf(msg, sizeof(msg), "calc_crc32  byte-at-a-time : %7.1f MB/sec", buf.size() * loop / legacy_sec * 1e-6);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "calc_crc32  slice-by-8     : %7.1f MB/sec", buf.size() * loop / slice_sec * 1e-6);
+    TEST_MESSAGE(msg);
+  }
+
+  static constexpr const int small_count = 64;
+  std::vector<std::unique_ptr<registry_t>> regs;
+  for (int i = 0; i < small_count; ++i) {
+    regs.emplace_back(new registry_t { 128, 0, registry_t::DATA_SIZE_8 });
+  }
+  regs.emplace_back(new registry_t { 32 * 1024, 0, registry_t::DATA_SIZE_8 });
+  size_t total_bytes = 0;
+  for (auto& r : regs) { r->init(); total_bytes += r->size(); }
+
+  static constexpr const int loop = 1000;
+  std::mt19937 rng(8000);
+  double full_sec = 0, cached_sec = 0;
+  for (int i = 0; i < loop; ++i) {
+    // 小さなレジストリのいずれか1つを変更する
+    auto& r = regs[rng() % small_count];
+    r->set8(rng() % r->size(), rng());
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t full = 0;
+    for (auto& r : regs) { full = r->crc32(full); }
+    auto mid = std::chrono::steady_clock::now();
+    uint32_t cached = 0;
+    for (auto& r : regs) { cached = r->crc32_cached(cached); }
+    auto end = std::chrono::steady_clock::now();
+    full_sec += std::chrono::duration<double>(mid - start).count();
+    cached_sec += std::chrono::duration<double>(end - mid).count();
+    TEST_ASSERT_EQUAL_UINT32(full, cached);
+  }
+  snprintf(msg, sizeof(msg), "%u registries (%u bytes), 1 modified per check", (unsigned)regs.size(), (unsigned)total_bytes);
+  TEST_MESSAGE(msg);
+  snprintf(msg, sizeof(msg), "  full crc32      : %8.2f usec/check", full_sec * 1e6 / loop);
+  TEST_MESSAGE(msg);
+  snprintf(msg, sizeof(msg), "  crc32_cached    : %8.2f usec/check", cached_sec * 1e6 / loop);
+  TEST_MESSAGE(msg);
+}
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// registry_base_t の変更履歴 (_addHistory / getHistory) の複数書込み・複数読出しの検証
+
+#include <unity.h>
+
+#include "registry.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+void test_registry_history_overrun(void)
+{
+  // 読出しが追いつかない場合、上書きされた分を読み飛ばして最新の history_count 件だけを読む
+  static constexpr const uint32_t history_count = 64;
+  registry_base_t reg { history_count };
+  reg.init();
+  for (uint32_t i = 0; i < history_count * 3; ++i) {
+    reg.set32(i & 0xFF, i);
+  }
+  registry_base_t::history_code_t code = 0;
+  registry_base_t::history_t history;
+  uint32_t count = 0;
+  while (reg.getHistory(code, history)) {
+    TEST_ASSERT_EQUAL_UINT32(history_count * 2 + count, history.value);
+    TEST_ASSERT_EQUAL(registry_base_t::DATA_SIZE_32, history.data_size);
+    ++count;
+  }
+  TEST_ASSERT_EQUAL_UINT32(history_count, count);
+  TEST_ASSERT_EQUAL_UINT32(history_count * 2, reg.getHistoryLostCount());
+  TEST_ASSERT_EQUAL_UINT32(reg.getHistoryCode(), code);
+}
+
+void test_registry_history_mpmc(void)
+{
+  // 書込みタスク N 個が同時に set32 し、読出しタスク M 個がそれぞれ自分のカーソルで getHistory する
+  // 値の上位8bitに書込みタスク番号、下位24bitに通し番号を入れておき、
+  // 読んだ履歴が index / data_size / value の組として一貫していること (torn が無いこと) と、
+  // 同じ書込みタスクの履歴が書込み順に並んでいることを確認する
+  // 読み飛ばされた件数は、読出しタスクごとの (書込み総数 - 読出し数) の合計が getHistoryLostCount と一致することで確認する
+  static constexpr const uint32_t history_count = 256;
+  static constexpr const uint32_t write_count = 100000;
+  char msg[160];
+  for (auto pattern : { std::make_pair(1, 1), std::make_pair(4, 1), std::make_pair(4, 3), std::make_pair(2, 4) }) {
+    const int producers = pattern.first;
+    const int consumers = pattern.second;
+    registry_base_t reg { history_count };
+    reg.init();
+
+    std::atomic<bool> done { false };
+    std::atomic<int> ready { 0 };
+    std::vector<uint32_t> read_count(consumers);
+    std::vector<uint32_t> torn_count(consumers);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; ++c) {
+      threads.emplace_back([&, c] {
+        registry_base_t::history_code_t code = 0;
+        registry_base_t::history_t history;
+        std::vector<int32_t> last(producers, -1);
+        uint32_t read = 0;
+        uint32_t torn = 0;
+        ready.fetch_add(1, std::memory_order_acq_rel);
+        for (;;) {
+          bool finished = done.load(std::memory_order_acquire);
+          while (reg.getHistory(code, history)) {
+            ++read;
+            uint32_t p = history.index;
+            int32_t seq = history.value & 0xFFFFFF;
+            if (p >= (uint32_t)producers
+             || history.data_size != registry_base_t::DATA_SIZE_32
+             || (history.value >> 24) != p
+             || seq <= last[p]) {
+              ++torn;
+              continue;
+            }
+            last[p] = seq;
+          }
+          if (finished) { break; }
+          std::this_thread::yield();
+        }
+        read_count[c] = read;
+        torn_count[c] = torn;
+      });
+    }
+    while (ready.load(std::memory_order_acquire) != consumers) { std::this_thread::yield(); }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> writers;
+    for (int p = 0; p < producers; ++p) {
+      writers.emplace_back([&, p] {
+        for (uint32_t i = 0; i < write_count; ++i) {
+          reg.set32(p, (p << 24) | i);
+          // 実機のタスク切替えを模して、一定件数ごとに他のタスクへ実行を譲る
+          if ((i & 31) == 31) { std::this_thread::yield(); }
+        }
+      });
+    }
+    for (auto &t : writers) { t.join(); }
+    auto write_end = std::chrono::steady_clock::now();
+    done.store(true, std::memory_order_release);
+    for (auto &t : threads) { t.join(); }
+    auto end = std::chrono::steady_clock::now();
+
+    uint32_t total = producers * write_count;
+    uint32_t lost = 0;
+    uint32_t torn = 0;
+    uint64_t read = 0;
+    for (int c = 0; c < consumers; ++c) {
+      lost += total - read_count[c];
+      torn += torn_count[c];
+      read += read_count[c];
+    }
+    double write_sec = std::chrono::duration<double>(write_end - start).count();
+    double read_sec = std::chrono::duration<double>(end - start).count();
+    snprintf(msg, sizeof(msg), "producers:%d consumers:%d  write:%.2f Mop/s  read:%.2f Mop/s  lost:%u torn:%u"
+            , producers, consumers, total / write_sec / 1e6, read / read_sec / 1e6, lost, torn);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_EQUAL_UINT32(total, reg.getHistoryCode());
+    TEST_ASSERT_EQUAL_UINT32(0, torn);
+    TEST_ASSERT_EQUAL_UINT32(lost, reg.getHistoryLostCount());
+  }
+}
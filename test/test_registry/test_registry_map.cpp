@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: MIT
+// Copyright (c) 2025 InstaChord Corp.
+
+// registry_map8_t / registry_map_t (flat_map_t) と従来の std::map による実装の比較
+
+#include <unity.h>
+
+#include "registry.hpp"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+#include <stdio.h>
+
+using namespace kanplay_ns;
+
+namespace {
+
+// 従来の registry_map8_t 相当。std::map で保持し、CRCは要素ごとに計算する
+struct legacy_map8_t {
+  std::map<uint16_t, uint8_t> _data;
+  uint8_t _default_value = 0;
+
+  bool set8(uint16_t index, uint8_t value) {
+    auto it = _data.find(index);
+    if (it != _data.end()) {
+      if (it->second == value) { return false; }
+      if (value == _default_value) { _data.erase(it); } else { it->second = value; }
+      return true;
+    }
+    if (value == _default_value) { return false; }
+    _data[index] = value;
+    return true;
+  }
+  uint8_t get8(uint16_t index) const {
+    auto it = _data.find(index);
+    return (it == _data.end()) ? _default_value : it->second;
+  }
+  void assign(const legacy_map8_t& src) { _data = src._data; }
+  uint32_t crc32(uint32_t crc) const {
+    for (const auto& pair : _data) {
+      crc = calc_crc32(&pair, sizeof(pair), crc);
+    }
+    return crc;
+  }
+};
+
+// 計算結果を使用しないループが最適化で削除されないようにする
+static volatile uint32_t benchmark_sink;
+
+template <typename F>
+static double measure(int loop, F&& func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loop; ++i) { func(i); }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / loop;
+}
+
+} // namespace
+
+// ランダムな書込みの後で、get・assign・比較の結果が std::map によるモデルと一致すること
+void test_registry_map_model(void)
+{
+  std::mt19937 rng(9);
+  registry_map8_t map8 { 0 };
+  map8.init();
+  registry_map8_t copy8 { 0 };
+  copy8.init();
+  registry_map_t<uint16_t> map16 { 0xFFFF };
+  map16.init();
+  registry_map_t<uint16_t> copy16 { 0xFFFF };
+  copy16.init();
+  std::map<uint16_t, uint8_t> ref8;
+  std::map<uint16_t, uint16_t> ref16;
+
+  for (int i = 0; i < 20000; ++i) {
+    uint16_t key = rng() % 300;
+    uint8_t value8 = (rng() % 3) ? rng() : 0;
+    bool changed = (value8 != (ref8.count(key) ? ref8[key] : 0));
+    TEST_ASSERT_EQUAL(changed, map8.set8(key, value8));
+    if (value8) { ref8[key] = value8; } else { ref8.erase(key); }
+
+    uint16_t value16 = (rng() % 3) ? (uint16_t)rng() : 0xFFFF;
+    map16.set(key, value16);
+    if (value16 != 0xFFFF) { ref16[key] = value16; } else { ref16.erase(key); }
+
+    if ((i % 1000) == 0) {
+      TEST_ASSERT_TRUE(copy8.assign(map8));
+      TEST_ASSERT_TRUE(copy16.assign(map16));
+      TEST_ASSERT_TRUE(copy8 == map8);
+      TEST_ASSERT_TRUE(copy16 == map16);
+    }
+  }
+  for (uint16_t key = 0; key < 300; ++key) {
+    TEST_ASSERT_EQUAL(ref8.count(key) ? ref8[key] : 0, map8.get8(key));
+    TEST_ASSERT_EQUAL(ref16.count(key) ? ref16[key] : 0xFFFF, map16.get(key));
+  }
+  TEST_ASSERT_EQUAL(ref8.size() * sizeof(flat_map_t<uint8_t>::value_type), map8.crc32_length());
+  TEST_ASSERT_EQUAL(ref16.size() * sizeof(flat_map_t<uint16_t>::value_type), map16.crc32_length());
+
+  // 空のマップを代入すると全て既定値に戻る
+  registry_map8_t empty { 0 };
+  empty.init();
+  TEST_ASSERT_TRUE(copy8.assign(empty));
+  TEST_ASSERT_EQUAL(0, copy8.crc32_length());
+  TEST_ASSERT_TRUE(copy8 == empty);
+}
+
+// get / set / assign / crc32 の1回あたりの処理時間 (従来の std::map との比較)
+void test_registry_map_benchmark(void)
+{
+  char msg[128];
+  for (int entries : { 16, 256 }) {
+    std::mt19937 rng(90);
+    const uint16_t key_range = entries * 4;
+    registry_map8_t map8 { 0 };
+    map8.init();
+    registry_map8_t copy8 { 0 };
+    copy8.init();
+    legacy_map8_t legacy;
+    legacy_map8_t legacy_copy;
+    while ((int)legacy._data.size() < entries) {
+      uint16_t key = rng() % key_range;
+      uint8_t value = 1 + rng() % 127;
+      legacy.set8(key, value);
+      map8.set8(key, value);
+    }
+
+    // 書込みは既存の値の更新と、要素の追加・削除を含める
+    std::vector<uint16_t> keys(4096);
+    std::vector<uint8_t> values(4096);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      keys[i] = rng() % key_range;
+      values[i] = (rng() % 8) ? (1 + rng() % 127) : 0;
+    }
+
+    static constexpr const int loop = 200000;
+    uint32_t sink = 0;
+    double get_legacy = measure(loop, [&](int i) { sink += legacy.get8(keys[i & 4095]); });
+    double get_flat   = measure(loop, [&](int i) { sink += map8.get8(keys[i & 4095]); });
+    double set_legacy = measure(loop, [&](int i) { legacy.set8(keys[i & 4095], values[(i * 7) & 4095]); });
+    double set_flat   = measure(loop, [&](int i) { map8.set8(keys[i & 4095], values[(i * 7) & 4095]); });
+    for (uint16_t key = 0; key < key_range; ++key) {
+      TEST_ASSERT_EQUAL(legacy.get8(key), map8.get8(key));
+    }
+    double assign_legacy = measure(loop / 10, [&](int) { legacy_copy.assign(legacy); });
+    double assign_flat   = measure(loop / 10, [&](int) { copy8.assign(map8); });
+    TEST_ASSERT_TRUE(copy8 == map8);
+    double crc_legacy = measure(loop / 10, [&](int) { sink += legacy.crc32(sink); });
+    double crc_flat   = measure(loop / 10, [&](int) { sink += map8.crc32(sink); });
+
+    benchmark_sink = sink;
+
+    snprintf(msg, sizeof(msg), "entries:%3d -> %3u      std::map   flat_map_t  [nsec/op]", entries, (unsigned)legacy._data.size());
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  get    : %8.1f %10.1f", get_legacy, get_flat);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  set    : %8.1f %10.1f", set_legacy, set_flat);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  assign : %8.1f %10.1f", assign_legacy, assign_flat);
+    TEST_MESSAGE(msg);
+    snprintf(msg, sizeof(msg), "  crc32  : %8.1f %10.1f", crc_legacy, crc_flat);
+    TEST_MESSAGE(msg);
+  }
+}